@@ -0,0 +1,168 @@
+// Allreduce and vote: OpenMP reduction vs. hwbx collectives
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+#include "timing.h"
+
+#include <sched.h>
+
+#include <hwbx.h>
+
+// All threads have to be on one CMG, the hwbx collectives work within the team of
+// one blade.
+static struct hwbx_plan _plan;
+static struct hwbx_coll _coll;
+
+// The OpenMP variants rotate over three shared variables. The master resets the one
+// of the next iteration, which was last read before the barrier of the previous
+// iteration. Like the hwbx collectives, each iteration has a single barrier.
+static double _sum[3];
+static int _vote[3];
+
+
+int main(int argc, char** argv) {
+
+  double wct_start,wct_end,cput_start,cput_end;
+  double t_omp_sum = 0, t_hwbx_sum = 0, t_omp_vote = 0, t_hwbx_vote = 0;
+  int NITER;
+  int nt;
+  int errors = 0;
+  double clockspeed;
+  enum hwbx_place_mode mode;
+  int ret = 0;
+
+  if(argc!=2 && argc!=3) {
+    fprintf(stderr,"Usage: %s <clock_in_GHz> [compact|balanced|omp_places]\n", argv[0]);
+    exit(1);
+  }
+  clockspeed = atof(argv[1])*1.0e9;
+  mode = hwbx_place_mode_from_env(HWBX_PLACE_COMPACT);
+  if (argc == 3 && hwbx_place_mode_parse(argv[2], &mode) < 0)
+  {
+    fprintf(stderr,"Unknown placement %s\n", argv[2]);
+    exit(1);
+  }
+  nt = omp_get_max_threads();
+  ret = hwbx_plan_create(&_plan, nt, mode);
+  if (ret == 0 && _plan.num_teams != 1)
+  {
+    fprintf(stderr,"Threads span %d CMGs, the collectives need all threads on one CMG\n", _plan.num_teams);
+    exit(1);
+  }
+  if (ret == 0)
+    ret = hwbx_plan_alloc(&_plan);
+  if (ret == 0)
+    ret = hwbx_coll_init(&_coll, nt);
+  if (ret < 0)
+  {
+    fprintf(stderr,"Error init barrier\n");
+    exit(1);
+  }
+  hwbx_plan_print(stdout, &_plan);
+  NITER=1;
+  do {
+#pragma omp parallel reduction(+:errors)
+{
+    struct hwbx_member member;
+    struct hwbx_coll_member cm;
+    double val, res;
+    double expect = (double)nt*(nt+1)/2;
+    int k, flag;
+
+    ret = hwbx_plan_join(&_plan, omp_get_thread_num(), &member);
+    if (ret < 0 || hwbx_coll_join(&_coll, member.rank, member.window, NULL, &cm) < 0)
+    {
+      fprintf(stderr,"Error assign barrier\n");
+      exit(1);
+    }
+    val = member.rank + 1;
+#pragma omp master
+    _sum[0] = _sum[1] = 0;
+#pragma omp barrier
+
+    // sum of one double
+#pragma omp single
+    timing(&wct_start, &cput_start);
+    for(k=0; k<NITER; ++k) {
+#pragma omp master
+      _sum[(k+1)%3] = 0;
+#pragma omp for schedule(static) reduction(+:_sum[k%3:1])
+      for (int i=0; i<nt; ++i)
+        _sum[k%3] += val;
+      if (_sum[k%3] != expect)
+        errors++;
+    }
+#pragma omp single
+    {
+      timing(&wct_end, &cput_end);
+      t_omp_sum = wct_end-wct_start;
+      timing(&wct_start, &cput_start);
+    }
+    for(k=0; k<NITER; ++k) {
+      hwbx_allreduce(&cm, HWBX_OP_SUM, &val, &res, 1);
+      if (res != expect)
+        errors++;
+    }
+#pragma omp single
+    {
+      timing(&wct_end, &cput_end);
+      t_hwbx_sum = wct_end-wct_start;
+    }
+
+    // vote, the last thread votes false in every other iteration
+#pragma omp master
+    _vote[0] = _vote[1] = 1;
+#pragma omp single
+    timing(&wct_start, &cput_start);
+    for(k=0; k<NITER; ++k) {
+      flag = !((k & 1) && member.rank == nt-1);
+#pragma omp master
+      _vote[(k+1)%3] = 1;
+#pragma omp for schedule(static) reduction(&&:_vote[k%3:1])
+      for (int i=0; i<nt; ++i)
+        _vote[k%3] = _vote[k%3] && flag;
+      if (_vote[k%3] != !(k & 1))
+        errors++;
+    }
+#pragma omp single
+    {
+      timing(&wct_end, &cput_end);
+      t_omp_vote = wct_end-wct_start;
+      timing(&wct_start, &cput_start);
+    }
+    for(k=0; k<NITER; ++k) {
+      flag = !((k & 1) && member.rank == nt-1);
+      if (hwbx_vote(&cm, HWBX_VOTE_ALL, flag) != !(k & 1))
+        errors++;
+    }
+#pragma omp single
+    {
+      timing(&wct_end, &cput_end);
+      t_hwbx_vote = wct_end-wct_start;
+    }
+
+    ret = hwbx_plan_leave(&_plan, &member);
+    if (ret < 0)
+    {
+      fprintf(stderr,"Error unassign barrier\n");
+      exit(1);
+    }
+} // end parallel
+    NITER = NITER*2;
+  } while (t_omp_sum<0.01);
+
+  NITER = NITER/2;
+  hwbx_coll_free(&_coll);
+  ret = hwbx_plan_free(&_plan);
+  if (ret < 0)
+  {
+    fprintf(stderr,"Error finalize barrier\n");
+    exit(1);
+  }
+  printf("NITER: %d, threads: %d, wrong results: %d\n",NITER,nt,errors);
+  printf("sum:  omp reduction: %.1lf cy, hwbx_allreduce: %.1lf cy\n",t_omp_sum/NITER*clockspeed,t_hwbx_sum/NITER*clockspeed);
+  printf("vote: omp reduction: %.1lf cy, hwbx_vote: %.1lf cy\n",t_omp_vote/NITER*clockspeed,t_hwbx_vote/NITER*clockspeed);
+
+  return (errors ? 1 : 0);
+}
@@ -1,8 +1,12 @@
 // skeleton
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <omp.h>
+#include <sched.h>
 #include "timing.h"
+#include "noise.h"
 
 
 double workfunc(double y) {
@@ -34,6 +38,8 @@ int main(int argc, char** argv) {
   int id,nt;
   int NITER;
   double t = 0, clockspeed;
+  struct noise_config noise;
+  struct noise_rec rec;
 
 
   if(argc!=2) {
@@ -72,6 +78,33 @@ int main(int argc, char** argv) {
   NITER = NITER/2;
 
   printf("NITER: %d, time: %.3lf, time w/o b: %.3lf, barrier: %.1lf cy\n",NITER,(wct_wend-wct_wstart),(wct_woend-wct_wostart),((wct_wend-wct_wstart)-(wct_woend-wct_wostart))/NITER*clockspeed);
-  
+
+  // noise run, per-iteration arrival and departure of every thread
+  if (noise_config_from_env(&noise)) {
+    if (noise_rec_alloc(&rec, omp_get_max_threads(), noise.iters) < 0) {
+      fprintf(stderr,"Error allocating noise records\n");
+      exit(1);
+    }
+#pragma omp parallel
+{
+    int k, tid = omp_get_thread_num();
+    unsigned long rng = 0x9E3779B97F4A7C15UL*(tid+1);
+    // on the CPU thread 0 runs on, the threads are not pinned
+    if (tid == 0 && noise_perturb_start(&noise, sched_getcpu()) < 0)
+      fprintf(stderr,"Error starting perturbation thread\n");
+    for(k=0; k<noise.iters; ++k) {
+      noise_delay(&noise, &rng);
+      rec.arrive[k*rec.num_threads+tid] = noise_now();
+#pragma omp barrier
+      rec.leave[k*rec.num_threads+tid] = noise_now();
+      func_without_barrier();
+    }
+#pragma omp single
+    noise_perturb_stop();
+} // end parallel
+    noise_report(stdout, &noise, &rec, clockspeed);
+    noise_rec_free(&rec);
+  }
+
   return 0;
 }
@@ -5,12 +5,18 @@
 #include <math.h>
 #include <omp.h>
 #include "timing.h"
+#include "noise.h"
 
 #include <sched.h>
 
 #include <fujitsu_hwb.h>
+#include <hwbx.h>
+#include <hwbx_fast.h>
 
-static int _bd;
+// Threads are placed by the hwbx planner, one blade per CMG team. With threads on
+// several CMGs, each team synchronizes only within its CMG. A team of a single thread
+// gets no blade (window -1) and has nobody to synchronize with.
+static struct hwbx_plan _plan;
 
 double workfunc(double y) {
     return exp(y);
@@ -19,7 +25,19 @@ double workfunc(double y) {
 
 double func_with_barrier(int win) {
 	double x=0.0,y=3.04;
-    fhwb_sync(win);
+    if (win >= 0)
+      fhwb_sync(win);
+    x = workfunc(y);
+    if(x<0.)
+      printf("%.15lf",x);
+    return x;
+}
+
+// zero-read arrival, the phase is kept by the thread
+double func_with_fast_barrier(struct hwbx_fast *fast) {
+	double x=0.0,y=3.04;
+    if (fast)
+      hwbx_fast_sync(fast);
     x = workfunc(y);
     if(x<0.)
       printf("%.15lf",x);
@@ -38,41 +56,47 @@ double func_without_barrier() {
 int main(int argc, char** argv) {
 
   double wct_wstart,wct_wostart,wct_wend,wct_woend,wct_mid,wct_end,cput_start,cput_end;
+  double wct_fstart,wct_fend;
   int id,nt;
   int NITER;
   double t = 0, clockspeed;
-  cpu_set_t myset;
+  struct noise_config noise;
+  struct noise_rec rec = {0};
+  enum hwbx_place_mode mode;
   int ret = 0;
 
-  if(argc!=2) {
-	fprintf(stderr,"Usage: %s <clock_in_GHz>\n", argv[0]);
+  if(argc!=2 && argc!=3) {
+	fprintf(stderr,"Usage: %s <clock_in_GHz> [compact|balanced|omp_places]\n", argv[0]);
     exit(1);
   }
   clockspeed = atof(argv[1])*1.0e9;
-  ret = sched_getaffinity(0, sizeof(cpu_set_t), &myset);
-  ret = fhwb_init(sizeof(cpu_set_t), &myset);
+  mode = hwbx_place_mode_from_env(HWBX_PLACE_COMPACT);
+  if (argc == 3 && hwbx_place_mode_parse(argv[2], &mode) < 0)
+  {
+    fprintf(stderr,"Unknown placement %s\n", argv[2]);
+    exit(1);
+  }
+  ret = hwbx_plan_create(&_plan, omp_get_max_threads(), mode);
+  if (ret == 0)
+    ret = hwbx_plan_alloc(&_plan);
   if (ret < 0)
   {
     fprintf(stderr,"Error init barrier\n");
     exit(1);
   }
-  _bd = ret;
+  hwbx_plan_print(stdout, &_plan);
+  if (_plan.num_teams > 1)
+    printf("Threads span %d CMGs, the barrier synchronizes each CMG team separately\n", _plan.num_teams);
   NITER=1;
   do {
 #pragma omp parallel
 {
     // time measurement
-    cpu_set_t set;
+    struct hwbx_member member;
+    struct hwbx_fast fast;
     int k;
-    CPU_ZERO(&set);
-	CPU_SET(omp_get_thread_num(), &set);
-	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
-	if (ret < 0)
-  {
-    fprintf(stderr,"Error setting cpuset\n");
-    exit(1);
-  }
-	ret = fhwb_assign(_bd, -1);
+	// pin the thread to its planned CPU and assign a window on its team's blade
+	ret = hwbx_plan_join(&_plan, omp_get_thread_num(), &member);
 	if (ret < 0)
   {
     fprintf(stderr,"Error assign barrier\n");
@@ -81,11 +105,22 @@ int main(int argc, char** argv) {
 #pragma omp single
     timing(&wct_wstart, &cput_start);
     for(k=0; k<NITER; ++k) {
-      func_with_barrier(ret);
+      func_with_barrier(member.window);
     }
 #pragma omp single
     timing(&wct_wend, &cput_end);
-    ret = fhwb_unassign(_bd);
+
+    // the phase is read once after the assign, the loop does not read LBSY before arriving
+    if (member.window >= 0)
+      hwbx_fast_init(&fast, member.window);
+#pragma omp single
+    timing(&wct_fstart, &cput_start);
+    for(k=0; k<NITER; ++k) {
+      func_with_fast_barrier(member.window >= 0 ? &fast : NULL);
+    }
+#pragma omp single
+    timing(&wct_fend, &cput_end);
+    ret = hwbx_plan_leave(&_plan, &member);
     if (ret < 0)
   {
     fprintf(stderr,"Error unassign barrier\n");
@@ -106,13 +141,51 @@ int main(int argc, char** argv) {
   } while (wct_woend-wct_wostart<0.001);
 
   NITER = NITER/2;
-  ret = fhwb_fini(_bd);
+
+  // noise run, per-iteration arrival and departure of every thread
+  if (noise_config_from_env(&noise)) {
+    if (noise_rec_alloc(&rec, _plan.num_threads, noise.iters) < 0) {
+      fprintf(stderr,"Error allocating noise records\n");
+      exit(1);
+    }
+    if (noise_perturb_start(&noise, _plan.cpu[0]) < 0)
+      fprintf(stderr,"Error starting perturbation thread\n");
+#pragma omp parallel
+{
+    struct hwbx_member member;
+    int k, tid = omp_get_thread_num();
+    unsigned long rng = 0x9E3779B97F4A7C15UL*(tid+1);
+	ret = hwbx_plan_join(&_plan, tid, &member);
+	if (ret < 0)
+  {
+    fprintf(stderr,"Error assign barrier\n");
+    exit(1);
+  }
+    for(k=0; k<noise.iters; ++k) {
+      noise_delay(&noise, &rng);
+      rec.arrive[k*rec.num_threads+tid] = noise_now();
+      if (member.window >= 0)
+        fhwb_sync(member.window);
+      rec.leave[k*rec.num_threads+tid] = noise_now();
+      func_without_barrier();
+    }
+    hwbx_plan_leave(&_plan, &member);
+} // end parallel
+    noise_perturb_stop();
+  }
+
+  ret = hwbx_plan_free(&_plan);
   if (ret < 0)
   {
     fprintf(stderr,"Error finalize barrier\n");
     exit(1);
   }
   printf("NITER: %d, time: %.3lf, time w/o b: %.3lf, barrier: %.1lf cy\n",NITER,(wct_wend-wct_wstart),(wct_woend-wct_wostart),((wct_wend-wct_wstart)-(wct_woend-wct_wostart))/NITER*clockspeed);
+  printf("zero-read barrier: %.1lf cy, saved: %.1lf cy per barrier\n",((wct_fend-wct_fstart)-(wct_woend-wct_wostart))/NITER*clockspeed,((wct_wend-wct_wstart)-(wct_fend-wct_fstart))/NITER*clockspeed);
+  if (rec.arrive) {
+    noise_report(stdout, &noise, &rec, clockspeed);
+    noise_rec_free(&rec);
+  }
   
   return 0;
 }
@@ -0,0 +1,337 @@
+// Software barrier zoo, same methodology as barrier.c and barrier_hwb.c
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "timing.h"
+
+#include <sched.h>
+
+#include <hwbx.h>
+
+// A64FX cache line, every flag polled by a thread sits in a line written by few others
+#define LINE 256
+// rounds of dissemination and tournament, ceil(log2(HWBX_MAX_CPUS))
+#define MAX_ROUNDS 16
+#define TREE_ARITY 4
+
+enum kind { OMP, CENTRAL, DISSEMINATION, TOURNAMENT, COMBINING, HIERARCHICAL, NUM_KINDS };
+static const char *kind_names[NUM_KINDS] = {
+  "omp", "central", "dissemination", "tournament", "combining", "hierarchical"
+};
+
+// global counter and sense, one line each
+struct shared {
+  unsigned int count;
+  unsigned int expected;
+  unsigned int sense;
+} __attribute__((aligned(LINE)));
+
+// per thread, written by the owner and its partners only
+struct thread {
+  // sense of each kind, the kinds run one after the other
+  unsigned int sense[NUM_KINDS];
+  // dissemination
+  unsigned int parity;
+  unsigned int dsense;
+  unsigned int dflags[2][MAX_ROUNDS];
+  // tournament: arrival of the loser of round r, wake-up by the winner
+  unsigned int tflags[MAX_ROUNDS];
+  unsigned int release;
+} __attribute__((aligned(LINE)));
+
+// combining tree node, the last arriving child goes on to the parent
+struct node {
+  unsigned int count;
+  unsigned int expected;
+  int parent;
+} __attribute__((aligned(LINE)));
+
+static struct hwbx_plan _plan;
+static int num_threads;
+static struct shared *_central;
+static struct shared *_root;
+static struct thread *_threads;
+static struct node *_nodes;
+static int *_leaf;
+// hierarchical: counter and wake-up flag per CMG team, counter over the teams
+static struct shared *_cmg;
+static struct shared *_top;
+
+static inline unsigned int load_acquire(const unsigned int *ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(unsigned int *ptr, unsigned int val) {
+  __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+// sense-reversing centralized barrier
+static inline void central_wait(struct thread *self) {
+  unsigned int sense = self->sense[CENTRAL] ^ 1;
+  if (__atomic_add_fetch(&_central->count, 1, __ATOMIC_ACQ_REL) == _central->expected) {
+    _central->count = 0;
+    store_release(&_central->sense, sense);
+  } else {
+    while (load_acquire(&_central->sense) != sense);
+  }
+  self->sense[CENTRAL] = sense;
+}
+
+// round r signals rank + 2^r and waits for rank - 2^r, flags alternate by parity
+static inline void dissemination_wait(struct thread *self, int rank) {
+  int r, dist;
+  unsigned int parity = self->parity;
+  unsigned int sense = self->dsense;
+  for (r=0, dist=1; dist<num_threads; ++r, dist<<=1) {
+    store_release(&_threads[(rank+dist)%num_threads].dflags[parity][r], sense);
+    while (load_acquire(&self->dflags[parity][r]) != sense);
+  }
+  if (parity == 1)
+    self->dsense = sense ^ 1;
+  self->parity = parity ^ 1;
+}
+
+// Statically paired tournament: in round r the rank with bit r set loses to rank - 2^r
+// and waits for its wake-up, the champion (rank 0) wakes its losers and every woken
+// winner wakes the losers of its earlier rounds.
+static inline void tournament_wait(struct thread *self, int rank) {
+  int r, dist;
+  unsigned int sense = self->sense[TOURNAMENT] ^ 1;
+  for (r=0, dist=1; dist<num_threads; ++r, dist<<=1) {
+    if (rank & dist) {
+      store_release(&_threads[rank-dist].tflags[r], sense);
+      while (load_acquire(&self->release) != sense);
+      break;
+    }
+    if (rank+dist < num_threads)
+      while (load_acquire(&self->tflags[r]) != sense);
+  }
+  for (--r; r>=0; --r) {
+    if (rank+(1<<r) < num_threads)
+      store_release(&_threads[rank+(1<<r)].release, sense);
+  }
+  self->sense[TOURNAMENT] = sense;
+}
+
+// combining tree with fan-in TREE_ARITY, the last thread at the root flips the sense
+static inline void combining_wait(struct thread *self, int rank) {
+  int n = _leaf[rank];
+  unsigned int sense = self->sense[COMBINING] ^ 1;
+  while (__atomic_add_fetch(&_nodes[n].count, 1, __ATOMIC_ACQ_REL) == _nodes[n].expected) {
+    _nodes[n].count = 0;
+    if (_nodes[n].parent < 0) {
+      store_release(&_root->sense, sense);
+      break;
+    }
+    n = _nodes[n].parent;
+  }
+  while (load_acquire(&_root->sense) != sense);
+  self->sense[COMBINING] = sense;
+}
+
+// CMG-aware: centralized barrier per CMG team, the last thread of a team meets the
+// other teams on the top counter and wakes its team through the team's own line, so
+// only one thread per CMG polls outside of its L2.
+static inline void hierarchical_wait(struct thread *self, int team) {
+  struct shared *cmg = &_cmg[team];
+  unsigned int sense = self->sense[HIERARCHICAL] ^ 1;
+  if (__atomic_add_fetch(&cmg->count, 1, __ATOMIC_ACQ_REL) == cmg->expected) {
+    cmg->count = 0;
+    if (__atomic_add_fetch(&_top->count, 1, __ATOMIC_ACQ_REL) == _top->expected) {
+      _top->count = 0;
+      store_release(&_top->sense, sense);
+    } else {
+      while (load_acquire(&_top->sense) != sense);
+    }
+    store_release(&cmg->sense, sense);
+  } else {
+    while (load_acquire(&cmg->sense) != sense);
+  }
+  self->sense[HIERARCHICAL] = sense;
+}
+
+double workfunc(double y) {
+    return exp(y);
+}
+
+double func_with_barrier(enum kind kind, struct thread *self, int rank, int team) {
+	double x=0.0,y=3.04;
+    switch (kind) {
+      case OMP: {
+#pragma omp barrier
+      } break;
+      case CENTRAL: central_wait(self); break;
+      case DISSEMINATION: dissemination_wait(self, rank); break;
+      case TOURNAMENT: tournament_wait(self, rank); break;
+      case COMBINING: combining_wait(self, rank); break;
+      case HIERARCHICAL: hierarchical_wait(self, team); break;
+      default: break;
+    }
+    x = workfunc(y);
+    if(x<0.)
+      printf("%.15lf",x);
+    return x;
+}
+
+double func_without_barrier() {
+	double x=0.0,y=3.04;
+    x = workfunc(y);
+    if(x<0.)
+      printf("%.15lf",x);
+    return x;
+}
+
+static void* alloc_lines(size_t count, size_t size) {
+  void *mem = NULL;
+  if (posix_memalign(&mem, LINE, count*size) != 0) {
+    fprintf(stderr,"Error allocating barrier state\n");
+    exit(1);
+  }
+  memset(mem, 0, count*size);
+  return mem;
+}
+
+// Leaves take TREE_ARITY threads each, every level above TREE_ARITY nodes of the one below
+static void build_tree(void) {
+  int first = 0, count = num_threads, num_nodes = 0;
+  int i, n;
+  for (n=num_threads; n>1; n=(n+TREE_ARITY-1)/TREE_ARITY)
+    num_nodes += (n+TREE_ARITY-1)/TREE_ARITY;
+  if (num_nodes == 0)
+    num_nodes = 1;
+  _nodes = alloc_lines(num_nodes, sizeof(struct node));
+  _leaf = malloc(num_threads*sizeof(int));
+  for (i=0; i<num_threads; ++i)
+    _leaf[i] = i/TREE_ARITY;
+  for (;;) {
+    n = (count+TREE_ARITY-1)/TREE_ARITY;
+    for (i=0; i<n; ++i) {
+      _nodes[first+i].expected = (count-i*TREE_ARITY < TREE_ARITY ? count-i*TREE_ARITY : TREE_ARITY);
+      _nodes[first+i].parent = (n > 1 ? first+n+i/TREE_ARITY : -1);
+    }
+    if (n == 1)
+      break;
+    first += n;
+    count = n;
+  }
+}
+
+static void init_barriers(void) {
+  int i;
+  _central = alloc_lines(1, sizeof(struct shared));
+  _central->expected = num_threads;
+  _threads = alloc_lines(num_threads, sizeof(struct thread));
+  for (i=0; i<num_threads; ++i)
+    _threads[i].dsense = 1;
+  _root = alloc_lines(1, sizeof(struct shared));
+  build_tree();
+  _cmg = alloc_lines(_plan.num_teams, sizeof(struct shared));
+  for (i=0; i<_plan.num_teams; ++i)
+    _cmg[i].expected = _plan.teams[i].num_threads;
+  _top = alloc_lines(1, sizeof(struct shared));
+  _top->expected = _plan.num_teams;
+}
+
+int main(int argc, char** argv) {
+
+  double wct_start,wct_end,cput_start,cput_end;
+  double t0, t[NUM_KINDS];
+  int NITER;
+  double clockspeed;
+  enum hwbx_place_mode mode;
+  int ret = 0;
+  int k;
+
+  if(argc!=2 && argc!=3) {
+	fprintf(stderr,"Usage: %s <clock_in_GHz> [compact|balanced|omp_places]\n", argv[0]);
+    exit(1);
+  }
+  clockspeed = atof(argv[1])*1.0e9;
+  mode = hwbx_place_mode_from_env(HWBX_PLACE_COMPACT);
+  if (argc == 3 && hwbx_place_mode_parse(argv[2], &mode) < 0)
+  {
+    fprintf(stderr,"Unknown placement %s\n", argv[2]);
+    exit(1);
+  }
+  num_threads = omp_get_max_threads();
+  // the plan only pins the threads, no blades are allocated
+  ret = hwbx_plan_create(&_plan, num_threads, mode);
+  if (ret < 0)
+  {
+    fprintf(stderr,"Error creating placement plan\n");
+    exit(1);
+  }
+  hwbx_plan_print(stdout, &_plan);
+  init_barriers();
+
+  NITER=1;
+  do {
+#pragma omp parallel
+{
+    int k;
+#pragma omp single
+    timing(&wct_start, &cput_start);
+    for(k=0; k<NITER; ++k) {
+      func_without_barrier();
+    }
+#pragma omp single
+    timing(&wct_end, &cput_end);
+} // end parallel
+    NITER = NITER*2;
+  } while (wct_end-wct_start<0.001);
+
+  NITER = NITER/2;
+
+#pragma omp parallel private(k)
+{
+    struct hwbx_member member;
+    struct thread *self;
+    int i;
+
+    ret = hwbx_plan_join(&_plan, omp_get_thread_num(), &member);
+    if (ret < 0)
+    {
+      fprintf(stderr,"Error pinning thread\n");
+      exit(1);
+    }
+    self = &_threads[member.thread];
+#pragma omp single
+    timing(&wct_start, &cput_start);
+    for(i=0; i<NITER; ++i) {
+      func_without_barrier();
+    }
+#pragma omp single
+    {
+      timing(&wct_end, &cput_end);
+      t0 = wct_end-wct_start;
+    }
+
+    for (k=0; k<NUM_KINDS; ++k) {
+      // warm up the lines of the barrier
+      for(i=0; i<100; ++i) {
+        func_with_barrier((enum kind)k, self, member.thread, member.team);
+      }
+#pragma omp barrier
+#pragma omp single
+      timing(&wct_start, &cput_start);
+      for(i=0; i<NITER; ++i) {
+        func_with_barrier((enum kind)k, self, member.thread, member.team);
+      }
+#pragma omp single
+      {
+        timing(&wct_end, &cput_end);
+        t[k] = wct_end-wct_start;
+      }
+    }
+    hwbx_plan_leave(&_plan, &member);
+} // end parallel
+
+  printf("NITER: %d, time w/o b: %.3lf\n",NITER,t0);
+  for (k=0; k<NUM_KINDS; ++k)
+    printf("%-14s time: %.3lf, barrier: %.1lf cy\n",kind_names[k],t[k],(t[k]-t0)/NITER*clockspeed);
+
+  return 0;
+}
@@ -0,0 +1,158 @@
+// Broadcast: omp single copyprivate vs. hwbx_publish and hwbx_bcast
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+#include "timing.h"
+
+#include <sched.h>
+
+#include <hwbx.h>
+
+// doubles per broadcast
+#define PAYLOAD 8
+
+// All threads have to be on one CMG, the hwbx collectives work within the team of
+// one blade.
+static struct hwbx_plan _plan;
+static struct hwbx_coll _coll;
+
+// shared state written by thread 0 for the publish variant
+static double _shared[PAYLOAD];
+
+
+static int check(const double *buf, int k) {
+  int i, err = 0;
+  for (i=0; i<PAYLOAD; ++i)
+    if (buf[i] != k+i)
+      err = 1;
+  return err;
+}
+
+int main(int argc, char** argv) {
+
+  double wct_start,wct_end,cput_start,cput_end;
+  double t_omp = 0, t_publish = 0, t_bcast = 0;
+  int NITER;
+  int nt;
+  int errors = 0;
+  double clockspeed;
+  enum hwbx_place_mode mode;
+  int ret = 0;
+
+  if(argc!=2 && argc!=3) {
+    fprintf(stderr,"Usage: %s <clock_in_GHz> [compact|balanced|omp_places]\n", argv[0]);
+    exit(1);
+  }
+  clockspeed = atof(argv[1])*1.0e9;
+  mode = hwbx_place_mode_from_env(HWBX_PLACE_COMPACT);
+  if (argc == 3 && hwbx_place_mode_parse(argv[2], &mode) < 0)
+  {
+    fprintf(stderr,"Unknown placement %s\n", argv[2]);
+    exit(1);
+  }
+  nt = omp_get_max_threads();
+  ret = hwbx_plan_create(&_plan, nt, mode);
+  if (ret == 0 && _plan.num_teams != 1)
+  {
+    fprintf(stderr,"Threads span %d CMGs, the collectives need all threads on one CMG\n", _plan.num_teams);
+    exit(1);
+  }
+  if (ret == 0)
+    ret = hwbx_plan_alloc(&_plan);
+  if (ret == 0)
+    ret = hwbx_coll_init(&_coll, nt);
+  if (ret < 0)
+  {
+    fprintf(stderr,"Error init barrier\n");
+    exit(1);
+  }
+  hwbx_plan_print(stdout, &_plan);
+  NITER=1;
+  do {
+#pragma omp parallel reduction(+:errors)
+{
+    struct hwbx_member member;
+    struct hwbx_coll_member cm;
+    double buf[PAYLOAD];
+    int k, i;
+
+    ret = hwbx_plan_join(&_plan, omp_get_thread_num(), &member);
+    if (ret < 0 || hwbx_coll_join(&_coll, member.rank, member.window, NULL, &cm) < 0)
+    {
+      fprintf(stderr,"Error assign barrier\n");
+      exit(1);
+    }
+
+    // omp single with copyprivate: one barrier plus the copy-out
+#pragma omp single
+    timing(&wct_start, &cput_start);
+    for(k=0; k<NITER; ++k) {
+#pragma omp single copyprivate(buf)
+      for (i=0; i<PAYLOAD; ++i)
+        buf[i] = k+i;
+      errors += check(buf, k);
+    }
+#pragma omp single
+    {
+      timing(&wct_end, &cput_end);
+      t_omp = wct_end-wct_start;
+      timing(&wct_start, &cput_start);
+    }
+
+    // rank 0 writes shared state, a second episode releases it for the next write
+    for(k=0; k<NITER; ++k) {
+      if (member.rank == 0)
+        for (i=0; i<PAYLOAD; ++i)
+          _shared[i] = k+i;
+      hwbx_publish(&cm);
+      for (i=0; i<PAYLOAD; ++i)
+        buf[i] = _shared[i];
+      hwbx_publish(&cm);
+      errors += check(buf, k);
+    }
+#pragma omp single
+    {
+      timing(&wct_end, &cput_end);
+      t_publish = wct_end-wct_start;
+      timing(&wct_start, &cput_start);
+    }
+
+    // double-buffered broadcast from a rotating root, one episode
+    for(k=0; k<NITER; ++k) {
+      if (member.rank == k%nt)
+        for (i=0; i<PAYLOAD; ++i)
+          buf[i] = k+i;
+      hwbx_bcast(&cm, k%nt, buf, sizeof(buf));
+      errors += check(buf, k);
+    }
+#pragma omp single
+    {
+      timing(&wct_end, &cput_end);
+      t_bcast = wct_end-wct_start;
+    }
+
+    ret = hwbx_plan_leave(&_plan, &member);
+    if (ret < 0)
+    {
+      fprintf(stderr,"Error unassign barrier\n");
+      exit(1);
+    }
+} // end parallel
+    NITER = NITER*2;
+  } while (t_omp<0.01);
+
+  NITER = NITER/2;
+  hwbx_coll_free(&_coll);
+  ret = hwbx_plan_free(&_plan);
+  if (ret < 0)
+  {
+    fprintf(stderr,"Error finalize barrier\n");
+    exit(1);
+  }
+  printf("NITER: %d, threads: %d, payload: %d bytes, wrong results: %d\n",NITER,nt,(int)(PAYLOAD*sizeof(double)),errors);
+  printf("omp single copyprivate: %.1lf cy, hwbx_publish (2 episodes): %.1lf cy, hwbx_bcast: %.1lf cy\n",
+         t_omp/NITER*clockspeed,t_publish/NITER*clockspeed,t_bcast/NITER*clockspeed);
+
+  return (errors ? 1 : 0);
+}
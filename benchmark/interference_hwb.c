@@ -0,0 +1,341 @@
+// Several independent jobs (processes) sharing a node: barrier loops and blade
+// setup/teardown cycles running concurrently
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "timing.h"
+
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include <hwbx.h>
+#include <hwbx_topo.h>
+#include <a64fx_hwb_uapi.h>
+
+#define MAX_JOBS 6
+// control cycles timed per phase, every RESET_EVERY-th cycle ends with a reset of the
+// job's allocations instead of unassign and free
+#define NCTL 1000
+#define RESET_EVERY 8
+
+// Phases, job 0 is measured, the other jobs are idle, synchronize or churn
+enum phase { SYNC_ALONE, SYNC_ALL, SYNC_CHURN, CTL_ALONE, CTL_CHURN, NUM_PHASES };
+static const char *phase_names[NUM_PHASES] = {
+  "barrier, alone", "barrier, all jobs sync", "barrier, other jobs churn",
+  "control, alone", "control, other jobs churn"
+};
+
+// shared between the jobs
+struct shared {
+  pthread_barrier_t phase;
+  volatile int stop;
+  int NITER;
+  // job 0 alone without barrier
+  double t0;
+  double t[MAX_JOBS][NUM_PHASES];
+  long cycles[MAX_JOBS][NUM_PHASES];
+};
+
+static struct shared *_shm;
+static struct hwbx_plan _plan;
+static int num_jobs;
+
+static int _job;
+
+// The other jobs would wait at the next phase forever. A failing job terminates the
+// first one, the others get their parent death signal.
+static void fail(const char *msg) {
+  fprintf(stderr,"Job %d: %s\n", _job, msg);
+  if (_job > 0)
+    kill(getppid(), SIGTERM);
+  exit(1);
+}
+
+double workfunc(double y) {
+    return exp(y);
+}
+
+double func_with_barrier(int win, const struct hwbx_wait_policy *policy) {
+	double x=0.0,y=3.04;
+    hwbx_sync_wait(win, policy, NULL);
+    x = workfunc(y);
+    if(x<0.)
+      printf("%.15lf",x);
+    return x;
+}
+
+double func_without_barrier() {
+	double x=0.0,y=3.04;
+    x = workfunc(y);
+    if(x<0.)
+      printf("%.15lf",x);
+    return x;
+}
+
+// NITER barriers on the job's blade (or none), returns the wall time
+static double sync_loop(int NITER, int barrier) {
+  double wct_start,wct_end,cput_start,cput_end;
+  int ret = 0;
+#pragma omp parallel
+{
+    struct hwbx_member member;
+    struct hwbx_wait_policy policy;
+    int k;
+
+    hwbx_wait_policy_from_env(&policy);
+    ret = hwbx_plan_join(&_plan, omp_get_thread_num(), &member);
+    if (ret < 0)
+      fail("Error assign barrier");
+#pragma omp single
+    timing(&wct_start, &cput_start);
+    for(k=0; k<NITER; ++k) {
+      if (barrier)
+        func_with_barrier(member.window, &policy);
+      else
+        func_without_barrier();
+    }
+#pragma omp single
+    timing(&wct_end, &cput_end);
+    if (hwbx_plan_leave(&_plan, &member) < 0)
+      fail("Error unassign barrier");
+} // end parallel
+  return wct_end-wct_start;
+}
+
+// Set up and tear down the team's blade: allocate, assign a window on every thread,
+// then unassign and free or reset all allocations of the job. Runs count cycles or,
+// with count 0, until the measured job sets stop. Returns the wall time.
+static double ctl_loop(int count, long *cycles) {
+  double wct_start,wct_end,cput_start,cput_end;
+  int cmg = -1, bb = -1;
+  long n = 0;
+  int done = 0;
+  struct a64fx_hwb_ioc_reset reset;
+#pragma omp parallel
+{
+    struct hwbx_member member;
+    int window;
+
+    if (hwbx_plan_join(&_plan, omp_get_thread_num(), &member) < 0)
+      fail("Error pinning thread");
+#pragma omp single
+    timing(&wct_start, &cput_start);
+    while (!done) {
+#pragma omp single
+      if (hwbx_blade_alloc(sizeof(cpu_set_t), &_plan.teams[0].cpus, &cmg, &bb) < 0)
+        fail("Error allocating blade");
+      window = hwbx_window_assign(bb, -1);
+      if (window < 0)
+        fail("Error assign window");
+#pragma omp barrier
+      if (n % RESET_EVERY == RESET_EVERY-1) {
+#pragma omp single
+        {
+          // TGID scope for the own process, clears the blade and all windows
+          memset(&reset, 0, sizeof(reset));
+          reset.scope = A64FX_HWB_RESET_TGID;
+          if (ioctl(hwbx_dev_fd(), A64FX_HWB_IOC_RESET_SCOPED, &reset) < 0)
+            fail("Error reset");
+        }
+      } else {
+        if (hwbx_window_unassign(bb, window) < 0)
+          fail("Error unassign window");
+#pragma omp barrier
+#pragma omp single
+        if (hwbx_blade_free(cmg, bb) < 0)
+          fail("Error free blade");
+      }
+#pragma omp single
+      {
+        ++n;
+        done = (count > 0 ? n >= count : _shm->stop);
+      }
+    }
+#pragma omp single
+    timing(&wct_end, &cput_end);
+    hwbx_plan_leave(&_plan, &member);
+} // end parallel
+  *cycles = n;
+  return wct_end-wct_start;
+}
+
+static void next_phase(void) {
+  pthread_barrier_wait(&_shm->phase);
+}
+
+// A job holds at most one blade: the plan's blade while it synchronizes, the blade of
+// the control cycles otherwise. A reset of the job's allocations would take the plan's
+// blade with it.
+static void plan_blade(int alloc) {
+  if (alloc && _plan.teams[0].bb < 0 && hwbx_plan_alloc(&_plan) < 0)
+    fail("Error init barrier");
+  if (!alloc && hwbx_plan_free(&_plan) < 0)
+    fail("Error finalize barrier");
+}
+
+static void run_job(int job) {
+  int NITER;
+  double t;
+  enum phase p;
+
+  // the process affinity holds the job's CPUs, one team on one CMG
+  if (hwbx_plan_create(&_plan, omp_get_max_threads(), HWBX_PLACE_COMPACT) < 0 ||
+      _plan.num_teams != 1 || _plan.teams[0].num_threads < 2)
+    fail("Error creating plan, every job needs at least two CPUs of one CMG");
+
+  if (job == 0) {
+    plan_blade(1);
+    NITER=1;
+    do {
+      t = sync_loop(NITER, 0);
+      NITER = NITER*2;
+    } while (t<0.001);
+    _shm->NITER = NITER/2;
+    _shm->t0 = sync_loop(_shm->NITER, 0);
+  }
+  next_phase();
+  NITER = _shm->NITER;
+
+  for (p=0; p<NUM_PHASES; ++p) {
+    _shm->stop = 0;
+    next_phase();
+    if (job == 0) {
+      if (p == SYNC_ALONE || p == SYNC_ALL || p == SYNC_CHURN) {
+        _shm->t[job][p] = sync_loop(NITER, 1);
+        _shm->cycles[job][p] = NITER;
+      } else {
+        plan_blade(0);
+        _shm->t[job][p] = ctl_loop(NCTL, &_shm->cycles[job][p]);
+      }
+      _shm->stop = 1;
+    } else if (p == SYNC_ALL) {
+      plan_blade(1);
+      _shm->t[job][p] = sync_loop(NITER, 1);
+      _shm->cycles[job][p] = NITER;
+    } else if (p == SYNC_CHURN || p == CTL_CHURN) {
+      plan_blade(0);
+      _shm->t[job][p] = ctl_loop(0, &_shm->cycles[job][p]);
+    }
+    next_phase();
+  }
+  plan_blade(0);
+}
+
+// Job j gets CMG j (cmg) or the j-th part of the CPUs of CMG 0 (shared)
+static int job_cpus(const struct hwbx_topology *topo, int shared, int job, cpu_set_t *cpus) {
+  int cpu, n = 0, count = 0;
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) < 0)
+    return -1;
+  for (cpu=0; cpu<HWBX_MAX_CPUS; ++cpu)
+    if (CPU_ISSET(cpu, &allowed) && topo->online[cpu] && topo->cmg[cpu] == (shared ? 0 : job))
+      ++count;
+  CPU_ZERO(cpus);
+  for (cpu=0; cpu<HWBX_MAX_CPUS; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed) && topo->online[cpu] && topo->cmg[cpu] == (shared ? 0 : job)) {
+      if (!shared || n*num_jobs/count == job)
+        CPU_SET(cpu, cpus);
+      ++n;
+    }
+  }
+  return CPU_COUNT(cpus);
+}
+
+int main(int argc, char** argv) {
+
+  int i, job, shared = 0, ret = 0;
+  double clockspeed;
+  enum phase p;
+  cpu_set_t cpus;
+  pthread_barrierattr_t attr;
+  struct hwbx_topology *topo;
+  pid_t pids[MAX_JOBS];
+
+  if(argc!=3 && argc!=4) {
+	fprintf(stderr,"Usage: %s <clock_in_GHz> <jobs> [cmg|shared]\n", argv[0]);
+    exit(1);
+  }
+  clockspeed = atof(argv[1])*1.0e9;
+  num_jobs = atoi(argv[2]);
+  if (argc == 4 && strcmp(argv[3], "shared") == 0)
+    shared = 1;
+  else if (argc == 4 && strcmp(argv[3], "cmg") != 0) {
+    fprintf(stderr,"Unknown mode %s\n", argv[3]);
+    exit(1);
+  }
+  // on a shared CMG, every job needs one of its six blades
+  if (num_jobs < 2 || num_jobs > (shared ? MAX_JOBS : HWBX_MAX_CMGS)) {
+    fprintf(stderr,"Invalid number of jobs %d\n", num_jobs);
+    exit(1);
+  }
+  topo = malloc(sizeof(struct hwbx_topology));
+  if (!topo || hwbx_topo_read(topo) < 0) {
+    fprintf(stderr,"Error reading topology\n");
+    exit(1);
+  }
+  _shm = mmap(NULL, sizeof(struct shared), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if (_shm == MAP_FAILED) {
+    fprintf(stderr,"Error mapping shared memory\n");
+    exit(1);
+  }
+  memset(_shm, 0, sizeof(struct shared));
+  pthread_barrierattr_init(&attr);
+  pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_barrier_init(&_shm->phase, &attr, num_jobs);
+
+  for (job=0; job<num_jobs; ++job) {
+    if (job_cpus(topo, shared, job, &cpus) < 2) {
+      fprintf(stderr,"Job %d has less than two CPUs\n", job);
+      exit(1);
+    }
+  }
+  printf("%d jobs on %s\n", num_jobs, (shared ? "CMG 0, one blade each" : "one CMG each"));
+  fflush(stdout);
+  // no OpenMP before the fork, every job starts its own runtime
+  job = 0;
+  for (i=1; i<num_jobs; ++i) {
+    pids[i] = fork();
+    if (pids[i] < 0)
+      fail("Error starting job");
+    if (pids[i] == 0) {
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      job = i;
+      break;
+    }
+  }
+  _job = job;
+  job_cpus(topo, shared, job, &cpus);
+  if (sched_setaffinity(0, sizeof(cpu_set_t), &cpus) < 0)
+    fail("Error setting job CPUs");
+  omp_set_num_threads(CPU_COUNT(&cpus));
+  run_job(job);
+  if (job > 0)
+    exit(0);
+  for (job=1; job<num_jobs; ++job) {
+    if (waitpid(pids[job], &ret, 0) < 0 || !WIFEXITED(ret) || WEXITSTATUS(ret) != 0)
+      fprintf(stderr,"Job %d failed\n", job);
+  }
+
+  printf("NITER: %d, time w/o b: %.3lf, control cycles: %d (reset every %d)\n", _shm->NITER, _shm->t0, NCTL, RESET_EVERY);
+  for (p=0; p<NUM_PHASES; ++p) {
+    if (p <= SYNC_CHURN)
+      printf("%-26s %.1lf cy per barrier", phase_names[p], (_shm->t[0][p]-_shm->t0)/_shm->NITER*clockspeed);
+    else
+      printf("%-26s %.2lf us per cycle", phase_names[p], _shm->t[0][p]/_shm->cycles[0][p]*1.0e6);
+    for (job=1; job<num_jobs; ++job)
+      if (_shm->cycles[job][p] > 0)
+        printf(", job %d: %ld %s", job, _shm->cycles[job][p], (p == SYNC_ALL ? "barriers" : "cycles"));
+    printf("\n");
+  }
+  free(topo);
+  return 0;
+}
@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "noise.h"
+
+static const char *dist_names[] = { "none", "fixed", "uniform", "exp", "spike" };
+
+static pthread_t perturb_thread;
+static volatile int perturb_stop = 0;
+static int perturb_running = 0;
+static struct noise_config perturb_cfg;
+static int perturb_cpu;
+
+static double env_double(const char *name, double def)
+{
+   const char *str = getenv(name);
+   return (str && *str ? atof(str) : def);
+}
+
+int noise_config_from_env(struct noise_config *cfg)
+{
+   int i;
+   const char *str = getenv("NOISE");
+
+   memset(cfg, 0, sizeof(struct noise_config));
+   cfg->dist = NOISE_NONE;
+   for (i=0; str && i<(int)(sizeof(dist_names)/sizeof(dist_names[0])); ++i)
+      if (strcmp(str, dist_names[i]) == 0)
+         cfg->dist = (enum noise_dist)i;
+   if (str && *str && cfg->dist == NOISE_NONE && strcmp(str, "none") != 0)
+      fprintf(stderr, "Unknown noise distribution %s, using none\n", str);
+   cfg->us = env_double("NOISE_US", 0.0);
+   cfg->prob = env_double("NOISE_PROB", 0.01);
+   cfg->iters = (int)env_double("NOISE_ITERS", 10000);
+   cfg->thread_us = env_double("NOISE_THREAD_US", 0.0);
+   cfg->thread_period_us = env_double("NOISE_THREAD_PERIOD_US", 1000.0);
+   cfg->thread_cpu = (int)env_double("NOISE_THREAD_CPU", -1);
+   cfg->log = getenv("NOISE_LOG");
+   if (cfg->iters < 1)
+      cfg->iters = 1;
+   return (str && *str) || cfg->thread_us > 0.0;
+}
+
+int noise_rec_alloc(struct noise_rec *rec, int num_threads, int iters)
+{
+   rec->num_threads = num_threads;
+   rec->iters = iters;
+   rec->arrive = calloc((size_t)num_threads*iters, sizeof(double));
+   rec->leave = calloc((size_t)num_threads*iters, sizeof(double));
+   if (!rec->arrive || !rec->leave) {
+      noise_rec_free(rec);
+      return -1;
+   }
+   return 0;
+}
+
+void noise_rec_free(struct noise_rec *rec)
+{
+   free(rec->arrive);
+   free(rec->leave);
+   rec->arrive = NULL;
+   rec->leave = NULL;
+}
+
+// CLOCK_MONOTONIC is consistent over all CPUs, the timestamps of the threads compare
+double noise_now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double)ts.tv_sec + (double)ts.tv_nsec*1.0e-9;
+}
+
+static double spin(double seconds)
+{
+   double end = noise_now() + seconds;
+   double now;
+   do {
+      now = noise_now();
+   } while (now < end);
+   return now;
+}
+
+// xorshift64, uniform in (0, 1]
+static double next_uniform(unsigned long *rng)
+{
+   unsigned long x = *rng;
+   x ^= x << 13;
+   x ^= x >> 7;
+   x ^= x << 17;
+   *rng = x;
+   return ((double)(x >> 11) + 1.0) / 9007199254740992.0;
+}
+
+void noise_delay(const struct noise_config *cfg, unsigned long *rng)
+{
+   double us = 0.0;
+   switch (cfg->dist) {
+      case NOISE_FIXED: us = cfg->us; break;
+      case NOISE_UNIFORM: us = 2.0*cfg->us*next_uniform(rng); break;
+      case NOISE_EXP: us = -cfg->us*log(next_uniform(rng)); break;
+      case NOISE_SPIKE: us = (next_uniform(rng) <= cfg->prob ? cfg->us : 0.0); break;
+      default: break;
+   }
+   if (us > 0.0)
+      spin(us*1.0e-6);
+}
+
+// Busy for thread_us every thread_period_us on the CPU of a team thread, the scheduler
+// has to time-slice both
+static void* perturb_func(void *arg)
+{
+   cpu_set_t set;
+   struct timespec ts;
+   double period = perturb_cfg.thread_period_us*1.0e-6;
+   double next = noise_now();
+
+   CPU_ZERO(&set);
+   CPU_SET(perturb_cpu, &set);
+   sched_setaffinity(0, sizeof(cpu_set_t), &set);
+   while (!perturb_stop) {
+      spin(perturb_cfg.thread_us*1.0e-6);
+      next += period;
+      ts.tv_sec = (time_t)next;
+      ts.tv_nsec = (long)((next - (double)ts.tv_sec)*1.0e9);
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+   }
+   return NULL;
+}
+
+int noise_perturb_start(const struct noise_config *cfg, int cpu)
+{
+   if (cfg->thread_us <= 0.0)
+      return 0;
+   perturb_cfg = *cfg;
+   perturb_cpu = (cfg->thread_cpu >= 0 ? cfg->thread_cpu : cpu);
+   perturb_stop = 0;
+   if (pthread_create(&perturb_thread, NULL, perturb_func, NULL) != 0)
+      return -1;
+   perturb_running = 1;
+   return 0;
+}
+
+void noise_perturb_stop(void)
+{
+   if (!perturb_running)
+      return;
+   perturb_stop = 1;
+   pthread_join(perturb_thread, NULL);
+   perturb_running = 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+   double x = *(const double*)a, y = *(const double*)b;
+   return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+static void print_dist(FILE *out, const char *name, double *v, int n)
+{
+   double sum = 0.0;
+   int i;
+   for (i=0; i<n; ++i)
+      sum += v[i];
+   qsort(v, n, sizeof(double), cmp_double);
+   fprintf(out, "%-10s mean %.1lf, p50 %.1lf, p90 %.1lf, p99 %.1lf, p99.9 %.1lf, max %.1lf cy\n", name, sum/n,
+           v[n/2], v[(int)(0.9*n)], v[(int)(0.99*n)], v[(int)(0.999*n)], v[n-1]);
+}
+
+void noise_report(FILE *out, const struct noise_config *cfg, const struct noise_rec *rec, double clockspeed)
+{
+   int k, t;
+   double last_arrive, last_leave, prev_leave = 0.0;
+   double *release = malloc(rec->iters*sizeof(double));
+   double *iteration = malloc(rec->iters*sizeof(double));
+   FILE *log = NULL;
+
+   if (!release || !iteration) {
+      free(release);
+      free(iteration);
+      return;
+   }
+   if (cfg->log && (log = fopen(cfg->log, "w")) == NULL)
+      fprintf(stderr, "Cannot open %s\n", cfg->log);
+   if (log)
+      fprintf(log, "# iteration release_cy iteration_cy\n");
+   for (k=0; k<rec->iters; ++k) {
+      last_arrive = rec->arrive[k*rec->num_threads];
+      last_leave = rec->leave[k*rec->num_threads];
+      for (t=1; t<rec->num_threads; ++t) {
+         if (rec->arrive[k*rec->num_threads+t] > last_arrive)
+            last_arrive = rec->arrive[k*rec->num_threads+t];
+         if (rec->leave[k*rec->num_threads+t] > last_leave)
+            last_leave = rec->leave[k*rec->num_threads+t];
+      }
+      release[k] = (last_leave-last_arrive)*clockspeed;
+      iteration[k] = (k > 0 ? (last_leave-prev_leave)*clockspeed : release[k]);
+      prev_leave = last_leave;
+      if (log)
+         fprintf(log, "%d %.1lf %.1lf\n", k, release[k], iteration[k]);
+   }
+   if (log)
+      fclose(log);
+   fprintf(out, "Noise %s, %.2lf us (p %.3lf), perturbation %.1lf us every %.1lf us, %d iterations\n",
+           dist_names[cfg->dist], cfg->us, cfg->prob, cfg->thread_us, cfg->thread_period_us, rec->iters);
+   print_dist(out, "release", release, rec->iters);
+   print_dist(out, "iteration", iteration, rec->iters);
+   free(release);
+   free(iteration);
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+
+/*
+ * OS-noise injection for the barrier benchmarks. Before each barrier, every thread
+ * spins for a random delay, optionally a perturbation thread steals time from a CPU of
+ * the team. The arrival and departure of every thread are recorded per iteration.
+ *
+ * Configured by environment variables, the noise run is skipped without them:
+ *   NOISE                  none, fixed, uniform, exp or spike (default none)
+ *   NOISE_US               delay (fixed, spike), mean (uniform in [0, 2*NOISE_US], exp)
+ *   NOISE_PROB             probability of a delay per iteration for spike (default 0.01)
+ *   NOISE_ITERS            recorded iterations (default 10000)
+ *   NOISE_THREAD_US        busy time of the perturbation thread per period, 0 disables it
+ *   NOISE_THREAD_PERIOD_US period of the perturbation thread (default 1000)
+ *   NOISE_THREAD_CPU       CPU of the perturbation thread (default: CPU of thread 0)
+ *   NOISE_LOG              file for the per-iteration latencies
+ */
+
+enum noise_dist { NOISE_NONE, NOISE_FIXED, NOISE_UNIFORM, NOISE_EXP, NOISE_SPIKE };
+
+struct noise_config {
+  enum noise_dist dist;
+  double us;
+  double prob;
+  int iters;
+  double thread_us;
+  double thread_period_us;
+  int thread_cpu;
+  const char *log;
+};
+
+// arrive and leave of thread t in iteration k at [k*num_threads+t], in seconds
+struct noise_rec {
+  int num_threads;
+  int iters;
+  double *arrive;
+  double *leave;
+};
+
+// Returns 1 if a noise run is configured
+int noise_config_from_env(struct noise_config *cfg);
+int noise_rec_alloc(struct noise_rec *rec, int num_threads, int iters);
+void noise_rec_free(struct noise_rec *rec);
+
+double noise_now(void);
+// Spin for a delay drawn from the distribution, rng is the thread's state (non-zero)
+void noise_delay(const struct noise_config *cfg, unsigned long *rng);
+
+int noise_perturb_start(const struct noise_config *cfg, int cpu);
+void noise_perturb_stop(void);
+
+// Percentiles of the release latency (last departure after the last arrival) and of
+// the iteration time in cycles, per-iteration values to cfg->log
+void noise_report(FILE *out, const struct noise_config *cfg, const struct noise_rec *rec, double clockspeed);
@@ -0,0 +1,182 @@
+// Cost of the memory-ordering modes of the hardware barrier
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "timing.h"
+
+#include <sched.h>
+
+#include <hwbx.h>
+
+// A64FX cache line, each thread publishes one line per phase
+#define LINE 256
+
+// Every thread writes its line before the barrier and reads the line of the next
+// thread of its team after it. The lines alternate by parity, so a line is rewritten
+// only after the reader has passed the following barrier.
+struct slot {
+  volatile long value[2];
+} __attribute__((aligned(LINE)));
+
+static struct hwbx_plan _plan;
+static struct slot *_slots;
+static struct hwbx_wait_policy _policy;
+
+double workfunc(double y) {
+    return exp(y);
+}
+
+double func_with_barrier(int win, enum hwbx_order order, int self, int next, long k, long *stale) {
+	double x=0.0,y=3.04;
+    _slots[self].value[k&1] = k;
+    // a team of a single thread has no blade
+    if (win >= 0)
+      hwbx_sync_ordered(win, order, &_policy, NULL);
+    if (_slots[next].value[k&1] != k)
+      ++*stale;
+    x = workfunc(y);
+    if(x<0.)
+      printf("%.15lf",x);
+    return x;
+}
+
+double func_without_barrier(int self, long k) {
+	double x=0.0,y=3.04;
+    _slots[self].value[k&1] = k;
+    x = workfunc(y);
+    if(x<0.)
+      printf("%.15lf",x);
+    return x;
+}
+
+
+int main(int argc, char** argv) {
+
+  double wct_start,wct_end,cput_start,cput_end;
+  double t0, t[HWBX_NUM_ORDERS];
+  long stale[HWBX_NUM_ORDERS];
+  int NITER;
+  double clockspeed;
+  enum hwbx_place_mode mode;
+  int ret = 0;
+  int o;
+
+  if(argc!=2 && argc!=3) {
+	fprintf(stderr,"Usage: %s <clock_in_GHz> [compact|balanced|omp_places]\n", argv[0]);
+    exit(1);
+  }
+  clockspeed = atof(argv[1])*1.0e9;
+  mode = hwbx_place_mode_from_env(HWBX_PLACE_COMPACT);
+  if (argc == 3 && hwbx_place_mode_parse(argv[2], &mode) < 0)
+  {
+    fprintf(stderr,"Unknown placement %s\n", argv[2]);
+    exit(1);
+  }
+  ret = hwbx_plan_create(&_plan, omp_get_max_threads(), mode);
+  if (ret == 0)
+    ret = hwbx_plan_alloc(&_plan);
+  if (ret < 0)
+  {
+    fprintf(stderr,"Error init barrier\n");
+    exit(1);
+  }
+  hwbx_plan_print(stdout, &_plan);
+  if (posix_memalign((void**)&_slots, LINE, _plan.num_threads*sizeof(struct slot)) != 0)
+  {
+    fprintf(stderr,"Error allocating slots\n");
+    exit(1);
+  }
+  memset(_slots, 0xff, _plan.num_threads*sizeof(struct slot));
+  // spin only, the ordering is measured and not the wake-up
+  hwbx_wait_policy_default(&_policy);
+  _policy.spin_iters = ~0UL;
+  _policy.block = 0;
+  _policy.timeout_ms = 0;
+
+  NITER=1;
+  do {
+#pragma omp parallel
+{
+    int k, self = omp_get_thread_num();
+#pragma omp single
+    timing(&wct_start, &cput_start);
+    for(k=0; k<NITER; ++k) {
+      func_without_barrier(self, k);
+    }
+#pragma omp single
+    timing(&wct_end, &cput_end);
+} // end parallel
+    NITER = NITER*2;
+  } while (wct_end-wct_start<0.001);
+
+  NITER = NITER/2;
+  t0 = wct_end-wct_start;
+
+#pragma omp parallel private(o)
+{
+    struct hwbx_member member;
+    long k, base = 0, errors;
+    int next;
+
+	ret = hwbx_plan_join(&_plan, omp_get_thread_num(), &member);
+	if (ret < 0)
+  {
+    fprintf(stderr,"Error assign barrier\n");
+    exit(1);
+  }
+    // the next thread of the own team, the barrier only synchronizes the team
+    next = member.thread;
+    do {
+      next = (next+1)%_plan.num_threads;
+    } while (_plan.team[next] != member.team);
+
+    for (o=0; o<HWBX_NUM_ORDERS; ++o) {
+      errors = 0;
+      // warm up the window and the lines
+      for(k=0; k<100; ++k) {
+        func_with_barrier(member.window, HWBX_ORDER_FULL, member.thread, next, base+k, &errors);
+      }
+      base += 100;
+      errors = 0;
+#pragma omp barrier
+#pragma omp single
+      timing(&wct_start, &cput_start);
+      for(k=0; k<NITER; ++k) {
+        func_with_barrier(member.window, (enum hwbx_order)o, member.thread, next, base+k, &errors);
+      }
+#pragma omp single
+      {
+        timing(&wct_end, &cput_end);
+        t[o] = wct_end-wct_start;
+        stale[o] = 0;
+      }
+#pragma omp atomic
+      stale[o] += errors;
+      base += NITER;
+#pragma omp barrier
+    }
+    ret = hwbx_plan_leave(&_plan, &member);
+    if (ret < 0)
+  {
+    fprintf(stderr,"Error unassign barrier\n");
+    exit(1);
+  }
+} // end parallel
+
+  ret = hwbx_plan_free(&_plan);
+  if (ret < 0)
+  {
+    fprintf(stderr,"Error finalize barrier\n");
+    exit(1);
+  }
+  printf("NITER: %d, time w/o b: %.3lf\n",NITER,t0);
+  // only full guarantees fresh reads, stale reads of the others show what is skipped
+  for (o=0; o<HWBX_NUM_ORDERS; ++o)
+    printf("%-8s time: %.3lf, barrier: %.1lf cy, stale reads: %ld\n",hwbx_order_name(o),t[o],(t[o]-t0)/NITER*clockspeed,stale[o]);
+  free(_slots);
+
+  return 0;
+}
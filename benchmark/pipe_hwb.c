@@ -0,0 +1,142 @@
+// Tightly looped BSP supersteps with pipelined hardware barriers
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <omp.h>
+#include "timing.h"
+
+#include <sched.h>
+
+#include <hwbx.h>
+
+// workfunc calls per superstep, the straggler of a superstep does SKEW times more
+#define WORK 4
+#define SKEW 4
+
+// One pipe per CMG team, the teams synchronize separately. A team of a single
+// thread has nobody to synchronize with and gets no pipe.
+static struct hwbx_plan _plan;
+static struct hwbx_pipe _pipes[HWBX_MAX_CMGS];
+
+double workfunc(double y) {
+    return exp(y);
+}
+
+double superstep(int n) {
+    double x=0.0,y=3.04;
+    int i;
+    for (i=0; i<n; ++i)
+      x += workfunc(y+i);
+    if(x<0.)
+      printf("%.15lf",x);
+    return x;
+}
+
+// Time NITER supersteps with the given pipe depth (0: no barrier). With skew, the
+// straggler rotates over the threads of a team from one superstep to the next.
+static double run(int depth, int skew, int NITER) {
+  double wct_start,wct_end,cput_start,cput_end;
+  int ret = 0;
+  int i;
+
+  for (i=0; depth>0 && i<_plan.num_teams; ++i) {
+    if (_plan.teams[i].num_threads < 2)
+      continue;
+    ret = hwbx_pipe_alloc(&_pipes[i], sizeof(cpu_set_t), &_plan.teams[i].cpus, depth);
+    if (ret < 0)
+    {
+      fprintf(stderr,"Error allocating %d blades\n", depth);
+      exit(1);
+    }
+  }
+#pragma omp parallel
+{
+    struct hwbx_member member;
+    struct hwbx_pipe_member pm;
+    struct hwbx_wait_policy policy;
+    int k, n, sync;
+
+    hwbx_wait_policy_from_env(&policy);
+    // pin only, the blades are allocated by the pipes
+    ret = hwbx_plan_join(&_plan, omp_get_thread_num(), &member);
+    sync = (depth > 0 && _plan.teams[member.team].num_threads > 1);
+    if (ret < 0 || (sync && hwbx_pipe_join(&_pipes[member.team], &pm) < 0))
+    {
+      fprintf(stderr,"Error assign barrier\n");
+      exit(1);
+    }
+#pragma omp single
+    timing(&wct_start, &cput_start);
+    for(k=0; k<NITER; ++k) {
+      n = WORK;
+      if (skew && k%_plan.teams[member.team].num_threads == member.rank)
+        n *= SKEW;
+      superstep(n);
+      if (sync)
+        hwbx_pipe_sync(&pm, &policy, NULL);
+    }
+#pragma omp single
+    timing(&wct_end, &cput_end);
+    if (sync && hwbx_pipe_leave(&pm) < 0)
+    {
+      fprintf(stderr,"Error unassign barrier\n");
+      exit(1);
+    }
+} // end parallel
+  for (i=0; depth>0 && i<_plan.num_teams; ++i) {
+    if (_plan.teams[i].num_threads > 1 && hwbx_pipe_free(&_pipes[i]) < 0)
+    {
+      fprintf(stderr,"Error finalize barrier\n");
+      exit(1);
+    }
+  }
+  return wct_end-wct_start;
+}
+
+int main(int argc, char** argv) {
+
+  int NITER;
+  int depth, skew;
+  double t, t0, clockspeed;
+  enum hwbx_place_mode mode;
+  int ret = 0;
+
+  if(argc!=2 && argc!=3) {
+    fprintf(stderr,"Usage: %s <clock_in_GHz> [compact|balanced|omp_places]\n", argv[0]);
+    exit(1);
+  }
+  clockspeed = atof(argv[1])*1.0e9;
+  mode = hwbx_place_mode_from_env(HWBX_PLACE_COMPACT);
+  if (argc == 3 && hwbx_place_mode_parse(argv[2], &mode) < 0)
+  {
+    fprintf(stderr,"Unknown placement %s\n", argv[2]);
+    exit(1);
+  }
+  ret = hwbx_plan_create(&_plan, omp_get_max_threads(), mode);
+  if (ret < 0)
+  {
+    fprintf(stderr,"Error init barrier\n");
+    exit(1);
+  }
+  hwbx_plan_print(stdout, &_plan);
+
+  NITER=1;
+  do {
+    t = run(0, 0, NITER);
+    NITER = NITER*2;
+  } while (t<0.01);
+  NITER = NITER/2;
+  printf("NITER: %d, superstep: %d workfunc calls, straggler: %dx\n",NITER,WORK,SKEW);
+
+  for (skew=0; skew<=1; ++skew) {
+    t0 = run(0, skew, NITER);
+    printf("%s supersteps, w/o barrier: %.1lf cy\n",(skew ? "skewed" : "balanced"),t0/NITER*clockspeed);
+    for (depth=1; depth<=HWBX_NUM_WINDOWS; ++depth) {
+      t = run(depth, skew, NITER);
+      printf("  depth %d: %.1lf cy per superstep, barrier: %.1lf cy\n",depth,t/NITER*clockspeed,(t-t0)/NITER*clockspeed);
+    }
+  }
+
+  return 0;
+}
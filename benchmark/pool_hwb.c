@@ -0,0 +1,126 @@
+// Supersteps of the hwbx thread pool against OpenMP parallel regions
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <omp.h>
+#include "timing.h"
+
+#include <sched.h>
+
+#include <hwbx.h>
+
+static double *_out;
+
+double workfunc(double y) {
+    return exp(y);
+}
+
+// one element per thread, the same work as the barrier benchmarks
+static void loop_body(void *arg, long begin, long end, int thread) {
+	double x=0.0,y=3.04;
+    long i;
+    for(i=begin; i<end; ++i) {
+      x = workfunc(y);
+      if(x<0.)
+        printf("%.15lf",x);
+      _out[i] = x;
+    }
+}
+
+static void step_body(void *arg, int thread, int num_threads) {
+    loop_body(arg, thread, thread+1, thread);
+}
+
+
+int main(int argc, char** argv) {
+
+  double wct_start,wct_end,cput_start,cput_end;
+  double t_omp_for, t_omp_region, t_pool_for, t_pool_run;
+  int NITER, num_threads, k;
+  double clockspeed;
+  enum hwbx_place_mode mode;
+  struct hwbx_pool pool;
+  int ret = 0;
+
+  if(argc!=2 && argc!=3) {
+	fprintf(stderr,"Usage: %s <clock_in_GHz> [compact|balanced|omp_places]\n", argv[0]);
+    exit(1);
+  }
+  clockspeed = atof(argv[1])*1.0e9;
+  mode = hwbx_place_mode_from_env(HWBX_PLACE_COMPACT);
+  if (argc == 3 && hwbx_place_mode_parse(argv[2], &mode) < 0)
+  {
+    fprintf(stderr,"Unknown placement %s\n", argv[2]);
+    exit(1);
+  }
+  num_threads = omp_get_max_threads();
+  _out = malloc(num_threads*sizeof(double));
+
+  // OpenMP: a parallel for per step and a region per step, the same NITER for all
+  NITER=1;
+  do {
+    timing(&wct_start, &cput_start);
+    for(k=0; k<NITER; ++k) {
+#pragma omp parallel for schedule(static)
+      for(int i=0; i<num_threads; ++i)
+        loop_body(NULL, i, i+1, i);
+    }
+    timing(&wct_end, &cput_end);
+    NITER = NITER*2;
+  } while (wct_end-wct_start<0.001);
+
+  NITER = NITER/2;
+  t_omp_for = wct_end-wct_start;
+
+  timing(&wct_start, &cput_start);
+  for(k=0; k<NITER; ++k) {
+#pragma omp parallel
+    step_body(NULL, omp_get_thread_num(), omp_get_num_threads());
+  }
+  timing(&wct_end, &cput_end);
+  t_omp_region = wct_end-wct_start;
+
+  // the pool pins the calling thread, it runs after the OpenMP loops
+  ret = hwbx_pool_create(&pool, num_threads, mode);
+  if (ret < 0)
+  {
+    fprintf(stderr,"Error creating thread pool\n");
+    exit(1);
+  }
+  hwbx_plan_print(stdout, &pool.plan);
+  for(k=0; k<100; ++k)
+    ret |= hwbx_pool_for(&pool, 0, num_threads, loop_body, NULL);
+
+  timing(&wct_start, &cput_start);
+  for(k=0; k<NITER; ++k) {
+    ret |= hwbx_pool_for(&pool, 0, num_threads, loop_body, NULL);
+  }
+  timing(&wct_end, &cput_end);
+  t_pool_for = wct_end-wct_start;
+
+  timing(&wct_start, &cput_start);
+  for(k=0; k<NITER; ++k) {
+    ret |= hwbx_pool_run(&pool, step_body, NULL, 0);
+  }
+  timing(&wct_end, &cput_end);
+  t_pool_run = wct_end-wct_start;
+
+  if (ret < 0)
+    fprintf(stderr,"Error in a superstep\n");
+  ret = hwbx_pool_destroy(&pool);
+  if (ret < 0)
+  {
+    fprintf(stderr,"Error destroying thread pool\n");
+    exit(1);
+  }
+  free(_out);
+
+  printf("NITER: %d, threads: %d\n",NITER,num_threads);
+  printf("omp parallel for: %.3lf, %.1lf cy per step\n",t_omp_for,t_omp_for/NITER*clockspeed);
+  printf("omp parallel:     %.3lf, %.1lf cy per step\n",t_omp_region,t_omp_region/NITER*clockspeed);
+  printf("pool for:         %.3lf, %.1lf cy per step\n",t_pool_for,t_pool_for/NITER*clockspeed);
+  printf("pool run:         %.3lf, %.1lf cy per step\n",t_pool_run,t_pool_run/NITER*clockspeed);
+
+  return 0;
+}
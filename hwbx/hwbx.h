@@ -0,0 +1,430 @@
+#ifndef HWBX_H
+#define HWBX_H
+
+#include <stdio.h>
+#include <sched.h>
+
+/*
+ * hwbx - extensions to Fujitsu's hardware barrier library (ulib) for the A64FX_HWB
+ * kernel module. Blades and windows are still set up through ulib (fhwb_init,
+ * fhwb_assign), hwbx adds synchronization flavors on top of the assigned windows
+ * and wrappers for the additional IOCTLs of the module (see kmod/a64fx_hwb_uapi.h).
+ *
+ * Functions return 0 or a positive value on success and a negative errno value in
+ * case of errors.
+ */
+
+#define HWBX_DEVICE "/dev/fujitsu_hwb"
+// barrier windows per PE
+#define HWBX_NUM_WINDOWS 4
+
+// File descriptor of the barrier device used for the module's extra IOCTLs. The
+// device is opened on first use and kept open for the lifetime of the process.
+int hwbx_dev_fd(void);
+
+
+/*
+ * Blade and window control with explicit CMG and blade numbers. The pinned
+ * thread calling hwbx_window_assign() gets a window on its CPU (window -1
+ * selects the next free one) and the window number is returned.
+ */
+int hwbx_blade_alloc(size_t size, const cpu_set_t *mask, int *cmg, int *bb);
+// Change the participating CPUs of an allocated blade in place. The new mask has
+// to be on the same CMG and include all CPUs with an assigned window. No thread of
+// the team may be inside a synchronization while resizing, the blade's BST and LBSY
+// bits are cleared.
+int hwbx_blade_resize(int cmg, int bb, size_t size, const cpu_set_t *mask);
+int hwbx_blade_free(int cmg, int bb);
+int hwbx_window_assign(int bb, int window);
+int hwbx_window_unassign(int bb, int window);
+
+
+/*
+ * Live state of a blade for diagnosing hanging barriers (A64FX_HWB_IOC_BB_STATUS).
+ * The blade is selected by a window on the calling CPU or, with window -1, by cmg and
+ * bb. pending are the PEs of bst_mask that did not arrive in the current episode, cpu
+ * maps the PE numbers of the masks to CPUs (-1 for none). tgid is the owning process.
+ */
+#define HWBX_MAX_PES 13
+
+struct hwbx_blade_status {
+    int cmg;
+    int bb;
+    int active;
+    int tgid;
+    unsigned int bst_mask;
+    unsigned int bst;
+    unsigned int lbsy;
+    unsigned int pending;
+    int cpu[HWBX_MAX_PES];
+};
+
+int hwbx_blade_status(int window, int cmg, int bb, struct hwbx_blade_status *status);
+void hwbx_blade_status_print(FILE *out, const struct hwbx_blade_status *status);
+
+
+/*
+ * Wait policy for hwbx_sync_wait(). A wait polls LBSY for spin_iters iterations,
+ * then executes WFE between the polls for wfe_iters iterations and finally blocks
+ * in the kernel (A64FX_HWB_IOC_WAIT) if block is set. Without blocking, the WFE
+ * tier is not limited. The defaults can be overwritten with the environment
+ * variables HWBX_SPIN_ITERS, HWBX_WFE_ITERS, HWBX_BLOCK and HWBX_BLOCK_TIMEOUT_US.
+ *
+ * With timeout_ms (HWBX_SYNC_TIMEOUT_MS), a wait that did not resolve within this time
+ * prints the state of the blade with the PEs that did not arrive to stderr and returns
+ * -ETIMEDOUT. The own arrival cannot be taken back, the team's barrier is out of step
+ * afterwards.
+ */
+struct hwbx_wait_policy {
+    unsigned long spin_iters;
+    unsigned long wfe_iters;
+    int block;
+    // timeout of a single blocking call, the wait blocks again until LBSY flips or the
+    // sync timeout expires. 0 blocks in one call.
+    unsigned int block_timeout_us;
+    // timeout of the whole wait with diagnostics, 0 disables it
+    unsigned int timeout_ms;
+};
+
+enum hwbx_wait_tier {
+    HWBX_TIER_SPIN = 0,
+    HWBX_TIER_WFE,
+    HWBX_TIER_BLOCK,
+    HWBX_NUM_TIERS
+};
+
+// Per-thread counters of the tier which resolved a wait
+struct hwbx_wait_stats {
+    unsigned long resolved[HWBX_NUM_TIERS];
+    unsigned long errors;
+};
+
+void hwbx_wait_policy_default(struct hwbx_wait_policy *policy);
+void hwbx_wait_policy_from_env(struct hwbx_wait_policy *policy);
+// Synchronize on an assigned window using the given policy. stats may be NULL.
+int hwbx_sync_wait(int window, const struct hwbx_wait_policy *policy, struct hwbx_wait_stats *stats);
+void hwbx_wait_stats_add(struct hwbx_wait_stats *sum, const struct hwbx_wait_stats *stats);
+void hwbx_wait_stats_print(FILE *out, const struct hwbx_wait_stats *stats);
+
+/*
+ * Memory ordering of a barrier episode. The barrier is signalled through system
+ * registers, which are not ordered with normal loads and stores, so hwbx_sync_wait()
+ * synchronizes only the control flow.
+ *   full:    DSB ISH before the arrival, ISB after the wait. Loads and stores before
+ *            the episode are complete when any thread leaves it and loads after it
+ *            are not executed early. Needed to hand over data written by other threads.
+ *   release: DSB ISHST before the arrival. Stores before the episode are visible to
+ *            threads that leave it with full ordering, loads are not ordered. For
+ *            producers whose consumers synchronize with full ordering.
+ *   none:    no fences, the same as hwbx_sync_wait(). For phases that only need the
+ *            timing, e.g. no shared data or data handed over by other means.
+ */
+enum hwbx_order {
+    HWBX_ORDER_FULL = 0,
+    HWBX_ORDER_RELEASE,
+    HWBX_ORDER_NONE,
+    HWBX_NUM_ORDERS
+};
+
+const char *hwbx_order_name(enum hwbx_order order);
+int hwbx_order_parse(const char *str, enum hwbx_order *order);
+int hwbx_sync_ordered(int window, enum hwbx_order order, const struct hwbx_wait_policy *policy, struct hwbx_wait_stats *stats);
+
+/*
+ * Zero-read arrival. hwbx_sync_wait() reads LBSY before each arrival to get the new
+ * BST. A thread taking part in every episode of its window knows the result already:
+ * hwbx_fast keeps the phase, the BST value of the next arrival, and flips it after
+ * each completed episode, so arriving costs only the register write.
+ *
+ * The phase has to be read from the hardware with hwbx_fast_resync() after the window
+ * was assigned (done by hwbx_fast_init()) and after the blade was resized or reset.
+ * hwbx_fast_wait() resynchronizes by itself after a failed wait. The spin-only
+ * variant hwbx_fast_sync() is inlined from hwbx_fast.h.
+ */
+struct hwbx_fast {
+    int window;
+    unsigned long phase;
+};
+
+int hwbx_fast_init(struct hwbx_fast *fast, int window);
+void hwbx_fast_resync(struct hwbx_fast *fast);
+int hwbx_fast_wait(struct hwbx_fast *fast, const struct hwbx_wait_policy *policy, struct hwbx_wait_stats *stats);
+
+
+/*
+ * Collectives within the team of one blade. Every thread owns a 256 byte slot (one
+ * A64FX cache line) per parity. A collective writes the thread's contribution to its
+ * slot, synchronizes once with hwbx_sync_ordered() and HWBX_ORDER_FULL, so the
+ * slots written before the barrier are visible after it, and then each thread combines
+ * all slots itself. The two parities alternate, so a thread may enter the next
+ * collective while others still read the slots of the previous one.
+ *
+ * All threads combine the slots in rank order, so every thread gets the same result.
+ * hwbx_coll_init() is called once for the team, num_threads has to match the
+ * threads with a window on the blade. Each of them calls hwbx_coll_join() with its
+ * rank (hwbx_member.rank) and window. A team of a single thread passes window -1.
+ */
+#define HWBX_COLL_SLOT_SIZE 256
+// doubles per slot, the maximum count of hwbx_allreduce()
+#define HWBX_COLL_MAX_COUNT ((int)(HWBX_COLL_SLOT_SIZE / sizeof(double)))
+
+enum hwbx_reduce_op {
+    HWBX_OP_SUM = 0,
+    HWBX_OP_MIN,
+    HWBX_OP_MAX,
+};
+
+enum hwbx_vote_op {
+    HWBX_VOTE_ALL = 0,
+    HWBX_VOTE_ANY,
+};
+
+struct hwbx_coll {
+    int num_threads;
+    // 2 * num_threads slots, parity 0 first
+    void *slots;
+};
+
+struct hwbx_coll_member {
+    struct hwbx_coll *coll;
+    int rank;
+    int window;
+    // parity of the next collective
+    unsigned int parity;
+    struct hwbx_wait_policy policy;
+    struct hwbx_wait_stats stats;
+};
+
+int hwbx_coll_init(struct hwbx_coll *coll, int num_threads);
+void hwbx_coll_free(struct hwbx_coll *coll);
+// policy NULL uses hwbx_wait_policy_from_env()
+int hwbx_coll_join(struct hwbx_coll *coll, int rank, int window, const struct hwbx_wait_policy *policy, struct hwbx_coll_member *member);
+// Reduce count doubles of all threads, in and out may be the same buffer
+int hwbx_allreduce(struct hwbx_coll_member *member, enum hwbx_reduce_op op, const double *in, double *out, int count);
+// Logical and (all) or or (any) of flag over all threads, returns 0 or 1
+int hwbx_vote(struct hwbx_coll_member *member, enum hwbx_vote_op op, int flag);
+// Single writer: data written by any thread before hwbx_publish() is visible to all
+// threads of the team afterwards. The writer may only change the data again after
+// the next hwbx_publish() or collective, so that the readers are done.
+int hwbx_publish(struct hwbx_coll_member *member);
+// Copy size bytes (at most HWBX_COLL_SLOT_SIZE) from buf of thread root to buf of
+// all other threads. The payload is double-buffered in root's slots, the root may
+// broadcast again right away.
+int hwbx_bcast(struct hwbx_coll_member *member, int root, void *buf, size_t size);
+
+
+/*
+ * Pipelined barriers. A team allocates up to HWBX_NUM_WINDOWS blades with the same
+ * CPU mask and every thread assigns one window to each of them. Consecutive barrier
+ * episodes rotate over the blades, so a thread arriving at episode k+1 writes the
+ * BST of another blade than the one of episode k and does not depend on the LBSY
+ * state of the previous episode. With depth 1, hwbx_pipe_sync() is hwbx_sync_wait()
+ * on a single window.
+ */
+struct hwbx_pipe {
+    int cmg;
+    int depth;
+    int bb[HWBX_NUM_WINDOWS];
+};
+
+struct hwbx_pipe_member {
+    const struct hwbx_pipe *pipe;
+    // window assigned to pipe->bb[i]
+    int window[HWBX_NUM_WINDOWS];
+    // blade index of the next episode
+    int next;
+};
+
+// Allocate depth blades for the CPUs in mask, all of them on one CMG
+int hwbx_pipe_alloc(struct hwbx_pipe *pipe, size_t size, const cpu_set_t *mask, int depth);
+int hwbx_pipe_free(struct hwbx_pipe *pipe);
+// Executed by each pinned thread of the team: assign a window to every blade
+int hwbx_pipe_join(const struct hwbx_pipe *pipe, struct hwbx_pipe_member *member);
+int hwbx_pipe_leave(struct hwbx_pipe_member *member);
+int hwbx_pipe_sync(struct hwbx_pipe_member *member, const struct hwbx_wait_policy *policy, struct hwbx_wait_stats *stats);
+
+
+/*
+ * Team barriers with a selectable implementation. Besides the hardware barrier
+ * (HWBX_BARRIER_HWB, only for teams on one CMG) there are software barriers: a
+ * centralized sense-reversing counter, a dissemination barrier and a tree barrier
+ * with fan-in 4 and a global wake-up flag. All shared flags are in separate 256 byte
+ * cache lines. Every kind orders memory: data written before the barrier is visible
+ * to all threads of the team after it (the hardware barrier uses HWBX_ORDER_FULL).
+ *
+ * HWBX_BARRIER_AUTO picks the fastest implementation for the team shape (number of
+ * threads and CMGs). The timings are taken from a per-node profile file
+ * (HWBX_TUNE_PROFILE, default hwbx_profile.<hostname> in $XDG_CACHE_HOME or
+ * $HOME/.cache, /tmp/hwbx_profile.<uid>.<hostname> without either). The profile is
+ * not opened through a symlink. Shapes missing in the profile are calibrated with
+ * pinned helper threads on the team's CPUs when the barrier is created, and appended
+ * to the profile. With HWBX_TUNE_LOG=1, the timings and the decision are printed to
+ * stderr.
+ *
+ * hwbx_barrier_init() is called once, outside of the team. Each thread pins itself to
+ * one of the CPUs (e.g. with hwbx_plan_join() of a plan without blades) and calls
+ * hwbx_barrier_join() with its rank.
+ */
+enum hwbx_barrier_kind {
+    HWBX_BARRIER_HWB = 0,
+    HWBX_BARRIER_CENTRAL,
+    HWBX_BARRIER_DISSEMINATION,
+    HWBX_BARRIER_TREE,
+    HWBX_NUM_BARRIER_KINDS,
+    HWBX_BARRIER_AUTO = HWBX_NUM_BARRIER_KINDS,
+};
+
+struct hwbx_barrier {
+    enum hwbx_barrier_kind kind;
+    int num_threads;
+    cpu_set_t cpus;
+    // blade for HWBX_BARRIER_HWB, -1 otherwise
+    int cmg;
+    int bb;
+    // shared state of the software barriers
+    void *sw;
+};
+
+struct hwbx_barrier_member {
+    struct hwbx_barrier *barrier;
+    int rank;
+    // window for HWBX_BARRIER_HWB
+    int window;
+    struct hwbx_wait_policy policy;
+};
+
+const char *hwbx_barrier_kind_name(enum hwbx_barrier_kind kind);
+// Parse "hwb", "central", "dissemination", "tree" or "auto"
+int hwbx_barrier_kind_parse(const char *str, enum hwbx_barrier_kind *kind);
+int hwbx_barrier_init(struct hwbx_barrier *barrier, const cpu_set_t *cpus, int num_threads, enum hwbx_barrier_kind kind);
+int hwbx_barrier_free(struct hwbx_barrier *barrier);
+// Executed by each pinned thread of the team
+int hwbx_barrier_join(struct hwbx_barrier *barrier, int rank, struct hwbx_barrier_member *member);
+int hwbx_barrier_leave(struct hwbx_barrier_member *member);
+int hwbx_barrier_wait(struct hwbx_barrier_member *member);
+
+// Measured time per barrier in ns for every kind, negative if not applicable
+struct hwbx_tune_result {
+    int num_threads;
+    int num_cmgs;
+    double ns[HWBX_NUM_BARRIER_KINDS];
+};
+
+// Calibrate all kinds on the first num_threads CPUs of cpus with pinned helper threads
+int hwbx_tune_calibrate(const cpu_set_t *cpus, int num_threads, struct hwbx_tune_result *result);
+// Profile entry for the team shape, calibrated and stored if missing
+int hwbx_tune_lookup(const cpu_set_t *cpus, int num_threads, struct hwbx_tune_result *result);
+enum hwbx_barrier_kind hwbx_tune_select(const struct hwbx_tune_result *result);
+
+
+/*
+ * Placement planner. The hardware barrier only works between CPUs of the same CMG,
+ * so threads are grouped into one team per CMG. The planner reads the CPU->CMG
+ * mapping from the module's sysfs files (CMGx/core_map) and the affinity mask of
+ * the calling process and places num_threads threads:
+ *  - compact: fill the CMGs one after the other, fewest teams
+ *  - balanced: spread the threads evenly over all CMGs with allowed CPUs
+ *  - omp_places: thread i is bound close to the places in OMP_PLACES
+ * With compact and balanced, the threads of a team have consecutive numbers. hwbx_plan_alloc() allocates a
+ * blade for every team with at least two threads, afterwards each thread calls
+ * hwbx_plan_join() to pin itself and get a window on its team's blade.
+ */
+#define HWBX_MAX_CMGS 4
+// CPU_SETSIZE, which is only defined with _GNU_SOURCE
+#define HWBX_MAX_CPUS ((int)(8 * sizeof(cpu_set_t)))
+
+enum hwbx_place_mode {
+    HWBX_PLACE_COMPACT = 0,
+    HWBX_PLACE_BALANCED,
+    HWBX_PLACE_OMP_PLACES,
+};
+
+struct hwbx_team {
+    int cmg;
+    // blade of the team, -1 if not allocated
+    int bb;
+    int num_threads;
+    cpu_set_t cpus;
+};
+
+struct hwbx_plan {
+    int num_threads;
+    int num_teams;
+    // CPU and team index per thread number
+    int cpu[HWBX_MAX_CPUS];
+    int team[HWBX_MAX_CPUS];
+    struct hwbx_team teams[HWBX_MAX_CMGS];
+};
+
+// Placement of a thread after hwbx_plan_join()
+struct hwbx_member {
+    int thread;
+    int team;
+    // index of the thread within its team, 0..num_threads-1
+    int rank;
+    int cmg;
+    int bb;
+    int cpu;
+    // window on the team's blade, -1 for teams without blade
+    int window;
+};
+
+// Parse "compact", "balanced" or "omp_places"
+int hwbx_place_mode_parse(const char *str, enum hwbx_place_mode *mode);
+// Mode from the environment variable HWBX_PLACEMENT or def if unset/invalid
+enum hwbx_place_mode hwbx_place_mode_from_env(enum hwbx_place_mode def);
+int hwbx_plan_create(struct hwbx_plan *plan, int num_threads, enum hwbx_place_mode mode);
+int hwbx_plan_alloc(struct hwbx_plan *plan);
+// Executed by each thread: pin to the planned CPU and assign a window
+int hwbx_plan_join(const struct hwbx_plan *plan, int thread, struct hwbx_member *member);
+int hwbx_plan_leave(const struct hwbx_plan *plan, struct hwbx_member *member);
+int hwbx_plan_free(struct hwbx_plan *plan);
+void hwbx_plan_print(FILE *out, const struct hwbx_plan *plan);
+
+
+/*
+ * Persistent thread pool for bulk-synchronous loops. hwbx_pool_create() plans the
+ * placement like hwbx_plan_create(), allocates one blade per CMG team and starts
+ * num_threads-1 workers. The calling thread becomes thread 0 of the pool and is pinned
+ * to its planned CPU until hwbx_pool_destroy() restores its affinity. Every thread is
+ * pinned and assigns its window once, the supersteps only synchronize.
+ *
+ * A superstep runs func on all threads and ends with a pool-wide barrier: each team
+ * synchronizes on its hardware barrier with full memory ordering, then the team
+ * leaders (the lowest thread of each team) meet on a sense-reversing counter. Only
+ * the calling thread may start supersteps, it returns when all threads are done and
+ * their stores are visible. Between the supersteps, the workers poll their mailbox, a
+ * 256 byte cache line per thread. The caller posts a step to its own team and to the
+ * other leaders, each leader forwards it to its team. With size > 0, arg is copied
+ * into every mailbox and func gets the thread's own copy.
+ */
+#define HWBX_POOL_ARG_SIZE 192
+
+typedef void (*hwbx_pool_func)(void *arg, int thread, int num_threads);
+// Called once per thread with its block [begin, end) of the range, not for empty blocks
+typedef void (*hwbx_pool_for_func)(void *arg, long begin, long end, int thread);
+
+struct hwbx_pool {
+    struct hwbx_plan plan;
+    struct hwbx_wait_policy policy;
+    // membership of the calling thread (thread 0)
+    struct hwbx_member member;
+    // mailboxes and leader barrier, see hwbx_pool.c
+    void *shared;
+    // started workers
+    void *workers;
+    int num_workers;
+    // sequence number of the last superstep
+    unsigned long step;
+    // affinity of the calling thread before hwbx_pool_create()
+    cpu_set_t affinity;
+};
+
+int hwbx_pool_create(struct hwbx_pool *pool, int num_threads, enum hwbx_place_mode mode);
+int hwbx_pool_destroy(struct hwbx_pool *pool);
+// One superstep, returns the first synchronization error not reported before
+int hwbx_pool_run(struct hwbx_pool *pool, hwbx_pool_func func, void *arg, size_t size);
+// Superstep over [begin, end) with a static block per thread
+int hwbx_pool_for(struct hwbx_pool *pool, long begin, long end, hwbx_pool_for_func func, void *arg);
+
+#endif /* HWBX_H */
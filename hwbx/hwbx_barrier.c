@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+
+#include "hwbx.h"
+
+/*
+ * Team barriers, see hwbx.h. The software barriers keep the per-thread state in the
+ * thread's own cache line. Flags written by other threads are only polled by the
+ * owner of the line, except for the global counter and sense of the centralized and
+ * the tree barrier.
+ */
+
+#define HWBX_SWB_LINE 256
+// dissemination rounds, ceil(log2(HWBX_MAX_CPUS))
+#define HWBX_SWB_MAX_ROUNDS 16
+#define HWBX_SWB_TREE_ARITY 4
+
+struct hwbx_swb_shared {
+    unsigned int count;
+    unsigned int sense;
+} __attribute__((aligned(HWBX_SWB_LINE)));
+
+struct hwbx_swb_thread {
+    // sense of the centralized and the tree barrier
+    unsigned int sense;
+    // tree: written by the thread when its subtree arrived
+    unsigned int arrived;
+    // dissemination: parity, sense and the flags set by the partners
+    unsigned int parity;
+    unsigned int dsense;
+    unsigned int flags[2][HWBX_SWB_MAX_ROUNDS];
+} __attribute__((aligned(HWBX_SWB_LINE)));
+
+struct hwbx_swb {
+    struct hwbx_swb_shared shared;
+    struct hwbx_swb_thread thread[];
+};
+
+static const char *kind_names[HWBX_NUM_BARRIER_KINDS + 1] = {
+    "hwb", "central", "dissemination", "tree", "auto"
+};
+
+const char *hwbx_barrier_kind_name(enum hwbx_barrier_kind kind)
+{
+    if (kind < 0 || kind > HWBX_BARRIER_AUTO)
+    {
+        return "unknown";
+    }
+    return kind_names[kind];
+}
+
+int hwbx_barrier_kind_parse(const char *str, enum hwbx_barrier_kind *kind)
+{
+    int i = 0;
+    if ((!str) || (!kind))
+    {
+        return -EINVAL;
+    }
+    for (i = 0; i <= HWBX_BARRIER_AUTO; i++)
+    {
+        if (strcmp(str, kind_names[i]) == 0)
+        {
+            *kind = (enum hwbx_barrier_kind)i;
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+static inline unsigned int load_acquire(const unsigned int *ptr)
+{
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(unsigned int *ptr, unsigned int val)
+{
+    __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+static void central_wait(struct hwbx_swb *swb, int num_threads, int rank)
+{
+    struct hwbx_swb_thread *self = &swb->thread[rank];
+    unsigned int sense = self->sense ^ 1;
+    if (__atomic_add_fetch(&swb->shared.count, 1, __ATOMIC_ACQ_REL) == (unsigned int)num_threads)
+    {
+        swb->shared.count = 0;
+        store_release(&swb->shared.sense, sense);
+    }
+    else
+    {
+        while (load_acquire(&swb->shared.sense) != sense);
+    }
+    self->sense = sense;
+}
+
+// Round r signals the thread rank + 2^r and waits for the signal of rank - 2^r. The
+// flags alternate between two sets by parity and the sense flips every second barrier,
+// so they never have to be reset.
+static void dissemination_wait(struct hwbx_swb *swb, int num_threads, int rank)
+{
+    int r = 0;
+    int dist = 1;
+    struct hwbx_swb_thread *self = &swb->thread[rank];
+    unsigned int parity = self->parity;
+    unsigned int sense = self->dsense;
+    for (r = 0; dist < num_threads; r++, dist <<= 1)
+    {
+        struct hwbx_swb_thread *partner = &swb->thread[(rank + dist) % num_threads];
+        store_release(&partner->flags[parity][r], sense);
+        while (load_acquire(&self->flags[parity][r]) != sense);
+    }
+    if (parity == 1)
+    {
+        self->dsense = sense ^ 1;
+    }
+    self->parity = parity ^ 1;
+}
+
+// Combining tree: a thread waits for its children, then reports to its parent. The
+// root releases everybody through the global sense.
+static void tree_wait(struct hwbx_swb *swb, int num_threads, int rank)
+{
+    int c = 0;
+    int child = 0;
+    struct hwbx_swb_thread *self = &swb->thread[rank];
+    unsigned int sense = self->sense ^ 1;
+    for (c = 1; c <= HWBX_SWB_TREE_ARITY; c++)
+    {
+        child = HWBX_SWB_TREE_ARITY * rank + c;
+        if (child >= num_threads)
+        {
+            break;
+        }
+        while (load_acquire(&swb->thread[child].arrived) != sense);
+    }
+    if (rank == 0)
+    {
+        store_release(&swb->shared.sense, sense);
+    }
+    else
+    {
+        store_release(&self->arrived, sense);
+        while (load_acquire(&swb->shared.sense) != sense);
+    }
+    self->sense = sense;
+}
+
+// First num_threads CPUs of cpus
+static int team_cpus(const cpu_set_t *cpus, int num_threads, cpu_set_t *team)
+{
+    int cpu = 0;
+    int n = 0;
+    CPU_ZERO(team);
+    for (cpu = 0; cpu < HWBX_MAX_CPUS && n < num_threads; cpu++)
+    {
+        if (CPU_ISSET(cpu, cpus))
+        {
+            CPU_SET(cpu, team);
+            n++;
+        }
+    }
+    return (n == num_threads ? 0 : -EINVAL);
+}
+
+int hwbx_barrier_init(struct hwbx_barrier *barrier, const cpu_set_t *cpus, int num_threads, enum hwbx_barrier_kind kind)
+{
+    int i = 0;
+    int err = 0;
+    int cmg = 0, bb = 0;
+    size_t size = 0;
+    void *mem = NULL;
+    struct hwbx_tune_result result;
+
+    if ((!barrier) || (!cpus) || num_threads < 1 || kind < 0 || kind > HWBX_BARRIER_AUTO)
+    {
+        return -EINVAL;
+    }
+    memset(barrier, 0, sizeof(struct hwbx_barrier));
+    barrier->num_threads = num_threads;
+    barrier->cmg = -1;
+    barrier->bb = -1;
+    err = team_cpus(cpus, num_threads, &barrier->cpus);
+    if (err < 0)
+    {
+        return err;
+    }
+    if (kind == HWBX_BARRIER_AUTO)
+    {
+        err = hwbx_tune_lookup(&barrier->cpus, num_threads, &result);
+        if (err < 0)
+        {
+            return err;
+        }
+        kind = hwbx_tune_select(&result);
+    }
+    barrier->kind = kind;
+
+    if (kind == HWBX_BARRIER_HWB)
+    {
+        err = hwbx_blade_alloc(sizeof(cpu_set_t), &barrier->cpus, &cmg, &bb);
+        if (err < 0)
+        {
+            return err;
+        }
+        barrier->cmg = cmg;
+        barrier->bb = bb;
+        return 0;
+    }
+    size = sizeof(struct hwbx_swb) + (size_t)num_threads * sizeof(struct hwbx_swb_thread);
+    if (posix_memalign(&mem, HWBX_SWB_LINE, size) != 0)
+    {
+        return -ENOMEM;
+    }
+    memset(mem, 0, size);
+    for (i = 0; i < num_threads; i++)
+    {
+        ((struct hwbx_swb *)mem)->thread[i].dsense = 1;
+    }
+    barrier->sw = mem;
+    return 0;
+}
+
+int hwbx_barrier_free(struct hwbx_barrier *barrier)
+{
+    int err = 0;
+    if (!barrier)
+    {
+        return -EINVAL;
+    }
+    if (barrier->bb >= 0)
+    {
+        err = hwbx_blade_free(barrier->cmg, barrier->bb);
+        barrier->bb = -1;
+    }
+    free(barrier->sw);
+    barrier->sw = NULL;
+    return err;
+}
+
+int hwbx_barrier_join(struct hwbx_barrier *barrier, int rank, struct hwbx_barrier_member *member)
+{
+    int ret = 0;
+    if ((!barrier) || (!member) || rank < 0 || rank >= barrier->num_threads)
+    {
+        return -EINVAL;
+    }
+    member->barrier = barrier;
+    member->rank = rank;
+    member->window = -1;
+    hwbx_wait_policy_from_env(&member->policy);
+    if (barrier->kind == HWBX_BARRIER_HWB)
+    {
+        ret = hwbx_window_assign(barrier->bb, -1);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        member->window = ret;
+    }
+    return 0;
+}
+
+int hwbx_barrier_leave(struct hwbx_barrier_member *member)
+{
+    int err = 0;
+    if ((!member) || (!member->barrier))
+    {
+        return -EINVAL;
+    }
+    if (member->window >= 0)
+    {
+        err = hwbx_window_unassign(member->barrier->bb, member->window);
+        member->window = -1;
+    }
+    return err;
+}
+
+int hwbx_barrier_wait(struct hwbx_barrier_member *member)
+{
+    struct hwbx_barrier *barrier = member->barrier;
+    switch (barrier->kind)
+    {
+        case HWBX_BARRIER_HWB:
+            // ordered like the software kinds, the calibration times the same guarantee
+            return hwbx_sync_ordered(member->window, HWBX_ORDER_FULL, &member->policy, NULL);
+        case HWBX_BARRIER_CENTRAL:
+            central_wait((struct hwbx_swb *)barrier->sw, barrier->num_threads, member->rank);
+            break;
+        case HWBX_BARRIER_DISSEMINATION:
+            dissemination_wait((struct hwbx_swb *)barrier->sw, barrier->num_threads, member->rank);
+            break;
+        case HWBX_BARRIER_TREE:
+            tree_wait((struct hwbx_swb *)barrier->sw, barrier->num_threads, member->rank);
+            break;
+        default:
+            return -EINVAL;
+    }
+    return 0;
+}
@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "hwbx.h"
+#include "hwbx_sysreg.h"
+
+/*
+ * Allreduce and vote on top of a single hardware barrier episode. The slots are
+ * written only by their owner and read by all threads after the barrier. A slot of
+ * parity p is written again two collectives later, which is only possible after
+ * every thread arrived at the barrier of the collective in between and therefore
+ * finished reading.
+ */
+
+union hwbx_coll_slot {
+    double val[HWBX_COLL_MAX_COUNT];
+    int flag;
+    unsigned char data[HWBX_COLL_SLOT_SIZE];
+} __attribute__((aligned(HWBX_COLL_SLOT_SIZE)));
+
+static inline union hwbx_coll_slot *coll_slots(const struct hwbx_coll_member *member)
+{
+    union hwbx_coll_slot *slots = (union hwbx_coll_slot *)member->coll->slots;
+    return &slots[member->parity * member->coll->num_threads];
+}
+
+int hwbx_coll_init(struct hwbx_coll *coll, int num_threads)
+{
+    void *slots = NULL;
+    size_t size = 0;
+    if ((!coll) || num_threads <= 0)
+    {
+        return -EINVAL;
+    }
+    size = 2 * (size_t)num_threads * sizeof(union hwbx_coll_slot);
+    if (posix_memalign(&slots, HWBX_COLL_SLOT_SIZE, size) != 0)
+    {
+        return -ENOMEM;
+    }
+    memset(slots, 0, size);
+    coll->num_threads = num_threads;
+    coll->slots = slots;
+    return 0;
+}
+
+void hwbx_coll_free(struct hwbx_coll *coll)
+{
+    if (coll)
+    {
+        free(coll->slots);
+        coll->slots = NULL;
+        coll->num_threads = 0;
+    }
+}
+
+int hwbx_coll_join(struct hwbx_coll *coll, int rank, int window, const struct hwbx_wait_policy *policy, struct hwbx_coll_member *member)
+{
+    // a team of a single thread has no blade and needs none
+    if ((!coll) || (!coll->slots) || (!member) || rank < 0 || rank >= coll->num_threads ||
+        (window < 0 && coll->num_threads > 1) || window >= HWBX_NUM_WINDOWS)
+    {
+        return -EINVAL;
+    }
+    memset(member, 0, sizeof(struct hwbx_coll_member));
+    member->coll = coll;
+    member->rank = rank;
+    member->window = window;
+    member->parity = 0;
+    if (policy)
+    {
+        member->policy = *policy;
+    }
+    else
+    {
+        hwbx_wait_policy_from_env(&member->policy);
+    }
+    return 0;
+}
+
+// Publish the own slot and wait for all other threads of the team
+static int coll_sync(struct hwbx_coll_member *member)
+{
+    if (member->window < 0)
+    {
+        return 0;
+    }
+    return hwbx_sync_ordered(member->window, HWBX_ORDER_FULL, &member->policy, &member->stats);
+}
+
+// The loops over the elements of a slot are vectorized, the slots are read in rank
+// order so that all threads compute the same rounding.
+static void combine_sum(const union hwbx_coll_slot *slots, int num_threads, double *out, int count)
+{
+    int t = 0;
+    int i = 0;
+    double acc[HWBX_COLL_MAX_COUNT];
+    memcpy(acc, slots[0].val, count * sizeof(double));
+    for (t = 1; t < num_threads; t++)
+    {
+        const double *val = slots[t].val;
+        for (i = 0; i < count; i++)
+        {
+            acc[i] += val[i];
+        }
+    }
+    memcpy(out, acc, count * sizeof(double));
+}
+
+static void combine_min(const union hwbx_coll_slot *slots, int num_threads, double *out, int count)
+{
+    int t = 0;
+    int i = 0;
+    double acc[HWBX_COLL_MAX_COUNT];
+    memcpy(acc, slots[0].val, count * sizeof(double));
+    for (t = 1; t < num_threads; t++)
+    {
+        const double *val = slots[t].val;
+        for (i = 0; i < count; i++)
+        {
+            acc[i] = (val[i] < acc[i] ? val[i] : acc[i]);
+        }
+    }
+    memcpy(out, acc, count * sizeof(double));
+}
+
+static void combine_max(const union hwbx_coll_slot *slots, int num_threads, double *out, int count)
+{
+    int t = 0;
+    int i = 0;
+    double acc[HWBX_COLL_MAX_COUNT];
+    memcpy(acc, slots[0].val, count * sizeof(double));
+    for (t = 1; t < num_threads; t++)
+    {
+        const double *val = slots[t].val;
+        for (i = 0; i < count; i++)
+        {
+            acc[i] = (val[i] > acc[i] ? val[i] : acc[i]);
+        }
+    }
+    memcpy(out, acc, count * sizeof(double));
+}
+
+int hwbx_allreduce(struct hwbx_coll_member *member, enum hwbx_reduce_op op, const double *in, double *out, int count)
+{
+    int err = 0;
+    union hwbx_coll_slot *slots = NULL;
+
+    if ((!member) || (!member->coll) || (!in) || (!out) || count <= 0 || count > HWBX_COLL_MAX_COUNT)
+    {
+        return -EINVAL;
+    }
+    if (op != HWBX_OP_SUM && op != HWBX_OP_MIN && op != HWBX_OP_MAX)
+    {
+        return -EINVAL;
+    }
+    slots = coll_slots(member);
+    memcpy(slots[member->rank].val, in, count * sizeof(double));
+    err = coll_sync(member);
+    if (err < 0)
+    {
+        return err;
+    }
+    member->parity ^= 1;
+
+    switch (op)
+    {
+        case HWBX_OP_SUM:
+            combine_sum(slots, member->coll->num_threads, out, count);
+            break;
+        case HWBX_OP_MIN:
+            combine_min(slots, member->coll->num_threads, out, count);
+            break;
+        case HWBX_OP_MAX:
+            combine_max(slots, member->coll->num_threads, out, count);
+            break;
+    }
+    return 0;
+}
+
+int hwbx_vote(struct hwbx_coll_member *member, enum hwbx_vote_op op, int flag)
+{
+    int t = 0;
+    int err = 0;
+    int res = 0;
+    union hwbx_coll_slot *slots = NULL;
+
+    if ((!member) || (!member->coll) || (op != HWBX_VOTE_ALL && op != HWBX_VOTE_ANY))
+    {
+        return -EINVAL;
+    }
+    slots = coll_slots(member);
+    slots[member->rank].flag = (flag != 0);
+    err = coll_sync(member);
+    if (err < 0)
+    {
+        return err;
+    }
+    member->parity ^= 1;
+
+    res = (op == HWBX_VOTE_ALL);
+    for (t = 0; t < member->coll->num_threads; t++)
+    {
+        if (op == HWBX_VOTE_ALL)
+        {
+            res &= slots[t].flag;
+        }
+        else
+        {
+            res |= slots[t].flag;
+        }
+    }
+    return res;
+}
+
+int hwbx_publish(struct hwbx_coll_member *member)
+{
+    if ((!member) || (!member->coll))
+    {
+        return -EINVAL;
+    }
+    return coll_sync(member);
+}
+
+int hwbx_bcast(struct hwbx_coll_member *member, int root, void *buf, size_t size)
+{
+    int err = 0;
+    union hwbx_coll_slot *slots = NULL;
+
+    if ((!member) || (!member->coll) || (!buf) || size > HWBX_COLL_SLOT_SIZE ||
+        root < 0 || root >= member->coll->num_threads)
+    {
+        return -EINVAL;
+    }
+    slots = coll_slots(member);
+    if (member->rank == root)
+    {
+        memcpy(slots[root].data, buf, size);
+    }
+    err = coll_sync(member);
+    if (err < 0)
+    {
+        return err;
+    }
+    member->parity ^= 1;
+
+    if (member->rank != root)
+    {
+        memcpy(buf, slots[root].data, size);
+    }
+    return 0;
+}
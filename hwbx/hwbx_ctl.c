@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+
+#include "hwbx.h"
+#include "a64fx_hwb_uapi.h"
+
+/*
+ * Direct wrappers around the blade and window IOCTLs. In contrast to ulib's
+ * barrier descriptors they expose the CMG and blade numbers, which are needed
+ * by the module's extra IOCTLs.
+ */
+
+static int hwbx_bb_ioctl(unsigned long ioc, size_t size, const cpu_set_t *mask, int *cmg, int *bb)
+{
+    int fd = hwbx_dev_fd();
+    struct fujitsu_hwb_ioc_bb_ctl ioc_bb_ctl = {0};
+    if (fd < 0)
+    {
+        return -ENODEV;
+    }
+    ioc_bb_ctl.cmg = (__u8)*cmg;
+    ioc_bb_ctl.bb = (__u8)*bb;
+    ioc_bb_ctl.size = size;
+    ioc_bb_ctl.pemask = (unsigned long *)mask;
+    if (ioctl(fd, ioc, &ioc_bb_ctl) < 0)
+    {
+        return -errno;
+    }
+    *cmg = (int)ioc_bb_ctl.cmg;
+    *bb = (int)ioc_bb_ctl.bb;
+    return 0;
+}
+
+int hwbx_blade_alloc(size_t size, const cpu_set_t *mask, int *cmg, int *bb)
+{
+    if ((!mask) || (!cmg) || (!bb))
+    {
+        return -EINVAL;
+    }
+    *cmg = 0;
+    *bb = 0;
+    return hwbx_bb_ioctl(FUJITSU_HWB_IOC_BB_ALLOC, size, mask, cmg, bb);
+}
+
+int hwbx_blade_resize(int cmg, int bb, size_t size, const cpu_set_t *mask)
+{
+    if (!mask)
+    {
+        return -EINVAL;
+    }
+    return hwbx_bb_ioctl(A64FX_HWB_IOC_BB_RESIZE, size, mask, &cmg, &bb);
+}
+
+int hwbx_blade_free(int cmg, int bb)
+{
+    return hwbx_bb_ioctl(FUJITSU_HWB_IOC_BB_FREE, 0, NULL, &cmg, &bb);
+}
+
+int hwbx_window_assign(int bb, int window)
+{
+    int fd = hwbx_dev_fd();
+    struct fujitsu_hwb_ioc_bw_ctl ioc_bw_ctl = {
+        .bb = (__u8)bb,
+        .window = (__s8)window,
+    };
+    if (fd < 0)
+    {
+        return -ENODEV;
+    }
+    if (ioctl(fd, FUJITSU_HWB_IOC_BW_ASSIGN, &ioc_bw_ctl) < 0)
+    {
+        return -errno;
+    }
+    return (int)ioc_bw_ctl.window;
+}
+
+int hwbx_window_unassign(int bb, int window)
+{
+    int fd = hwbx_dev_fd();
+    struct fujitsu_hwb_ioc_bw_ctl ioc_bw_ctl = {
+        .bb = (__u8)bb,
+        .window = (__s8)window,
+    };
+    if (fd < 0)
+    {
+        return -ENODEV;
+    }
+    if (ioctl(fd, FUJITSU_HWB_IOC_BW_UNASSIGN, &ioc_bw_ctl) < 0)
+    {
+        return -errno;
+    }
+    return 0;
+}
+
+int hwbx_blade_status(int window, int cmg, int bb, struct hwbx_blade_status *status)
+{
+    int i = 0;
+    int fd = hwbx_dev_fd();
+    struct a64fx_hwb_ioc_bb_status ioc_status = {
+        .window = (__s8)window,
+        .cmg = (__u8)cmg,
+        .bb = (__u8)bb,
+    };
+    if (!status)
+    {
+        return -EINVAL;
+    }
+    if (fd < 0)
+    {
+        return -ENODEV;
+    }
+    if (ioctl(fd, A64FX_HWB_IOC_BB_STATUS, &ioc_status) < 0)
+    {
+        return -errno;
+    }
+    status->cmg = (int)ioc_status.cmg;
+    status->bb = (int)ioc_status.bb;
+    status->active = (int)ioc_status.active;
+    status->tgid = (int)ioc_status.tgid;
+    status->bst_mask = ioc_status.bst_mask;
+    status->bst = ioc_status.bst;
+    status->lbsy = ioc_status.lbsy;
+    status->pending = ioc_status.pending;
+    for (i = 0; i < HWBX_MAX_PES; i++)
+    {
+        status->cpu[i] = (int)ioc_status.cpu[i];
+    }
+    return 0;
+}
+
+void hwbx_blade_status_print(FILE *out, const struct hwbx_blade_status *status)
+{
+    int i = 0;
+    fprintf(out, "CMG %d blade %d (active %d, TGID %d): mask %.4x bst %.4x lbsy %u, not arrived: %.4x, CPUs:",
+            status->cmg, status->bb, status->active, status->tgid, status->bst_mask, status->bst,
+            status->lbsy, status->pending);
+    for (i = 0; i < HWBX_MAX_PES; i++)
+    {
+        if (status->pending & (1U << i))
+        {
+            fprintf(out, " %d", status->cpu[i]);
+        }
+    }
+    fprintf(out, "\n");
+}
@@ -0,0 +1,19 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "hwbx.h"
+
+static int hwbx_fd = -1;
+static pthread_once_t hwbx_fd_once = PTHREAD_ONCE_INIT;
+
+static void hwbx_dev_open(void)
+{
+    hwbx_fd = open(HWBX_DEVICE, O_RDWR | O_CLOEXEC);
+}
+
+int hwbx_dev_fd(void)
+{
+    pthread_once(&hwbx_fd_once, hwbx_dev_open);
+    return hwbx_fd;
+}
@@ -0,0 +1,19 @@
+#ifndef HWBX_FAST_H
+#define HWBX_FAST_H
+
+#include "hwbx.h"
+#include "hwbx_sysreg.h"
+
+/*
+ * Inline zero-read arrival for tight loops, see struct hwbx_fast in hwbx.h. The wait
+ * only spins, there is no timeout and no fallback to WFE or blocking.
+ */
+static inline void hwbx_fast_sync(struct hwbx_fast *fast)
+{
+    unsigned long phase = fast->phase;
+    hwbx_write_bst(fast->window, phase);
+    while (hwbx_read_lbsy(fast->window) != phase);
+    fast->phase = phase ^ HWBX_SYNC_MASK;
+}
+
+#endif /* HWBX_FAST_H */
@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+
+#include "hwbx.h"
+
+int hwbx_pipe_alloc(struct hwbx_pipe *pipe, size_t size, const cpu_set_t *mask, int depth)
+{
+    int i = 0;
+    int err = 0;
+    int cmg = 0, bb = 0;
+
+    if ((!pipe) || (!mask) || depth < 1 || depth > HWBX_NUM_WINDOWS)
+    {
+        return -EINVAL;
+    }
+    pipe->cmg = -1;
+    pipe->depth = 0;
+    for (i = 0; i < depth; i++)
+    {
+        err = hwbx_blade_alloc(size, mask, &cmg, &bb);
+        if (err < 0)
+        {
+            hwbx_pipe_free(pipe);
+            return err;
+        }
+        // the mask selects the CMG, all blades end up on the same one
+        if (pipe->cmg >= 0 && cmg != pipe->cmg)
+        {
+            // hwbx_pipe_free() frees on pipe->cmg, this blade is on another one
+            hwbx_blade_free(cmg, bb);
+            hwbx_pipe_free(pipe);
+            return -EINVAL;
+        }
+        pipe->bb[i] = bb;
+        pipe->depth++;
+        pipe->cmg = cmg;
+    }
+    return 0;
+}
+
+int hwbx_pipe_free(struct hwbx_pipe *pipe)
+{
+    int i = 0;
+    int err = 0;
+    int ret = 0;
+    if (!pipe)
+    {
+        return -EINVAL;
+    }
+    for (i = 0; i < pipe->depth; i++)
+    {
+        ret = hwbx_blade_free(pipe->cmg, pipe->bb[i]);
+        if (ret < 0 && err == 0)
+        {
+            err = ret;
+        }
+    }
+    pipe->depth = 0;
+    return err;
+}
+
+int hwbx_pipe_join(const struct hwbx_pipe *pipe, struct hwbx_pipe_member *member)
+{
+    int i = 0;
+    int ret = 0;
+    if ((!pipe) || (!member) || pipe->depth < 1)
+    {
+        return -EINVAL;
+    }
+    member->pipe = pipe;
+    member->next = 0;
+    for (i = 0; i < HWBX_NUM_WINDOWS; i++)
+    {
+        member->window[i] = -1;
+    }
+    for (i = 0; i < pipe->depth; i++)
+    {
+        ret = hwbx_window_assign(pipe->bb[i], -1);
+        if (ret < 0)
+        {
+            hwbx_pipe_leave(member);
+            return ret;
+        }
+        member->window[i] = ret;
+    }
+    return 0;
+}
+
+int hwbx_pipe_leave(struct hwbx_pipe_member *member)
+{
+    int i = 0;
+    int err = 0;
+    int ret = 0;
+    if ((!member) || (!member->pipe))
+    {
+        return -EINVAL;
+    }
+    for (i = 0; i < member->pipe->depth; i++)
+    {
+        if (member->window[i] < 0)
+        {
+            continue;
+        }
+        ret = hwbx_window_unassign(member->pipe->bb[i], member->window[i]);
+        if (ret < 0 && err == 0)
+        {
+            err = ret;
+        }
+        member->window[i] = -1;
+    }
+    return err;
+}
+
+int hwbx_pipe_sync(struct hwbx_pipe_member *member, const struct hwbx_wait_policy *policy, struct hwbx_wait_stats *stats)
+{
+    int err = 0;
+    if ((!member) || (!member->pipe))
+    {
+        return -EINVAL;
+    }
+    err = hwbx_sync_wait(member->window[member->next], policy, stats);
+    if (err < 0)
+    {
+        return err;
+    }
+    member->next++;
+    if (member->next == member->pipe->depth)
+    {
+        member->next = 0;
+    }
+    return 0;
+}
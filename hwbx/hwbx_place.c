@@ -0,0 +1,601 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+
+#include "hwbx.h"
+#include "hwbx_topo.h"
+
+/*
+ * Placement planner, see hwbx.h. All modes first compute the CPU of every thread,
+ * the teams are then formed by the CMGs of these CPUs.
+ */
+
+int hwbx_place_mode_parse(const char *str, enum hwbx_place_mode *mode)
+{
+    if ((!str) || (!mode))
+    {
+        return -EINVAL;
+    }
+    if (strcmp(str, "compact") == 0)
+    {
+        *mode = HWBX_PLACE_COMPACT;
+    }
+    else if (strcmp(str, "balanced") == 0)
+    {
+        *mode = HWBX_PLACE_BALANCED;
+    }
+    else if (strcmp(str, "omp_places") == 0)
+    {
+        *mode = HWBX_PLACE_OMP_PLACES;
+    }
+    else
+    {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+enum hwbx_place_mode hwbx_place_mode_from_env(enum hwbx_place_mode def)
+{
+    enum hwbx_place_mode mode = def;
+    if (hwbx_place_mode_parse(getenv("HWBX_PLACEMENT"), &mode) < 0)
+    {
+        return def;
+    }
+    return mode;
+}
+
+
+/*
+ * OMP_PLACES parser. Supported are explicit place lists with intervals, e.g.
+ * "{0,1,2,3},{4:4}", "{0:4}:12:4", and the abstract names threads, cores
+ * (one place per CPU) and ll_caches, numa_domains (one place per CMG) and
+ * sockets (one place). Exclusions ('!') are not supported.
+ */
+struct hwbx_places {
+    int num;
+    int max;
+    cpu_set_t *sets;
+};
+
+static int places_add(struct hwbx_places *places, const cpu_set_t *set)
+{
+    if (places->num == places->max)
+    {
+        return -E2BIG;
+    }
+    memcpy(&places->sets[places->num], set, sizeof(cpu_set_t));
+    places->num++;
+    return 0;
+}
+
+// Parse "num[:len[:stride]]"
+static int parse_interval(const char **str, int *start, int *len, int *stride)
+{
+    char *end = NULL;
+    *start = (int)strtol(*str, &end, 10);
+    if (end == *str)
+    {
+        return -EINVAL;
+    }
+    *len = 1;
+    *stride = 1;
+    if (*end == ':')
+    {
+        *str = end + 1;
+        *len = (int)strtol(*str, &end, 10);
+        if (end == *str || *len < 1)
+        {
+            return -EINVAL;
+        }
+        if (*end == ':')
+        {
+            *str = end + 1;
+            *stride = (int)strtol(*str, &end, 10);
+            if (end == *str)
+            {
+                return -EINVAL;
+            }
+        }
+    }
+    *str = end;
+    return 0;
+}
+
+// Parse "{res,res,...}"
+static int parse_place(const char **str, cpu_set_t *set)
+{
+    int i = 0;
+    int start = 0, len = 0, stride = 0;
+    CPU_ZERO(set);
+    if (**str != '{')
+    {
+        return -EINVAL;
+    }
+    (*str)++;
+    while (1)
+    {
+        if (parse_interval(str, &start, &len, &stride) < 0)
+        {
+            return -EINVAL;
+        }
+        for (i = 0; i < len; i++)
+        {
+            int cpu = start + i * stride;
+            if (cpu >= 0 && cpu < HWBX_MAX_CPUS)
+            {
+                CPU_SET(cpu, set);
+            }
+        }
+        if (**str == ',')
+        {
+            (*str)++;
+            continue;
+        }
+        if (**str == '}')
+        {
+            (*str)++;
+            return 0;
+        }
+        return -EINVAL;
+    }
+}
+
+static int parse_abstract_places(const char *str, const struct hwbx_topology *topo, const cpu_set_t *allowed, struct hwbx_places *places)
+{
+    int cpu = 0;
+    int cmg = 0;
+    int err = 0;
+    cpu_set_t set;
+
+    if (strncmp(str, "threads", 7) == 0 || strncmp(str, "cores", 5) == 0)
+    {
+        for (cpu = 0; cpu < HWBX_MAX_CPUS && !err; cpu++)
+        {
+            if (CPU_ISSET(cpu, allowed) && topo->cmg[cpu] >= 0)
+            {
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                err = places_add(places, &set);
+            }
+        }
+        return err;
+    }
+    if (strncmp(str, "ll_caches", 9) == 0 || strncmp(str, "numa_domains", 12) == 0)
+    {
+        for (cmg = 0; cmg < HWBX_MAX_CMGS && !err; cmg++)
+        {
+            CPU_ZERO(&set);
+            for (cpu = 0; cpu < HWBX_MAX_CPUS; cpu++)
+            {
+                if (topo->cmg[cpu] == cmg)
+                {
+                    CPU_SET(cpu, &set);
+                }
+            }
+            if (CPU_COUNT(&set) > 0)
+            {
+                err = places_add(places, &set);
+            }
+        }
+        return err;
+    }
+    if (strncmp(str, "sockets", 7) == 0)
+    {
+        CPU_ZERO(&set);
+        for (cpu = 0; cpu < HWBX_MAX_CPUS; cpu++)
+        {
+            if (topo->cmg[cpu] >= 0)
+            {
+                CPU_SET(cpu, &set);
+            }
+        }
+        return places_add(places, &set);
+    }
+    return -EINVAL;
+}
+
+static int parse_omp_places(const char *str, const struct hwbx_topology *topo, const cpu_set_t *allowed, struct hwbx_places *places)
+{
+    int i = 0, j = 0;
+    int err = 0;
+    int len = 0, stride = 0;
+    char *end = NULL;
+    cpu_set_t set, shifted;
+
+    if (!str)
+    {
+        return parse_abstract_places("cores", topo, allowed, places);
+    }
+    while (isspace((unsigned char)*str))
+    {
+        str++;
+    }
+    if (isalpha((unsigned char)*str))
+    {
+        return parse_abstract_places(str, topo, allowed, places);
+    }
+    while (*str != '\0')
+    {
+        err = parse_place(&str, &set);
+        if (err < 0)
+        {
+            return err;
+        }
+        // place interval "{...}:len[:stride]"
+        len = 1;
+        stride = 0;
+        if (*str == ':')
+        {
+            str++;
+            len = (int)strtol(str, &end, 10);
+            if (end == str || len < 1)
+            {
+                return -EINVAL;
+            }
+            str = end;
+            stride = 1;
+            if (*str == ':')
+            {
+                str++;
+                stride = (int)strtol(str, &end, 10);
+                if (end == str)
+                {
+                    return -EINVAL;
+                }
+                str = end;
+            }
+        }
+        for (i = 0; i < len; i++)
+        {
+            CPU_ZERO(&shifted);
+            for (j = 0; j < HWBX_MAX_CPUS; j++)
+            {
+                int cpu = j + i * stride;
+                if (CPU_ISSET(j, &set) && cpu >= 0 && cpu < HWBX_MAX_CPUS)
+                {
+                    CPU_SET(cpu, &shifted);
+                }
+            }
+            err = places_add(places, &shifted);
+            if (err < 0)
+            {
+                return err;
+            }
+        }
+        if (*str == ',')
+        {
+            str++;
+        }
+        else if (*str != '\0')
+        {
+            return -EINVAL;
+        }
+    }
+    return (places->num > 0 ? 0 : -EINVAL);
+}
+
+
+// Threads are bound close to the places: with more places than threads, thread i
+// uses place i, otherwise consecutive threads share a place. Each thread gets an own
+// CPU of its place.
+static int place_omp_places(struct hwbx_plan *plan, int num_threads, const struct hwbx_topology *topo, const cpu_set_t *allowed)
+{
+    int t = 0;
+    int cpu = 0;
+    int err = 0;
+    int place = 0;
+    cpu_set_t used;
+    struct hwbx_places places = {0};
+
+    places.max = HWBX_MAX_CPUS;
+    places.sets = malloc(places.max * sizeof(cpu_set_t));
+    if (!places.sets)
+    {
+        return -ENOMEM;
+    }
+    err = parse_omp_places(getenv("OMP_PLACES"), topo, allowed, &places);
+    if (err < 0)
+    {
+        free(places.sets);
+        return err;
+    }
+    CPU_ZERO(&used);
+    for (t = 0; t < num_threads; t++)
+    {
+        place = (num_threads <= places.num ? t : (int)((long)t * places.num / num_threads));
+        for (cpu = 0; cpu < HWBX_MAX_CPUS; cpu++)
+        {
+            if (CPU_ISSET(cpu, &places.sets[place]) && CPU_ISSET(cpu, allowed) &&
+                topo->cmg[cpu] >= 0 && !CPU_ISSET(cpu, &used))
+            {
+                break;
+            }
+        }
+        if (cpu == HWBX_MAX_CPUS)
+        {
+            // the place has fewer usable CPUs than threads bound to it
+            free(places.sets);
+            return -EINVAL;
+        }
+        CPU_SET(cpu, &used);
+        plan->cpu[t] = cpu;
+    }
+    free(places.sets);
+    return 0;
+}
+
+// Threads in CMG order, for balanced with counts[cmg] threads per CMG
+static void place_by_cmg(struct hwbx_plan *plan, const int *counts, const struct hwbx_topology *topo, const cpu_set_t *allowed)
+{
+    int t = 0;
+    int cmg = 0;
+    int cpu = 0;
+    int placed = 0;
+    for (cmg = 0; cmg < HWBX_MAX_CMGS; cmg++)
+    {
+        placed = 0;
+        for (cpu = 0; cpu < HWBX_MAX_CPUS && placed < counts[cmg]; cpu++)
+        {
+            if (CPU_ISSET(cpu, allowed) && topo->cmg[cpu] == cmg)
+            {
+                plan->cpu[t++] = cpu;
+                placed++;
+            }
+        }
+    }
+}
+
+int hwbx_plan_create(struct hwbx_plan *plan, int num_threads, enum hwbx_place_mode mode)
+{
+    int i = 0;
+    int t = 0;
+    int cpu = 0;
+    int cmg = 0;
+    int err = 0;
+    int total = 0;
+    int counts[HWBX_MAX_CMGS] = {0};
+    int capacity[HWBX_MAX_CMGS] = {0};
+    cpu_set_t allowed;
+    struct hwbx_topology *topo = NULL;
+
+    if ((!plan) || num_threads < 1 || num_threads > HWBX_MAX_CPUS)
+    {
+        return -EINVAL;
+    }
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) < 0)
+    {
+        return -errno;
+    }
+    topo = malloc(sizeof(struct hwbx_topology));
+    if (!topo)
+    {
+        return -ENOMEM;
+    }
+    err = hwbx_topo_read(topo);
+    if (err < 0)
+    {
+        goto out;
+    }
+    for (cpu = 0; cpu < HWBX_MAX_CPUS; cpu++)
+    {
+        // the module keeps the entries of offline CPUs
+        if (!topo->online[cpu])
+        {
+            CPU_CLR(cpu, &allowed);
+        }
+        if (CPU_ISSET(cpu, &allowed) && topo->cmg[cpu] >= 0)
+        {
+            capacity[topo->cmg[cpu]]++;
+            total++;
+        }
+    }
+    if (num_threads > total)
+    {
+        err = -EINVAL;
+        goto out;
+    }
+
+    memset(plan, 0, sizeof(struct hwbx_plan));
+    plan->num_threads = num_threads;
+    switch (mode)
+    {
+        case HWBX_PLACE_COMPACT:
+            for (cmg = 0, t = num_threads; cmg < HWBX_MAX_CMGS; cmg++)
+            {
+                counts[cmg] = (t < capacity[cmg] ? t : capacity[cmg]);
+                t -= counts[cmg];
+            }
+            place_by_cmg(plan, counts, topo, &allowed);
+            break;
+        case HWBX_PLACE_BALANCED:
+            // the next thread goes to the CMG with the fewest threads and free CPUs
+            for (t = 0; t < num_threads; t++)
+            {
+                int min = -1;
+                for (cmg = 0; cmg < HWBX_MAX_CMGS; cmg++)
+                {
+                    if (counts[cmg] < capacity[cmg] && (min < 0 || counts[cmg] < counts[min]))
+                    {
+                        min = cmg;
+                    }
+                }
+                counts[min]++;
+            }
+            place_by_cmg(plan, counts, topo, &allowed);
+            break;
+        case HWBX_PLACE_OMP_PLACES:
+            err = place_omp_places(plan, num_threads, topo, &allowed);
+            if (err < 0)
+            {
+                goto out;
+            }
+            break;
+        default:
+            err = -EINVAL;
+            goto out;
+    }
+
+    // one team per CMG in the order of the first thread
+    for (t = 0; t < num_threads; t++)
+    {
+        cmg = topo->cmg[plan->cpu[t]];
+        for (i = 0; i < plan->num_teams; i++)
+        {
+            if (plan->teams[i].cmg == cmg)
+            {
+                break;
+            }
+        }
+        if (i == plan->num_teams)
+        {
+            plan->teams[i].cmg = cmg;
+            plan->teams[i].bb = -1;
+            plan->teams[i].num_threads = 0;
+            CPU_ZERO(&plan->teams[i].cpus);
+            plan->num_teams++;
+        }
+        plan->team[t] = i;
+        plan->teams[i].num_threads++;
+        CPU_SET(plan->cpu[t], &plan->teams[i].cpus);
+    }
+out:
+    free(topo);
+    return err;
+}
+
+// A blade needs at least two CPUs, single-thread teams stay without blade
+int hwbx_plan_alloc(struct hwbx_plan *plan)
+{
+    int i = 0;
+    int err = 0;
+    int cmg = 0, bb = 0;
+    struct hwbx_team *team = NULL;
+
+    for (i = 0; i < plan->num_teams; i++)
+    {
+        team = &plan->teams[i];
+        if (team->num_threads < 2)
+        {
+            continue;
+        }
+        err = hwbx_blade_alloc(sizeof(cpu_set_t), &team->cpus, &cmg, &bb);
+        if (err < 0)
+        {
+            hwbx_plan_free(plan);
+            return err;
+        }
+        if (cmg != team->cmg)
+        {
+            // not the team's blade, hwbx_plan_free() would free it on the wrong CMG
+            hwbx_blade_free(cmg, bb);
+            hwbx_plan_free(plan);
+            return -EINVAL;
+        }
+        team->bb = bb;
+    }
+    return 0;
+}
+
+int hwbx_plan_join(const struct hwbx_plan *plan, int thread, struct hwbx_member *member)
+{
+    int i = 0;
+    int ret = 0;
+    cpu_set_t set;
+    const struct hwbx_team *team = NULL;
+
+    if ((!plan) || (!member) || thread < 0 || thread >= plan->num_threads)
+    {
+        return -EINVAL;
+    }
+    team = &plan->teams[plan->team[thread]];
+    member->thread = thread;
+    member->team = plan->team[thread];
+    member->rank = 0;
+    for (i = 0; i < thread; i++)
+    {
+        if (plan->team[i] == member->team)
+        {
+            member->rank++;
+        }
+    }
+    member->cmg = team->cmg;
+    member->bb = team->bb;
+    member->cpu = plan->cpu[thread];
+    member->window = -1;
+
+    // the module only assigns windows to pinned threads
+    CPU_ZERO(&set);
+    CPU_SET(member->cpu, &set);
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &set) < 0)
+    {
+        return -errno;
+    }
+    if (team->bb >= 0)
+    {
+        ret = hwbx_window_assign(team->bb, -1);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        member->window = ret;
+    }
+    return 0;
+}
+
+int hwbx_plan_leave(const struct hwbx_plan *plan, struct hwbx_member *member)
+{
+    int err = 0;
+    if ((!plan) || (!member))
+    {
+        return -EINVAL;
+    }
+    if (member->bb >= 0 && member->window >= 0)
+    {
+        err = hwbx_window_unassign(member->bb, member->window);
+        member->window = -1;
+    }
+    return err;
+}
+
+int hwbx_plan_free(struct hwbx_plan *plan)
+{
+    int i = 0;
+    int err = 0;
+    int ret = 0;
+    for (i = 0; i < plan->num_teams; i++)
+    {
+        if (plan->teams[i].bb >= 0)
+        {
+            ret = hwbx_blade_free(plan->teams[i].cmg, plan->teams[i].bb);
+            if (ret < 0)
+            {
+                err = ret;
+            }
+            plan->teams[i].bb = -1;
+        }
+    }
+    return err;
+}
+
+void hwbx_plan_print(FILE *out, const struct hwbx_plan *plan)
+{
+    int i = 0;
+    int t = 0;
+    for (i = 0; i < plan->num_teams; i++)
+    {
+        fprintf(out, "Team %d: CMG %d Blade %d Threads %d CPUs", i, plan->teams[i].cmg, plan->teams[i].bb, plan->teams[i].num_threads);
+        for (t = 0; t < plan->num_threads; t++)
+        {
+            if (plan->team[t] == i)
+            {
+                fprintf(out, " %d", plan->cpu[t]);
+            }
+        }
+        fprintf(out, "\n");
+    }
+}
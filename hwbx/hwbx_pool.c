@@ -0,0 +1,415 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "hwbx.h"
+#include "hwbx_sysreg.h"
+
+/*
+ * Thread pool, see hwbx.h. A mailbox is written by one thread only (the caller for
+ * the leaders and its own team, the leader for the rest of a team) and polled by its
+ * owner. The next step is posted after the pool-wide barrier of the previous one, so
+ * the owner has finished with the mailbox when it is overwritten. Every step has
+ * exactly one leader barrier, its sense is the parity of the step number.
+ */
+
+#define HWBX_POOL_LINE 256
+
+enum pool_cmd {
+    POOL_RUN = 0,
+    POOL_FOR,
+    POOL_EXIT,
+};
+
+struct pool_mailbox {
+    // step number, written last with release semantics
+    unsigned long seq;
+    int cmd;
+    int size;
+    union {
+        hwbx_pool_func run;
+        hwbx_pool_for_func loop;
+    } func;
+    void *arg;
+    long begin;
+    long end;
+    unsigned char data[HWBX_POOL_ARG_SIZE];
+} __attribute__((aligned(HWBX_POOL_LINE)));
+
+struct pool_shared {
+    // leader barrier
+    unsigned int count;
+    unsigned int sense;
+    // first error of the current step
+    int error;
+    // started workers that joined the plan
+    int ready;
+    // lowest thread of each team
+    int leader[HWBX_MAX_CMGS];
+    struct pool_mailbox mailbox[];
+};
+
+struct pool_worker {
+    struct hwbx_pool *pool;
+    int thread;
+    pthread_t tid;
+};
+
+static inline struct pool_shared *pool_shared(const struct hwbx_pool *pool)
+{
+    return (struct pool_shared *)pool->shared;
+}
+
+static inline int is_leader(const struct hwbx_pool *pool, int thread)
+{
+    return pool_shared(pool)->leader[pool->plan.team[thread]] == thread;
+}
+
+static void set_error(struct pool_shared *shared, int err)
+{
+    int expected = 0;
+    if (err < 0)
+    {
+        __atomic_compare_exchange_n(&shared->error, &expected, err, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+}
+
+static void post(struct pool_mailbox *to, const struct pool_mailbox *from)
+{
+    to->cmd = from->cmd;
+    to->size = from->size;
+    to->func = from->func;
+    to->arg = from->arg;
+    to->begin = from->begin;
+    to->end = from->end;
+    memcpy(to->data, from->data, from->size);
+    __atomic_store_n(&to->seq, from->seq, __ATOMIC_RELEASE);
+}
+
+// The caller posts to the other leaders first, they forward in parallel to its own team
+static void post_caller(struct hwbx_pool *pool)
+{
+    int t = 0;
+    struct pool_shared *shared = pool_shared(pool);
+    for (t = 1; t < pool->num_workers + 1; t++)
+    {
+        if (pool->plan.team[t] != pool->plan.team[0] && is_leader(pool, t))
+        {
+            post(&shared->mailbox[t], &shared->mailbox[0]);
+        }
+    }
+    for (t = 1; t < pool->num_workers + 1; t++)
+    {
+        if (pool->plan.team[t] == pool->plan.team[0])
+        {
+            post(&shared->mailbox[t], &shared->mailbox[0]);
+        }
+    }
+    // the workers past spin_iters wait in WFE
+    hwbx_sev();
+}
+
+static void post_leader(struct hwbx_pool *pool, int leader)
+{
+    int t = 0;
+    struct pool_shared *shared = pool_shared(pool);
+    for (t = leader + 1; t < pool->num_workers + 1; t++)
+    {
+        if (pool->plan.team[t] == pool->plan.team[leader])
+        {
+            post(&shared->mailbox[t], &shared->mailbox[leader]);
+        }
+    }
+    hwbx_sev();
+}
+
+// Poll the own mailbox for a step after last, WFE between the polls after spin_iters.
+// The posts send an event, the timer event stream bounds a missed one.
+static unsigned long wait_mailbox(const struct hwbx_pool *pool, struct pool_mailbox *box, unsigned long last)
+{
+    unsigned long i = 0;
+    unsigned long seq = 0;
+    while ((seq = __atomic_load_n(&box->seq, __ATOMIC_ACQUIRE)) == last)
+    {
+        if (i < pool->policy.spin_iters)
+        {
+            i++;
+        }
+        else
+        {
+            hwbx_wfe();
+        }
+    }
+    return seq;
+}
+
+static void execute(const struct hwbx_pool *pool, struct pool_mailbox *box, int thread)
+{
+    long n = 0, begin = 0, end = 0;
+    int num_threads = pool->plan.num_threads;
+    void *arg = (box->size > 0 ? (void *)box->data : box->arg);
+
+    if (box->cmd == POOL_RUN)
+    {
+        box->func.run(arg, thread, num_threads);
+    }
+    else if (box->cmd == POOL_FOR)
+    {
+        n = box->end - box->begin;
+        begin = box->begin + n * thread / num_threads;
+        end = box->begin + n * (thread + 1) / num_threads;
+        if (begin < end)
+        {
+            box->func.loop(arg, begin, end, thread);
+        }
+    }
+}
+
+// End of a step: hardware barrier of the team, then the leaders meet
+static int step_end(struct hwbx_pool *pool, const struct hwbx_member *member, unsigned long seq)
+{
+    int err = 0;
+    unsigned int sense = (unsigned int)(seq & 1);
+    struct pool_shared *shared = pool_shared(pool);
+
+    if (member->window >= 0)
+    {
+        err = hwbx_sync_ordered(member->window, HWBX_ORDER_FULL, &pool->policy, NULL);
+    }
+    if (pool->plan.num_teams > 1 && is_leader(pool, member->thread))
+    {
+        if (__atomic_add_fetch(&shared->count, 1, __ATOMIC_ACQ_REL) == (unsigned int)pool->plan.num_teams)
+        {
+            shared->count = 0;
+            __atomic_store_n(&shared->sense, sense, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            while (__atomic_load_n(&shared->sense, __ATOMIC_ACQUIRE) != sense);
+        }
+    }
+    return err;
+}
+
+static void *worker_main(void *data)
+{
+    struct pool_worker *worker = (struct pool_worker *)data;
+    struct hwbx_pool *pool = worker->pool;
+    struct pool_shared *shared = pool_shared(pool);
+    struct pool_mailbox *box = &shared->mailbox[worker->thread];
+    struct hwbx_member member;
+    unsigned long seq = 0;
+    int leader = is_leader(pool, worker->thread);
+    int err = 0;
+
+    err = hwbx_plan_join(&pool->plan, worker->thread, &member);
+    set_error(shared, err);
+    __atomic_add_fetch(&shared->ready, 1, __ATOMIC_RELEASE);
+
+    for (;;)
+    {
+        seq = wait_mailbox(pool, box, seq);
+        if (leader)
+        {
+            post_leader(pool, worker->thread);
+        }
+        if (box->cmd == POOL_EXIT)
+        {
+            break;
+        }
+        execute(pool, box, worker->thread);
+        set_error(shared, step_end(pool, &member, seq));
+    }
+    if (err == 0)
+    {
+        hwbx_plan_leave(&pool->plan, &member);
+    }
+    return NULL;
+}
+
+// Post the exit to the started workers and release all resources of the pool
+static int pool_stop(struct hwbx_pool *pool)
+{
+    int i = 0;
+    int err = 0;
+    int ret = 0;
+    struct pool_shared *shared = pool_shared(pool);
+    struct pool_worker *workers = (struct pool_worker *)pool->workers;
+
+    if (pool->num_workers > 0)
+    {
+        shared->mailbox[0].cmd = POOL_EXIT;
+        shared->mailbox[0].size = 0;
+        shared->mailbox[0].seq = ++pool->step;
+        post_caller(pool);
+        for (i = 0; i < pool->num_workers; i++)
+        {
+            pthread_join(workers[i].tid, NULL);
+        }
+        pool->num_workers = 0;
+    }
+    if (pool->member.window >= 0)
+    {
+        err = hwbx_plan_leave(&pool->plan, &pool->member);
+    }
+    ret = hwbx_plan_free(&pool->plan);
+    if (ret < 0 && err == 0)
+    {
+        err = ret;
+    }
+    sched_setaffinity(0, sizeof(cpu_set_t), &pool->affinity);
+    free(pool->workers);
+    free(pool->shared);
+    pool->workers = NULL;
+    pool->shared = NULL;
+    return err;
+}
+
+int hwbx_pool_create(struct hwbx_pool *pool, int num_threads, enum hwbx_place_mode mode)
+{
+    int t = 0;
+    int err = 0;
+    int ret = 0;
+    size_t size = 0;
+    void *mem = NULL;
+    struct pool_shared *shared = NULL;
+    struct pool_worker *workers = NULL;
+
+    if ((!pool) || num_threads < 1 || num_threads > HWBX_MAX_CPUS)
+    {
+        return -EINVAL;
+    }
+    memset(pool, 0, sizeof(struct hwbx_pool));
+    pool->member.window = -1;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &pool->affinity) < 0)
+    {
+        return -errno;
+    }
+    err = hwbx_plan_create(&pool->plan, num_threads, mode);
+    if (err < 0)
+    {
+        return err;
+    }
+    err = hwbx_plan_alloc(&pool->plan);
+    if (err < 0)
+    {
+        return err;
+    }
+    hwbx_wait_policy_from_env(&pool->policy);
+
+    size = sizeof(struct pool_shared) + (size_t)num_threads * sizeof(struct pool_mailbox);
+    workers = calloc(num_threads, sizeof(struct pool_worker));
+    if (posix_memalign(&mem, HWBX_POOL_LINE, size) != 0 || (!workers))
+    {
+        free(mem);
+        free(workers);
+        hwbx_plan_free(&pool->plan);
+        return -ENOMEM;
+    }
+    memset(mem, 0, size);
+    shared = (struct pool_shared *)mem;
+    for (t = num_threads - 1; t >= 0; t--)
+    {
+        shared->leader[pool->plan.team[t]] = t;
+    }
+    pool->shared = mem;
+    pool->workers = workers;
+
+    err = hwbx_plan_join(&pool->plan, 0, &pool->member);
+    for (t = 1; err == 0 && t < num_threads; t++)
+    {
+        workers[t - 1].pool = pool;
+        workers[t - 1].thread = t;
+        ret = pthread_create(&workers[t - 1].tid, NULL, worker_main, &workers[t - 1]);
+        if (ret != 0)
+        {
+            err = -ret;
+            break;
+        }
+        pool->num_workers++;
+    }
+    // a worker only gets the exit if its leader was started, the leader is the
+    // lowest thread of the team
+    while (__atomic_load_n(&shared->ready, __ATOMIC_ACQUIRE) < pool->num_workers)
+    {
+        sched_yield();
+    }
+    if (err == 0)
+    {
+        err = shared->error;
+    }
+    if (err < 0)
+    {
+        pool_stop(pool);
+        return err;
+    }
+    return 0;
+}
+
+int hwbx_pool_destroy(struct hwbx_pool *pool)
+{
+    if ((!pool) || (!pool->shared))
+    {
+        return -EINVAL;
+    }
+    return pool_stop(pool);
+}
+
+static int pool_step(struct hwbx_pool *pool, struct pool_mailbox *box)
+{
+    int err = 0;
+    struct pool_shared *shared = pool_shared(pool);
+
+    box->seq = ++pool->step;
+    post_caller(pool);
+    execute(pool, box, 0);
+    err = step_end(pool, &pool->member, box->seq);
+    if (err == 0)
+    {
+        err = __atomic_exchange_n(&shared->error, 0, __ATOMIC_ACQ_REL);
+    }
+    else
+    {
+        __atomic_store_n(&shared->error, 0, __ATOMIC_RELAXED);
+    }
+    return err;
+}
+
+int hwbx_pool_run(struct hwbx_pool *pool, hwbx_pool_func func, void *arg, size_t size)
+{
+    struct pool_mailbox *box = NULL;
+    if ((!pool) || (!pool->shared) || (!func) || size > HWBX_POOL_ARG_SIZE || (size > 0 && (!arg)))
+    {
+        return -EINVAL;
+    }
+    box = &pool_shared(pool)->mailbox[0];
+    box->cmd = POOL_RUN;
+    box->size = (int)size;
+    box->func.run = func;
+    box->arg = arg;
+    if (size > 0)
+    {
+        memcpy(box->data, arg, size);
+    }
+    return pool_step(pool, box);
+}
+
+int hwbx_pool_for(struct hwbx_pool *pool, long begin, long end, hwbx_pool_for_func func, void *arg)
+{
+    struct pool_mailbox *box = NULL;
+    if ((!pool) || (!pool->shared) || (!func) || end < begin)
+    {
+        return -EINVAL;
+    }
+    box = &pool_shared(pool)->mailbox[0];
+    box->cmd = POOL_FOR;
+    box->size = 0;
+    box->func.loop = func;
+    box->arg = arg;
+    box->begin = begin;
+    box->end = end;
+    return pool_step(pool, box);
+}
@@ -0,0 +1,94 @@
+#ifndef HWBX_SYSREG_H
+#define HWBX_SYSREG_H
+
+#include "hwbx.h"
+
+/*
+ * EL0 accessors for the per-PE barrier window registers. The kernel module enables
+ * EL0 access (IMP_BARRIER_CTRL_EL1.EL0AE) on all CPUs, a window has to be assigned
+ * before its BST_SYNC register carries any meaning.
+ *
+ * Reading IMP_BARRIER_BST_SYNC_Wn_EL0 returns the blade's LBSY, writing it sets the
+ * PE's BST bit.
+ */
+
+#define HWBX_SYNC_MASK 0x1UL
+
+static inline unsigned long hwbx_read_lbsy(int window)
+{
+    unsigned long val = 0;
+    switch (window)
+    {
+        case 0:
+            asm volatile ("MRS %0, S3_3_C15_C15_0" : "=r" (val));
+            break;
+        case 1:
+            asm volatile ("MRS %0, S3_3_C15_C15_1" : "=r" (val));
+            break;
+        case 2:
+            asm volatile ("MRS %0, S3_3_C15_C15_2" : "=r" (val));
+            break;
+        case 3:
+            asm volatile ("MRS %0, S3_3_C15_C15_3" : "=r" (val));
+            break;
+    }
+    return val & HWBX_SYNC_MASK;
+}
+
+static inline void hwbx_write_bst(int window, unsigned long bst)
+{
+    unsigned long val = bst & HWBX_SYNC_MASK;
+    switch (window)
+    {
+        case 0:
+            asm volatile ("MSR S3_3_C15_C15_0, %0" :: "r" (val));
+            break;
+        case 1:
+            asm volatile ("MSR S3_3_C15_C15_1, %0" :: "r" (val));
+            break;
+        case 2:
+            asm volatile ("MSR S3_3_C15_C15_2, %0" :: "r" (val));
+            break;
+        case 3:
+            asm volatile ("MSR S3_3_C15_C15_3, %0" :: "r" (val));
+            break;
+    }
+}
+
+// Wait for an event. The arm64 kernel enables the generic timer event stream, so WFE
+// returns after at most ~100us even if nothing else generates an event.
+static inline void hwbx_wfe(void)
+{
+    asm volatile ("wfe" ::: "memory");
+}
+
+// Wake up the PEs waiting in WFE. The preceding stores are completed first, so a
+// woken PE sees them when it polls again.
+static inline void hwbx_sev(void)
+{
+    asm volatile ("dsb ishst\n\tsev" ::: "memory");
+}
+
+// Complete all memory accesses before the following BST write. Writes to system
+// registers are not ordered with normal stores, so data handed over with a barrier
+// episode needs a DSB, a DMB is not sufficient.
+static inline void hwbx_dsb_ish(void)
+{
+    asm volatile ("dsb ish" ::: "memory");
+}
+
+// Only stores before the following BST write are complete, loads may still be
+// outstanding
+static inline void hwbx_dsb_ishst(void)
+{
+    asm volatile ("dsb ishst" ::: "memory");
+}
+
+// Loads after the LBSY poll must not be executed before the poll observed the
+// completion. The conditional branch of the poll loop plus an ISB prevents this.
+static inline void hwbx_isb(void)
+{
+    asm volatile ("isb" ::: "memory");
+}
+
+#endif /* HWBX_SYSREG_H */
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "hwbx.h"
+#include "a64fx_hwb_uapi.h"
+#include "hwbx_topo.h"
+
+#define HWBX_TOPOLOGY_BIN "/sys/class/misc/fujitsu_hwb/topology_bin"
+#define HWBX_CORE_MAP "/sys/class/misc/fujitsu_hwb/CMG%d/core_map"
+
+static struct hwbx_topology *hwbx_topo = NULL;
+static int hwbx_topo_err = 0;
+static pthread_once_t hwbx_topo_once = PTHREAD_ONCE_INIT;
+
+static void topo_clear(struct hwbx_topology *topo)
+{
+    int i = 0;
+    memset(topo, 0, sizeof(struct hwbx_topology));
+    for (i = 0; i < HWBX_MAX_CPUS; i++)
+    {
+        topo->cmg[i] = -1;
+        topo->ppe[i] = -1;
+    }
+}
+
+// One read of the binary export, returns the number of known CPUs
+static int topo_read_bin(struct hwbx_topology *topo)
+{
+    int cpu = 0;
+    int cmg = 0;
+    int found = 0;
+    struct a64fx_hwb_topology bin;
+    FILE *fp = fopen(HWBX_TOPOLOGY_BIN, "rb");
+    if (!fp)
+    {
+        return -errno;
+    }
+    if (fread(&bin, sizeof(bin), 1, fp) != 1 || bin.version != A64FX_HWB_TOPO_VERSION)
+    {
+        fclose(fp);
+        return -EIO;
+    }
+    fclose(fp);
+    for (cmg = 0; cmg < HWBX_MAX_CMGS && cmg < (int)bin.num_cmgs && cmg < A64FX_HWB_TOPO_CMGS; cmg++)
+    {
+        topo->num_pes[cmg] = bin.cmg[cmg].num_pes;
+        topo->num_blades[cmg] = bin.cmg[cmg].num_blades;
+        topo->num_windows[cmg] = bin.cmg[cmg].num_windows;
+    }
+    for (cpu = 0; cpu < (int)bin.num_cpus && cpu < A64FX_HWB_TOPO_CPUS && cpu < HWBX_MAX_CPUS; cpu++)
+    {
+        if (bin.cpu[cpu].cmg >= 0 && bin.cpu[cpu].cmg < HWBX_MAX_CMGS)
+        {
+            topo->cmg[cpu] = bin.cpu[cpu].cmg;
+            topo->ppe[cpu] = bin.cpu[cpu].ppe;
+            topo->online[cpu] = bin.cpu[cpu].online;
+            found++;
+        }
+    }
+    return found;
+}
+
+// Text files of the modules without topology_bin, all listed CPUs count as online
+static int topo_read_core_map(struct hwbx_topology *topo)
+{
+    int cmg = 0;
+    int cpu = 0, ppe = 0;
+    int found = 0;
+    char path[64];
+    FILE *fp = NULL;
+
+    for (cmg = 0; cmg < HWBX_MAX_CMGS; cmg++)
+    {
+        snprintf(path, sizeof(path), HWBX_CORE_MAP, cmg);
+        fp = fopen(path, "r");
+        if (!fp)
+        {
+            continue;
+        }
+        while (fscanf(fp, "%d %d", &cpu, &ppe) == 2)
+        {
+            if (cpu >= 0 && cpu < HWBX_MAX_CPUS)
+            {
+                topo->cmg[cpu] = cmg;
+                topo->ppe[cpu] = ppe;
+                topo->online[cpu] = 1;
+                topo->num_pes[cmg]++;
+                found++;
+            }
+        }
+        fclose(fp);
+    }
+    return found;
+}
+
+static void hwbx_topo_load(void)
+{
+    int found = 0;
+    hwbx_topo = malloc(sizeof(struct hwbx_topology));
+    if (!hwbx_topo)
+    {
+        hwbx_topo_err = -ENOMEM;
+        return;
+    }
+    topo_clear(hwbx_topo);
+    found = topo_read_bin(hwbx_topo);
+    if (found <= 0)
+    {
+        topo_clear(hwbx_topo);
+        found = topo_read_core_map(hwbx_topo);
+    }
+    hwbx_topo_err = (found > 0 ? 0 : -ENODEV);
+}
+
+int hwbx_topo_read(struct hwbx_topology *topo)
+{
+    if (!topo)
+    {
+        return -EINVAL;
+    }
+    pthread_once(&hwbx_topo_once, hwbx_topo_load);
+    if (hwbx_topo_err < 0)
+    {
+        return hwbx_topo_err;
+    }
+    memcpy(topo, hwbx_topo, sizeof(struct hwbx_topology));
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef HWBX_TOPO_H
+#define HWBX_TOPO_H
+
+#include "hwbx.h"
+
+/*
+ * CPU to CMG mapping of the node as exported by the module, used by the placement
+ * planner and the barrier tuner.
+ */
+
+struct hwbx_topology {
+    // CMG and physical PE per CPU, -1 for CPUs unknown to the module
+    int cmg[HWBX_MAX_CPUS];
+    int ppe[HWBX_MAX_CPUS];
+    // 1 if the CPU was online when the topology was loaded
+    int online[HWBX_MAX_CPUS];
+    // Capacity per CMG, blades and windows are 0 if only core_map was available
+    int num_pes[HWBX_MAX_CMGS];
+    int num_blades[HWBX_MAX_CMGS];
+    int num_windows[HWBX_MAX_CMGS];
+};
+
+// Copy the topology of the node. It is loaded once per process from the binary
+// topology_bin file, with a fallback to CMGx/core_map of all CMGs for older modules.
+// Returns -ENODEV if no CPU is known.
+int hwbx_topo_read(struct hwbx_topology *topo);
+
+#endif /* HWBX_TOPO_H */
@@ -0,0 +1,393 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "hwbx.h"
+#include "hwbx_topo.h"
+
+/*
+ * Barrier tuner, see hwbx.h. A calibration runs every barrier kind with one pinned
+ * helper thread per CPU of the team and keeps the best of a few short runs. The
+ * profile is a text file with one line per team shape:
+ *   <threads> <cmgs> <ns hwb> <ns central> <ns dissemination> <ns tree>
+ * with -1 for kinds that are not applicable.
+ */
+
+#define HWBX_TUNE_WARMUP 100
+#define HWBX_TUNE_ITERS 2000
+#define HWBX_TUNE_RUNS 3
+// in $XDG_CACHE_HOME or $HOME/.cache, per user in /tmp without either
+#define HWBX_TUNE_PROFILE_NAME "hwbx_profile.%s"
+#define HWBX_TUNE_PROFILE_TMP "/tmp/hwbx_profile.%u.%s"
+
+struct tune_run {
+    struct hwbx_barrier *barrier;
+    // helpers that joined, they start when the caller sets go
+    int ready;
+    int go;
+    double ns;
+    int err;
+};
+
+struct tune_thread {
+    struct tune_run *run;
+    int rank;
+    int cpu;
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1.0e9 + (double)ts.tv_nsec;
+}
+
+static void* tune_thread_func(void *arg)
+{
+    int i = 0;
+    int err = 0;
+    double start = 0;
+    cpu_set_t set;
+    struct hwbx_barrier_member member;
+    struct tune_thread *t = (struct tune_thread*) arg;
+
+    CPU_ZERO(&set);
+    CPU_SET(t->cpu, &set);
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &set) < 0)
+    {
+        err = -errno;
+    }
+    else
+    {
+        err = hwbx_barrier_join(t->run->barrier, t->rank, &member);
+    }
+    if (err < 0)
+    {
+        __atomic_store_n(&t->run->err, err, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&t->run->ready, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&t->run->go, __ATOMIC_ACQUIRE))
+    {
+        sched_yield();
+    }
+    // all helpers leave if one of them failed to join or was not started
+    if (__atomic_load_n(&t->run->err, __ATOMIC_RELAXED) < 0)
+    {
+        if (err == 0)
+        {
+            hwbx_barrier_leave(&member);
+        }
+        return NULL;
+    }
+    for (i = 0; i < HWBX_TUNE_WARMUP; i++)
+    {
+        hwbx_barrier_wait(&member);
+    }
+    start = now_ns();
+    for (i = 0; i < HWBX_TUNE_ITERS; i++)
+    {
+        hwbx_barrier_wait(&member);
+    }
+    if (t->rank == 0)
+    {
+        t->run->ns = (now_ns() - start) / HWBX_TUNE_ITERS;
+    }
+    hwbx_barrier_leave(&member);
+    return NULL;
+}
+
+// Time one barrier kind, negative if it cannot be used for the team
+static double tune_kind(const cpu_set_t *cpus, int num_threads, enum hwbx_barrier_kind kind)
+{
+    int i = 0;
+    int cpu = 0;
+    int started = 0;
+    struct hwbx_barrier barrier;
+    struct tune_run run;
+    struct tune_thread *threads = NULL;
+    pthread_t *tids = NULL;
+
+    if (hwbx_barrier_init(&barrier, cpus, num_threads, kind) < 0)
+    {
+        return -1.0;
+    }
+    threads = calloc(num_threads, sizeof(struct tune_thread));
+    tids = calloc(num_threads, sizeof(pthread_t));
+    if ((!threads) || (!tids))
+    {
+        free(threads);
+        free(tids);
+        hwbx_barrier_free(&barrier);
+        return -1.0;
+    }
+    memset(&run, 0, sizeof(struct tune_run));
+    run.barrier = &barrier;
+    run.ns = -1.0;
+    for (cpu = 0; cpu < HWBX_MAX_CPUS && i < num_threads; cpu++)
+    {
+        if (CPU_ISSET(cpu, &barrier.cpus))
+        {
+            threads[i].run = &run;
+            threads[i].rank = i;
+            threads[i].cpu = cpu;
+            i++;
+        }
+    }
+    for (i = 0; i < num_threads; i++)
+    {
+        if (pthread_create(&tids[i], NULL, tune_thread_func, &threads[i]) != 0)
+        {
+            // the started helpers are released and leave again
+            __atomic_store_n(&run.err, -EAGAIN, __ATOMIC_RELAXED);
+            break;
+        }
+        started++;
+    }
+    while (__atomic_load_n(&run.ready, __ATOMIC_ACQUIRE) < started)
+    {
+        sched_yield();
+    }
+    __atomic_store_n(&run.go, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    hwbx_barrier_free(&barrier);
+    free(threads);
+    free(tids);
+    return (run.err < 0 ? -1.0 : run.ns);
+}
+
+static int count_cmgs(const cpu_set_t *cpus)
+{
+    int cpu = 0;
+    int err = 0;
+    unsigned int cmgs = 0;
+    struct hwbx_topology *topo = malloc(sizeof(struct hwbx_topology));
+    if (!topo)
+    {
+        return -ENOMEM;
+    }
+    err = hwbx_topo_read(topo);
+    if (err < 0)
+    {
+        free(topo);
+        return err;
+    }
+    for (cpu = 0; cpu < HWBX_MAX_CPUS; cpu++)
+    {
+        if (CPU_ISSET(cpu, cpus) && topo->cmg[cpu] >= 0)
+        {
+            cmgs |= (1U << topo->cmg[cpu]);
+        }
+    }
+    free(topo);
+    return __builtin_popcount(cmgs);
+}
+
+int hwbx_tune_calibrate(const cpu_set_t *cpus, int num_threads, struct hwbx_tune_result *result)
+{
+    int k = 0;
+    int r = 0;
+    double ns = 0;
+    int cmgs = 0;
+
+    if ((!cpus) || (!result) || num_threads < 1 || num_threads > CPU_COUNT(cpus))
+    {
+        return -EINVAL;
+    }
+    // without the module, the hardware barrier is not applicable and the CMGs unknown
+    cmgs = count_cmgs(cpus);
+    result->num_threads = num_threads;
+    result->num_cmgs = (cmgs > 0 ? cmgs : 0);
+    for (k = 0; k < HWBX_NUM_BARRIER_KINDS; k++)
+    {
+        result->ns[k] = -1.0;
+        if (k == HWBX_BARRIER_HWB && (result->num_cmgs != 1 || num_threads < 2))
+        {
+            continue;
+        }
+        for (r = 0; r < HWBX_TUNE_RUNS; r++)
+        {
+            ns = tune_kind(cpus, num_threads, (enum hwbx_barrier_kind)k);
+            if (ns < 0)
+            {
+                break;
+            }
+            if (result->ns[k] < 0 || ns < result->ns[k])
+            {
+                result->ns[k] = ns;
+            }
+        }
+    }
+    // e.g. the helpers could not be pinned, nothing to store in the profile
+    return (result->ns[hwbx_tune_select(result)] < 0 ? -EIO : 0);
+}
+
+enum hwbx_barrier_kind hwbx_tune_select(const struct hwbx_tune_result *result)
+{
+    int k = 0;
+    enum hwbx_barrier_kind best = HWBX_BARRIER_CENTRAL;
+    for (k = 0; k < HWBX_NUM_BARRIER_KINDS; k++)
+    {
+        if (result->ns[k] >= 0 && (result->ns[best] < 0 || result->ns[k] < result->ns[best]))
+        {
+            best = (enum hwbx_barrier_kind)k;
+        }
+    }
+    return best;
+}
+
+// A path that does not fit is not truncated, it would name a different file
+static int profile_path(char *path, size_t len)
+{
+    int n = 0;
+    char host[64];
+    char dir[PATH_MAX];
+    const char *env = getenv("HWBX_TUNE_PROFILE");
+    const char *cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (env && *env != '\0')
+    {
+        n = snprintf(path, len, "%s", env);
+        return (n < 0 || (size_t)n >= len ? -ENAMETOOLONG : 0);
+    }
+    if (gethostname(host, sizeof(host)) < 0)
+    {
+        snprintf(host, sizeof(host), "unknown");
+    }
+    host[sizeof(host) - 1] = '\0';
+    if (cache && *cache != '\0')
+    {
+        n = snprintf(dir, sizeof(dir), "%s", cache);
+    }
+    else if (home && *home != '\0')
+    {
+        n = snprintf(dir, sizeof(dir), "%s/.cache", home);
+    }
+    else
+    {
+        n = snprintf(path, len, HWBX_TUNE_PROFILE_TMP, (unsigned int)getuid(), host);
+        return (n < 0 || (size_t)n >= len ? -ENAMETOOLONG : 0);
+    }
+    if (n < 0 || (size_t)n >= sizeof(dir))
+    {
+        return -ENAMETOOLONG;
+    }
+    mkdir(dir, 0700);
+    n = snprintf(path, len, "%s/" HWBX_TUNE_PROFILE_NAME, dir, host);
+    return (n < 0 || (size_t)n >= len ? -ENAMETOOLONG : 0);
+}
+
+// The profile is never opened through a symlink, it may be in a shared directory
+static FILE *profile_open(const char *path, int flags, const char *mode)
+{
+    FILE *fp = NULL;
+    int fd = open(path, flags | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    fp = fdopen(fd, mode);
+    if (!fp)
+    {
+        close(fd);
+    }
+    return fp;
+}
+
+static int profile_load(const char *path, int num_threads, int num_cmgs, struct hwbx_tune_result *result)
+{
+    int found = 0;
+    struct hwbx_tune_result entry;
+    FILE *fp = profile_open(path, O_RDONLY, "r");
+    if (!fp)
+    {
+        return 0;
+    }
+    while (fscanf(fp, "%d %d %lf %lf %lf %lf", &entry.num_threads, &entry.num_cmgs,
+                  &entry.ns[HWBX_BARRIER_HWB], &entry.ns[HWBX_BARRIER_CENTRAL],
+                  &entry.ns[HWBX_BARRIER_DISSEMINATION], &entry.ns[HWBX_BARRIER_TREE]) == 6)
+    {
+        // the last entry wins, so a recalibration can simply be appended
+        if (entry.num_threads == num_threads && entry.num_cmgs == num_cmgs)
+        {
+            *result = entry;
+            found = 1;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+static void profile_store(const char *path, const struct hwbx_tune_result *result)
+{
+    FILE *fp = profile_open(path, O_WRONLY | O_APPEND | O_CREAT, "a");
+    if (!fp)
+    {
+        return;
+    }
+    fprintf(fp, "%d %d %.1f %.1f %.1f %.1f\n", result->num_threads, result->num_cmgs,
+            result->ns[HWBX_BARRIER_HWB], result->ns[HWBX_BARRIER_CENTRAL],
+            result->ns[HWBX_BARRIER_DISSEMINATION], result->ns[HWBX_BARRIER_TREE]);
+    fclose(fp);
+}
+
+int hwbx_tune_lookup(const cpu_set_t *cpus, int num_threads, struct hwbx_tune_result *result)
+{
+    int k = 0;
+    int err = 0;
+    int cmgs = 0;
+    int cached = 0;
+    int has_path = 0;
+    char path[PATH_MAX];
+    const char *log = getenv("HWBX_TUNE_LOG");
+
+    if ((!cpus) || (!result) || num_threads < 1)
+    {
+        return -EINVAL;
+    }
+    cmgs = count_cmgs(cpus);
+    // without a usable path the shape is calibrated every time
+    has_path = (profile_path(path, sizeof(path)) == 0);
+    if (!has_path)
+    {
+        path[0] = '\0';
+    }
+    else
+    {
+        cached = profile_load(path, num_threads, (cmgs > 0 ? cmgs : 0), result);
+    }
+    if (!cached)
+    {
+        err = hwbx_tune_calibrate(cpus, num_threads, result);
+        if (err < 0)
+        {
+            return err;
+        }
+        if (has_path)
+        {
+            profile_store(path, result);
+        }
+    }
+    if (log && atoi(log) > 0)
+    {
+        fprintf(stderr, "hwbx: %d threads on %d CMGs (%s%s%s):", result->num_threads, result->num_cmgs,
+                (cached ? "profile" : (has_path ? "calibrated, stored in" : "calibrated, profile path too long")), (has_path ? " " : ""), path);
+        for (k = 0; k < HWBX_NUM_BARRIER_KINDS; k++)
+        {
+            fprintf(stderr, " %s %.1f ns", hwbx_barrier_kind_name((enum hwbx_barrier_kind)k), result->ns[k]);
+        }
+        fprintf(stderr, " -> %s\n", hwbx_barrier_kind_name(hwbx_tune_select(result)));
+    }
+    return 0;
+}
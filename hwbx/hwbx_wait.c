@@ -0,0 +1,306 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "hwbx.h"
+#include "hwbx_sysreg.h"
+#include "a64fx_hwb_uapi.h"
+
+#define HWBX_DEFAULT_SPIN_ITERS 100000UL
+#define HWBX_DEFAULT_WFE_ITERS 10000UL
+// polls between two checks of the sync timeout
+#define HWBX_TIMEOUT_CHECK_ITERS 64UL
+
+static unsigned long env_ulong(const char *name, unsigned long def)
+{
+    char *end = NULL;
+    unsigned long val = 0;
+    const char *str = getenv(name);
+    if (!str || *str == '\0')
+    {
+        return def;
+    }
+    val = strtoul(str, &end, 0);
+    if (*end != '\0')
+    {
+        return def;
+    }
+    return val;
+}
+
+void hwbx_wait_policy_default(struct hwbx_wait_policy *policy)
+{
+    policy->spin_iters = HWBX_DEFAULT_SPIN_ITERS;
+    policy->wfe_iters = HWBX_DEFAULT_WFE_ITERS;
+    policy->block = 1;
+    policy->block_timeout_us = 0;
+    policy->timeout_ms = 0;
+}
+
+void hwbx_wait_policy_from_env(struct hwbx_wait_policy *policy)
+{
+    hwbx_wait_policy_default(policy);
+    policy->spin_iters = env_ulong("HWBX_SPIN_ITERS", policy->spin_iters);
+    policy->wfe_iters = env_ulong("HWBX_WFE_ITERS", policy->wfe_iters);
+    policy->block = (int)env_ulong("HWBX_BLOCK", (unsigned long)policy->block);
+    policy->block_timeout_us = (unsigned int)env_ulong("HWBX_BLOCK_TIMEOUT_US", policy->block_timeout_us);
+    policy->timeout_ms = (unsigned int)env_ulong("HWBX_SYNC_TIMEOUT_MS", policy->timeout_ms);
+}
+
+static int hwbx_block(int window, unsigned long sync, unsigned int timeout_us)
+{
+    int fd = hwbx_dev_fd();
+    struct a64fx_hwb_ioc_wait ioc_wait = {
+        .window = (__u8)window,
+        .sync = (__u8)sync,
+        .timeout_us = timeout_us,
+    };
+    if (fd < 0)
+    {
+        return -ENODEV;
+    }
+    while (ioctl(fd, A64FX_HWB_IOC_WAIT, &ioc_wait) < 0)
+    {
+        if (errno != EINTR)
+        {
+            return -errno;
+        }
+    }
+    return 0;
+}
+
+static unsigned long elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)(now.tv_sec - start->tv_sec) * 1000000UL +
+           (unsigned long)((now.tv_nsec - start->tv_nsec) / 1000L);
+}
+
+static int timed_out(const struct hwbx_wait_policy *policy, const struct timespec *start, unsigned long i)
+{
+    if (policy->timeout_ms == 0 || (i % HWBX_TIMEOUT_CHECK_ITERS) != HWBX_TIMEOUT_CHECK_ITERS - 1)
+    {
+        return 0;
+    }
+    return (elapsed_us(start) >= (unsigned long)policy->timeout_ms * 1000UL);
+}
+
+// Tell which PEs are missing, so a hanging job can be diagnosed from its output
+static void report_timeout(int window, const struct hwbx_wait_policy *policy)
+{
+    struct hwbx_blade_status status;
+    int err = hwbx_blade_status(window, 0, 0, &status);
+    fprintf(stderr, "hwbx: barrier on window %d did not resolve within %u ms\n", window, policy->timeout_ms);
+    if (err < 0)
+    {
+        fprintf(stderr, "hwbx: cannot read blade status: %d\n", err);
+        return;
+    }
+    fprintf(stderr, "hwbx: ");
+    hwbx_blade_status_print(stderr, &status);
+}
+
+// Arrive with BST sync and wait until LBSY becomes sync
+static int arrive_wait(int window, unsigned long sync, const struct hwbx_wait_policy *policy, struct hwbx_wait_stats *stats)
+{
+    int err = 0;
+    unsigned long i = 0;
+    unsigned long remaining = 0;
+    unsigned int timeout_us = 0;
+    struct timespec start;
+    enum hwbx_wait_tier tier = HWBX_TIER_SPIN;
+
+    if (policy->timeout_ms > 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+    hwbx_write_bst(window, sync);
+
+    for (i = 0; i < policy->spin_iters; i++)
+    {
+        if (hwbx_read_lbsy(window) == sync)
+        {
+            goto sync_done;
+        }
+        if (timed_out(policy, &start, i))
+        {
+            goto sync_timeout;
+        }
+    }
+    tier = HWBX_TIER_WFE;
+    for (i = 0; (!policy->block) || i < policy->wfe_iters; i++)
+    {
+        if (hwbx_read_lbsy(window) == sync)
+        {
+            goto sync_done;
+        }
+        if (timed_out(policy, &start, i))
+        {
+            goto sync_timeout;
+        }
+        hwbx_wfe();
+    }
+    tier = HWBX_TIER_BLOCK;
+    // The own arrival cannot be taken back, so an expired block_timeout_us only ends one
+    // blocking call. Only the sync timeout gives up on the barrier.
+    for (;;)
+    {
+        timeout_us = policy->block_timeout_us;
+        if (policy->timeout_ms > 0)
+        {
+            // block at most for the rest of the sync timeout
+            remaining = elapsed_us(&start);
+            remaining = (remaining < (unsigned long)policy->timeout_ms * 1000UL ? (unsigned long)policy->timeout_ms * 1000UL - remaining : 1UL);
+            if (timeout_us == 0 || remaining < timeout_us)
+            {
+                // a truncated 0 would block without limit
+                timeout_us = (unsigned int)(remaining < UINT_MAX ? remaining : UINT_MAX);
+            }
+        }
+        err = hwbx_block(window, sync, timeout_us);
+        if (err != -ETIMEDOUT)
+        {
+            goto sync_done;
+        }
+        if (policy->timeout_ms > 0 && elapsed_us(&start) >= (unsigned long)policy->timeout_ms * 1000UL)
+        {
+            goto sync_timeout;
+        }
+    }
+
+sync_timeout:
+    report_timeout(window, policy);
+    err = -ETIMEDOUT;
+
+sync_done:
+    if (stats)
+    {
+        if (err < 0)
+        {
+            stats->errors++;
+        }
+        else
+        {
+            stats->resolved[tier]++;
+        }
+    }
+    return err;
+}
+
+int hwbx_sync_wait(int window, const struct hwbx_wait_policy *policy, struct hwbx_wait_stats *stats)
+{
+    if (window < 0 || window >= HWBX_NUM_WINDOWS || (!policy))
+    {
+        return -EINVAL;
+    }
+    // the new BST is the inverted LBSY of the previous episode
+    return arrive_wait(window, (~hwbx_read_lbsy(window)) & HWBX_SYNC_MASK, policy, stats);
+}
+
+static const char *order_names[HWBX_NUM_ORDERS] = { "full", "release", "none" };
+
+const char *hwbx_order_name(enum hwbx_order order)
+{
+    if (order < 0 || order >= HWBX_NUM_ORDERS)
+    {
+        return "unknown";
+    }
+    return order_names[order];
+}
+
+int hwbx_order_parse(const char *str, enum hwbx_order *order)
+{
+    int i = 0;
+    if ((!str) || (!order))
+    {
+        return -EINVAL;
+    }
+    for (i = 0; i < HWBX_NUM_ORDERS; i++)
+    {
+        if (strcmp(str, order_names[i]) == 0)
+        {
+            *order = (enum hwbx_order)i;
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+int hwbx_sync_ordered(int window, enum hwbx_order order, const struct hwbx_wait_policy *policy, struct hwbx_wait_stats *stats)
+{
+    int err = 0;
+    if (window < 0 || window >= HWBX_NUM_WINDOWS || (!policy) || order < 0 || order >= HWBX_NUM_ORDERS)
+    {
+        return -EINVAL;
+    }
+    if (order == HWBX_ORDER_FULL)
+    {
+        hwbx_dsb_ish();
+    }
+    else if (order == HWBX_ORDER_RELEASE)
+    {
+        hwbx_dsb_ishst();
+    }
+    err = arrive_wait(window, (~hwbx_read_lbsy(window)) & HWBX_SYNC_MASK, policy, stats);
+    if (order == HWBX_ORDER_FULL)
+    {
+        // also after a failed wait, the caller may read data of the threads that did arrive
+        hwbx_isb();
+    }
+    return err;
+}
+
+int hwbx_fast_init(struct hwbx_fast *fast, int window)
+{
+    if ((!fast) || window < 0 || window >= HWBX_NUM_WINDOWS)
+    {
+        return -EINVAL;
+    }
+    fast->window = window;
+    hwbx_fast_resync(fast);
+    return 0;
+}
+
+void hwbx_fast_resync(struct hwbx_fast *fast)
+{
+    fast->phase = (~hwbx_read_lbsy(fast->window)) & HWBX_SYNC_MASK;
+}
+
+int hwbx_fast_wait(struct hwbx_fast *fast, const struct hwbx_wait_policy *policy, struct hwbx_wait_stats *stats)
+{
+    int err = 0;
+    if ((!fast) || (!policy))
+    {
+        return -EINVAL;
+    }
+    err = arrive_wait(fast->window, fast->phase, policy, stats);
+    if (err < 0)
+    {
+        // the episode is still open or the blade changed, ask the hardware
+        hwbx_fast_resync(fast);
+        return err;
+    }
+    fast->phase ^= HWBX_SYNC_MASK;
+    return 0;
+}
+
+void hwbx_wait_stats_add(struct hwbx_wait_stats *sum, const struct hwbx_wait_stats *stats)
+{
+    int i = 0;
+    for (i = 0; i < HWBX_NUM_TIERS; i++)
+    {
+        sum->resolved[i] += stats->resolved[i];
+    }
+    sum->errors += stats->errors;
+}
+
+void hwbx_wait_stats_print(FILE *out, const struct hwbx_wait_stats *stats)
+{
+    fprintf(out, "spin: %lu, wfe: %lu, block: %lu, errors: %lu\n",
+            stats->resolved[HWBX_TIER_SPIN], stats->resolved[HWBX_TIER_WFE],
+            stats->resolved[HWBX_TIER_BLOCK], stats->errors);
+}
@@ -3,6 +3,10 @@
 
 #include <linux/kobject.h>
 #include <linux/miscdevice.h>
+#include <linux/atomic.h>
+#include <linux/mutex.h>
+
+#include "a64fx_hwb_uapi.h"
 
 #define MAX_NUM_CMG    4
 #define MAX_PE_PER_CMG 13
@@ -24,6 +28,31 @@ struct a64fx_core_mapping {
 };
 
 
+// Counters for the blocking wait IOCTL, exported per CMG through sysfs
+struct a64fx_wait_stats {
+    // LBSY had already flipped when entering the kernel
+    atomic_long_t immediate;
+    // woken up by the polling timer
+    atomic_long_t resolved;
+    atomic_long_t timeout;
+    atomic_long_t interrupted;
+    // window got unassigned while waiting
+    atomic_long_t unassigned;
+};
+
+// Where the register accesses of the control path were executed, exported per CMG
+// through sysfs. Only the busy ones interrupted a CPU with assigned windows.
+struct a64fx_ipi_stats {
+    // on the calling CPU, no IPI
+    atomic_long_t local;
+    atomic_long_t housekeeping;
+    // IPI to a CPU that was not running a task
+    atomic_long_t idle;
+    // IPI to a running CPU without assigned windows
+    atomic_long_t unassigned;
+    atomic_long_t busy;
+};
+
 struct a64fx_cmg_device {
     int cmg_id;
     int num_pes;
@@ -34,8 +63,17 @@ struct a64fx_cmg_device {
     struct a64fx_core_mapping pe_map[MAX_PE_PER_CMG];
     int bw_map[MAX_BW_PER_CMG];
     spinlock_t cmg_lock;
+    struct a64fx_wait_stats wait_stats;
+    struct a64fx_ipi_stats ipi_stats;
+    // last register snapshot, see a64fx_hwb_cmg.c
+    struct mutex snapshot_lock;
+    struct a64fx_hwb_snapshot snapshot;
+    u64 snapshot_time;
+    unsigned long snapshot_reads;
 };
 
+struct a64fx_hwb_quota;
+
 struct a64fx_task_allocation {
     u8 blade;
     u8 cmg;
@@ -45,12 +83,18 @@ struct a64fx_task_allocation {
     struct cpumask assign_mask;
     struct cpumask cpumask;
     struct task_struct* task;
+    // File used for the allocation, the allocation is freed at its release
+    struct file* file;
     struct list_head list;
+    // quota entry the blade is charged to, NULL if none
+    struct a64fx_hwb_quota* quota;
 };
 
 struct a64fx_task_mapping {
     // Allocating task
     struct task_struct* task;
+    // Group leader of the allocating task, used to detect dead processes
+    struct task_struct* leader;
     // Anchor for the struct inside the device->task_list
     struct list_head list;
     // Head of the allocation list
@@ -59,6 +103,12 @@ struct a64fx_task_mapping {
     int num_allocs;
 };
 
+// Number of tasks and blades freed because the owner did not free them
+struct a64fx_reclaim_stats {
+    unsigned long tasks;
+    unsigned long blades;
+};
+
 struct a64fx_hwb_device {
     int num_cmgs;
     int num_bb_per_cmg;
@@ -70,6 +120,12 @@ struct a64fx_hwb_device {
     int active_count;
     int num_tasks;
     struct list_head task_list;
+    // at release of the file or exit of the process
+    struct a64fx_reclaim_stats reclaim_release;
+    // by the leak scanner
+    struct a64fx_reclaim_stats reclaim_scan;
+    // blade quotas per cgroup
+    struct list_head quota_list;
 };
 
 
@@ -45,67 +45,99 @@ int write_hwb_ctrl(int el0ae, int el1ae)
     return 0;
 }
 
-int read_init_sync_bb(int bb, unsigned long *mask, unsigned long *bst)
+/*
+ * The barrier registers are encoded in the MRS/MSR instructions, so an indexed access
+ * needs one instruction per register. The per-blade and per-window instructions are
+ * generated from the register tables below:
+ *  - __read_<reg>(idx) / __write_<reg>(idx, val): single raw register
+ *  - read_<reg>_all(vals): all registers of the family as straight-line code
+ *  - write_<reg>_bulk(mask, vals): the registers with a bit in mask, straight-line code
+ * The bulk functions are meant for IPI handlers which otherwise loop over the single
+ * accessors and re-check the bounds for every register.
+ */
+
+#define INIT_SYNC_BB_REG(n)   "S3_0_C15_C13_" #n
+#define ASSIGN_SYNC_WR_REG(n) "S3_0_C15_C15_" #n
+#define BST_SYNC_WR_REG(n)    "S3_3_C15_C15_" #n
+
+#define FOR_EACH_BB(X, REG) X(0, REG) X(1, REG) X(2, REG) X(3, REG) X(4, REG) X(5, REG)
+#define FOR_EACH_BW(X, REG) X(0, REG) X(1, REG) X(2, REG) X(3, REG)
+
+#define HWB_READ_CASE(n, REG) \
+        case n: \
+            asm volatile ("MRS %0, " REG(n) : "=r"(val)); \
+            break;
+#define HWB_WRITE_CASE(n, REG) \
+        case n: \
+            asm volatile ("MSR " REG(n) ", %0" :: "r"(val)); \
+            break;
+#define HWB_READ_ALL(n, REG) \
+    asm volatile ("MRS %0, " REG(n) : "=r"(vals[n]));
+#define HWB_WRITE_BULK(n, REG) \
+    if (mask & (1UL << n)) \
+        asm volatile ("MSR " REG(n) ", %0" :: "r"(vals[n]));
+
+#define HWB_REG_ACCESSORS(name, REG, FOR_EACH) \
+static inline u64 __read_##name(int idx) \
+{ \
+    u64 val = 0; \
+    switch(idx) \
+    { \
+        FOR_EACH(HWB_READ_CASE, REG) \
+    } \
+    return val; \
+} \
+static inline void __write_##name(int idx, u64 val) \
+{ \
+    switch(idx) \
+    { \
+        FOR_EACH(HWB_WRITE_CASE, REG) \
+    } \
+} \
+void read_##name##_all(u64 *vals) \
+{ \
+    FOR_EACH(HWB_READ_ALL, REG) \
+} \
+void write_##name##_bulk(unsigned long mask, const u64 *vals) \
+{ \
+    FOR_EACH(HWB_WRITE_BULK, REG) \
+}
+
+HWB_REG_ACCESSORS(init_sync_bb, INIT_SYNC_BB_REG, FOR_EACH_BB)
+HWB_REG_ACCESSORS(assign_sync_wr, ASSIGN_SYNC_WR_REG, FOR_EACH_BW)
+HWB_REG_ACCESSORS(bst_sync_wr, BST_SYNC_WR_REG, FOR_EACH_BW)
+
+
+int read_init_sync_bb(int bb, unsigned long *mask, unsigned long *bst, unsigned long *lbsy)
 {
     u64 val = 0;
-    switch(bb)
+    if ((bb < 0) || (bb >= MAX_BB_PER_CMG) || (!mask) || (!bst))
     {
-        case 0:
-            asm volatile ("MRS %0, S3_0_C15_C13_0" : "=r"(val));
-            break;
-        case 1:
-            asm volatile ("MRS %0, S3_0_C15_C13_1" : "=r"(val));
-            break;
-        case 2:
-            asm volatile ("MRS %0, S3_0_C15_C13_2" : "=r"(val));
-            break;
-        case 3:
-            asm volatile ("MRS %0, S3_0_C15_C13_3" : "=r"(val));
-            break;
-        case 4:
-            asm volatile ("MRS %0, S3_0_C15_C13_4" : "=r"(val));
-            break;
-        case 5:
-            asm volatile ("MRS %0, S3_0_C15_C13_5" : "=r"(val));
-            break;
-
+        return -EINVAL;
+    }
+    val = __read_init_sync_bb(bb);
+    *bst = A64FX_HWB_INIT_BST(val);
+    *mask = A64FX_HWB_INIT_MASK(val);
+    // LBSY is optional, most callers only need the masks
+    if (lbsy)
+    {
+        *lbsy = A64FX_HWB_INIT_LBSY(val);
     }
-    *bst = val & A64FX_HWB_INIT_BST_MASK;
-    *mask = (val >> A64FX_HWB_INIT_BST_SHIFT) & A64FX_HWB_INIT_BST_MASK;
     return 0;
 }
 
 int write_init_sync_bb(int blade, unsigned long bst_mask)
 {
     u64 val = 0;
-    if ((blade < 0) || (blade >= MAX_BB_PER_CMG) || (bst_mask == 0x0UL))
+    // An empty bst_mask is valid, it releases the blade
+    if ((blade < 0) || (blade >= MAX_BB_PER_CMG))
     {
         return -EINVAL;
     }
 
-    val |= (bst_mask & A64FX_HWB_INIT_BST_MASK) << A64FX_HWB_INIT_BST_SHIFT;
+    val = a64fx_hwb_init_sync_bb_val(bst_mask);
     pr_debug("write_init_sync_bb: new 0x%llx\n", val);
-    switch(blade)
-    {
-        case 0:
-            asm volatile ("MSR S3_0_C15_C13_0, %0" :: "r"(val));
-            break;
-        case 1:
-            asm volatile ("MSR S3_0_C15_C13_1, %0" :: "r"(val));
-            break;
-        case 2:
-            asm volatile ("MSR S3_0_C15_C13_2, %0" :: "r"(val));
-            break;
-        case 3:
-            asm volatile ("MSR S3_0_C15_C13_3, %0" :: "r"(val));
-            break;
-        case 4:
-            asm volatile ("MSR S3_0_C15_C13_4, %0" :: "r"(val));
-            break;
-        case 5:
-            asm volatile ("MSR S3_0_C15_C13_5, %0" :: "r"(val));
-            break;
-    }
+    __write_init_sync_bb(blade, val);
     return 0;
 }
 
@@ -117,23 +149,9 @@ int read_assign_sync_wr(int window, int* valid, int *blade)
     {
         return -EINVAL;
     }
-    switch(window)
-    {
-        case 0:
-            asm volatile ("MRS %0, S3_0_C15_C15_0" : "=r" (val));
-            break;
-        case 1:
-            asm volatile ("MRS %0, S3_0_C15_C15_1" : "=r" (val));
-            break;
-        case 2:
-            asm volatile ("MRS %0, S3_0_C15_C15_2" : "=r" (val));
-            break;
-        case 3:
-            asm volatile ("MRS %0, S3_0_C15_C15_3" : "=r" (val));
-            break;
-    }
-    *valid = (val >> A64FX_HWB_ASSIGN_VALID_BIT) & 0x1;
-    *blade = (val & A64FX_HWB_ASSIGN_BB_MASK);
+    val = __read_assign_sync_wr(window);
+    *valid = A64FX_HWB_ASSIGN_VALID(val);
+    *blade = A64FX_HWB_ASSIGN_BB(val);
     return 0;
 }
 
@@ -143,31 +161,9 @@ int write_assign_sync_wr(int window, int valid, int blade)
     if ((window < 0) || (window >= MAX_BW_PER_CMG) || (blade < 0) || (blade >= MAX_BB_PER_CMG))
         return -EINVAL;
 
-    val |= (u8)blade;
-    if (valid)
-    {
-        val |= (1ULL<<A64FX_HWB_ASSIGN_VALID_BIT);
-    }
-    else
-    {
-        val &= ~(1ULL<<A64FX_HWB_ASSIGN_VALID_BIT);
-    }
+    val = a64fx_hwb_assign_sync_wr_val(valid, blade);
     pr_debug("write_assign_sync_wr: new 0x%llx\n", val);
-    switch(window)
-    {
-        case 0:
-            asm volatile ("MSR S3_0_C15_C15_0, %0" :: "r"(val));
-            break;
-        case 1:
-            asm volatile ("MSR S3_0_C15_C15_1, %0" :: "r"(val));
-            break;
-        case 2:
-            asm volatile ("MSR S3_0_C15_C15_2, %0" :: "r"(val));
-            break;
-        case 3:
-            asm volatile ("MSR S3_0_C15_C15_3, %0" :: "r"(val));
-            break;
-    }
+    __write_assign_sync_wr(window, val);
     return 0;
 }
 
@@ -185,25 +181,9 @@ int read_peinfo(u8 *cmg, u8 *ppe)
 
 int read_bst_sync_wr(int window, int* sync)
 {
-    u64 val = 0;
     if ((window < 0) || (window >= MAX_BW_PER_CMG) || (!sync))
         return -EINVAL;
-    switch(window)
-    {
-        case 0:
-            asm volatile ("MRS %0, S3_3_C15_C15_0" : "=r" (val));
-            break;
-        case 1:
-            asm volatile ("MRS %0, S3_3_C15_C15_1" : "=r" (val));
-            break;
-        case 2:
-            asm volatile ("MRS %0, S3_3_C15_C15_2" : "=r" (val));
-            break;
-        case 3:
-            asm volatile ("MRS %0, S3_3_C15_C15_3" : "=r" (val));
-            break;
-    }
-    *sync = val & A64FX_HWB_SYNC_WINDOW_MASK;
+    *sync = __read_bst_sync_wr(window) & A64FX_HWB_SYNC_WINDOW_MASK;
     return 0;
 }
 
@@ -213,33 +193,11 @@ int write_bst_sync_wr(int window, int sync)
     if ((window < 0) || (window >= MAX_BW_PER_CMG))
         return -EINVAL;
 
-    if (sync)
-    {
-        val |= A64FX_HWB_SYNC_WINDOW_MASK;
-    }
-    else
-    {
-        val &= ~(A64FX_HWB_SYNC_WINDOW_MASK);
-    }
+    val = (sync ? A64FX_HWB_SYNC_WINDOW_MASK : 0x0UL);
     pr_debug("write_bst_sync_wr: new 0x%llx\n", val);
-    switch(window)
-    {
-        case 0:
-            asm volatile ("MSR S3_3_C15_C15_0, %0" :: "r" (val));
-            break;
-        case 1:
-            asm volatile ("MSR S3_3_C15_C15_1, %0" :: "r" (val));
-            break;
-        case 2:
-            asm volatile ("MSR S3_3_C15_C15_2, %0" :: "r" (val));
-            break;
-        case 3:
-            asm volatile ("MSR S3_3_C15_C15_3, %0" :: "r" (val));
-            break;
-    }
+    __write_bst_sync_wr(window, val);
     return 0;
 }
 
 
 #endif
-
@@ -1,6 +1,8 @@
 #ifndef A64FX_HWB_ASM_H
 #define A64FX_HWB_ASM_H
 
+#include "a64fx_hwb.h"
+
 #define A64FX_PEINFO_CMG_MASK 0x3UL
 #define A64FX_PEINFO_CMG_OFFSET 4
 #define A64FX_PEINFO_PPE_MASK 0xFUL
@@ -16,12 +18,25 @@ int write_hwb_ctrl(int el0ae, int el1ae);
 #define A64FX_HWB_INIT_BST_MASK 0x1FFFUL
 #define A64FX_HWB_INIT_BST_SHIFT 32
 #define A64FX_HWB_INIT_LBSY_SHIFT 20
-int read_init_sync_bb(int bb, unsigned long *mask, unsigned long *bst);
+#define A64FX_HWB_INIT_BST(val) ((unsigned long)(val) & A64FX_HWB_INIT_BST_MASK)
+#define A64FX_HWB_INIT_MASK(val) (((unsigned long)(val) >> A64FX_HWB_INIT_BST_SHIFT) & A64FX_HWB_INIT_BST_MASK)
+#define A64FX_HWB_INIT_LBSY(val) (((unsigned long)(val) >> A64FX_HWB_INIT_LBSY_SHIFT) & 0x1UL)
+static inline u64 a64fx_hwb_init_sync_bb_val(unsigned long bst_mask)
+{
+    return (u64)(bst_mask & A64FX_HWB_INIT_BST_MASK) << A64FX_HWB_INIT_BST_SHIFT;
+}
+int read_init_sync_bb(int bb, unsigned long *mask, unsigned long *bst, unsigned long *lbsy);
 int write_init_sync_bb(int blade, unsigned long bst_mask);
 
 
 #define A64FX_HWB_ASSIGN_BB_MASK 0x7UL
 #define A64FX_HWB_ASSIGN_VALID_BIT 63
+#define A64FX_HWB_ASSIGN_VALID(val) ((int)(((val) >> A64FX_HWB_ASSIGN_VALID_BIT) & 0x1))
+#define A64FX_HWB_ASSIGN_BB(val) ((int)((val) & A64FX_HWB_ASSIGN_BB_MASK))
+static inline u64 a64fx_hwb_assign_sync_wr_val(int valid, int blade)
+{
+    return ((u64)blade & A64FX_HWB_ASSIGN_BB_MASK) | (valid ? (1ULL<<A64FX_HWB_ASSIGN_VALID_BIT) : 0x0ULL);
+}
 int read_assign_sync_wr(int window, int* valid, int *blade);
 int write_assign_sync_wr(int window, int valid, int blade);
 
@@ -30,4 +45,17 @@ int write_assign_sync_wr(int window, int valid, int blade);
 int read_bst_sync_wr(int window, int* sync);
 int write_bst_sync_wr(int window, int sync);
 
+
+// Bulk access to all registers of a family with straight-line code. The arrays hold
+// the raw register values indexed by blade or window. The write functions only write
+// the registers with a bit set in mask.
+void read_init_sync_bb_all(u64 *vals);
+void write_init_sync_bb_bulk(unsigned long mask, const u64 *vals);
+void read_assign_sync_wr_all(u64 *vals);
+void write_assign_sync_wr_bulk(unsigned long mask, const u64 *vals);
+void read_bst_sync_wr_all(u64 *vals);
+void write_bst_sync_wr_bulk(unsigned long mask, const u64 *vals);
+#define A64FX_HWB_ALL_BB ((1UL << MAX_BB_PER_CMG) - 1)
+#define A64FX_HWB_ALL_BW ((1UL << MAX_BW_PER_CMG) - 1)
+
 #endif /* A64FX_HWB_ASM_H */
@@ -4,6 +4,12 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/init.h>
+#include <linux/version.h>
+#include <linux/mutex.h>
+#include <linux/cpu.h>
+#include <linux/smp.h>
+#include <linux/ktime.h>
+#include <linux/sysfs.h>
 #include <include/linux/cpumask.h>
 
 #include "a64fx_hwb.h"
@@ -33,8 +39,13 @@ static ssize_t core_map_show(struct kobject *kobj, struct kobj_attribute * attr,
     int i = 0;
     int slen = 0;
     struct a64fx_cmg_device *cmg = kobj_to_cmg(kobj);
-    for (i = 0; i < cmg->num_pes; i++)
+    // the PE map is indexed by the physical PE number, unused entries have no CPU
+    for (i = 0; i < MAX_PE_PER_CMG; i++)
     {
+        if (cmg->pe_map[i].cpu_id < 0)
+        {
+            continue;
+        }
         slen += snprintf(&buf[slen], PAGE_SIZE-slen, "%d %d\n", cmg->pe_map[i].cpu_id, cmg->pe_map[i].ppe_id);
     }
     buf[slen] = '\0';
@@ -52,78 +63,297 @@ static ssize_t used_bw_bmap_show(struct kobject *kobj, struct kobj_attribute * a
     int i = 0;
     int slen = 0;
     struct a64fx_cmg_device *cmg = kobj_to_cmg(kobj);
-    for (i = 0; i < cmg->num_pes; i++)
+    // the PE map is indexed by the physical PE number, unused entries have no CPU
+    for (i = 0; i < MAX_PE_PER_CMG; i++)
     {
+        if (cmg->pe_map[i].cpu_id < 0)
+        {
+            continue;
+        }
         slen += snprintf(&buf[slen], PAGE_SIZE-slen, "%d %.4lx\n", cmg->pe_map[i].cpu_id, cmg->pe_map[i].bw_map);
     }
     buf[slen] = '\0';
     return slen;
 }
 
-struct bb_show_info {
-    int blade;
-    unsigned long mask;
-    unsigned long bst;
-};
+static ssize_t wait_stats_show(struct kobject *kobj, struct kobj_attribute * attr, char* buf)
+{
+    struct a64fx_cmg_device *cmg = kobj_to_cmg(kobj);
+    return scnprintf(buf, PAGE_SIZE, "immediate %ld\nresolved %ld\ntimeout %ld\ninterrupted %ld\nunassigned %ld\n",
+                     atomic_long_read(&cmg->wait_stats.immediate),
+                     atomic_long_read(&cmg->wait_stats.resolved),
+                     atomic_long_read(&cmg->wait_stats.timeout),
+                     atomic_long_read(&cmg->wait_stats.interrupted),
+                     atomic_long_read(&cmg->wait_stats.unassigned));
+}
 
-static void _init_sync_bb_show_func(void* info)
+static ssize_t ipi_stats_show(struct kobject *kobj, struct kobj_attribute * attr, char* buf)
 {
-    struct bb_show_info* bbinfo = (struct bb_show_info*)info;
-    read_init_sync_bb(bbinfo->blade, &bbinfo->mask, &bbinfo->bst);
+    struct a64fx_cmg_device *cmg = kobj_to_cmg(kobj);
+    return scnprintf(buf, PAGE_SIZE, "local %ld\nhousekeeping %ld\nidle %ld\nunassigned %ld\nbusy %ld\n",
+                     atomic_long_read(&cmg->ipi_stats.local),
+                     atomic_long_read(&cmg->ipi_stats.housekeeping),
+                     atomic_long_read(&cmg->ipi_stats.idle),
+                     atomic_long_read(&cmg->ipi_stats.unassigned),
+                     atomic_long_read(&cmg->ipi_stats.busy));
 }
 
-static ssize_t init_sync_bb_show(struct a64fx_cmg_device *cmg, int blade, char* buf)
+/*
+ * Register snapshot: The barrier registers can only be read on a PE of the CMG
+ * (INIT_SYNC_BBx) or on the PE itself (ASSIGN_SYNC_Wx, BST_SYNC_Wx). Instead of one
+ * cross-call per register, a single IPI wave to all online PEs of the CMG reads the
+ * windows of each PE and the first PE in the mask additionally reads all blades.
+ * The result is cached and readers within snapshot_interval_ms get the cached copy,
+ * so monitoring daemons polling the files do not disturb running jobs.
+ */
+
+static unsigned int snapshot_interval_ms = 100;
+module_param(snapshot_interval_ms, uint, 0644);
+MODULE_PARM_DESC(snapshot_interval_ms, "Minimal interval between hardware reads for the CMG snapshot files in ms (default 100)");
+
+struct snapshot_info {
+    int blade_cpu;
+    struct a64fx_hwb_snapshot *snap;
+};
+
+static void _snapshot_func(void* info)
 {
-    struct bb_show_info info = {blade, 0U, 0U};
-    smp_call_function_any(&cmg->cmgmask, _init_sync_bb_show_func, &info, 1);
-    return scnprintf(buf, PAGE_SIZE, "%.4lx\n%.4lx\n", info.mask, info.bst);
+    int i = 0;
+    u8 cmg = 0, ppe = 0;
+    u64 assign[MAX_BW_PER_CMG];
+    u64 sync[MAX_BW_PER_CMG];
+    u64 blades[MAX_BB_PER_CMG];
+    struct snapshot_info* sinfo = (struct snapshot_info*)info;
+    struct a64fx_hwb_snapshot *snap = sinfo->snap;
+    struct a64fx_hwb_snapshot_pe *pe = NULL;
+
+    read_peinfo(&cmg, &ppe);
+    if (ppe >= A64FX_HWB_SNAPSHOT_PES)
+    {
+        return;
+    }
+    read_assign_sync_wr_all(assign);
+    read_bst_sync_wr_all(sync);
+    // every PE writes only its own entry
+    pe = &snap->pe[ppe];
+    pe->cpu = smp_processor_id();
+    pe->ppe = ppe;
+    for (i = 0; i < A64FX_HWB_SNAPSHOT_WINDOWS; i++)
+    {
+        int valid = A64FX_HWB_ASSIGN_VALID(assign[i]);
+        pe->window_blade[i] = (valid ? A64FX_HWB_ASSIGN_BB(assign[i]) : A64FX_HWB_UNASSIGNED_BB);
+        pe->window_valid |= (valid << i);
+        pe->window_lbsy |= ((sync[i] & A64FX_HWB_SYNC_WINDOW_MASK) << i);
+    }
+    if (pe->cpu == sinfo->blade_cpu)
+    {
+        read_init_sync_bb_all(blades);
+        for (i = 0; i < A64FX_HWB_SNAPSHOT_BLADES; i++)
+        {
+            snap->blade[i].bst_mask = (__u16)A64FX_HWB_INIT_MASK(blades[i]);
+            snap->blade[i].bst = (__u16)A64FX_HWB_INIT_BST(blades[i]);
+            snap->blade[i].lbsy = (__u8)A64FX_HWB_INIT_LBSY(blades[i]);
+        }
+    }
 }
 
-static ssize_t init_sync_bb0_show(struct kobject *kobj, struct kobj_attribute * attr, char* buf)
+// Copy the snapshot of the CMG to snap. The hardware is only read if the cached snapshot
+// is older than snapshot_interval_ms.
+static int get_cmg_snapshot(struct a64fx_cmg_device *cmg, struct a64fx_hwb_snapshot *snap)
 {
-    struct a64fx_cmg_device *cmg = kobj_to_cmg(kobj);
-    return init_sync_bb_show(cmg, 0, buf);
+    int i = 0;
+    u64 now = 0;
+    struct cpumask mask;
+    struct snapshot_info info;
+
+    mutex_lock(&cmg->snapshot_lock);
+    now = ktime_get_ns();
+    if ((cmg->snapshot_time == 0) || (now - cmg->snapshot_time >= (u64)snapshot_interval_ms * NSEC_PER_MSEC))
+    {
+        memset(&cmg->snapshot, 0, sizeof(struct a64fx_hwb_snapshot));
+        for (i = 0; i < A64FX_HWB_SNAPSHOT_PES; i++)
+        {
+            cmg->snapshot.pe[i].cpu = -1;
+            memset(cmg->snapshot.pe[i].window_blade, A64FX_HWB_UNASSIGNED_BB, A64FX_HWB_SNAPSHOT_WINDOWS);
+        }
+        cpus_read_lock();
+        cpumask_and(&mask, &cmg->cmgmask, cpu_online_mask);
+        if (cpumask_empty(&mask))
+        {
+            cpus_read_unlock();
+            mutex_unlock(&cmg->snapshot_lock);
+            return -ENODEV;
+        }
+        info.blade_cpu = cpumask_first(&mask);
+        info.snap = &cmg->snapshot;
+        on_each_cpu_mask(&mask, _snapshot_func, &info, 1);
+        cpus_read_unlock();
+
+        cmg->snapshot.timestamp_ns = ktime_get_real_ns();
+        cmg->snapshot.cmg = cmg->cmg_id;
+        cmg->snapshot.num_pes = cmg->num_pes;
+        for (i = 0; i < A64FX_HWB_SNAPSHOT_BLADES; i++)
+        {
+            cmg->snapshot.blade[i].active = test_bit(i, &cmg->bb_active);
+        }
+        cmg->snapshot_time = now;
+        cmg->snapshot_reads++;
+        pr_debug("New snapshot for CMG%d\n", cmg->cmg_id);
+    }
+    memcpy(snap, &cmg->snapshot, sizeof(struct a64fx_hwb_snapshot));
+    mutex_unlock(&cmg->snapshot_lock);
+    return 0;
 }
 
-static ssize_t init_sync_bb1_show(struct kobject *kobj, struct kobj_attribute * attr, char* buf)
+static ssize_t snapshot_show(struct kobject *kobj, struct kobj_attribute * attr, char* buf)
 {
+    int i = 0, j = 0;
+    int err = 0;
+    int slen = 0;
+    struct a64fx_hwb_snapshot snap;
     struct a64fx_cmg_device *cmg = kobj_to_cmg(kobj);
-    return init_sync_bb_show(cmg, 1, buf);
+
+    err = get_cmg_snapshot(cmg, &snap);
+    if (err < 0)
+    {
+        return err;
+    }
+    slen += scnprintf(&buf[slen], PAGE_SIZE-slen, "timestamp %llu\n", snap.timestamp_ns);
+    for (i = 0; i < A64FX_HWB_SNAPSHOT_BLADES; i++)
+    {
+        struct a64fx_hwb_snapshot_blade *bb = &snap.blade[i];
+        slen += scnprintf(&buf[slen], PAGE_SIZE-slen, "bb %d active %d mask %.4x bst %.4x lbsy %d\n",
+                          i, bb->active, bb->bst_mask, bb->bst, bb->lbsy);
+    }
+    for (i = 0; i < A64FX_HWB_SNAPSHOT_PES; i++)
+    {
+        struct a64fx_hwb_snapshot_pe *pe = &snap.pe[i];
+        if (pe->cpu < 0)
+        {
+            continue;
+        }
+        slen += scnprintf(&buf[slen], PAGE_SIZE-slen, "pe %d cpu %d valid %x lbsy %x bb", pe->ppe, pe->cpu, pe->window_valid, pe->window_lbsy);
+        for (j = 0; j < A64FX_HWB_SNAPSHOT_WINDOWS; j++)
+        {
+            slen += scnprintf(&buf[slen], PAGE_SIZE-slen, " %d", pe->window_blade[j]);
+        }
+        slen += scnprintf(&buf[slen], PAGE_SIZE-slen, "\n");
+    }
+    return slen;
 }
 
-static ssize_t init_sync_bb2_show(struct kobject *kobj, struct kobj_attribute * attr, char* buf)
+// Hanging barriers: for every allocated blade the PEs of the BST_MASK which did not
+// arrive in the current episode and their CPUs, served from the snapshot
+static ssize_t blade_status_show(struct kobject *kobj, struct kobj_attribute * attr, char* buf)
 {
+    int i = 0, j = 0;
+    int err = 0;
+    int slen = 0;
+    unsigned long pending = 0;
+    struct cpumask cpus;
+    struct a64fx_hwb_snapshot snap;
     struct a64fx_cmg_device *cmg = kobj_to_cmg(kobj);
-    return init_sync_bb_show(cmg, 2, buf);
+
+    err = get_cmg_snapshot(cmg, &snap);
+    if (err < 0)
+    {
+        return err;
+    }
+    slen += scnprintf(&buf[slen], PAGE_SIZE-slen, "timestamp %llu\n", snap.timestamp_ns);
+    for (i = 0; i < A64FX_HWB_SNAPSHOT_BLADES; i++)
+    {
+        struct a64fx_hwb_snapshot_blade *bb = &snap.blade[i];
+        if (!bb->active)
+        {
+            continue;
+        }
+        pending = a64fx_hwb_pending_pes(bb->bst_mask, bb->bst, bb->lbsy);
+        cpumask_clear(&cpus);
+        for_each_set_bit(j, &pending, MAX_PE_PER_CMG)
+        {
+            if (cmg->pe_map[j].cpu_id >= 0)
+            {
+                cpumask_set_cpu(cmg->pe_map[j].cpu_id, &cpus);
+            }
+        }
+        slen += scnprintf(&buf[slen], PAGE_SIZE-slen, "bb %d mask %.4x bst %.4x lbsy %d pending %.4lx cpus %*pbl\n",
+                          i, bb->bst_mask, bb->bst, bb->lbsy, pending, cpumask_pr_args(&cpus));
+    }
+    return slen;
 }
 
-static ssize_t init_sync_bb3_show(struct kobject *kobj, struct kobj_attribute * attr, char* buf)
+static ssize_t snapshot_reads_show(struct kobject *kobj, struct kobj_attribute * attr, char* buf)
 {
     struct a64fx_cmg_device *cmg = kobj_to_cmg(kobj);
-    return init_sync_bb_show(cmg, 3, buf);
+    return scnprintf(buf, PAGE_SIZE, "%lu\n", READ_ONCE(cmg->snapshot_reads));
 }
 
-static ssize_t init_sync_bb4_show(struct kobject *kobj, struct kobj_attribute * attr, char* buf)
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,13,0)
+static ssize_t snapshot_bin_read(struct file *filp, struct kobject *kobj, struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+#else
+static ssize_t snapshot_bin_read(struct file *filp, struct kobject *kobj, const struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+#endif
 {
+    int err = 0;
+    struct a64fx_hwb_snapshot snap;
     struct a64fx_cmg_device *cmg = kobj_to_cmg(kobj);
-    return init_sync_bb_show(cmg, 4, buf);
+
+    err = get_cmg_snapshot(cmg, &snap);
+    if (err < 0)
+    {
+        return err;
+    }
+    return memory_read_from_buffer(buf, count, &off, &snap, sizeof(struct a64fx_hwb_snapshot));
 }
 
-static ssize_t init_sync_bb5_show(struct kobject *kobj, struct kobj_attribute * attr, char* buf)
+static ssize_t init_sync_bb_show(struct a64fx_cmg_device *cmg, int blade, char* buf)
 {
-    struct a64fx_cmg_device *cmg = kobj_to_cmg(kobj);
-    return init_sync_bb_show(cmg, 5, buf);
+    int err = 0;
+    struct a64fx_hwb_snapshot snap;
+
+    err = get_cmg_snapshot(cmg, &snap);
+    if (err < 0)
+    {
+        return err;
+    }
+    return scnprintf(buf, PAGE_SIZE, "%.4x\n%.4x\n", snap.blade[blade].bst_mask, snap.blade[blade].bst);
 }
 
+#define INIT_SYNC_BB_ATTR(n) \
+static ssize_t init_sync_bb##n##_show(struct kobject *kobj, struct kobj_attribute * attr, char* buf) \
+{ \
+    return init_sync_bb_show(kobj_to_cmg(kobj), n, buf); \
+} \
+static struct kobj_attribute init_sync_bb##n##_attr = __ATTR(init_sync_bb##n, 0400, init_sync_bb##n##_show, NULL)
+
+INIT_SYNC_BB_ATTR(0);
+INIT_SYNC_BB_ATTR(1);
+INIT_SYNC_BB_ATTR(2);
+INIT_SYNC_BB_ATTR(3);
+INIT_SYNC_BB_ATTR(4);
+INIT_SYNC_BB_ATTR(5);
+
 static struct kobj_attribute core_map_attr = __ATTR(core_map, 0444, core_map_show, NULL);
 static struct kobj_attribute used_bb_map_attr = __ATTR(used_bb_bmap, 0444, used_bb_bmap_show, NULL);
 static struct kobj_attribute used_bw_map_attr = __ATTR(used_bw_bmap, 0444, used_bw_bmap_show, NULL);
-static struct kobj_attribute init_sync_bb0_attr = __ATTR(init_sync_bb0, 0400, init_sync_bb0_show, NULL);
-static struct kobj_attribute init_sync_bb1_attr = __ATTR(init_sync_bb1, 0400, init_sync_bb1_show, NULL);
-static struct kobj_attribute init_sync_bb2_attr = __ATTR(init_sync_bb2, 0400, init_sync_bb2_show, NULL);
-static struct kobj_attribute init_sync_bb3_attr = __ATTR(init_sync_bb3, 0400, init_sync_bb3_show, NULL);
-static struct kobj_attribute init_sync_bb4_attr = __ATTR(init_sync_bb4, 0400, init_sync_bb4_show, NULL);
-static struct kobj_attribute init_sync_bb5_attr = __ATTR(init_sync_bb5, 0400, init_sync_bb5_show, NULL);
+static struct kobj_attribute wait_stats_attr = __ATTR(wait_stats, 0444, wait_stats_show, NULL);
+static struct kobj_attribute ipi_stats_attr = __ATTR(ipi_stats, 0444, ipi_stats_show, NULL);
+static struct kobj_attribute snapshot_attr = __ATTR(snapshot, 0444, snapshot_show, NULL);
+static struct kobj_attribute blade_status_attr = __ATTR(blade_status, 0444, blade_status_show, NULL);
+static struct kobj_attribute snapshot_reads_attr = __ATTR(snapshot_reads, 0444, snapshot_reads_show, NULL);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0) && LINUX_VERSION_CODE < KERNEL_VERSION(6,16,0)
+static const struct bin_attribute snapshot_bin_attr = {
+    .attr = { .name = "snapshot_bin", .mode = 0444 },
+    .read_new = snapshot_bin_read,
+    .size = sizeof(struct a64fx_hwb_snapshot),
+};
+#else
+static struct bin_attribute snapshot_bin_attr = {
+    .attr = { .name = "snapshot_bin", .mode = 0444 },
+    .read = snapshot_bin_read,
+    .size = sizeof(struct a64fx_hwb_snapshot),
+};
+#endif
 struct kobj_type* kobjtype = NULL;
 
 
@@ -131,6 +361,11 @@ static struct attribute *cmg_attrs[] = {
     &core_map_attr.attr,
     &used_bb_map_attr.attr,
     &used_bw_map_attr.attr,
+    &wait_stats_attr.attr,
+    &ipi_stats_attr.attr,
+    &snapshot_attr.attr,
+    &snapshot_reads_attr.attr,
+    &blade_status_attr.attr,
     &init_sync_bb0_attr.attr,
     &init_sync_bb1_attr.attr,
     &init_sync_bb2_attr.attr,
@@ -146,16 +381,6 @@ static struct attribute_group cmg_group_attrs = {
 };
 
 
-void init_cmgmask(struct a64fx_cmg_device* dev)
-{
-    int i = 0;
-    for (i = 0; i < dev->num_pes; i++)
-    {
-        cpumask_set_cpu(dev->pe_map[i].cpu_id, &dev->cmgmask);
-    }
-}
-
-
 int initialize_cmg(int cmg_id, struct a64fx_cmg_device* dev, struct kobject* parent)
 {
     int ret = 0;
@@ -165,7 +390,11 @@ int initialize_cmg(int cmg_id, struct a64fx_cmg_device* dev, struct kobject* par
     dev->bb_active = 0x0U;
     dev->cmg_id = cmg_id;
     spin_lock_init(&dev->cmg_lock);
-    init_cmgmask(dev);
+    mutex_init(&dev->snapshot_lock);
+    dev->snapshot_time = 0;
+    dev->snapshot_reads = 0;
+    // filled by the CPU hotplug callbacks
+    cpumask_clear(&dev->cmgmask);
 
     if (!kobjtype)
     {
@@ -188,6 +417,12 @@ int initialize_cmg(int cmg_id, struct a64fx_cmg_device* dev, struct kobject* par
         pr_err("Cannot create sysfs files for CMG%d\n", cmg_id);
         return ret;
     }
+    ret = sysfs_create_bin_file(&dev->kobj, &snapshot_bin_attr);
+    if (ret) {
+        pr_err("Cannot create binary snapshot file for CMG%d\n", cmg_id);
+        sysfs_remove_group(&dev->kobj, &cmg_group_attrs);
+        return ret;
+    }
     return 0;
 }
 
@@ -196,6 +431,7 @@ void destroy_cmg(struct a64fx_cmg_device* dev)
     if (dev)
     {
         pr_debug("destroy CMG%d\n", dev->cmg_id);
+        sysfs_remove_bin_file(&dev->kobj, &snapshot_bin_attr);
         sysfs_remove_group(&dev->kobj, &cmg_group_attrs);
         kobject_put(&dev->kobj);
     }
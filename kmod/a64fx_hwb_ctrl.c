@@ -0,0 +1,155 @@
+#define pr_fmt(fmt) "%s:%s: " fmt, KBUILD_MODNAME, __func__
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/smp.h>
+#include <linux/sched.h>
+#include <linux/cpumask.h>
+
+#include "a64fx_hwb.h"
+#include "a64fx_hwb_topo.h"
+#include "a64fx_hwb_ctrl.h"
+
+/*
+ * CPU selection for the control path. The blade registers can be written on any PE of
+ * the CMG, so a cross call for them should not interrupt a compute core of a running
+ * job. The preference is:
+ *  1. the calling CPU, if it is on the CMG (no IPI)
+ *  2. a housekeeping CPU of the CMG (module parameter housekeeping_cpus)
+ *  3. an idle CPU, i.e. one that is not running a task (idle_cpu())
+ *  4. a CPU without assigned windows, it is not part of a barrier team
+ *  5. any CPU of the CMG
+ * The window registers are PE-local, a thread assigning its own window writes it
+ * directly. Where the writes ended up is counted per CMG in CMGx/ipi_stats, the waves
+ * that clear the windows of a team or a CMG are counted per CPU in the same tiers.
+ */
+
+static char *housekeeping_cpus = "";
+module_param(housekeeping_cpus, charp, 0444);
+MODULE_PARM_DESC(housekeeping_cpus, "CPU list preferred for the blade register writes, e.g. 0,12,24,36 (default none)");
+
+static struct cpumask housekeeping_mask;
+
+int a64fx_hwb_ctrl_init(void)
+{
+    int err = 0;
+    cpumask_clear(&housekeeping_mask);
+    if (housekeeping_cpus && housekeeping_cpus[0] != '\0')
+    {
+        err = cpulist_parse(housekeeping_cpus, &housekeeping_mask);
+        if (err < 0)
+        {
+            pr_err("Invalid housekeeping CPU list '%s'\n", housekeeping_cpus);
+            return err;
+        }
+    }
+    return 0;
+}
+
+// Execute func on a CPU of the CMG, selected as described above. Has to be called with
+// the device lock held, the window bookkeeping must not change during the selection.
+int a64fx_hwb_ctrl_call_cmg(struct a64fx_cmg_device *cmg, smp_call_func_t func, void *info)
+{
+    int cpu = 0;
+    int self = smp_processor_id();
+    int hk = -1;
+    int idle = -1;
+    int unassigned = -1;
+    int target = -1;
+    struct a64fx_cpu_topo* topo = NULL;
+
+    if (cpumask_test_cpu(self, &cmg->cmgmask))
+    {
+        atomic_long_inc(&cmg->ipi_stats.local);
+        return smp_call_function_single(self, func, info, 1);
+    }
+    for_each_cpu(cpu, &cmg->cmgmask)
+    {
+        if (cpumask_test_cpu(cpu, &housekeeping_mask))
+        {
+            hk = cpu;
+            break;
+        }
+        if (target < 0)
+        {
+            target = cpu;
+        }
+        if (idle < 0 && idle_cpu(cpu))
+        {
+            idle = cpu;
+        }
+        topo = a64fx_hwb_topo(cpu);
+        if (unassigned < 0 && topo && topo->pe->bw_map == 0x0UL)
+        {
+            unassigned = cpu;
+        }
+    }
+    if (hk >= 0)
+    {
+        target = hk;
+        atomic_long_inc(&cmg->ipi_stats.housekeeping);
+    }
+    else if (idle >= 0)
+    {
+        target = idle;
+        atomic_long_inc(&cmg->ipi_stats.idle);
+    }
+    else if (unassigned >= 0)
+    {
+        target = unassigned;
+        atomic_long_inc(&cmg->ipi_stats.unassigned);
+    }
+    else if (target >= 0)
+    {
+        atomic_long_inc(&cmg->ipi_stats.busy);
+    }
+    else
+    {
+        pr_debug("No online CPU on CMG %d\n", cmg->cmg_id);
+        return -ENXIO;
+    }
+    pr_debug("Control path of CMG %d on CPU %d\n", cmg->cmg_id, target);
+    return smp_call_function_single(target, func, info, 1);
+}
+
+// Execute func for the PE of the calling CPU, which has to stay on the CPU (device
+// lock held or preemption disabled)
+void a64fx_hwb_ctrl_call_local(struct a64fx_cmg_device *cmg, smp_call_func_t func, void *info)
+{
+    atomic_long_inc(&cmg->ipi_stats.local);
+    func(info);
+}
+
+// Count the CPUs of a cross call wave (on_each_cpu_mask) to mask. Has to be called with
+// the device lock held and before the windows of the wave are removed from the
+// bookkeeping, the CPUs losing their windows are busy.
+void a64fx_hwb_ctrl_count_wave(struct a64fx_cmg_device *cmg, const struct cpumask *mask)
+{
+    int cpu = 0;
+    int self = smp_processor_id();
+    struct a64fx_cpu_topo* topo = NULL;
+
+    for_each_cpu(cpu, mask)
+    {
+        topo = a64fx_hwb_topo(cpu);
+        if (cpu == self)
+        {
+            atomic_long_inc(&cmg->ipi_stats.local);
+        }
+        else if (cpumask_test_cpu(cpu, &housekeeping_mask))
+        {
+            atomic_long_inc(&cmg->ipi_stats.housekeeping);
+        }
+        else if (idle_cpu(cpu))
+        {
+            atomic_long_inc(&cmg->ipi_stats.idle);
+        }
+        else if (topo && topo->pe->bw_map == 0x0UL)
+        {
+            atomic_long_inc(&cmg->ipi_stats.unassigned);
+        }
+        else
+        {
+            atomic_long_inc(&cmg->ipi_stats.busy);
+        }
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef A64FX_HWB_CTRL_H
+#define A64FX_HWB_CTRL_H
+
+#include <linux/smp.h>
+
+#include "a64fx_hwb.h"
+
+int a64fx_hwb_ctrl_init(void);
+int a64fx_hwb_ctrl_call_cmg(struct a64fx_cmg_device *cmg, smp_call_func_t func, void *info);
+void a64fx_hwb_ctrl_call_local(struct a64fx_cmg_device *cmg, smp_call_func_t func, void *info);
+void a64fx_hwb_ctrl_count_wave(struct a64fx_cmg_device *cmg, const struct cpumask *mask);
+
+#endif
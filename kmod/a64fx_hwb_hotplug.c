@@ -0,0 +1,196 @@
+#define pr_fmt(fmt) "%s:%s: " fmt, KBUILD_MODNAME, __func__
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/cpuhotplug.h>
+#include <linux/syscore_ops.h>
+#include <linux/smp.h>
+#include <linux/cpumask.h>
+
+#include "a64fx_hwb.h"
+#include "a64fx_hwb_asm.h"
+#include "a64fx_hwb_ioctl.h"
+#include "a64fx_hwb_hotplug.h"
+#include "a64fx_hwb_topo.h"
+
+/*
+ * CPU hotplug and suspend/resume support. The PE map, the topology index, the CMG
+ * cpumasks and the EL0/EL1 access bits are maintained by a dynamic cpuhp state, so its online
+ * callback also performs the initial setup for all CPUs online at module load.
+ *
+ * A CPU going offline loses its window assignments and is removed from the blade
+ * masks of all allocations. For suspend (cpuhp_tasks_frozen), the bookkeeping is
+ * kept and the registers are rewritten when the CPU comes back: the windows of the
+ * PE and, if it is the first CPU of its CMG, all blades of the CMG. The boot CPU
+ * does not go through hotplug on suspend, it is restored by the syscore resume hook.
+ */
+
+static struct a64fx_hwb_device *hotplug_dev = NULL;
+static int hotplug_state = -1;
+
+// Recount the known PEs of a CMG, the PE map is indexed by the physical PE number
+static void update_num_pes(struct a64fx_hwb_device *dev, struct a64fx_cmg_device *cmg)
+{
+    int i = 0;
+    int count = 0;
+    for (i = 0; i < MAX_PE_PER_CMG; i++)
+    {
+        if (cmg->pe_map[i].cpu_id >= 0)
+        {
+            count++;
+        }
+    }
+    pr_debug("CMG %d has %d PEs\n", cmg->cmg_id, count);
+    cmg->num_pes = count;
+    if (count > dev->max_pe_per_cmg)
+    {
+        dev->max_pe_per_cmg = count;
+    }
+}
+
+// Get the PE map entry of the current CPU. The entry is returned even if it is not
+// filled yet, the CMG and PPE read from the hardware are returned in cmg and ppe.
+static struct a64fx_core_mapping* get_local_pe(struct a64fx_hwb_device *dev, int *cmg, int *ppe)
+{
+    if (oss_a64fx_hwb_get_peinfo(cmg, ppe) < 0)
+    {
+        return NULL;
+    }
+    if (*cmg >= MAX_NUM_CMG || *ppe >= MAX_PE_PER_CMG)
+    {
+        pr_err("CPU %d reports invalid CMG %d PPE %d\n", smp_processor_id(), *cmg, *ppe);
+        return NULL;
+    }
+    return &dev->cmgs[*cmg].pe_map[*ppe];
+}
+
+// Program the PE-local registers of the current CPU from the bookkeeping
+static void restore_pe(struct a64fx_core_mapping *pe)
+{
+    int window = 0;
+    u64 assign[MAX_BW_PER_CMG];
+    write_hwb_ctrl(1, 1);
+    for (window = 0; window < MAX_BW_PER_CMG; window++)
+    {
+        if (test_bit(window, &pe->bw_map) && pe->win_blades[window] >= 0)
+        {
+            pr_debug("Restore window %d to Blade %d on CPU %d\n", window, pe->win_blades[window], pe->cpu_id);
+            assign[window] = a64fx_hwb_assign_sync_wr_val(1, pe->win_blades[window]);
+        }
+        else
+        {
+            assign[window] = a64fx_hwb_assign_sync_wr_val(0, 0);
+        }
+    }
+    write_assign_sync_wr_bulk(A64FX_HWB_ALL_BW, assign);
+}
+
+static int a64fx_hwb_cpu_online(unsigned int cpu)
+{
+    int cmg_id = 0;
+    int ppe = 0;
+    int restore_blades = 0;
+    struct a64fx_hwb_device *dev = hotplug_dev;
+    struct a64fx_cmg_device *cmg = NULL;
+    struct a64fx_core_mapping *pe = get_local_pe(dev, &cmg_id, &ppe);
+    if (!pe)
+    {
+        return 0;
+    }
+    spin_lock(&dev->dev_lock);
+    cmg = &dev->cmgs[cmg_id];
+    if (pe->cpu_id != (int)cpu)
+    {
+        // PE seen for the first time, the pe_map entry is still unset
+        pe->cpu_id = (int)cpu;
+        pe->cmg_id = cmg_id;
+        pe->ppe_id = ppe;
+        pe->bw_map = 0x0;
+        memset(pe->win_blades, A64FX_HWB_UNASSIGNED_BB, sizeof(pe->win_blades));
+        update_num_pes(dev, cmg);
+        a64fx_hwb_topo_set((int)cpu, pe);
+    }
+    restore_blades = cpumask_empty(&cmg->cmgmask);
+    cpumask_set_cpu(cpu, &cmg->cmgmask);
+    restore_pe(pe);
+    if (restore_blades)
+    {
+        restore_cmg_blades(dev, cmg);
+    }
+    spin_unlock(&dev->dev_lock);
+    pr_debug("CPU %d online (CMG %d PPE %d)\n", cpu, pe->cmg_id, pe->ppe_id);
+    return 0;
+}
+
+static int a64fx_hwb_cpu_offline(unsigned int cpu)
+{
+    int cmg_id = 0;
+    int ppe = 0;
+    struct a64fx_hwb_device *dev = hotplug_dev;
+    struct a64fx_cmg_device *cmg = NULL;
+    struct a64fx_core_mapping *pe = get_local_pe(dev, &cmg_id, &ppe);
+    if ((!pe) || pe->cpu_id != (int)cpu)
+    {
+        return 0;
+    }
+    spin_lock(&dev->dev_lock);
+    cmg = &dev->cmgs[cmg_id];
+    cpumask_clear_cpu(cpu, &cmg->cmgmask);
+    if (!cpuhp_tasks_frozen)
+    {
+        teardown_cpu_allocations(dev, cmg, pe);
+    }
+    write_hwb_ctrl(0, 0);
+    spin_unlock(&dev->dev_lock);
+    pr_debug("CPU %d offline (CMG %d PPE %d)\n", cpu, pe->cmg_id, pe->ppe_id);
+    return 0;
+}
+
+// Runs on the boot CPU with interrupts disabled while all other CPUs are still offline
+static void a64fx_hwb_syscore_resume(void)
+{
+    int cmg_id = 0;
+    int ppe = 0;
+    struct a64fx_hwb_device *dev = hotplug_dev;
+    struct a64fx_core_mapping *pe = get_local_pe(dev, &cmg_id, &ppe);
+    if ((!pe) || pe->cpu_id < 0)
+    {
+        return;
+    }
+    spin_lock(&dev->dev_lock);
+    restore_pe(pe);
+    restore_cmg_blades(dev, &dev->cmgs[cmg_id]);
+    spin_unlock(&dev->dev_lock);
+    pr_debug("Restored CPU %d (CMG %d PPE %d)\n", pe->cpu_id, pe->cmg_id, pe->ppe_id);
+}
+
+static struct syscore_ops a64fx_hwb_syscore_ops = {
+    .resume = a64fx_hwb_syscore_resume,
+};
+
+int a64fx_hwb_hotplug_init(struct a64fx_hwb_device *dev)
+{
+    int ret = 0;
+    hotplug_dev = dev;
+    // Calls a64fx_hwb_cpu_online() on all online CPUs
+    ret = cpuhp_setup_state(CPUHP_AP_ONLINE_DYN, "misc/a64fx_hwb:online", a64fx_hwb_cpu_online, a64fx_hwb_cpu_offline);
+    if (ret < 0)
+    {
+        pr_err("Cannot register CPU hotplug state\n");
+        return ret;
+    }
+    hotplug_state = ret;
+    register_syscore_ops(&a64fx_hwb_syscore_ops);
+    return 0;
+}
+
+void a64fx_hwb_hotplug_exit(void)
+{
+    if (hotplug_state >= 0)
+    {
+        unregister_syscore_ops(&a64fx_hwb_syscore_ops);
+        // Calls a64fx_hwb_cpu_offline() on all online CPUs, disables EL0/EL1 access
+        cpuhp_remove_state(hotplug_state);
+        hotplug_state = -1;
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef A64FX_HWB_HOTPLUG_H
+#define A64FX_HWB_HOTPLUG_H
+
+#include "a64fx_hwb.h"
+
+int a64fx_hwb_hotplug_init(struct a64fx_hwb_device *dev);
+void a64fx_hwb_hotplug_exit(void);
+
+#endif
@@ -9,6 +9,11 @@
 #include <linux/uaccess.h>
 #include <linux/cpumask.h>
 #include <linux/bitmap.h>
+#include <linux/err.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/sched/task.h>
+#include <linux/capability.h>
 #include <include/linux/smp.h>
 #include <include/linux/cpumask.h>
 
@@ -16,41 +21,21 @@
 #include "a64fx_hwb_cmg.h"
 #include "a64fx_hwb_asm.h"
 #include "fujitsu_hpc_ioctl.h"
+#include "a64fx_hwb_uapi.h"
+#include "a64fx_hwb_wait.h"
+#include "a64fx_hwb_quota.h"
+#include "a64fx_hwb_topo.h"
+#include "a64fx_hwb_ctrl.h"
 
 // Function to check a given cpumask whether it contains only CPUs of a single
 // CMG, the mask contains at least two CPUs and all CPUs are online.
 static int check_cpumask(struct a64fx_hwb_device *dev, struct cpumask *cpumask)
 {
-    int i = 0;
-    int j = 0;
-    int cpu = -1;
-    int cmg = -1;
     if (cpumask_weight(cpumask) < 2)
     {
         return -EINVAL;
     }
-    for_each_cpu(cpu, cpumask)
-    {
-        if (!cpu_online(cpu)) return -1;
-        for (i = 0; i < dev->num_cmgs; i++)
-        {
-            for (j = 0; j < dev->cmgs[i].num_pes; j++)
-            {
-                if (dev->cmgs[i].pe_map[j].cpu_id == cpu)
-                {
-                    if (cmg < 0)
-                    {
-                        cmg = dev->cmgs[i].pe_map[j].cmg_id;
-                    }
-                    if (cmg != dev->cmgs[i].pe_map[j].cmg_id)
-                    {
-                        return -1;
-                    }
-                }
-            }
-        }
-    }
-    return cmg;
+    return a64fx_hwb_topo_cpumask_cmg(dev, cpumask);
 }
 
 
@@ -58,47 +43,15 @@ static int check_cpumask(struct a64fx_hwb_device *dev, struct cpumask *cpumask)
 // the phyiscal location of a CPU/PE inside a CMG
 static int cpumask_to_ppemask(struct a64fx_cmg_device* cmg, struct cpumask *cpumask, unsigned long* ppemask)
 {
-    int cpu = 0;
-    int i = 0;
-    unsigned long mask = 0x0UL;
     if ((!cmg) || (!ppemask) || (!cpumask))
     {
         return -EINVAL;
     }
-    for_each_cpu(cpu, cpumask)
-    {
-        for (i = 0; i < cmg->num_pes; i++)
-        {
-            if (cmg->pe_map[i].cpu_id == cpu)
-            {
-                pr_debug("CPU %d -> CMG %d PPE %d\n", cpu, cmg->cmg_id, cmg->pe_map[i].ppe_id);
-                set_bit(cmg->pe_map[i].ppe_id, &mask);
-            }
-        }
-    }
-    *ppemask = mask;
+    *ppemask = a64fx_hwb_topo_ppemask(cmg, cpumask);
+    pr_debug("CMG %d PPEmask 0x%lx\n", cmg->cmg_id, *ppemask);
     return 0;
 }
 
-// Get the core_mapping structure for a given CMG and PPE. The core_mapping contains the window
-// mapping
-static struct a64fx_core_mapping* get_pemap(struct a64fx_hwb_device *dev, int cmg, int ppe)
-{
-    int i = 0;
-    struct a64fx_core_mapping* pe = NULL;
-    struct a64fx_cmg_device *cmgdev = &dev->cmgs[cmg];
-    for (i = 0; i < cmgdev->num_pes; i++)
-    {
-        pe = &cmgdev->pe_map[i];
-        if (pe->cmg_id == cmg && pe->ppe_id == ppe)
-        {
-            return pe;
-        }
-    }
-    return NULL;
-}
-
-
 // Structure and function to be executed on a specific CPU via smp_call_function_*
 // for allocating a barrier blade for a set of CPUs (ppemask)
 struct hwb_allocate_info {
@@ -115,8 +68,8 @@ static void oss_a64fx_hwb_allocate_func(void* info)
 }
 
 
-// Structure and function to be executed on a specific CPU via smp_call_function_*
-// for assigning a CPU-local window to the CMG-wide barrier blade
+// Structure and function to be executed on the CPU owning the window via
+// a64fx_hwb_ctrl_call_local for assigning a CPU-local window to the CMG-wide barrier blade
 struct hwb_assign_info {
     int cpu;
     int cmg;
@@ -133,6 +86,28 @@ static void oss_a64fx_hwb_assign_func(void* info)
 }
 
 
+// Structure and function to be executed on all assigned CPUs of an allocation via
+// on_each_cpu_mask to release its windows with a single IPI wave. Each CPU clears the
+// windows in its entry of ppe_windows.
+struct hwb_release_info {
+    int blade;
+    unsigned long ppe_windows[MAX_PE_PER_CMG];
+};
+
+static void oss_a64fx_hwb_release_func(void* info)
+{
+    u8 cmg = 0, ppe = 0;
+    u64 unassigned[MAX_BW_PER_CMG] = {0};
+    struct hwb_release_info* rinfo = (struct hwb_release_info*) info;
+    read_peinfo(&cmg, &ppe);
+    if (ppe < MAX_PE_PER_CMG && rinfo->ppe_windows[ppe])
+    {
+        write_assign_sync_wr_bulk(rinfo->ppe_windows[ppe], unassigned);
+    }
+    pr_debug("Release windows 0x%lx of Blade %d on CPU %d\n", (ppe < MAX_PE_PER_CMG ? rinfo->ppe_windows[ppe] : 0x0UL), rinfo->blade, smp_processor_id());
+}
+
+
 // Each task can have multiple barriers allocated. The blade number inside the task contains information like participating
 // CPUs, assigned CPU-specific window registers, ...
 static struct a64fx_task_allocation * get_allocation(struct a64fx_cmg_device *cmg, struct a64fx_task_mapping *taskmap, int blade)
@@ -151,23 +126,24 @@ static struct a64fx_task_allocation * get_allocation(struct a64fx_cmg_device *cm
 }
 
 // Add a new allocation for a task for a barrier blade with the given cpumask. The cpumask should contain only CPUs located on the same CMG. In this module,
-// this is done in the IOCTL allocate function.
-static struct a64fx_task_allocation * new_allocation(struct a64fx_cmg_device *cmg, struct a64fx_task_mapping *taskmap, int blade, struct cpumask *cpumask)
+// this is done in the IOCTL allocate function. Returns the allocation or an ERR_PTR.
+static struct a64fx_task_allocation * new_allocation(struct a64fx_cmg_device *cmg, struct a64fx_task_mapping *taskmap, struct file *file, int blade, struct cpumask *cpumask)
 {
     int i = 0;
+    int err = 0;
     struct a64fx_task_allocation *alloc = NULL;
     struct hwb_allocate_info info = {0, 0UL};
     alloc = get_allocation(cmg, taskmap, blade);
     if (alloc)
     {
         pr_debug("Error allocation already exists\n");
-        return NULL;
+        return ERR_PTR(-EEXIST);
     }
     // no allocation for blade on CMG, allocate new one
     alloc = kmalloc(sizeof(struct a64fx_task_allocation), GFP_KERNEL);
     if (!alloc)
     {
-        return NULL;
+        return ERR_PTR(-ENOMEM);
     }
     pr_debug("New allocation for CMG %d and Blade %d\n", cmg->cmg_id, blade);
     // save all required data in the allocation and add it to the task's allocations
@@ -176,6 +152,8 @@ static struct a64fx_task_allocation * new_allocation(struct a64fx_cmg_device *cm
     for (i = 0; i < MAX_PE_PER_CMG; i++)
         alloc->window[i] = A64FX_HWB_UNASSIGNED_WIN;
     alloc->task = taskmap->task;
+    alloc->file = file;
+    alloc->quota = NULL;
     INIT_LIST_HEAD(&alloc->list);
     alloc->assign_count = 0;
     cpumask_clear(&alloc->assign_mask);
@@ -190,22 +168,32 @@ static struct a64fx_task_allocation * new_allocation(struct a64fx_cmg_device *cm
     info.cmg = cmg->cmg_id;
     cpumask_to_ppemask(cmg, &alloc->cpumask, &info.ppemask);
     pr_debug("PPEmask is 0x%lx\n", info.ppemask);
-    smp_call_function_any(&cmg->cmgmask, oss_a64fx_hwb_allocate_func, &info, 1);
+    err = a64fx_hwb_ctrl_call_cmg(cmg, oss_a64fx_hwb_allocate_func, &info);
+    if (err < 0)
+    {
+        // blade register not written, the blade stays free
+        pr_debug("Cannot write Blade %d on CMG %d: %d\n", blade, cmg->cmg_id, err);
+        list_del(&alloc->list);
+        taskmap->num_allocs--;
+        kfree(alloc);
+        return ERR_PTR(err);
+    }
     pr_debug("Set blade %d in CMG %d active\n", info.blade, info.cmg);
     set_bit(info.blade, &cmg->bb_active);
 
     pr_debug("Task %d has %d allocations\n", task_pid_nr(taskmap->task), taskmap->num_allocs);
-    return 0;
+    return alloc;
 }
 
-// Helper function to create a new allocation if it does not already exist
-static struct a64fx_task_allocation * register_allocation(struct a64fx_cmg_device *cmg, struct a64fx_task_mapping *taskmap, int blade, struct cpumask *cpumask)
+// Helper function to create a new allocation if it does not already exist. Returns the
+// allocation or an ERR_PTR.
+static struct a64fx_task_allocation * register_allocation(struct a64fx_cmg_device *cmg, struct a64fx_task_mapping *taskmap, struct file *file, int blade, struct cpumask *cpumask)
 {
     struct a64fx_task_allocation *alloc = NULL;
     alloc = get_allocation(cmg, taskmap, blade);
     if (!alloc)
     {
-        alloc = new_allocation(cmg, taskmap, blade, cpumask);
+        alloc = new_allocation(cmg, taskmap, file, blade, cpumask);
     }
     return alloc;
 }
@@ -213,61 +201,72 @@ static struct a64fx_task_allocation * register_allocation(struct a64fx_cmg_devic
 
 // Free an allocation. We have to check whether there are still CPUs assigned to the blade
 // associated with an allocation. If there are, free the window registers on the still assigned CPUs
-// Afterwards the barrier blade register is freed and the allocation removed for the task
+// Afterwards the barrier blade register is freed and the allocation removed for the task.
+// The allocation is also removed if the blade register cannot be written because no CPU of
+// the CMG is online, restore_cmg_blades() clears it when the first one comes back. The
+// error is returned nevertheless.
 static int free_allocation(struct a64fx_cmg_device *cmg, struct a64fx_task_mapping *taskmap, struct a64fx_task_allocation* alloc)
 {
-    int i = 0;
+    int err = 0;
     struct hwb_allocate_info info = {0, 0UL};
     if (test_bit(alloc->blade, &cmg->bb_active))
     {
         int cpu = 0;
+        int window = 0;
+        struct cpumask wave;
+        struct hwb_release_info rinfo;
+
+        memset(&rinfo, 0, sizeof(struct hwb_release_info));
+        rinfo.blade = alloc->blade;
+        cpumask_and(&wave, &alloc->assign_mask, cpu_online_mask);
+        a64fx_hwb_ctrl_count_wave(cmg, &wave);
         if (alloc->assign_count > 0)
         {
             struct a64fx_core_mapping* pemap = NULL;
+            struct a64fx_cpu_topo* topo = NULL;
             pr_err("Allocation (PID %d CMG %d Blade %d) still assigned by %d threads\n", task_pid_nr(taskmap->task), alloc->cmg, alloc->blade, alloc->assign_count);
             for_each_cpu(cpu, &alloc->assign_mask)
             {
-                struct hwb_assign_info ainfo = {
-                    .cpu = cpu,
-                    .cmg = alloc->cmg,
-                    .blade = 0,
-                    .valid = 0,
-                };
-                for (i = 0; i < cmg->num_pes; i++)
+                topo = a64fx_hwb_topo(cpu);
+                if (!topo)
                 {
-                    if (cmg->pe_map[i].cpu_id == cpu)
-                    {
-                        pemap = &cmg->pe_map[i];
-                        break;
-                    }
+                    continue;
                 }
-                ainfo.window = alloc->window[pemap->ppe_id];
-                if (alloc->window[pemap->ppe_id] >= 0 && alloc->window[pemap->ppe_id] < MAX_BW_PER_CMG)
+                pemap = topo->pe;
+                window = alloc->window[pemap->ppe_id];
+                if (window >= 0 && window < MAX_BW_PER_CMG)
                 {
-                    pr_debug("Clear window %d on CPU %d\n", alloc->window[pemap->ppe_id], cpu);
-                    smp_call_function_single(pemap->cpu_id, oss_a64fx_hwb_assign_func, &ainfo, 1);
+                    pr_debug("Clear window %d on CPU %d\n", window, cpu);
+                    set_bit(window, &rinfo.ppe_windows[pemap->ppe_id]);
                     cpumask_clear_cpu(cpu, &alloc->assign_mask);
-                    clear_bit(alloc->window[pemap->ppe_id], &pemap->bw_map);
+                    clear_bit(window, &pemap->bw_map);
+                    pemap->win_blades[window] = A64FX_HWB_UNASSIGNED_BB;
                     alloc->window[pemap->ppe_id] = A64FX_HWB_UNASSIGNED_WIN;
                     alloc->assign_count--;
                 }
             }
         }
         pr_debug("PID %d free BB %d at CMG %d\n", task_pid_nr(taskmap->task), alloc->blade, alloc->cmg);
+        if (!cpumask_empty(&wave))
+        {
+            on_each_cpu_mask(&wave, oss_a64fx_hwb_release_func, &rinfo, 1);
+        }
+        // the blade after its windows, not on a compute core of the team if avoidable
         info.blade = alloc->blade;
         info.cmg = alloc->cmg;
         info.ppemask = 0x0UL;
-        smp_call_function_any(&cmg->cmgmask, oss_a64fx_hwb_allocate_func, &info, 1);
+        err = a64fx_hwb_ctrl_call_cmg(cmg, oss_a64fx_hwb_allocate_func, &info);
         clear_bit(alloc->blade, &cmg->bb_active);
     }
     else
     {
         pr_debug("AAAH! Task %d free inactive Blade %d at CMG %d\n", task_pid_nr(taskmap->task), alloc->blade, alloc->cmg);
     }
+    a64fx_hwb_quota_uncharge(alloc);
     list_del(&alloc->list);
     kfree(alloc);
     taskmap->num_allocs--;
-    return 0;
+    return err;
 }
 
 // Helper function to the task->allocation mapping for a task. The task group identifier
@@ -304,7 +303,11 @@ static struct a64fx_task_mapping * new_taskmap(struct a64fx_hwb_device *dev, str
         return NULL;
     }
     pr_debug("New task (PID %d TGID %d)\n", task_pid_nr(task), task_tgid_nr(task));
+    // Keep references, the task may exit without releasing the device
+    get_task_struct(task);
     taskmap->task = task;
+    get_task_struct(task->group_leader);
+    taskmap->leader = task->group_leader;
     pr_debug("Initialize list of allocations\n");
     taskmap->num_allocs = 0;
     INIT_LIST_HEAD(&taskmap->allocs);
@@ -337,6 +340,8 @@ int unregister_task(struct a64fx_hwb_device *dev, struct a64fx_task_mapping *tas
         }
         pr_debug("Remove task %d\n", task_pid_nr(taskmap->task));
         list_del(&taskmap->list);
+        put_task_struct(taskmap->leader);
+        put_task_struct(taskmap->task);
         kfree(taskmap);
         dev->num_tasks--;
         pr_debug("Currently %d/ tasks with allocations\n", dev->num_tasks);
@@ -345,18 +350,158 @@ int unregister_task(struct a64fx_hwb_device *dev, struct a64fx_task_mapping *tas
 }
 
 
-// Get the CMG and phyiscal PE offset inside the CMG from the hardware
-// The A64FX provides a special register on each CPU for this purpose
-static int _oss_a64fx_hwb_get_peinfo(u8* cmg, u8 * ppe)
+// A process is dead when its group leader exited and no other thread of the group is left.
+// The leader stays a zombie until all threads are gone.
+static int taskmap_dead(struct a64fx_task_mapping *taskmap)
 {
-    u64 val = 0;
-    asm volatile ("MRS %0, S3_0_C11_C12_4" : "=r"(val) );
-    *ppe = (u8)(val & 0xF);
-    *cmg = (u8)((val >> 4) & 0x3);
-    pr_debug("get_peinfo for CPU %d CMG%u PPE %u Raw 0x%llX\n", smp_processor_id(), *cmg, *ppe, val);
-    return 0;
+    return taskmap->leader->exit_state && thread_group_empty(taskmap->leader);
+}
+
+// Free the allocations made through the given file. Called when the last reference to
+// the file is dropped, independent of the task closing it. Allocations of the same
+// process through other files (e.g. ulib and hwbx open the device separately) stay.
+void reclaim_file_allocations(struct a64fx_hwb_device *dev, struct file *file)
+{
+    int freed = 0;
+    struct list_head *cur = NULL, *tmp = NULL;
+    struct list_head *alloccur = NULL, *alloctmp = NULL;
+    struct a64fx_task_mapping *taskmap = NULL;
+    struct a64fx_task_allocation *alloc = NULL;
+    list_for_each_safe(cur, tmp, &dev->task_list)
+    {
+        taskmap = list_entry(cur, struct a64fx_task_mapping, list);
+        freed = 0;
+        list_for_each_safe(alloccur, alloctmp, &taskmap->allocs)
+        {
+            alloc = list_entry(alloccur, struct a64fx_task_allocation, list);
+            if (alloc->file == file)
+            {
+                free_allocation(&dev->cmgs[(int)alloc->cmg], taskmap, alloc);
+                freed++;
+            }
+        }
+        if (freed > 0)
+        {
+            pr_debug("Release of file frees %d allocations of TGID %d\n", freed, task_tgid_nr(taskmap->task));
+            dev->reclaim_release.tasks++;
+            dev->reclaim_release.blades += freed;
+        }
+        // also mappings emptied earlier e.g. by a reset, they are recreated on the next allocation
+        if (taskmap->num_allocs == 0)
+        {
+            unregister_task(dev, taskmap);
+        }
+    }
+}
+
+// Free the allocations of an exiting process
+void reclaim_task_allocations(struct a64fx_hwb_device *dev, struct task_struct *task)
+{
+    struct a64fx_task_mapping *taskmap = get_taskmap(dev, task);
+    if (taskmap)
+    {
+        pr_debug("Exit of TGID %d frees %d allocations\n", task_tgid_nr(task), taskmap->num_allocs);
+        dev->reclaim_release.tasks++;
+        dev->reclaim_release.blades += taskmap->num_allocs;
+        unregister_task(dev, taskmap);
+    }
+}
+
+// Leak scanner: free the allocations of processes that died without releasing them,
+// e.g. because a child process still holds the inherited file descriptor.
+// Returns the number of reclaimed tasks.
+int reclaim_dead_tasks(struct a64fx_hwb_device *dev)
+{
+    int count = 0;
+    struct list_head *cur = NULL, *tmp = NULL;
+    struct a64fx_task_mapping *taskmap = NULL;
+    list_for_each_safe(cur, tmp, &dev->task_list)
+    {
+        taskmap = list_entry(cur, struct a64fx_task_mapping, list);
+        if (taskmap_dead(taskmap))
+        {
+            pr_debug("TGID %d is dead, free %d allocations\n", task_tgid_nr(taskmap->task), taskmap->num_allocs);
+            dev->reclaim_scan.tasks++;
+            dev->reclaim_scan.blades += taskmap->num_allocs;
+            unregister_task(dev, taskmap);
+            count++;
+        }
+    }
+    return count;
+}
+
+// Called on a CPU that goes offline. Its window assignments are removed and the CPU is dropped
+// from the blade masks of all allocations, so the remaining CPUs of a team can still
+// synchronize. Executed on the outgoing CPU itself, so the registers are written directly.
+// The device lock has to be held.
+void teardown_cpu_allocations(struct a64fx_hwb_device *dev, struct a64fx_cmg_device *cmg, struct a64fx_core_mapping *pe)
+{
+    int window = 0;
+    unsigned long ppemask = 0x0UL;
+    struct list_head *taskcur = NULL, *alloccur = NULL;
+    struct a64fx_task_mapping *taskmap = NULL;
+    struct a64fx_task_allocation *alloc = NULL;
+
+    list_for_each(taskcur, &dev->task_list)
+    {
+        taskmap = list_entry(taskcur, struct a64fx_task_mapping, list);
+        list_for_each(alloccur, &taskmap->allocs)
+        {
+            alloc = list_entry(alloccur, struct a64fx_task_allocation, list);
+            if (alloc->cmg != cmg->cmg_id || (!cpumask_test_cpu(pe->cpu_id, &alloc->cpumask)))
+            {
+                continue;
+            }
+            window = alloc->window[pe->ppe_id];
+            if (window >= 0 && window < MAX_BW_PER_CMG)
+            {
+                pr_debug("Clear window %d on offline CPU %d\n", window, pe->cpu_id);
+                write_assign_sync_wr(window, 0, 0);
+                clear_bit(window, &pe->bw_map);
+                pe->win_blades[window] = A64FX_HWB_UNASSIGNED_BB;
+                alloc->window[pe->ppe_id] = A64FX_HWB_UNASSIGNED_WIN;
+                cpumask_clear_cpu(pe->cpu_id, &alloc->assign_mask);
+                alloc->assign_count--;
+            }
+            cpumask_clear_cpu(pe->cpu_id, &alloc->cpumask);
+            cpumask_to_ppemask(cmg, &alloc->cpumask, &ppemask);
+            pr_debug("Remove CPU %d from Blade %d on CMG %d (PPEmask 0x%lx)\n", pe->cpu_id, alloc->blade, cmg->cmg_id, ppemask);
+            write_init_sync_bb(alloc->blade, ppemask);
+        }
+    }
+}
+
+// Rewrite all blade registers of a CMG from the bookkeeping, e.g. after the CMG was powered
+// down. Has to be executed on a CPU of the CMG with the device lock held.
+void restore_cmg_blades(struct a64fx_hwb_device *dev, struct a64fx_cmg_device *cmg)
+{
+    unsigned long ppemask = 0x0UL;
+    u64 blades[MAX_BB_PER_CMG] = {0};
+    struct list_head *taskcur = NULL, *alloccur = NULL;
+    struct a64fx_task_mapping *taskmap = NULL;
+    struct a64fx_task_allocation *alloc = NULL;
+
+    // inactive blades stay zero
+    list_for_each(taskcur, &dev->task_list)
+    {
+        taskmap = list_entry(taskcur, struct a64fx_task_mapping, list);
+        list_for_each(alloccur, &taskmap->allocs)
+        {
+            alloc = list_entry(alloccur, struct a64fx_task_allocation, list);
+            if (alloc->cmg == cmg->cmg_id)
+            {
+                cpumask_to_ppemask(cmg, &alloc->cpumask, &ppemask);
+                pr_debug("Restore Blade %d on CMG %d (PPEmask 0x%lx)\n", alloc->blade, cmg->cmg_id, ppemask);
+                blades[alloc->blade] = a64fx_hwb_init_sync_bb_val(ppemask);
+            }
+        }
+    }
+    write_init_sync_bb_bulk(A64FX_HWB_ALL_BB, blades);
 }
 
+
+// Get the CMG and phyiscal PE offset inside the CMG from the hardware
+// The A64FX provides a special register on each CPU for this purpose
 int oss_a64fx_hwb_get_peinfo(int *cmg, int *ppe)
 {
     int err = 0;
@@ -401,17 +546,18 @@ int oss_a64fx_hwb_get_peinfo_ioctl(unsigned long arg)
 }
 
 
-// Allocate a barrier blade with the given cpumask at the given CMG
+// Allocate a barrier blade with the given cpumask at the given CMG for a task
 // It returns the barrier blade allocated to be used by the user-space library as part of its bbid
-int oss_a64fx_hwb_allocate(struct a64fx_hwb_device *dev, int cmg, struct cpumask *cpumask, int *blade)
+int oss_a64fx_hwb_allocate(struct a64fx_hwb_device *dev, struct task_struct *task, struct file *file, int cmg, struct cpumask *cpumask, int *blade)
 {
     int err = 0;
     int bit = 0;
     struct a64fx_cmg_device *cmgdev = NULL;
     struct a64fx_task_mapping *taskmap = NULL;
-    
-    struct task_struct* current_task = get_current();
-    if (cmg < 0 || cmg > MAX_NUM_CMG || (!blade))
+    struct a64fx_task_allocation *alloc = NULL;
+    struct a64fx_hwb_quota *quota = NULL;
+
+    if (cmg < 0 || cmg >= MAX_NUM_CMG || (!task) || (!blade))
     {
         return -EINVAL;
     }
@@ -419,10 +565,10 @@ int oss_a64fx_hwb_allocate(struct a64fx_hwb_device *dev, int cmg, struct cpumask
     // acquire lock
     spin_lock(&dev->dev_lock);
 
-    taskmap = get_taskmap(dev, current_task);
+    taskmap = get_taskmap(dev, task);
     if (!taskmap)
     {
-        taskmap = new_taskmap(dev, current_task);
+        taskmap = new_taskmap(dev, task);
         if (!taskmap)
         {
             pr_err("Failed to register task or get existing mapping\n");
@@ -431,14 +577,35 @@ int oss_a64fx_hwb_allocate(struct a64fx_hwb_device *dev, int cmg, struct cpumask
         }
     }
     cmgdev = &dev->cmgs[cmg];
+    // the mask was checked without the lock, a CPU may have gone offline since
+    if (!cpumask_subset(cpumask, &cmgdev->cmgmask))
+    {
+        pr_debug("cpumask not within the online CPUs of CMG %d\n", cmg);
+        err = -EINVAL;
+        goto allocate_exit;
+    }
     err = -ENODEV;
     // Search for a free barrier blade for a CMG
     bit = find_first_zero_bit(&cmgdev->bb_active, MAX_BB_PER_CMG);
     pr_debug("Blade %d is free, use it\n", bit);
     if (bit >= 0 && bit < dev->num_bb_per_cmg)
     {
-        // Free blade found, register the allocation
-        register_allocation(cmgdev, taskmap, bit, cpumask);
+        // Free blade found, check the quota of the task's cgroup
+        quota = a64fx_hwb_quota_charge(dev, task, cmg);
+        if (IS_ERR(quota))
+        {
+            err = PTR_ERR(quota);
+            goto allocate_exit;
+        }
+        // register the allocation
+        alloc = register_allocation(cmgdev, taskmap, file, bit, cpumask);
+        if (IS_ERR(alloc))
+        {
+            a64fx_hwb_quota_uncharge_cmg(quota, cmg);
+            err = PTR_ERR(alloc);
+            goto allocate_exit;
+        }
+        alloc->quota = quota;
         *blade = bit;
         err = 0;
     }
@@ -449,15 +616,37 @@ allocate_exit:
     return err;
 }
 
+// Read the pemask of a bb_ctl IOCTL argument from user-space and copy it to a kernel cpumask
+static int get_user_cpumask(struct fujitsu_hwb_ioc_bb_ctl *ioc_bb_ctl, struct cpumask *cpumask)
+{
+    int cpu = 0;
+    unsigned long mask = 0;
+    // Not 100% sure whether it is a single unsigned long or more. The ioc_bb_ctl contain a field
+    // for mask size which is currently not used. But since the A64FX has less than 64 CPUs, a single
+    // unsigned long should be enough.
+    if (copy_from_user(&mask, (unsigned long __user *)ioc_bb_ctl->pemask, sizeof(unsigned long __user)))
+    {
+        pr_err("Error to get bb_ctl pemask data\n");
+        return -EINVAL;
+    }
+    pr_debug("Read cpumask 0x%lX\n", mask);
+    cpumask_clear(cpumask);
+    for_each_set_bit(cpu, &mask, BITS_PER_LONG)
+    {
+        if (cpu < nr_cpu_ids)
+        {
+            cpumask_set_cpu(cpu, cpumask);
+        }
+    }
+    return 0;
+}
+
 // Entry point for the allocation IOCTL
-int oss_a64fx_hwb_allocate_ioctl(struct a64fx_hwb_device *dev, unsigned long arg)
+int oss_a64fx_hwb_allocate_ioctl(struct a64fx_hwb_device *dev, struct file *file, unsigned long arg)
 {
     int err = 0;
     int cmg_id = 0;
     int bb_id = 0;
-    unsigned long mask = 0;
-    int cpu;
-    struct cpumask *cpumask;
     struct cpumask clean_cpumask;
     struct fujitsu_hwb_ioc_bb_ctl ioc_bb_ctl = {0};
     struct fujitsu_hwb_ioc_bb_ctl __user *uarg = (struct fujitsu_hwb_ioc_bb_ctl __user *)arg;
@@ -469,20 +658,10 @@ int oss_a64fx_hwb_allocate_ioctl(struct a64fx_hwb_device *dev, unsigned long arg
         return -EINVAL;
     }
     pr_debug("Start allocate (pemask)\n");
-    // Not 100% sure whether it is a single unsigned long or more. The ioc_bb_ctl contain a field
-    // for mask size which is currently not used. But since the A64FX has less than 64 CPUs, a single
-    // unsigned long should be enough.
-    if (copy_from_user(&mask, (unsigned long __user *)ioc_bb_ctl.pemask, sizeof(unsigned long __user)))
-    {
-        pr_err("Error to get bb_ctl pemask data, %d\n", err);
-        return -EINVAL;
-    }
-    pr_debug("Read cpumask 0x%lX\n", mask);
-    cpumask_clear(&clean_cpumask);
-    cpumask = to_cpumask(&mask);
-    for_each_cpu(cpu, cpumask)
+    err = get_user_cpumask(&ioc_bb_ctl, &clean_cpumask);
+    if (err < 0)
     {
-       cpumask_set_cpu(cpu, &clean_cpumask);
+        return err;
     }
     err = check_cpumask(dev, &clean_cpumask);
     if (err < 0)
@@ -493,7 +672,7 @@ int oss_a64fx_hwb_allocate_ioctl(struct a64fx_hwb_device *dev, unsigned long arg
     cmg_id = err;
     bb_id = (int)ioc_bb_ctl.bb;
     pr_debug("Receive CMG %d and Blade %d from userspace\n", cmg_id, bb_id);
-    err = oss_a64fx_hwb_allocate(dev, cmg_id, &clean_cpumask, &bb_id);
+    err = oss_a64fx_hwb_allocate(dev, get_current(), file, cmg_id, &clean_cpumask, &bb_id);
     if (err)
     {
         return err;
@@ -511,6 +690,92 @@ int oss_a64fx_hwb_allocate_ioctl(struct a64fx_hwb_device *dev, unsigned long arg
 }
 
 
+// Rewrite the BST_MASK of an existing allocation without freeing it. The new cpumask has to be
+// located on the allocation's CMG and it has to contain all CPUs that currently have a window
+// assigned to the blade, so the existing window assignments stay valid. Writing the blade
+// register clears all BST bits and LBSY, so the caller must make sure that no thread of the
+// team is inside a synchronization.
+int oss_a64fx_hwb_resize(struct a64fx_hwb_device *dev, int cmg_id, int blade, struct cpumask *cpumask)
+{
+    int err = -EINVAL;
+    struct a64fx_cmg_device *cmg = NULL;
+    struct a64fx_task_mapping *taskmap = NULL;
+    struct a64fx_task_allocation *alloc = NULL;
+    struct hwb_allocate_info info = {0, 0UL};
+    struct task_struct* current_task = get_current();
+
+    if (cmg_id < 0 || cmg_id >= MAX_NUM_CMG || blade < 0 || blade >= MAX_BB_PER_CMG)
+    {
+        return -EINVAL;
+    }
+    spin_lock(&dev->dev_lock);
+    taskmap = get_taskmap(dev, current_task);
+    if (!taskmap)
+    {
+        goto resize_exit;
+    }
+    cmg = &dev->cmgs[cmg_id];
+    alloc = get_allocation(cmg, taskmap, blade);
+    if (!alloc)
+    {
+        pr_err("Blade %d on CMG %d not allocated by task\n", blade, cmg_id);
+        goto resize_exit;
+    }
+    if (!cpumask_subset(cpumask, &cmg->cmgmask))
+    {
+        pr_debug("cpumask not within the online CPUs of CMG %d\n", cmg_id);
+        goto resize_exit;
+    }
+    if (!cpumask_subset(&alloc->assign_mask, cpumask))
+    {
+        pr_debug("New cpumask does not contain all assigned CPUs of Blade %d on CMG %d\n", blade, cmg_id);
+        err = -EBUSY;
+        goto resize_exit;
+    }
+    info.blade = blade;
+    info.cmg = cmg_id;
+    cpumask_to_ppemask(cmg, cpumask, &info.ppemask);
+    pr_debug("Resize Blade %d on CMG %d to PPEmask 0x%lx\n", blade, cmg_id, info.ppemask);
+    err = a64fx_hwb_ctrl_call_cmg(cmg, oss_a64fx_hwb_allocate_func, &info);
+    if (err < 0)
+    {
+        // the register still holds the old mask
+        goto resize_exit;
+    }
+    cpumask_copy(&alloc->cpumask, cpumask);
+
+resize_exit:
+    spin_unlock(&dev->dev_lock);
+    pr_debug("Resize returns %d\n", err);
+    return err;
+}
+
+// Entry point for the resize IOCTL
+int oss_a64fx_hwb_resize_ioctl(struct a64fx_hwb_device *dev, unsigned long arg)
+{
+    int err = 0;
+    struct cpumask clean_cpumask;
+    struct fujitsu_hwb_ioc_bb_ctl ioc_bb_ctl = {0};
+    if (copy_from_user(&ioc_bb_ctl, (struct fujitsu_hwb_ioc_bb_ctl __user *)arg, sizeof(struct fujitsu_hwb_ioc_bb_ctl)))
+    {
+        pr_err("Error to get bb_ctl data\n");
+        return -EINVAL;
+    }
+    err = get_user_cpumask(&ioc_bb_ctl, &clean_cpumask);
+    if (err < 0)
+    {
+        return err;
+    }
+    err = check_cpumask(dev, &clean_cpumask);
+    if (err < 0 || err != (int)ioc_bb_ctl.cmg)
+    {
+        pr_err("cpumask not on CMG %d, contains only a single CPU or contains offline CPUs\n", ioc_bb_ctl.cmg);
+        return -EINVAL;
+    }
+    return oss_a64fx_hwb_resize(dev, (int)ioc_bb_ctl.cmg, (int)ioc_bb_ctl.bb, &clean_cpumask);
+}
+
+
 // Free an allocated barrier blade at given CMG
 int oss_a64fx_hwb_free(struct a64fx_hwb_device *dev, int cmg_id, int blade)
 {
@@ -535,13 +800,12 @@ int oss_a64fx_hwb_free(struct a64fx_hwb_device *dev, int cmg_id, int blade)
         // Only the task which allocated the barrier blade, can free it.
         if (task_pid_nr(current_task) == task_pid_nr(taskmap->task))
         {
-            free_allocation(cmg, taskmap, alloc);
+            err = free_allocation(cmg, taskmap, alloc);
             if (taskmap->num_allocs == 0)
             {
                 pr_debug("Task has no more allocations, unregister it\n");
                 unregister_task(dev, taskmap);
             }
-            err = 0;
         }
         else if (task_tgid_nr(current_task) == task_tgid_nr(taskmap->task))
         {
@@ -551,14 +815,13 @@ int oss_a64fx_hwb_free(struct a64fx_hwb_device *dev, int cmg_id, int blade)
             // to the blade. If yes, unassign it and remove the CPU from the
             // allocation's cpumask so that the other tasks of the group
             // can still use the barrier.
-            u8 cmg8, ppe8;
-            struct a64fx_core_mapping* pe = NULL;
-            int cpuid = get_cpu();
-            _oss_a64fx_hwb_get_peinfo(&cmg8, &ppe8);
-            pe = get_pemap(dev, (int)cmg8, (int)ppe8);
-            pr_debug("Finishing only for CPU %d PE %d Blade %d\n", cpuid, pe->ppe_id, blade);
-            
-            if (cpumask_test_cpu(cpuid, &alloc->cpumask))
+            // preemption is disabled by the device lock
+            int cpuid = smp_processor_id();
+            struct a64fx_cpu_topo* topo = a64fx_hwb_topo(cpuid);
+            struct a64fx_core_mapping* pe = (topo ? topo->pe : NULL);
+
+            err = 0;
+            if (pe && cpumask_test_cpu(cpuid, &alloc->cpumask))
             {
                 struct hwb_allocate_info info = {0, 0UL};
                 if (cpumask_test_cpu(cpuid, &alloc->assign_mask))
@@ -568,13 +831,14 @@ int oss_a64fx_hwb_free(struct a64fx_hwb_device *dev, int cmg_id, int blade)
                         .cmg = alloc->cmg,
                         .blade = 0,
                         .valid = 0,
+                        .window = alloc->window[pe->ppe_id],
                     };
                     pr_debug("CPU %d PE %d Blade %d assigned with win %d\n", cpuid, pe->ppe_id, blade, alloc->window[pe->ppe_id]);
                     // unassign window on CPU
                     clear_bit(alloc->window[pe->ppe_id], &pe->bw_map);
-                    pe->win_blades[alloc->window[pe->ppe_id]] = A64FX_HWB_UNASSIGNED_WIN;
+                    pe->win_blades[alloc->window[pe->ppe_id]] = A64FX_HWB_UNASSIGNED_BB;
                     alloc->window[pe->ppe_id] = A64FX_HWB_UNASSIGNED_WIN;
-                    smp_call_function_single(pe->cpu_id, oss_a64fx_hwb_assign_func, &ainfo, 1);
+                    a64fx_hwb_ctrl_call_local(cmg, oss_a64fx_hwb_assign_func, &ainfo);
                     cpumask_clear_cpu(cpuid, &alloc->assign_mask);
                     alloc->assign_count--;
                 }
@@ -584,14 +848,20 @@ int oss_a64fx_hwb_free(struct a64fx_hwb_device *dev, int cmg_id, int blade)
                 info.ppemask = 0x0UL;
                 cpumask_clear_cpu(cpuid, &alloc->cpumask);
                 cpumask_to_ppemask(cmg, &alloc->cpumask, &info.ppemask);
-                smp_call_function_any(&cmg->cmgmask, oss_a64fx_hwb_allocate_func, &info, 1);
+                err = a64fx_hwb_ctrl_call_cmg(cmg, oss_a64fx_hwb_allocate_func, &info);
+                if (err < 0)
+                {
+                    // the CPU is still part of the blade register
+                    cpumask_set_cpu(cpuid, &alloc->cpumask);
+                    goto free_exit;
+                }
                 // Not sure if this is needed as only the original allocating CPU should
                 // be able to free an allocation. This would be only needed if the originally
                 // allocating CPU already vanished from the cpumask.
                 if (cpumask_weight(&alloc->cpumask) == 0)
                 {
                     pr_debug("No more CPUs in cpumask, free alloc\n");
-                    free_allocation(cmg, taskmap, alloc);
+                    err = free_allocation(cmg, taskmap, alloc);
                     if (taskmap->num_allocs == 0)
                     {
                         pr_debug("No more allocations, free task\n");
@@ -599,7 +869,6 @@ int oss_a64fx_hwb_free(struct a64fx_hwb_device *dev, int cmg_id, int blade)
                     }
                 }
             }
-            err = 0;
         }
         else
         {
@@ -615,6 +884,40 @@ free_exit:
 }
 
 
+// Free a barrier blade allocated by the given task. Unlike oss_a64fx_hwb_free(), there
+// is no handling for other threads of the group, the blade is always freed completely.
+int oss_a64fx_hwb_free_task(struct a64fx_hwb_device *dev, struct task_struct *task, int cmg_id, int blade)
+{
+    int err = -EINVAL;
+    struct a64fx_cmg_device *cmg = NULL;
+    struct a64fx_task_mapping *taskmap = NULL;
+    struct a64fx_task_allocation *alloc = NULL;
+
+    if (cmg_id < 0 || cmg_id >= MAX_NUM_CMG || blade < 0 || blade >= MAX_BB_PER_CMG)
+    {
+        return -EINVAL;
+    }
+    spin_lock(&dev->dev_lock);
+    taskmap = get_taskmap(dev, task);
+    if (taskmap)
+    {
+        cmg = &dev->cmgs[cmg_id];
+        alloc = get_allocation(cmg, taskmap, blade);
+        if (alloc)
+        {
+            err = free_allocation(cmg, taskmap, alloc);
+            if (taskmap->num_allocs == 0)
+            {
+                unregister_task(dev, taskmap);
+            }
+        }
+    }
+    spin_unlock(&dev->dev_lock);
+    pr_debug("Free (TGID %d CMG %d Blade %d) returns %d\n", task_tgid_nr(task), cmg_id, blade, err);
+    return err;
+}
+
+
 // Entry point to free a barrier blade
 int oss_a64fx_hwb_free_ioctl(struct a64fx_hwb_device *dev, unsigned long arg)
 {
@@ -646,12 +949,13 @@ int oss_a64fx_hwb_free_ioctl(struct a64fx_hwb_device *dev, unsigned long arg)
 
 // Assign a CPU to a barrier blade. Each CPU has four window register which contain the offset of the barrier blade
 // and a valid bit. The user-space IOCTL can supply a window offset to use but if -1, the next free window register
-// is taken and returned
-int oss_a64fx_hwb_assign_blade(struct a64fx_hwb_device *dev, int blade, int window, int* outwindow)
+// is taken and returned. The blade is looked up in the allocations of task, the calling thread has to be pinned
+// to the CPU getting the window.
+int oss_a64fx_hwb_assign_blade(struct a64fx_hwb_device *dev, struct task_struct *task, int blade, int window, int* outwindow)
 {
     int err = 0;
     int cpuid = 0;
-    u8 cmg = 0, ppe = 0;
+    struct a64fx_cpu_topo* topo = NULL;
     struct task_struct* current_task = get_current();
     struct a64fx_task_mapping* taskmap = NULL;
     struct a64fx_task_allocation* alloc = NULL;
@@ -669,20 +973,21 @@ int oss_a64fx_hwb_assign_blade(struct a64fx_hwb_device *dev, int blade, int wind
     // acquire lock
     spin_lock(&dev->dev_lock);
     cpuid = get_cpu();
-    pr_debug("Get task mapping for PID %d (TGID %d) CPU %d\n", task_pid_nr(current_task), task_tgid_nr(current_task), cpuid);
-    taskmap = get_taskmap(dev, current_task);
+    pr_debug("Get task mapping for PID %d (TGID %d) CPU %d\n", task_pid_nr(current_task), task_tgid_nr(task), cpuid);
+    taskmap = get_taskmap(dev, task);
     if (!taskmap)
     {
         err = -ENODEV;
         goto assign_blade_out;
     }
     
-    err = _oss_a64fx_hwb_get_peinfo(&cmg, &ppe);
+    topo = a64fx_hwb_topo(cpuid);
+    err = (topo ? 0 : -ENODEV);
     if (!err)
     {
-        int cmg_id = (int)cmg;
+        int cmg_id = topo->cmg_id;
         struct a64fx_cmg_device* cmgdev = &dev->cmgs[cmg_id];
-        struct a64fx_core_mapping* pe = get_pemap(dev, cmg_id, (int)ppe);
+        struct a64fx_core_mapping* pe = topo->pe;
         pr_debug("Get allocation for CMG %d and Blade %d (CPU %d, PPE %d)\n", cmg_id, blade, pe->cpu_id, pe->ppe_id);
         alloc = get_allocation(cmgdev, taskmap, blade);
         if (alloc)
@@ -733,11 +1038,12 @@ int oss_a64fx_hwb_assign_blade(struct a64fx_hwb_device *dev, int blade, int wind
                     .valid = 1
                 };
                 pr_debug("Write window %d assign (CPU %d/%d CMG %d Blade %d)\n", window, pe->cpu_id, cpuid, cmg_id, blade);
-                smp_call_function_single(pe->cpu_id, oss_a64fx_hwb_assign_func, &info, 1);
+                a64fx_hwb_ctrl_call_local(cmgdev, oss_a64fx_hwb_assign_func, &info);
                 pr_debug("Store window %d for CPU %d on CMG %d to Blade %d in allocation\n", window, pe->cpu_id, cmg_id, blade);
                 alloc->window[pe->ppe_id] = window;
                 pr_debug("Set window %d for CPU %d/%d\n", window, pe->cpu_id, cpuid);
                 set_bit(window, &pe->bw_map);
+                pe->win_blades[window] = blade;
                 cpumask_set_cpu(pe->cpu_id, &alloc->assign_mask);
                 alloc->assign_count++;
                 pr_debug("%d Threads assigned to allocation (TGID %d CMG %d Blade %d)\n", alloc->assign_count, task_tgid_nr(taskmap->task), cmg_id, blade);
@@ -780,7 +1086,7 @@ int oss_a64fx_hwb_assign_blade_ioctl(struct a64fx_hwb_device *dev, unsigned long
     }
     bb_id = (int)ioc_bw_ctl.bb;
     win_id = (int)ioc_bw_ctl.window;
-    err = oss_a64fx_hwb_assign_blade(dev, bb_id, win_id, &win_out);
+    err = oss_a64fx_hwb_assign_blade(dev, get_current(), bb_id, win_id, &win_out);
     if (!err)
     {
         ioc_bw_ctl.window = (u8)win_out;
@@ -794,11 +1100,13 @@ int oss_a64fx_hwb_assign_blade_ioctl(struct a64fx_hwb_device *dev, unsigned long
     return err;
 }
 
-int oss_a64fx_hwb_unassign_blade(struct a64fx_hwb_device *dev, int blade, int window)
+// Remove the window of the current CPU from a blade of task, the counterpart of
+// oss_a64fx_hwb_assign_blade()
+int oss_a64fx_hwb_unassign_blade(struct a64fx_hwb_device *dev, struct task_struct *task, int blade, int window)
 {
     int err = 0;
     int cpuid = 0;
-    u8 cmg = 0, ppe = 0;
+    struct a64fx_cpu_topo* topo = NULL;
     int valid = 0, bb = 0;
     struct task_struct* current_task = get_current();
     struct a64fx_task_mapping* taskmap = NULL;
@@ -817,18 +1125,19 @@ int oss_a64fx_hwb_unassign_blade(struct a64fx_hwb_device *dev, int blade, int wi
     spin_lock(&dev->dev_lock);
     cpuid = get_cpu();
     pr_debug("Get task mapping\n");
-    taskmap = get_taskmap(dev, current_task);
+    taskmap = get_taskmap(dev, task);
     if (!taskmap)
     {
         err = -ENODEV;
         goto unassign_blade_out;
     }
 
-    err = _oss_a64fx_hwb_get_peinfo(&cmg, &ppe);
+    topo = a64fx_hwb_topo(cpuid);
+    err = (topo ? 0 : -ENODEV);
     if (!err)
     {
-        int cmg_id = (int)cmg;
-        struct a64fx_core_mapping* pe = get_pemap(dev, cmg_id, (int)ppe);
+        int cmg_id = topo->cmg_id;
+        struct a64fx_core_mapping* pe = topo->pe;
         struct a64fx_cmg_device* cmgdev = &dev->cmgs[cmg_id];
         pr_debug("Get allocation for CMG %d and Blade %d\n", cmg_id, blade);
         alloc = get_allocation(cmgdev, taskmap, blade);
@@ -855,11 +1164,12 @@ int oss_a64fx_hwb_unassign_blade(struct a64fx_hwb_device *dev, int blade, int wi
                         pr_debug("Free window %d for CMG %d and Blade %d\n", window, cmg_id, blade);
                         clear_bit(window, &pe->bw_map);
                         pr_debug("Clear window %d assign (CPU %d/%d CMG %d Blade %d)\n", window, pe->cpu_id, cpuid, cmg_id, blade);
-                        smp_call_function_single(pe->cpu_id, oss_a64fx_hwb_assign_func, &info, 1);
+                        a64fx_hwb_ctrl_call_local(cmgdev, oss_a64fx_hwb_assign_func, &info);
                         pr_debug("Remove mapping window %d on CMG %d to Blade %d\n", window, cmg_id, blade);
                         alloc->window[pe->ppe_id] = A64FX_HWB_UNASSIGNED_WIN;
                         pr_debug("Clear window %d for CPU %d/%d\n", window, pe->cpu_id, cpuid);
                         clear_bit(window, &pe->bw_map);
+                        pe->win_blades[window] = A64FX_HWB_UNASSIGNED_BB;
                         cpumask_clear_cpu(pe->cpu_id, &alloc->assign_mask);
                         alloc->assign_count--;
                         err = 0;
@@ -903,7 +1213,7 @@ int oss_a64fx_hwb_unassign_blade_ioctl(struct a64fx_hwb_device *dev, unsigned lo
     }
     bb_id = (int)ioc_bw_ctl.bb;
     win_id = (int)ioc_bw_ctl.window;
-    err = oss_a64fx_hwb_unassign_blade(dev, bb_id, win_id);
+    err = oss_a64fx_hwb_unassign_blade(dev, get_current(), bb_id, win_id);
     if (err)
     {
         return err;
@@ -917,71 +1227,424 @@ int oss_a64fx_hwb_unassign_blade_ioctl(struct a64fx_hwb_device *dev, unsigned lo
 }
 
 
+// Block the calling thread until the LBSY of one of its windows becomes the requested value.
+// The window has to be assigned by the calling task on the current CPU. Only the validation
+// is done with the device lock held, the wait itself happens without any lock.
+int oss_a64fx_hwb_wait_ioctl(struct a64fx_hwb_device *dev, unsigned long arg)
+{
+    int err = 0;
+    struct a64fx_cpu_topo* topo = NULL;
+    struct list_head *cur = NULL;
+    struct a64fx_cmg_device* cmgdev = NULL;
+    struct task_struct* current_task = get_current();
+    struct a64fx_task_mapping* taskmap = NULL;
+    struct a64fx_task_allocation* alloc = NULL;
+    struct a64fx_hwb_ioc_wait ioc_wait = {0};
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,3,0)
+    cpumask_t* task_cpus = &current_task->cpus_allowed;
+#else
+    cpumask_t* task_cpus = &current_task->cpus_mask;
+#endif
+    if (copy_from_user(&ioc_wait, (struct a64fx_hwb_ioc_wait __user *)arg, sizeof(struct a64fx_hwb_ioc_wait)))
+    {
+        pr_err("Error to get wait data\n");
+        return -EINVAL;
+    }
+    if (ioc_wait.window >= MAX_BW_PER_CMG || ioc_wait.sync > 1)
+    {
+        return -EINVAL;
+    }
+    // The polling timer runs on the current CPU, so the task must not migrate
+    if (cpumask_weight(task_cpus) > 1)
+    {
+        pr_debug("Task in wait not pinned\n");
+        return -EINVAL;
+    }
+
+    spin_lock(&dev->dev_lock);
+    get_cpu();
+    taskmap = get_taskmap(dev, current_task);
+    topo = a64fx_hwb_topo(smp_processor_id());
+    if ((!taskmap) || (!topo))
+    {
+        err = -ENODEV;
+        goto wait_out;
+    }
+    err = -ENODEV;
+    list_for_each(cur, &taskmap->allocs)
+    {
+        alloc = list_entry(cur, struct a64fx_task_allocation, list);
+        if (alloc->cmg == topo->cmg_id && alloc->window[topo->ppe_id] == (int)ioc_wait.window)
+        {
+            cmgdev = &dev->cmgs[topo->cmg_id];
+            err = 0;
+            break;
+        }
+    }
+wait_out:
+    put_cpu();
+    spin_unlock(&dev->dev_lock);
+    if (err)
+    {
+        pr_debug("Window %d not assigned by task (PID %d)\n", ioc_wait.window, task_pid_nr(current_task));
+        return err;
+    }
+    return a64fx_hwb_wait_lbsy(cmgdev, (int)ioc_wait.window, (int)ioc_wait.sync, ioc_wait.timeout_us);
+}
+
+
+// Structure and function to be executed on the CPUs of a CMG via on_each_cpu_mask to clear
+// the registers of a set of blades. Each CPU clears its windows that point to one of the
+// blades, the CPU blade_cpu additionally clears the blades. Windows of other blades are
+// not touched.
+struct hwb_reset_info {
+    int blade_cpu;
+    unsigned long blades;
+};
 
-void asm_reset_func(void* info)
+static void oss_a64fx_hwb_reset_func(void* info)
 {
-    int i = 0;
-    for (i = 0; i < MAX_BW_PER_CMG; i++)
+    int window = 0;
+    unsigned long windows = 0x0UL;
+    u64 zero[MAX_BB_PER_CMG] = {0};
+    u64 assign[MAX_BW_PER_CMG];
+    struct hwb_reset_info* rinfo = (struct hwb_reset_info*) info;
+    read_assign_sync_wr_all(assign);
+    for (window = 0; window < MAX_BW_PER_CMG; window++)
     {
-        int valid, blade;
-        read_assign_sync_wr(i, &valid, &blade);
-        pr_debug("Reset CPU %d: Win %d Valid %d Blade %d\n", smp_processor_id(), i, valid, blade);
-        write_assign_sync_wr(i, 0, 0);
-        write_bst_sync_wr(i, 0);
+        if (A64FX_HWB_ASSIGN_VALID(assign[window]) && test_bit(A64FX_HWB_ASSIGN_BB(assign[window]), &rinfo->blades))
+        {
+            pr_debug("Reset CPU %d: Win %d Blade %d\n", smp_processor_id(), window, A64FX_HWB_ASSIGN_BB(assign[window]));
+            set_bit(window, &windows);
+        }
     }
-    for (i = 0; i < MAX_BB_PER_CMG; i++)
+    // BST while the windows are still valid
+    write_bst_sync_wr_bulk(windows, zero);
+    write_assign_sync_wr_bulk(windows, zero);
+    if (smp_processor_id() == rinfo->blade_cpu)
     {
-        unsigned long bst, bst_mask;
-        read_init_sync_bb(i, &bst, &bst_mask);
-        pr_debug("Reset CPU %d: Blade %d BST 0x%lx BSTMASK 0x%lx\n", smp_processor_id(), i, bst, bst_mask);
-        write_init_sync_bb(i, 0x0);
+        pr_debug("Reset CPU %d: Blades 0x%lx\n", smp_processor_id(), rinfo->blades);
+        write_init_sync_bb_bulk(rinfo->blades, zero);
     }
-    write_hwb_ctrl(0, 0);
 }
 
-int oss_a64fx_hwb_reset_ioctl(struct a64fx_hwb_device *dev, unsigned long arg)
+// Clear the given blades of a CMG and all windows on the CMG pointing to them, also if the
+// registers have no owner in the bookkeeping. The blades must not be allocated anymore.
+// The device lock has to be held.
+static void reset_cmg_blades(struct a64fx_cmg_device *cmg, unsigned long blades)
 {
-    int i = 0;
-    int j = 0;
-    struct a64fx_cmg_device* cmg = NULL;
+    struct hwb_reset_info rinfo = {0, 0UL};
+    if (cpumask_empty(&cmg->cmgmask) || (!blades))
+    {
+        return;
+    }
+    rinfo.blade_cpu = cpumask_first(&cmg->cmgmask);
+    rinfo.blades = blades;
+    a64fx_hwb_ctrl_count_wave(cmg, &cmg->cmgmask);
+    on_each_cpu_mask(&cmg->cmgmask, oss_a64fx_hwb_reset_func, &rinfo, 1);
+}
+
+// Owner of an allocated blade or NULL if the blade is not allocated
+static struct a64fx_task_mapping * get_blade_owner(struct a64fx_hwb_device *dev, struct a64fx_cmg_device *cmg, int blade)
+{
+    struct list_head *cur = NULL;
+    struct a64fx_task_mapping *taskmap = NULL;
+    list_for_each(cur, &dev->task_list)
+    {
+        taskmap = list_entry(cur, struct a64fx_task_mapping, list);
+        if (get_allocation(cmg, taskmap, blade))
+        {
+            return taskmap;
+        }
+    }
+    return NULL;
+}
+
+// Reset the allocations and registers of a TGID, a CMG or a blade. Other processes and
+// CMGs, active_count and the EL0 access are not touched. Without admin, only the calling
+// process may be reset, for the blade scope the blade has to belong to it.
+int oss_a64fx_hwb_reset_scoped(struct a64fx_hwb_device *dev, int scope, int cmg_id, int blade, int tgid, int admin, unsigned int *freed)
+{
+    int err = 0;
+    struct a64fx_cmg_device *cmg = NULL;
     struct list_head *taskcur = NULL, *tasktmp = NULL;
-    struct a64fx_task_mapping* taskmap = NULL;
     struct list_head *alloccur = NULL, *alloctmp = NULL;
-    struct a64fx_task_allocation* alloc = NULL;
+    struct a64fx_task_mapping *taskmap = NULL;
+    struct a64fx_task_allocation *alloc = NULL;
+    unsigned long orphans = 0x0UL;
+    int own_tgid = task_tgid_nr(get_current());
 
-    spin_lock(&dev->dev_lock);
-    pr_debug("Reset all registers\n");
-    on_each_cpu(asm_reset_func, NULL, 0);
+    *freed = 0;
+    if (scope == A64FX_HWB_RESET_TGID)
+    {
+        if (tgid != own_tgid && (!admin))
+        {
+            return -EPERM;
+        }
+    }
+    else if (scope == A64FX_HWB_RESET_CMG || scope == A64FX_HWB_RESET_BLADE)
+    {
+        if (cmg_id < 0 || cmg_id >= dev->num_cmgs)
+        {
+            return -EINVAL;
+        }
+        if (scope == A64FX_HWB_RESET_BLADE && (blade < 0 || blade >= dev->num_bb_per_cmg))
+        {
+            return -EINVAL;
+        }
+        if (scope == A64FX_HWB_RESET_CMG && (!admin))
+        {
+            return -EPERM;
+        }
+        cmg = &dev->cmgs[cmg_id];
+    }
+    else
+    {
+        return -EINVAL;
+    }
 
+    spin_lock(&dev->dev_lock);
+    if (scope == A64FX_HWB_RESET_BLADE && (!admin))
+    {
+        taskmap = get_blade_owner(dev, cmg, blade);
+        if ((!taskmap) || task_tgid_nr(taskmap->task) != own_tgid)
+        {
+            pr_debug("TGID %d cannot reset Blade %d on CMG %d\n", own_tgid, blade, cmg_id);
+            err = -EPERM;
+            goto reset_exit;
+        }
+    }
+    if (cmg)
+    {
+        // registers without owner, e.g. left behind by another driver. The owned blades
+        // are cleared by free_allocation(), only the orphans need the CMG-wide wave.
+        orphans = (scope == A64FX_HWB_RESET_CMG ? A64FX_HWB_ALL_BB : BIT(blade)) & ~cmg->bb_active;
+    }
     list_for_each_safe(taskcur, tasktmp, &dev->task_list)
     {
+        int touched = 0;
         taskmap = list_entry(taskcur, struct a64fx_task_mapping, list);
+        if (scope == A64FX_HWB_RESET_TGID)
+        {
+            if (task_tgid_nr(taskmap->task) == tgid)
+            {
+                pr_debug("Reset TGID %d with %d allocations\n", tgid, taskmap->num_allocs);
+                *freed += taskmap->num_allocs;
+                unregister_task(dev, taskmap);
+            }
+            continue;
+        }
         list_for_each_safe(alloccur, alloctmp, &taskmap->allocs)
         {
             alloc = list_entry(alloccur, struct a64fx_task_allocation, list);
-            pr_debug("Delete allocation (PID %d CMG %d Blade %d)\n", alloc->task->pid, alloc->cmg, alloc->blade);
-            list_del(&alloc->list);
-            taskmap->num_allocs--;
-            kfree(alloc);
+            if (alloc->cmg != cmg_id || (scope == A64FX_HWB_RESET_BLADE && alloc->blade != blade))
+            {
+                continue;
+            }
+            pr_debug("Reset allocation (TGID %d CMG %d Blade %d)\n", task_tgid_nr(taskmap->task), alloc->cmg, alloc->blade);
+            free_allocation(cmg, taskmap, alloc);
+            (*freed)++;
+            touched = 1;
+        }
+        if (touched && taskmap->num_allocs == 0)
+        {
+            unregister_task(dev, taskmap);
         }
-        pr_debug("Delete task mapping (PID %d)\n", taskmap->task->pid);
-        list_del(&taskmap->list);
-        dev->num_tasks--;
-        kfree(taskmap);
     }
-    pr_debug("Reset all bookkeeping variables\n");
-    dev->num_tasks = 0;
-    dev->active_count = 0;
-    for (i = 0; i < MAX_NUM_CMG; i++)
+    if (cmg)
+    {
+        reset_cmg_blades(cmg, orphans);
+    }
+reset_exit:
+    spin_unlock(&dev->dev_lock);
+    pr_debug("Reset (scope %d) returns %d, freed %u allocations\n", scope, err, *freed);
+    return err;
+}
+
+// Entry point for the scoped reset IOCTL
+int oss_a64fx_hwb_reset_scoped_ioctl(struct a64fx_hwb_device *dev, unsigned long arg)
+{
+    int err = 0;
+    int tgid = 0;
+    int admin = 0;
+    unsigned int freed = 0;
+    struct a64fx_hwb_ioc_reset ioc_reset = {0};
+    if (copy_from_user(&ioc_reset, (struct a64fx_hwb_ioc_reset __user *)arg, sizeof(struct a64fx_hwb_ioc_reset)))
+    {
+        pr_err("Error to get reset data\n");
+        return -EINVAL;
+    }
+    tgid = (ioc_reset.tgid > 0 ? ioc_reset.tgid : task_tgid_nr(get_current()));
+    // only ask for the capability if the scope requires it
+    if (ioc_reset.scope != A64FX_HWB_RESET_TGID || tgid != task_tgid_nr(get_current()))
+    {
+        admin = capable(CAP_SYS_ADMIN);
+    }
+    err = oss_a64fx_hwb_reset_scoped(dev, (int)ioc_reset.scope, (int)ioc_reset.cmg, (int)ioc_reset.bb, tgid, admin, &freed);
+    if (err)
+    {
+        return err;
+    }
+    ioc_reset.tgid = tgid;
+    ioc_reset.freed = freed;
+    if (copy_to_user((struct a64fx_hwb_ioc_reset __user *)arg, &ioc_reset, sizeof(struct a64fx_hwb_ioc_reset)))
+    {
+        pr_err("Error to copy back reset data\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Reset the whole node: free all allocations and clear all blades and windows. Only
+// for CAP_SYS_ADMIN, the EL0 access and the open files stay as they are.
+int oss_a64fx_hwb_reset_ioctl(struct a64fx_hwb_device *dev, unsigned long arg)
+{
+    int i = 0;
+    int j = 0;
+    struct a64fx_cmg_device* cmg = NULL;
+    struct list_head *taskcur = NULL, *tasktmp = NULL;
+    struct a64fx_task_mapping* taskmap = NULL;
+
+    if (!capable(CAP_SYS_ADMIN))
+    {
+        return -EPERM;
+    }
+    spin_lock(&dev->dev_lock);
+    pr_debug("Reset all allocations\n");
+    list_for_each_safe(taskcur, tasktmp, &dev->task_list)
+    {
+        taskmap = list_entry(taskcur, struct a64fx_task_mapping, list);
+        unregister_task(dev, taskmap);
+    }
+    pr_debug("Reset all registers\n");
+    for (i = 0; i < dev->num_cmgs; i++)
     {
         cmg = &dev->cmgs[i];
-        pr_debug("Reset CMG %d\n", cmg->cmg_id);
+        reset_cmg_blades(cmg, A64FX_HWB_ALL_BB);
+        // the registers are clear now, drop anything the bookkeeping may still have
         cmg->bb_active = 0x0;
         for (j = 0; j < MAX_PE_PER_CMG; j++)
         {
             cmg->pe_map[j].bw_map = 0x0;
+            memset(cmg->pe_map[j].win_blades, A64FX_HWB_UNASSIGNED_BB, sizeof(cmg->pe_map[j].win_blades));
+        }
+    }
+    spin_unlock(&dev->dev_lock);
+    return 0;
+}
+
+
+// Structure and function to be executed on a CPU of the CMG via a64fx_hwb_ctrl_call_cmg
+// to read the INIT_SYNC_BB register of a single blade
+struct hwb_status_info {
+    int blade;
+    unsigned long mask;
+    unsigned long bst;
+    unsigned long lbsy;
+};
+
+static void oss_a64fx_hwb_status_func(void* info)
+{
+    struct hwb_status_info* sinfo = (struct hwb_status_info*) info;
+    read_init_sync_bb(sinfo->blade, &sinfo->mask, &sinfo->bst, &sinfo->lbsy);
+    pr_debug("read_init_sync_bb (Blade %d, Mask 0x%lX, BST 0x%lX, LBSY %lu) on CPU %d\n", sinfo->blade, sinfo->mask, sinfo->bst, sinfo->lbsy, smp_processor_id());
+}
+
+// Read the live state of a blade. The blade is selected by a window on the current CPU
+// (status->window >= 0) or by status->cmg and status->bb. Everybody may read any blade,
+// the register is read on a CPU of the CMG, the current one if possible.
+int oss_a64fx_hwb_status(struct a64fx_hwb_device *dev, struct a64fx_hwb_ioc_bb_status *status)
+{
+    int i = 0;
+    int err = 0;
+    struct a64fx_cpu_topo* topo = NULL;
+    struct list_head *cur = NULL;
+    struct a64fx_cmg_device* cmg = NULL;
+    struct a64fx_task_mapping* taskmap = NULL;
+    struct a64fx_task_allocation* alloc = NULL;
+    struct hwb_status_info info = {0, 0UL, 0UL, 0UL};
+
+    if (status->window >= MAX_BW_PER_CMG || (status->window < 0 && (status->cmg >= dev->num_cmgs || status->bb >= MAX_BB_PER_CMG)))
+    {
+        return -EINVAL;
+    }
+    spin_lock(&dev->dev_lock);
+    if (status->window >= 0)
+    {
+        err = -ENODEV;
+        get_cpu();
+        taskmap = get_taskmap(dev, get_current());
+        topo = a64fx_hwb_topo(smp_processor_id());
+        if (taskmap && topo)
+        {
+            list_for_each(cur, &taskmap->allocs)
+            {
+                alloc = list_entry(cur, struct a64fx_task_allocation, list);
+                if (alloc->cmg == topo->cmg_id && alloc->window[topo->ppe_id] == (int)status->window)
+                {
+                    status->cmg = alloc->cmg;
+                    status->bb = alloc->blade;
+                    err = 0;
+                    break;
+                }
+            }
+        }
+        put_cpu();
+        if (err)
+        {
+            pr_debug("Window %d not assigned by task (PID %d)\n", status->window, task_pid_nr(get_current()));
+            goto status_out;
         }
     }
+    cmg = &dev->cmgs[status->cmg];
+    if (cpumask_empty(&cmg->cmgmask))
+    {
+        err = -ENODEV;
+        goto status_out;
+    }
+    info.blade = status->bb;
+    err = a64fx_hwb_ctrl_call_cmg(cmg, oss_a64fx_hwb_status_func, &info);
+    if (err < 0)
+    {
+        goto status_out;
+    }
+    status->bst_mask = (__u16)info.mask;
+    status->bst = (__u16)info.bst;
+    status->lbsy = (__u8)info.lbsy;
+    status->pending = a64fx_hwb_pending_pes(status->bst_mask, status->bst, status->lbsy);
+    status->active = test_bit(status->bb, &cmg->bb_active);
+    taskmap = get_blade_owner(dev, cmg, status->bb);
+    status->tgid = (taskmap ? task_tgid_nr(taskmap->task) : 0);
+    for (i = 0; i < A64FX_HWB_SNAPSHOT_PES; i++)
+    {
+        status->cpu[i] = (i < MAX_PE_PER_CMG ? cmg->pe_map[i].cpu_id : -1);
+    }
+    pr_debug("Status of Blade %d on CMG %d: pending 0x%x\n", status->bb, status->cmg, status->pending);
+
+status_out:
     spin_unlock(&dev->dev_lock);
+    return err;
+}
+
+// Entry point for the diagnostics IOCTL
+int oss_a64fx_hwb_status_ioctl(struct a64fx_hwb_device *dev, unsigned long arg)
+{
+    int err = 0;
+    struct a64fx_hwb_ioc_bb_status ioc_status = {0};
+    if (copy_from_user(&ioc_status, (struct a64fx_hwb_ioc_bb_status __user *)arg, sizeof(struct a64fx_hwb_ioc_bb_status)))
+    {
+        pr_err("Error to get status data\n");
+        return -EINVAL;
+    }
+    err = oss_a64fx_hwb_status(dev, &ioc_status);
+    if (err)
+    {
+        return err;
+    }
+    if (copy_to_user((struct a64fx_hwb_ioc_bb_status __user *)arg, &ioc_status, sizeof(struct a64fx_hwb_ioc_bb_status)))
+    {
+        pr_err("Error to copy back status data\n");
+        return -1;
+    }
     return 0;
 }
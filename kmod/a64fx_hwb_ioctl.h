@@ -2,23 +2,37 @@
 #define A64FX_HWB_IOCTL_H
 
 #include "a64fx_hwb.h"
+#include "a64fx_hwb_uapi.h"
 
 #define FUJITSU_HWB_IOC_RESET _IOWR(__FUJITSU_IOCTL_MAGIC, 0x05, int)
 
 int oss_a64fx_hwb_get_peinfo(int *cmg, int *ppe);
 int oss_a64fx_hwb_get_peinfo_ioctl(unsigned long arg);
-/*int oss_a64fx_hwb_allocate(struct a64fx_hwb_device *dev, unsigned long arg);*/
-int oss_a64fx_hwb_allocate_ioctl(struct a64fx_hwb_device *dev, unsigned long arg);
+int oss_a64fx_hwb_allocate(struct a64fx_hwb_device *dev, struct task_struct *task, struct file *file, int cmg, struct cpumask *cpumask, int *blade);
+int oss_a64fx_hwb_allocate_ioctl(struct a64fx_hwb_device *dev, struct file *file, unsigned long arg);
 /*int oss_a64fx_hwb_free(struct a64fx_hwb_device *dev, int cmg_id, int bb_id);*/
+int oss_a64fx_hwb_free_task(struct a64fx_hwb_device *dev, struct task_struct *task, int cmg_id, int blade);
 int oss_a64fx_hwb_free_ioctl(struct a64fx_hwb_device *dev, unsigned long arg);
-/*int oss_a64fx_hwb_assign_blade(struct a64fx_hwb_device *dev, int blade, int window);*/
+int oss_a64fx_hwb_assign_blade(struct a64fx_hwb_device *dev, struct task_struct *task, int blade, int window, int* outwindow);
 int oss_a64fx_hwb_assign_blade_ioctl(struct a64fx_hwb_device *dev, unsigned long arg);
-/*int oss_a64fx_hwb_unassign_blade(struct a64fx_hwb_device *dev, int bb, int window);*/
+int oss_a64fx_hwb_unassign_blade(struct a64fx_hwb_device *dev, struct task_struct *task, int blade, int window);
 int oss_a64fx_hwb_unassign_blade_ioctl(struct a64fx_hwb_device *dev, unsigned long arg);
 
+int oss_a64fx_hwb_resize_ioctl(struct a64fx_hwb_device *dev, unsigned long arg);
+int oss_a64fx_hwb_wait_ioctl(struct a64fx_hwb_device *dev, unsigned long arg);
+int oss_a64fx_hwb_status(struct a64fx_hwb_device *dev, struct a64fx_hwb_ioc_bb_status *status);
+int oss_a64fx_hwb_status_ioctl(struct a64fx_hwb_device *dev, unsigned long arg);
+
 int oss_a64fx_hwb_reset_ioctl(struct a64fx_hwb_device *dev, unsigned long arg);
+int oss_a64fx_hwb_reset_scoped(struct a64fx_hwb_device *dev, int scope, int cmg_id, int blade, int tgid, int admin, unsigned int *freed);
+int oss_a64fx_hwb_reset_scoped_ioctl(struct a64fx_hwb_device *dev, unsigned long arg);
 
 struct a64fx_task_mapping * get_taskmap(struct a64fx_hwb_device *dev, struct task_struct* task);
 int unregister_task(struct a64fx_hwb_device *dev, struct a64fx_task_mapping *taskmap);
+void reclaim_file_allocations(struct a64fx_hwb_device *dev, struct file *file);
+void reclaim_task_allocations(struct a64fx_hwb_device *dev, struct task_struct *task);
+int reclaim_dead_tasks(struct a64fx_hwb_device *dev);
+void teardown_cpu_allocations(struct a64fx_hwb_device *dev, struct a64fx_cmg_device *cmg, struct a64fx_core_mapping *pe);
+void restore_cmg_blades(struct a64fx_hwb_device *dev, struct a64fx_cmg_device *cmg);
 
 #endif
@@ -0,0 +1,144 @@
+#define pr_fmt(fmt) "%s:%s: " fmt, KBUILD_MODNAME, __func__
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/sched/task.h>
+#include <linux/smp.h>
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
+#include <asm/barrier.h>
+#include <asm/processor.h>
+
+#include "a64fx_hwb.h"
+#include "a64fx_hwb_asm.h"
+#include "a64fx_hwb_ioctl.h"
+#include "a64fx_hwb_topo.h"
+#include "a64fx_hwb_kapi.h"
+
+/*
+ * Exported in-kernel API, see a64fx_hwb_kapi.h. The allocations of all kernel users
+ * belong to init_task: its TGID 0 never matches a user process, so the IOCTLs
+ * cannot reach them except for the admin resets, and the leak scanner never
+ * considers it dead.
+ */
+
+static struct a64fx_hwb_device *kapi_dev = NULL;
+
+// LBSY polls between two checks of the timeout
+#define A64FX_HWB_KAPI_POLLS 64
+
+int a64fx_hwb_kernel_alloc(const struct cpumask *cpumask, int *cmg, int *blade)
+{
+    int err = 0;
+    struct cpumask mask;
+
+    if (!kapi_dev)
+    {
+        return -ENODEV;
+    }
+    if ((!cpumask) || (!cmg) || (!blade) || cpumask_weight(cpumask) < 2)
+    {
+        return -EINVAL;
+    }
+    err = a64fx_hwb_topo_cpumask_cmg(kapi_dev, cpumask);
+    if (err < 0)
+    {
+        pr_err("cpumask spans multiple CMGs or contains offline CPUs\n");
+        return -EINVAL;
+    }
+    *cmg = err;
+    cpumask_copy(&mask, cpumask);
+    err = oss_a64fx_hwb_allocate(kapi_dev, &init_task, NULL, *cmg, &mask, blade);
+    pr_debug("Kernel allocation on CMG %d returns %d (Blade %d)\n", *cmg, err, *blade);
+    return err;
+}
+EXPORT_SYMBOL_GPL(a64fx_hwb_kernel_alloc);
+
+int a64fx_hwb_kernel_free(int cmg, int blade)
+{
+    if (!kapi_dev)
+    {
+        return -ENODEV;
+    }
+    return oss_a64fx_hwb_free_task(kapi_dev, &init_task, cmg, blade);
+}
+EXPORT_SYMBOL_GPL(a64fx_hwb_kernel_free);
+
+int a64fx_hwb_kernel_assign(int blade, int *window)
+{
+    if (!kapi_dev)
+    {
+        return -ENODEV;
+    }
+    if (!window)
+    {
+        return -EINVAL;
+    }
+    return oss_a64fx_hwb_assign_blade(kapi_dev, &init_task, blade, -1, window);
+}
+EXPORT_SYMBOL_GPL(a64fx_hwb_kernel_assign);
+
+int a64fx_hwb_kernel_unassign(int blade, int window)
+{
+    if (!kapi_dev)
+    {
+        return -ENODEV;
+    }
+    return oss_a64fx_hwb_unassign_blade(kapi_dev, &init_task, blade, window);
+}
+EXPORT_SYMBOL_GPL(a64fx_hwb_kernel_unassign);
+
+// Same protocol as the user-space library: write the inverted LBSY to the window's
+// BST bit and poll until LBSY flips. The window is not checked against the
+// bookkeeping, like the user-space access it is a plain register access.
+int a64fx_hwb_kernel_sync(int window, unsigned int timeout_us)
+{
+    int i = 0;
+    int sync = 0;
+    int cur = 0;
+    u64 deadline = 0;
+
+    if (window < 0 || window >= MAX_BW_PER_CMG)
+    {
+        return -EINVAL;
+    }
+    if (timeout_us > 0)
+    {
+        deadline = ktime_get_ns() + (u64)timeout_us * NSEC_PER_USEC;
+    }
+    dsb(ish);
+    read_bst_sync_wr(window, &sync);
+    sync = !sync;
+    write_bst_sync_wr(window, sync);
+    for (;;)
+    {
+        read_bst_sync_wr(window, &cur);
+        if (cur == sync)
+        {
+            break;
+        }
+        cpu_relax();
+        if (deadline && ++i == A64FX_HWB_KAPI_POLLS)
+        {
+            i = 0;
+            if (ktime_get_ns() > deadline)
+            {
+                pr_debug("Window %d on CPU %d timed out\n", window, raw_smp_processor_id());
+                return -ETIMEDOUT;
+            }
+        }
+    }
+    isb();
+    return 0;
+}
+EXPORT_SYMBOL_GPL(a64fx_hwb_kernel_sync);
+
+void a64fx_hwb_kapi_init(struct a64fx_hwb_device *dev)
+{
+    kapi_dev = dev;
+}
+
+void a64fx_hwb_kapi_exit(void)
+{
+    kapi_dev = NULL;
+}
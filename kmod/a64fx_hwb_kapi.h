@@ -0,0 +1,34 @@
+#ifndef A64FX_HWB_KAPI_H
+#define A64FX_HWB_KAPI_H
+
+#include <linux/cpumask.h>
+
+/*
+ * In-kernel interface to the hardware barrier for kernel threads and per-CPU work
+ * items. The blades are kept in the same bookkeeping as the allocations of user
+ * processes (owner TGID 0), so they count against the blades of the CMG, show up in
+ * the status IOCTL and are restored after suspend.
+ *
+ * All functions except a64fx_hwb_kernel_sync() take the device lock and send IPIs,
+ * so they have to be called from process context without spinlocks held.
+ * Assign, sync and unassign work on the current CPU, the calling thread has to be
+ * bound to it (kthread_bind(), per-CPU workqueue).
+ */
+
+// Allocate a blade for the CPUs in cpumask, at least two online CPUs of one CMG
+int a64fx_hwb_kernel_alloc(const struct cpumask *cpumask, int *cmg, int *blade);
+int a64fx_hwb_kernel_free(int cmg, int blade);
+// Assign a free window of the current CPU to the blade of its CMG
+int a64fx_hwb_kernel_assign(int blade, int *window);
+int a64fx_hwb_kernel_unassign(int blade, int window);
+// Barrier episode on a window of the current CPU. Stores before the call are visible
+// to the other CPUs of the blade after it. With timeout_us > 0, -ETIMEDOUT is
+// returned when the other CPUs did not arrive in time, the episode stays open.
+int a64fx_hwb_kernel_sync(int window, unsigned int timeout_us);
+
+// Module internal, called at module load and unload
+struct a64fx_hwb_device;
+void a64fx_hwb_kapi_init(struct a64fx_hwb_device *dev);
+void a64fx_hwb_kapi_exit(void);
+
+#endif /* A64FX_HWB_KAPI_H */
@@ -9,16 +9,79 @@
 #include <include/linux/cpumask.h>
 #include <linux/slab.h>
 #include <linux/list.h>
+#include <linux/sched.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
 
 #include "a64fx_hwb.h"
 #include "a64fx_hwb_cmg.h"
 #include "fujitsu_hpc_ioctl.h"
 #include "a64fx_hwb_ioctl.h"
 #include "a64fx_hwb_asm.h"
+#include "a64fx_hwb_hotplug.h"
+#include "a64fx_hwb_quota.h"
+#include "a64fx_hwb_kapi.h"
+#include "a64fx_hwb_ctrl.h"
+#include "a64fx_hwb_topo.h"
 
 static long oss_a64fx_hwb_ioctl(struct file *file, unsigned int ioc, unsigned long arg);
+static struct a64fx_hwb_device oss_a64fx_hwb_device;
+/*
+ * Leak scanner, periodically frees the allocations of processes which died without
+ * releasing them. A new interval written at runtime takes effect immediately, 0 stops
+ * the scanner until a non-zero interval is written.
+ */
+static unsigned int leak_scan_ms = 5000;
+// set while the device is set up, protected by the parameter lock of the module
+static bool leak_scan_ready = false;
+
+static void oss_a64fx_hwb_scan_func(struct work_struct *work);
+static DECLARE_DELAYED_WORK(oss_a64fx_hwb_scan_work, oss_a64fx_hwb_scan_func);
+
+static int leak_scan_ms_set(const char *val, const struct kernel_param *kp)
+{
+    int err = param_set_uint(val, kp);
+    if (err < 0 || (!leak_scan_ready))
+    {
+        return err;
+    }
+    if (leak_scan_ms > 0)
+    {
+        mod_delayed_work(system_wq, &oss_a64fx_hwb_scan_work, msecs_to_jiffies(leak_scan_ms));
+    }
+    else
+    {
+        cancel_delayed_work_sync(&oss_a64fx_hwb_scan_work);
+    }
+    return 0;
+}
+
+static const struct kernel_param_ops leak_scan_ms_ops = {
+    .set = leak_scan_ms_set,
+    .get = param_get_uint,
+};
+module_param_cb(leak_scan_ms, &leak_scan_ms_ops, &leak_scan_ms, 0644);
+MODULE_PARM_DESC(leak_scan_ms, "Interval of the scanner for allocations of dead processes in ms, 0 disables it (default 5000)");
+
+static void oss_a64fx_hwb_scan_func(struct work_struct *work)
+{
+    int count = 0;
+    spin_lock(&oss_a64fx_hwb_device.dev_lock);
+    count = reclaim_dead_tasks(&oss_a64fx_hwb_device);
+    spin_unlock(&oss_a64fx_hwb_device.dev_lock);
+    if (count > 0)
+    {
+        pr_info("Reclaimed allocations of %d dead tasks\n", count);
+    }
+    if (leak_scan_ms > 0)
+    {
+        schedule_delayed_work(&oss_a64fx_hwb_scan_work, msecs_to_jiffies(leak_scan_ms));
+    }
+}
+
 static int oss_a64fx_hwb_open(struct inode *inode, struct file *file);
 static int oss_a64fx_hwb_close(struct inode *inode, struct file *file);
+static int oss_a64fx_hwb_flush(struct file *file, fl_owner_t id);
 
 
 
@@ -27,6 +90,7 @@ static const struct file_operations oss_a64fx_hwb_fops = {
 	.owner = THIS_MODULE,
 	.open = oss_a64fx_hwb_open,
 	.release = oss_a64fx_hwb_close,
+	.flush = oss_a64fx_hwb_flush,
 	.unlocked_ioctl = oss_a64fx_hwb_ioctl,
 	.compat_ioctl = oss_a64fx_hwb_ioctl,
 };
@@ -44,6 +108,63 @@ static ssize_t hwinfo_show(struct device *device, struct device_attribute *attr,
 
 DEVICE_ATTR_RO(hwinfo);
 
+/*
+ * Global reclaim attribute (sysfs file), tasks and blades freed at release/exit and by the
+ * leak scanner
+ */
+
+static ssize_t reclaimed_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    ssize_t slen = 0;
+    struct a64fx_hwb_device* dev = dev_get_drvdata(device);
+    spin_lock(&dev->dev_lock);
+    slen = scnprintf(buf, PAGE_SIZE, "release %lu %lu\nscanner %lu %lu\n",
+                     dev->reclaim_release.tasks, dev->reclaim_release.blades,
+                     dev->reclaim_scan.tasks, dev->reclaim_scan.blades);
+    spin_unlock(&dev->dev_lock);
+    return slen;
+}
+
+DEVICE_ATTR_RO(reclaimed);
+
+/*
+ * Global binary topology attribute (sysfs file 'topology_bin'), the CPU to CMG/PPE
+ * table and the capacity of each CMG in the layout of struct a64fx_hwb_topology
+ */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,13,0)
+static ssize_t topology_bin_read(struct file *filp, struct kobject *kobj, struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+#else
+static ssize_t topology_bin_read(struct file *filp, struct kobject *kobj, const struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+#endif
+{
+    ssize_t ret = 0;
+    struct a64fx_hwb_device* dev = dev_get_drvdata(kobj_to_dev(kobj));
+    struct a64fx_hwb_topology *topo = kmalloc(sizeof(struct a64fx_hwb_topology), GFP_KERNEL);
+    if (!topo)
+    {
+        return -ENOMEM;
+    }
+    a64fx_hwb_topo_export(dev, topo);
+    ret = memory_read_from_buffer(buf, count, &off, topo, sizeof(struct a64fx_hwb_topology));
+    kfree(topo);
+    return ret;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0) && LINUX_VERSION_CODE < KERNEL_VERSION(6,16,0)
+static const struct bin_attribute topology_bin_attr = {
+    .attr = { .name = "topology_bin", .mode = 0444 },
+    .read_new = topology_bin_read,
+    .size = sizeof(struct a64fx_hwb_topology),
+};
+#else
+static struct bin_attribute topology_bin_attr = {
+    .attr = { .name = "topology_bin", .mode = 0444 },
+    .read = topology_bin_read,
+    .size = sizeof(struct a64fx_hwb_topology),
+};
+#endif
+
 /*struct attribute *oss_a64fx_sysfs_base_attrs[] = {*/
 /*    &dev_attr_hwinfo.attr,*/
 /*    NULL,*/
@@ -61,23 +182,12 @@ static struct a64fx_hwb_device oss_a64fx_hwb_device = {
         .mode = 0666,
     },
     .task_list = LIST_HEAD_INIT(oss_a64fx_hwb_device.task_list),
+    .quota_list = LIST_HEAD_INIT(oss_a64fx_hwb_device.quota_list),
     .num_tasks = 0,
     .num_cmgs = 0,
     .active_count = 0,
 };
 
-struct hwb_ctrl_info {
-    int el0ae;
-    int el1ae;
-};
-
-static void oss_a64fx_hwb_ctrl_func(void* info)
-{
-    struct hwb_ctrl_info* cinfo = (struct hwb_ctrl_info*) info;
-    write_hwb_ctrl(cinfo->el0ae, cinfo->el1ae);
-    read_hwb_ctrl(&cinfo->el0ae, &cinfo->el1ae);
-}
-
 static int oss_a64fx_hwb_open(struct inode *inode, struct file *file)
 {
     pr_debug("Opening device\n");
@@ -89,35 +199,41 @@ static int oss_a64fx_hwb_open(struct inode *inode, struct file *file)
     return 0;
 }
 
+// Called when the last reference to the file is dropped. All allocations made through the
+// file are freed, no matter which task closes it.
 static int oss_a64fx_hwb_close(struct inode *inode, struct file *file)
 {
-    int err = 0;
-    struct task_struct* task = get_current();
-    struct a64fx_task_mapping *taskmap = NULL;
     spin_lock(&oss_a64fx_hwb_device.dev_lock);
     pr_debug("Closing device (Active %d)\n", oss_a64fx_hwb_device.active_count);
     if (oss_a64fx_hwb_device.active_count > 0)
     {
         oss_a64fx_hwb_device.active_count--;
-        taskmap = get_taskmap(&oss_a64fx_hwb_device, task);
-        if (taskmap && task_pid_nr(task) == task_pid_nr(taskmap->task))
-        {
-            err = unregister_task(&oss_a64fx_hwb_device, taskmap);
-            if (err)
-            {
-                pr_debug("Failed close for task %d (TGID %d)\n", task->pid, task->tgid);
-            }
-        }
     }
     else
     {
         pr_err("Close on not opened device\n");
     }
+    reclaim_file_allocations(&oss_a64fx_hwb_device, file);
     pr_debug("Active Tasks %d\n", oss_a64fx_hwb_device.active_count);
     spin_unlock(&oss_a64fx_hwb_device.dev_lock);
     return 0;
 }
 
+// Called at every close of a file descriptor. When the process exits, its allocations are
+// freed immediately, even if a child process inherited the descriptor and keeps the file
+// open.
+static int oss_a64fx_hwb_flush(struct file *file, fl_owner_t id)
+{
+    struct task_struct* task = get_current();
+    if (task->flags & PF_EXITING)
+    {
+        spin_lock(&oss_a64fx_hwb_device.dev_lock);
+        reclaim_task_allocations(&oss_a64fx_hwb_device, task);
+        spin_unlock(&oss_a64fx_hwb_device.dev_lock);
+    }
+    return 0;
+}
+
 static long oss_a64fx_hwb_ioctl(struct file *file, unsigned int ioc, unsigned long arg)
 {
     int err = 0;
@@ -137,15 +253,31 @@ static long oss_a64fx_hwb_ioctl(struct file *file, unsigned int ioc, unsigned lo
             break;
         case FUJITSU_HWB_IOC_BB_ALLOC:
             pr_debug("FUJITSU_HWB_IOC_BB_ALLOC...\n");
-            err = oss_a64fx_hwb_allocate_ioctl(&oss_a64fx_hwb_device, arg);
+            err = oss_a64fx_hwb_allocate_ioctl(&oss_a64fx_hwb_device, file, arg);
             break;
         case FUJITSU_HWB_IOC_BB_FREE:
             pr_debug("FUJITSU_HWB_IOC_BB_FREE...\n");
             err = oss_a64fx_hwb_free_ioctl(&oss_a64fx_hwb_device, arg);
             break;
+        case A64FX_HWB_IOC_BB_RESIZE:
+            pr_debug("A64FX_HWB_IOC_BB_RESIZE...\n");
+            err = oss_a64fx_hwb_resize_ioctl(&oss_a64fx_hwb_device, arg);
+            break;
+        case A64FX_HWB_IOC_WAIT:
+            err = oss_a64fx_hwb_wait_ioctl(&oss_a64fx_hwb_device, arg);
+            break;
         case FUJITSU_HWB_IOC_RESET:
             pr_debug("FUJITSU_HWB_IOC_RESET...\n");
             err = oss_a64fx_hwb_reset_ioctl(&oss_a64fx_hwb_device, arg);
+            break;
+        case A64FX_HWB_IOC_RESET_SCOPED:
+            pr_debug("A64FX_HWB_IOC_RESET_SCOPED...\n");
+            err = oss_a64fx_hwb_reset_scoped_ioctl(&oss_a64fx_hwb_device, arg);
+            break;
+        case A64FX_HWB_IOC_BB_STATUS:
+            pr_debug("A64FX_HWB_IOC_BB_STATUS...\n");
+            err = oss_a64fx_hwb_status_ioctl(&oss_a64fx_hwb_device, arg);
+            break;
         default:
             err = -ENOTTY;
             break;
@@ -154,55 +286,18 @@ static long oss_a64fx_hwb_ioctl(struct file *file, unsigned int ioc, unsigned lo
     return err;
 }
 
-void fill_pe_map(void *info)
-{
-    int cmg = 0;
-    int ppe = 0;
-    struct a64fx_hwb_device* dev = (struct a64fx_hwb_device*)info;
-    // preemption disabled, safe to use smp_processor_id()
-    int cpuid = smp_processor_id();
-    oss_a64fx_hwb_get_peinfo(&cmg, &ppe);
-    dev->cmgs[cmg].pe_map[ppe].cpu_id = cpuid;
-    dev->cmgs[cmg].pe_map[ppe].cmg_id = cmg;
-    dev->cmgs[cmg].pe_map[ppe].ppe_id = ppe;
-    pr_debug("CPU %d CMG %d PPE %d\n", cpuid, cmg, ppe);
-    dev->cmgs[cmg].pe_map[ppe].bw_map = 0x0;
-}
-
-static int get_max_pe_per_cmg(struct a64fx_hwb_device* dev)
-{
-    int i = 0;
-    int j = 0;
-    int maxcount = 0;
-    int tmpcount = 0;
-    for (i = 0; i < MAX_NUM_CMG; i++)
-    {
-        tmpcount = 0;
-        for (j = 0; j < MAX_PE_PER_CMG; j++)
-        {
-            if (dev->cmgs[i].pe_map[j].cpu_id >= 0)
-            {
-                tmpcount++;
-            }
-        }
-        pr_debug("CMG %d has %d PEs\n", i, tmpcount);
-        dev->cmgs[i].num_pes = tmpcount;
-        if (tmpcount > maxcount)
-        {
-            maxcount = tmpcount;
-        }
-    }
-    return maxcount;
-}
-
 static int __init oss_a64fx_hwb_init(void)
 {
     int err = 0;
     int i = 0;
     int j = 0;
-    struct hwb_ctrl_info info = {1, 1};
     struct device *dev = NULL;
     pr_debug("initializing...\n");
+    spin_lock_init(&oss_a64fx_hwb_device.dev_lock);
+    err = a64fx_hwb_ctrl_init();
+    if (err) {
+        return err;
+    }
 
     // Create misc device fujitsu_hwb
     err = misc_register(&oss_a64fx_hwb_device.misc);
@@ -219,15 +314,28 @@ static int __init oss_a64fx_hwb_init(void)
         pr_err("creation of hwinfo sysfs file failed\n");
         goto unreg_miscdev;
     }
+    err = device_create_file(dev, &dev_attr_reclaimed);
+    if (err) {
+        pr_err("creation of reclaimed sysfs file failed\n");
+        goto remove_hwinfo;
+    }
+    err = device_create_bin_file(dev, &topology_bin_attr);
+    if (err) {
+        pr_err("creation of topology_bin sysfs file failed\n");
+        goto remove_reclaimed;
+    }
+    err = a64fx_hwb_quota_init(&oss_a64fx_hwb_device, dev);
+    if (err) {
+        goto remove_topology;
+    }
 
     // Iterate over CMGs and initialize data structures and CMG
     // related sysfs files
     for (i = 0; i < MAX_NUM_CMG; i++)
         memset(oss_a64fx_hwb_device.cmgs[i].pe_map, -1, sizeof(struct a64fx_core_mapping)*MAX_PE_PER_CMG);
 
-    on_each_cpu(fill_pe_map, (void*)&oss_a64fx_hwb_device, 1);
     oss_a64fx_hwb_device.num_cmgs = MAX_NUM_CMG;
-    oss_a64fx_hwb_device.max_pe_per_cmg = get_max_pe_per_cmg(&oss_a64fx_hwb_device);
+    oss_a64fx_hwb_device.max_pe_per_cmg = 0;
     oss_a64fx_hwb_device.num_bb_per_cmg = MAX_BB_PER_CMG;
     oss_a64fx_hwb_device.num_bw_per_cmg = MAX_BW_PER_CMG;
 
@@ -244,13 +352,36 @@ static int __init oss_a64fx_hwb_init(void)
         }
     }
 
-    pr_debug("init done\n");
-    for_each_online_cpu(j)
+    // Fill the PE map and the CMG cpumasks and enable the EL0/EL1 access on all online
+    // CPUs. CPUs coming online later are handled by the hotplug callbacks.
+    err = a64fx_hwb_hotplug_init(&oss_a64fx_hwb_device);
+    if (err < 0)
     {
-        smp_call_function_single(j, oss_a64fx_hwb_ctrl_func, &info, 1);
+        goto destroy_cmgs;
     }
+    kernel_param_lock(THIS_MODULE);
+    leak_scan_ready = true;
+    if (leak_scan_ms > 0)
+    {
+        schedule_delayed_work(&oss_a64fx_hwb_scan_work, msecs_to_jiffies(leak_scan_ms));
+    }
+    kernel_param_unlock(THIS_MODULE);
+    // in-kernel users only after the setup is complete
+    a64fx_hwb_kapi_init(&oss_a64fx_hwb_device);
+    pr_debug("init done\n");
     return err;
+destroy_cmgs:
+    for (i = 0; i < MAX_NUM_CMG; i++)
+    {
+        destroy_cmg(&oss_a64fx_hwb_device.cmgs[i]);
+    }
 remove_global_sysfs:
+    a64fx_hwb_quota_exit(&oss_a64fx_hwb_device, dev);
+remove_topology:
+    device_remove_bin_file(dev, &topology_bin_attr);
+remove_reclaimed:
+    device_remove_file(dev, &dev_attr_reclaimed);
+remove_hwinfo:
     device_remove_file(dev, &dev_attr_hwinfo);
 unreg_miscdev:
     misc_deregister(&oss_a64fx_hwb_device.misc);
@@ -260,14 +391,15 @@ unreg_miscdev:
 static void __exit oss_a64fx_hwb_exit(void)
 {
     int i = 0;
-    int j = 0;
     struct device *dev = NULL;
-    struct hwb_ctrl_info info = {0, 0};
     pr_debug("exiting...\n");
-    for_each_online_cpu(j)
-    {
-        smp_call_function_single(j, oss_a64fx_hwb_ctrl_func, &info, 1);
-    }
+    a64fx_hwb_kapi_exit();
+    kernel_param_lock(THIS_MODULE);
+    leak_scan_ready = false;
+    cancel_delayed_work_sync(&oss_a64fx_hwb_scan_work);
+    kernel_param_unlock(THIS_MODULE);
+    // Disables the EL0/EL1 access on all CPUs
+    a64fx_hwb_hotplug_exit();
     // Iterate over CMGs and destroy data structures and CMG
     // related sysfs files
     for (i = 0; i < oss_a64fx_hwb_device.num_cmgs; i++)
@@ -275,7 +407,10 @@ static void __exit oss_a64fx_hwb_exit(void)
         destroy_cmg(&oss_a64fx_hwb_device.cmgs[i]);
     }
     dev = oss_a64fx_hwb_device.misc.this_device;
-    // Remove global sysfs attribute 'hwinfo'
+    // Remove global sysfs attributes 'hwinfo', 'reclaimed', 'topology_bin' and 'blade_quota'
+    a64fx_hwb_quota_exit(&oss_a64fx_hwb_device, dev);
+    device_remove_bin_file(dev, &topology_bin_attr);
+    device_remove_file(dev, &dev_attr_reclaimed);
     device_remove_file(dev, &dev_attr_hwinfo);
     // Remove misc device fujitsu_hwb
     misc_deregister(&oss_a64fx_hwb_device.misc);
@@ -0,0 +1,284 @@
+#define pr_fmt(fmt) "%s:%s: " fmt, KBUILD_MODNAME, __func__
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/device.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include <linux/list.h>
+#include <linux/cgroup.h>
+#include <linux/rcupdate.h>
+#include <linux/bitops.h>
+#include <linux/bitmap.h>
+
+#include "a64fx_hwb.h"
+#include "a64fx_hwb_quota.h"
+
+/*
+ * Blade quotas and reservations per cgroup. Only six blades exist per CMG, so a batch
+ * system has to be able to guarantee each job the blades on the CMGs it was given.
+ * Quotas are managed by root through the global sysfs file 'blade_quota':
+ *
+ *   echo "<cgroup path> <cmg> <limit> <reserve>" > blade_quota
+ *   echo "<cgroup path> clear" > blade_quota
+ *
+ * The cgroup path is relative to the root of the cgroup v2 hierarchy. A limit of -1
+ * means unlimited. A task is accounted to the most specific entry whose cgroup contains
+ * the task. A new blade is only handed out if it does not eat into the unused
+ * reservations of other entries. Reading the file lists all entries with the current
+ * usage per CMG.
+ */
+
+// Entry for the cgroup of a task, the deepest cgroup wins. Called with RCU read lock held.
+static struct a64fx_hwb_quota* find_quota(struct a64fx_hwb_device *dev, struct task_struct *task)
+{
+    struct list_head *cur = NULL;
+    struct a64fx_hwb_quota *quota = NULL;
+    struct a64fx_hwb_quota *best = NULL;
+    struct cgroup *cgrp = task_dfl_cgroup(task);
+    list_for_each(cur, &dev->quota_list)
+    {
+        quota = list_entry(cur, struct a64fx_hwb_quota, list);
+        if (cgroup_is_descendant(cgrp, quota->cgrp))
+        {
+            if ((!best) || quota->cgrp->level > best->cgrp->level)
+            {
+                best = quota;
+            }
+        }
+    }
+    return best;
+}
+
+// Check whether the task may allocate another blade on the CMG and charge it to the task's
+// quota entry. Returns the charged entry (NULL if the task has none) or an ERR_PTR.
+// The device lock has to be held.
+struct a64fx_hwb_quota* a64fx_hwb_quota_charge(struct a64fx_hwb_device *dev, struct task_struct *task, int cmg)
+{
+    int free_blades = 0;
+    int reserved = 0;
+    struct list_head *cur = NULL;
+    struct a64fx_hwb_quota *quota = NULL;
+    struct a64fx_hwb_quota *other = NULL;
+
+    if (list_empty(&dev->quota_list))
+    {
+        return NULL;
+    }
+    rcu_read_lock();
+    quota = find_quota(dev, task);
+    rcu_read_unlock();
+
+    if (quota && quota->limit[cmg] != A64FX_HWB_QUOTA_UNLIMITED && quota->used[cmg] >= quota->limit[cmg])
+    {
+        pr_debug("TGID %d reached limit of %d blades on CMG %d (%s)\n", task_tgid_nr(task), quota->limit[cmg], cmg, quota->path);
+        return ERR_PTR(-EDQUOT);
+    }
+    // Blades reserved but not yet used by other entries
+    list_for_each(cur, &dev->quota_list)
+    {
+        other = list_entry(cur, struct a64fx_hwb_quota, list);
+        if (other != quota && other->reserve[cmg] > other->used[cmg])
+        {
+            reserved += other->reserve[cmg] - other->used[cmg];
+        }
+    }
+    free_blades = dev->num_bb_per_cmg - bitmap_weight(&dev->cmgs[cmg].bb_active, MAX_BB_PER_CMG);
+    if (free_blades - reserved < 1)
+    {
+        pr_debug("No unreserved blade on CMG %d for TGID %d (free %d reserved %d)\n", cmg, task_tgid_nr(task), free_blades, reserved);
+        return ERR_PTR(-EBUSY);
+    }
+    if (quota)
+    {
+        quota->used[cmg]++;
+    }
+    return quota;
+}
+
+// Return a blade charged by a64fx_hwb_quota_charge() that was not allocated after all.
+// quota may be NULL. The device lock has to be held.
+void a64fx_hwb_quota_uncharge_cmg(struct a64fx_hwb_quota *quota, int cmg)
+{
+    if (quota)
+    {
+        quota->used[cmg]--;
+    }
+}
+
+// Return the blade of an allocation to its quota entry. The device lock has to be held.
+void a64fx_hwb_quota_uncharge(struct a64fx_task_allocation *alloc)
+{
+    a64fx_hwb_quota_uncharge_cmg(alloc->quota, alloc->cmg);
+    alloc->quota = NULL;
+}
+
+static struct a64fx_hwb_quota* get_quota_by_path(struct a64fx_hwb_device *dev, const char *path)
+{
+    struct list_head *cur = NULL;
+    struct a64fx_hwb_quota *quota = NULL;
+    list_for_each(cur, &dev->quota_list)
+    {
+        quota = list_entry(cur, struct a64fx_hwb_quota, list);
+        if (strncmp(quota->path, path, A64FX_HWB_QUOTA_PATH_LEN) == 0)
+        {
+            return quota;
+        }
+    }
+    return NULL;
+}
+
+// Remove an entry, allocations charged to it are not accounted anymore.
+// The device lock has to be held.
+static void remove_quota(struct a64fx_hwb_device *dev, struct a64fx_hwb_quota *quota)
+{
+    struct list_head *taskcur = NULL, *alloccur = NULL;
+    struct a64fx_task_mapping *taskmap = NULL;
+    struct a64fx_task_allocation *alloc = NULL;
+    list_for_each(taskcur, &dev->task_list)
+    {
+        taskmap = list_entry(taskcur, struct a64fx_task_mapping, list);
+        list_for_each(alloccur, &taskmap->allocs)
+        {
+            alloc = list_entry(alloccur, struct a64fx_task_allocation, list);
+            if (alloc->quota == quota)
+            {
+                alloc->quota = NULL;
+            }
+        }
+    }
+    list_del(&quota->list);
+}
+
+static ssize_t blade_quota_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    int cmg = 0;
+    int slen = 0;
+    struct list_head *cur = NULL;
+    struct a64fx_hwb_quota *quota = NULL;
+    struct a64fx_hwb_device* dev = dev_get_drvdata(device);
+    spin_lock(&dev->dev_lock);
+    list_for_each(cur, &dev->quota_list)
+    {
+        quota = list_entry(cur, struct a64fx_hwb_quota, list);
+        for (cmg = 0; cmg < dev->num_cmgs; cmg++)
+        {
+            slen += scnprintf(&buf[slen], PAGE_SIZE-slen, "%s %d %d %d %d\n", quota->path, cmg, quota->limit[cmg], quota->reserve[cmg], quota->used[cmg]);
+        }
+    }
+    spin_unlock(&dev->dev_lock);
+    return slen;
+}
+
+static ssize_t blade_quota_store(struct device *device, struct device_attribute *attr, const char *buf, size_t count)
+{
+    int i = 0;
+    int cmg = 0;
+    int limit = 0;
+    int reserve = 0;
+    char path[A64FX_HWB_QUOTA_PATH_LEN];
+    char arg[16];
+    struct cgroup *cgrp = NULL;
+    struct a64fx_hwb_quota *quota = NULL;
+    struct a64fx_hwb_quota *newquota = NULL;
+    struct a64fx_hwb_device* dev = dev_get_drvdata(device);
+
+    if (sscanf(buf, "%255s %15s", path, arg) != 2)
+    {
+        return -EINVAL;
+    }
+    if (strcmp(arg, "clear") == 0)
+    {
+        spin_lock(&dev->dev_lock);
+        quota = get_quota_by_path(dev, path);
+        if (quota)
+        {
+            remove_quota(dev, quota);
+        }
+        spin_unlock(&dev->dev_lock);
+        if (!quota)
+        {
+            return -ENOENT;
+        }
+        pr_debug("Remove quota for %s\n", quota->path);
+        cgroup_put(quota->cgrp);
+        kfree(quota);
+        return count;
+    }
+    if (sscanf(buf, "%255s %d %d %d", path, &cmg, &limit, &reserve) != 4)
+    {
+        return -EINVAL;
+    }
+    if (cmg < 0 || cmg >= dev->num_cmgs || limit < A64FX_HWB_QUOTA_UNLIMITED || limit > dev->num_bb_per_cmg ||
+        reserve < 0 || reserve > dev->num_bb_per_cmg || (limit != A64FX_HWB_QUOTA_UNLIMITED && reserve > limit))
+    {
+        return -EINVAL;
+    }
+
+    // Resolving the cgroup and allocating may sleep, do it before taking the lock
+    cgrp = cgroup_get_from_path(path);
+    if (IS_ERR(cgrp))
+    {
+        pr_debug("Cannot find cgroup %s\n", path);
+        return PTR_ERR(cgrp);
+    }
+    newquota = kzalloc(sizeof(struct a64fx_hwb_quota), GFP_KERNEL);
+    if (!newquota)
+    {
+        cgroup_put(cgrp);
+        return -ENOMEM;
+    }
+
+    spin_lock(&dev->dev_lock);
+    quota = get_quota_by_path(dev, path);
+    if (!quota)
+    {
+        quota = newquota;
+        newquota = NULL;
+        strscpy(quota->path, path, A64FX_HWB_QUOTA_PATH_LEN);
+        quota->cgrp = cgrp;
+        cgrp = NULL;
+        for (i = 0; i < MAX_NUM_CMG; i++)
+        {
+            quota->limit[i] = A64FX_HWB_QUOTA_UNLIMITED;
+        }
+        INIT_LIST_HEAD(&quota->list);
+        list_add(&quota->list, &dev->quota_list);
+    }
+    quota->limit[cmg] = limit;
+    quota->reserve[cmg] = reserve;
+    spin_unlock(&dev->dev_lock);
+    pr_debug("Quota for %s on CMG %d: limit %d reserve %d\n", path, cmg, limit, reserve);
+
+    if (cgrp)
+    {
+        cgroup_put(cgrp);
+    }
+    kfree(newquota);
+    return count;
+}
+
+static DEVICE_ATTR_RW(blade_quota);
+
+int a64fx_hwb_quota_init(struct a64fx_hwb_device *dev, struct device *device)
+{
+    int err = device_create_file(device, &dev_attr_blade_quota);
+    if (err)
+    {
+        pr_err("creation of blade_quota sysfs file failed\n");
+    }
+    return err;
+}
+
+void a64fx_hwb_quota_exit(struct a64fx_hwb_device *dev, struct device *device)
+{
+    struct list_head *cur = NULL, *tmp = NULL;
+    struct a64fx_hwb_quota *quota = NULL;
+    device_remove_file(device, &dev_attr_blade_quota);
+    list_for_each_safe(cur, tmp, &dev->quota_list)
+    {
+        quota = list_entry(cur, struct a64fx_hwb_quota, list);
+        list_del(&quota->list);
+        cgroup_put(quota->cgrp);
+        kfree(quota);
+    }
+}
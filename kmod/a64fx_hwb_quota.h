@@ -0,0 +1,27 @@
+#ifndef A64FX_HWB_QUOTA_H
+#define A64FX_HWB_QUOTA_H
+
+#include <linux/device.h>
+
+#include "a64fx_hwb.h"
+
+#define A64FX_HWB_QUOTA_PATH_LEN 256
+#define A64FX_HWB_QUOTA_UNLIMITED (-1)
+
+// Blade limit and reservation per CMG for all tasks inside a cgroup (v2 hierarchy)
+struct a64fx_hwb_quota {
+    struct list_head list;
+    struct cgroup *cgrp;
+    char path[A64FX_HWB_QUOTA_PATH_LEN];
+    int limit[MAX_NUM_CMG];
+    int reserve[MAX_NUM_CMG];
+    int used[MAX_NUM_CMG];
+};
+
+int a64fx_hwb_quota_init(struct a64fx_hwb_device *dev, struct device *device);
+void a64fx_hwb_quota_exit(struct a64fx_hwb_device *dev, struct device *device);
+struct a64fx_hwb_quota* a64fx_hwb_quota_charge(struct a64fx_hwb_device *dev, struct task_struct *task, int cmg);
+void a64fx_hwb_quota_uncharge_cmg(struct a64fx_hwb_quota *quota, int cmg);
+void a64fx_hwb_quota_uncharge(struct a64fx_task_allocation *alloc);
+
+#endif
@@ -0,0 +1,112 @@
+#define pr_fmt(fmt) "%s:%s: " fmt, KBUILD_MODNAME, __func__
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+
+#include "a64fx_hwb.h"
+#include "a64fx_hwb_topo.h"
+
+/*
+ * Topology index: CPU -> (CMG, PPE, PE map entry). The IOCTL paths translate cpumasks
+ * and the calling CPU with it instead of scanning the PE maps of all CMGs while
+ * holding the device lock. Entries are written with the device lock held.
+ */
+
+DEFINE_PER_CPU(struct a64fx_cpu_topo, a64fx_hwb_cpu_topo);
+
+void a64fx_hwb_topo_set(int cpu, struct a64fx_core_mapping *pe)
+{
+    struct a64fx_cpu_topo* topo = per_cpu_ptr(&a64fx_hwb_cpu_topo, cpu);
+    topo->cmg_id = pe->cmg_id;
+    topo->ppe_id = pe->ppe_id;
+    topo->ppe_bit = BIT(pe->ppe_id);
+    topo->pe = pe;
+    pr_debug("CPU %d -> CMG %d PPE %d\n", cpu, topo->cmg_id, topo->ppe_id);
+}
+
+// Get the CMG of the CPUs in cpumask. Returns -1 if the CPUs are on different CMGs or
+// not all of them are online
+int a64fx_hwb_topo_cpumask_cmg(struct a64fx_hwb_device *dev, const struct cpumask *cpumask)
+{
+    struct a64fx_cpu_topo* topo = a64fx_hwb_topo(cpumask_first(cpumask));
+    if (!topo)
+    {
+        return -1;
+    }
+    // cmgmask contains only the online CPUs of the CMG
+    if (!cpumask_subset(cpumask, &dev->cmgs[topo->cmg_id].cmgmask))
+    {
+        return -1;
+    }
+    return topo->cmg_id;
+}
+
+// Get the BST_MASK for the CPUs in cpumask that belong to the CMG
+unsigned long a64fx_hwb_topo_ppemask(struct a64fx_cmg_device *cmg, const struct cpumask *cpumask)
+{
+    int cpu = 0;
+    unsigned long mask = 0x0UL;
+    struct a64fx_cpu_topo* topo = NULL;
+    for_each_cpu(cpu, cpumask)
+    {
+        topo = a64fx_hwb_topo(cpu);
+        if (topo && topo->cmg_id == cmg->cmg_id)
+        {
+            mask |= topo->ppe_bit;
+        }
+    }
+    return mask;
+}
+
+// Fill the binary topology export (topology_bin) from the PE maps. The device lock
+// keeps the PE maps, the CMG cpumasks and the allocated blades consistent.
+void a64fx_hwb_topo_export(struct a64fx_hwb_device *dev, struct a64fx_hwb_topology *out)
+{
+    int c = 0;
+    int i = 0;
+    int cpu = 0;
+    struct a64fx_cmg_device *cmg = NULL;
+    struct a64fx_core_mapping *pe = NULL;
+
+    memset(out, 0, sizeof(struct a64fx_hwb_topology));
+    for (cpu = 0; cpu < A64FX_HWB_TOPO_CPUS; cpu++)
+    {
+        out->cpu[cpu].cmg = -1;
+        out->cpu[cpu].ppe = -1;
+    }
+    out->version = A64FX_HWB_TOPO_VERSION;
+    out->num_cmgs = dev->num_cmgs;
+    spin_lock(&dev->dev_lock);
+    for (c = 0; c < dev->num_cmgs && c < A64FX_HWB_TOPO_CMGS; c++)
+    {
+        cmg = &dev->cmgs[c];
+        out->cmg[c].num_pes = cmg->num_pes;
+        out->cmg[c].online_pes = cpumask_weight(&cmg->cmgmask);
+        out->cmg[c].num_blades = dev->num_bb_per_cmg;
+        out->cmg[c].free_blades = dev->num_bb_per_cmg - hweight_long(cmg->bb_active);
+        out->cmg[c].num_windows = dev->num_bw_per_cmg;
+        for (i = 0; i < MAX_PE_PER_CMG; i++)
+        {
+            pe = &cmg->pe_map[i];
+            if (pe->cpu_id < 0)
+            {
+                continue;
+            }
+            out->cmg[c].pe_mask |= BIT(pe->ppe_id);
+            if (pe->cpu_id >= A64FX_HWB_TOPO_CPUS)
+            {
+                continue;
+            }
+            out->cpu[pe->cpu_id].cmg = pe->cmg_id;
+            out->cpu[pe->cpu_id].ppe = pe->ppe_id;
+            out->cpu[pe->cpu_id].online = cpumask_test_cpu(pe->cpu_id, &cmg->cmgmask);
+            if (pe->cpu_id >= out->num_cpus)
+            {
+                out->num_cpus = pe->cpu_id + 1;
+            }
+        }
+    }
+    spin_unlock(&dev->dev_lock);
+}
@@ -0,0 +1,39 @@
+#ifndef A64FX_HWB_TOPO_H
+#define A64FX_HWB_TOPO_H
+
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+
+#include "a64fx_hwb.h"
+
+// Per-CPU entry of the topology index. It is filled by the hotplug online callback
+// (so at module load for all online CPUs) and kept when the CPU goes offline.
+struct a64fx_cpu_topo {
+    int cmg_id;
+    int ppe_id;
+    // BIT(ppe_id), the CPU's bit in a blade's BST_MASK
+    unsigned long ppe_bit;
+    // PE map entry of the CPU, NULL if the CPU was never online
+    struct a64fx_core_mapping* pe;
+};
+
+DECLARE_PER_CPU(struct a64fx_cpu_topo, a64fx_hwb_cpu_topo);
+
+// Get the topology entry of a CPU or NULL if the CPU is unknown
+static inline struct a64fx_cpu_topo* a64fx_hwb_topo(int cpu)
+{
+    struct a64fx_cpu_topo* topo = NULL;
+    if ((cpu < 0) || (cpu >= nr_cpu_ids))
+    {
+        return NULL;
+    }
+    topo = per_cpu_ptr(&a64fx_hwb_cpu_topo, cpu);
+    return (topo->pe ? topo : NULL);
+}
+
+void a64fx_hwb_topo_set(int cpu, struct a64fx_core_mapping *pe);
+int a64fx_hwb_topo_cpumask_cmg(struct a64fx_hwb_device *dev, const struct cpumask *cpumask);
+unsigned long a64fx_hwb_topo_ppemask(struct a64fx_cmg_device *cmg, const struct cpumask *cpumask);
+void a64fx_hwb_topo_export(struct a64fx_hwb_device *dev, struct a64fx_hwb_topology *out);
+
+#endif
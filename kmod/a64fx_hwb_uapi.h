@@ -0,0 +1,159 @@
+#ifndef A64FX_HWB_UAPI_H
+#define A64FX_HWB_UAPI_H
+
+/*
+ * IOCTLs and structures provided by this module in addition to the ones
+ * defined by Fujitsu's fujitsu_hpc_ioctl.h. This header is shared between
+ * the kernel module and user-space (hwbx library, tools), so it only uses
+ * the __u* types.
+ */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#include "fujitsu_hpc_ioctl.h"
+
+// Block until the LBSY bit of a window assigned on the calling (pinned) CPU
+// becomes 'sync'. A timeout of 0 waits until the barrier resolves or a signal
+// arrives.
+struct a64fx_hwb_ioc_wait {
+    __u8 window;
+    __u8 sync;
+    __u8 unused[2];
+    __u32 timeout_us;
+};
+
+#define A64FX_HWB_IOC_WAIT _IOW(__FUJITSU_IOCTL_MAGIC, 0x06, struct a64fx_hwb_ioc_wait)
+
+// Rewrite the BST_MASK of an allocated blade (cmg, bb) to the CPUs in pemask. The new
+// mask has to be on the same CMG and contain all CPUs with a window assigned to the
+// blade.
+#define A64FX_HWB_IOC_BB_RESIZE _IOW(__FUJITSU_IOCTL_MAGIC, 0x07, struct fujitsu_hwb_ioc_bb_ctl)
+
+// Reset the blades and windows of one process, one CMG or one blade without touching
+// the rest of the node. The allocations in the scope are freed and their windows and
+// blades are cleared, for the CMG and blade scopes also the windows and blade
+// registers without owner. EL0 access stays enabled. The TGID scope with tgid 0 (or
+// the caller's TGID) and the blade scope for a blade of the calling process are
+// allowed for everybody, everything else requires CAP_SYS_ADMIN. The number of freed
+// allocations is returned in freed.
+#define A64FX_HWB_RESET_TGID 0
+#define A64FX_HWB_RESET_CMG 1
+#define A64FX_HWB_RESET_BLADE 2
+
+struct a64fx_hwb_ioc_reset {
+    __u8 scope;
+    __u8 cmg;
+    __u8 bb;
+    __u8 unused;
+    __s32 tgid;
+    __u32 freed;
+};
+
+#define A64FX_HWB_IOC_RESET_SCOPED _IOWR(__FUJITSU_IOCTL_MAGIC, 0x08, struct a64fx_hwb_ioc_reset)
+
+// Layout of the binary per-CMG sysfs file CMGx/snapshot_bin. All registers of a CMG
+// are read in one IPI wave, the module serves cached copies to readers that come
+// within the module parameter snapshot_interval_ms.
+#define A64FX_HWB_SNAPSHOT_BLADES 6
+#define A64FX_HWB_SNAPSHOT_WINDOWS 4
+#define A64FX_HWB_SNAPSHOT_PES 13
+
+// INIT_SYNC_BBx of a blade. active is the driver's view (allocated or not)
+struct a64fx_hwb_snapshot_blade {
+    __u16 bst_mask;
+    __u16 bst;
+    __u8 lbsy;
+    __u8 active;
+    __u8 unused[2];
+};
+
+// ASSIGN_SYNC_Wx and BST_SYNC_Wx of a PE, indexed by the physical PE number. cpu is -1
+// if the PE was not online when the snapshot was taken. Bit x of window_valid and
+// window_lbsy belongs to window x, window_blade is -1 for unassigned windows.
+struct a64fx_hwb_snapshot_pe {
+    __s32 cpu;
+    __u8 ppe;
+    __u8 window_valid;
+    __u8 window_lbsy;
+    __u8 unused;
+    __s8 window_blade[A64FX_HWB_SNAPSHOT_WINDOWS];
+};
+
+struct a64fx_hwb_snapshot {
+    // CLOCK_REALTIME of the hardware read
+    __u64 timestamp_ns;
+    __u32 cmg;
+    __u32 num_pes;
+    struct a64fx_hwb_snapshot_blade blade[A64FX_HWB_SNAPSHOT_BLADES];
+    struct a64fx_hwb_snapshot_pe pe[A64FX_HWB_SNAPSHOT_PES];
+};
+
+// Live state of a blade for diagnosing hanging barriers. With window >= 0, the blade
+// assigned to this window on the calling CPU by the calling process is selected and cmg
+// and bb are returned, otherwise cmg and bb select the blade. INIT_SYNC_BB is read from
+// the hardware at every call. tgid is the owning process, 0 if the blade is not
+// allocated. cpu maps the physical PE numbers of the masks to CPUs (-1 if none).
+struct a64fx_hwb_ioc_bb_status {
+    __s8 window;
+    __u8 cmg;
+    __u8 bb;
+    __u8 lbsy;
+    __u16 bst_mask;
+    __u16 bst;
+    // PEs of bst_mask that did not arrive in the current episode
+    __u16 pending;
+    __u8 active;
+    __u8 unused;
+    __s32 tgid;
+    __s32 cpu[A64FX_HWB_SNAPSHOT_PES];
+};
+
+#define A64FX_HWB_IOC_BB_STATUS _IOWR(__FUJITSU_IOCTL_MAGIC, 0x09, struct a64fx_hwb_ioc_bb_status)
+
+// Layout of the binary sysfs file topology_bin of the device. A single read returns the
+// CMG and physical PE of every CPU known to the module and the capacity of each CMG,
+// instead of one GET_PE_INFO IOCTL per pinned thread. CPUs that were never online
+// have cmg -1. Entries are kept when a CPU goes offline, online tells the current
+// state. free_blades is the number of unallocated blades at the time of the read.
+#define A64FX_HWB_TOPO_VERSION 1
+#define A64FX_HWB_TOPO_CMGS 4
+#define A64FX_HWB_TOPO_CPUS 256
+
+struct a64fx_hwb_topo_cmg {
+    __u8 num_pes;
+    __u8 online_pes;
+    __u8 num_blades;
+    __u8 free_blades;
+    // windows per PE
+    __u8 num_windows;
+    __u8 unused;
+    // physical PEs of the CMG, the bits of BST_MASK
+    __u16 pe_mask;
+};
+
+struct a64fx_hwb_topo_cpu {
+    __s8 cmg;
+    __s8 ppe;
+    __u8 online;
+    __u8 unused;
+};
+
+struct a64fx_hwb_topology {
+    __u32 version;
+    __u32 num_cmgs;
+    // highest known CPU + 1, the entries behind it are unset
+    __u32 num_cpus;
+    __u32 unused;
+    struct a64fx_hwb_topo_cmg cmg[A64FX_HWB_TOPO_CMGS];
+    struct a64fx_hwb_topo_cpu cpu[A64FX_HWB_TOPO_CPUS];
+};
+
+// An arriving PE writes the inverted LBSY to its BST bit. While LBSY is 0, the PEs with
+// BST 0 are missing, while LBSY is 1 the ones with BST 1.
+static inline __u16 a64fx_hwb_pending_pes(__u16 bst_mask, __u16 bst, __u8 lbsy)
+{
+    return (lbsy ? (bst_mask & bst) : (bst_mask & ~bst));
+}
+
+#endif /* A64FX_HWB_UAPI_H */
@@ -0,0 +1,137 @@
+#define pr_fmt(fmt) "%s:%s: " fmt, KBUILD_MODNAME, __func__
+#include <linux/version.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/jiffies.h>
+
+#include "a64fx_hwb.h"
+#include "a64fx_hwb_asm.h"
+#include "a64fx_hwb_wait.h"
+
+/*
+ * Blocking wait for a barrier window. The hardware does not raise an interrupt
+ * when LBSY flips, so the waiting thread is parked on a wait queue and a pinned
+ * hrtimer polls the window register on the thread's CPU. The window registers
+ * are PE-local, so the timer callback can read them although the waiting thread
+ * is not running. The user-space library uses this only as last tier after
+ * spinning and WFE, so the polling interval can be rather coarse.
+ */
+
+static unsigned int wait_poll_us = 20;
+module_param(wait_poll_us, uint, 0644);
+MODULE_PARM_DESC(wait_poll_us, "Polling interval of the LBSY timer for blocking waits in us (default 20)");
+
+#define A64FX_HWB_WAIT_PENDING 0
+#define A64FX_HWB_WAIT_RESOLVED 1
+#define A64FX_HWB_WAIT_UNASSIGNED 2
+
+struct hwb_wait_info {
+    struct hrtimer timer;
+    wait_queue_head_t wq;
+    ktime_t interval;
+    int window;
+    int sync;
+    int state;
+};
+
+// Timer callback, executed in hardirq context on the CPU of the waiting thread.
+// It stops polling when LBSY reached the expected value or when the window got
+// unassigned in the meantime (free from another thread, reset).
+static enum hrtimer_restart hwb_wait_timer_func(struct hrtimer *timer)
+{
+    int sync = 0;
+    int valid = 0;
+    int blade = 0;
+    struct hwb_wait_info *winfo = container_of(timer, struct hwb_wait_info, timer);
+
+    read_assign_sync_wr(winfo->window, &valid, &blade);
+    if (!valid)
+    {
+        WRITE_ONCE(winfo->state, A64FX_HWB_WAIT_UNASSIGNED);
+        wake_up(&winfo->wq);
+        return HRTIMER_NORESTART;
+    }
+    read_bst_sync_wr(winfo->window, &sync);
+    if (sync == winfo->sync)
+    {
+        WRITE_ONCE(winfo->state, A64FX_HWB_WAIT_RESOLVED);
+        wake_up(&winfo->wq);
+        return HRTIMER_NORESTART;
+    }
+    hrtimer_forward_now(timer, winfo->interval);
+    return HRTIMER_RESTART;
+}
+
+// Wait until LBSY of the window on the current CPU becomes sync. The caller has to make
+// sure that the task is pinned to the CPU owning the window and that no lock is held.
+int a64fx_hwb_wait_lbsy(struct a64fx_cmg_device *cmg, int window, int sync, unsigned int timeout_us)
+{
+    int err = 0;
+    int cur = 0;
+    long remaining = 0;
+    struct hwb_wait_info winfo;
+
+    read_bst_sync_wr(window, &cur);
+    if (cur == sync)
+    {
+        atomic_long_inc(&cmg->wait_stats.immediate);
+        return 0;
+    }
+
+    init_waitqueue_head(&winfo.wq);
+    winfo.window = window;
+    winfo.sync = sync;
+    winfo.state = A64FX_HWB_WAIT_PENDING;
+    winfo.interval = us_to_ktime(max(wait_poll_us, 1U));
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,13,0)
+    hrtimer_init_on_stack(&winfo.timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+    winfo.timer.function = hwb_wait_timer_func;
+#else
+    hrtimer_setup_on_stack(&winfo.timer, hwb_wait_timer_func, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+#endif
+    pr_debug("Block on CPU %d for window %d (sync %d, timeout %u us)\n", raw_smp_processor_id(), window, sync, timeout_us);
+    hrtimer_start(&winfo.timer, winfo.interval, HRTIMER_MODE_REL_PINNED);
+
+    if (timeout_us > 0)
+    {
+        remaining = wait_event_interruptible_timeout(winfo.wq, READ_ONCE(winfo.state) != A64FX_HWB_WAIT_PENDING, usecs_to_jiffies(timeout_us));
+        if (remaining == 0)
+        {
+            err = -ETIMEDOUT;
+        }
+        else if (remaining < 0)
+        {
+            err = (int)remaining;
+        }
+    }
+    else
+    {
+        err = wait_event_interruptible(winfo.wq, READ_ONCE(winfo.state) != A64FX_HWB_WAIT_PENDING);
+    }
+    hrtimer_cancel(&winfo.timer);
+    destroy_hrtimer_on_stack(&winfo.timer);
+
+    if (err == -ETIMEDOUT)
+    {
+        atomic_long_inc(&cmg->wait_stats.timeout);
+    }
+    else if (err)
+    {
+        atomic_long_inc(&cmg->wait_stats.interrupted);
+    }
+    else if (winfo.state == A64FX_HWB_WAIT_UNASSIGNED)
+    {
+        atomic_long_inc(&cmg->wait_stats.unassigned);
+        err = -ENODEV;
+    }
+    else
+    {
+        atomic_long_inc(&cmg->wait_stats.resolved);
+    }
+    pr_debug("Wait for window %d returns %d\n", window, err);
+    return err;
+}
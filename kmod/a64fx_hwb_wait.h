@@ -0,0 +1,8 @@
+#ifndef A64FX_HWB_WAIT_H
+#define A64FX_HWB_WAIT_H
+
+#include "a64fx_hwb.h"
+
+int a64fx_hwb_wait_lbsy(struct a64fx_cmg_device *cmg, int window, int sync, unsigned int timeout_us);
+
+#endif
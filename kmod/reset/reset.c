@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -8,17 +9,80 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 
+#include "../a64fx_hwb_uapi.h"
 
-int main()
+#define FUJITSU_HWB_IOC_RESET _IOWR(__FUJITSU_IOCTL_MAGIC, 0x05, int)
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s <scope>\n", prog);
+	printf("  tgid [<tgid>]      allocations of a process (default: own process)\n");
+	printf("  cmg <cmg>          all blades and windows of a CMG\n");
+	printf("  blade <cmg> <bb>   a single blade and its windows\n");
+	printf("  all                the whole node\n");
+	printf("Everything except the own process and own blades requires CAP_SYS_ADMIN.\n");
+}
+
+int main(int argc, char* argv[])
 {
 	int fd;
 	int ret;
 	int dummy = 42;
-	
-	fd = open("/dev/fujitsu_hwb", O_RDONLY);
+	struct a64fx_hwb_ioc_reset reset;
+
+	if (argc < 2)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	memset(&reset, 0, sizeof(reset));
+	if (strcmp(argv[1], "tgid") == 0 && argc <= 3)
+	{
+		reset.scope = A64FX_HWB_RESET_TGID;
+		reset.tgid = (argc == 3 ? atoi(argv[2]) : 0);
+	}
+	else if (strcmp(argv[1], "cmg") == 0 && argc == 3)
+	{
+		reset.scope = A64FX_HWB_RESET_CMG;
+		reset.cmg = (__u8)atoi(argv[2]);
+	}
+	else if (strcmp(argv[1], "blade") == 0 && argc == 4)
+	{
+		reset.scope = A64FX_HWB_RESET_BLADE;
+		reset.cmg = (__u8)atoi(argv[2]);
+		reset.bb = (__u8)atoi(argv[3]);
+	}
+	else if (strcmp(argv[1], "all") != 0 || argc != 2)
+	{
+		usage(argv[0]);
+		return 1;
+	}
 
-	ret = ioctl(fd, _IOWR('F', 0x05, int), &dummy);
+	fd = open("/dev/fujitsu_hwb", O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Cannot open /dev/fujitsu_hwb: %s\n", strerror(errno));
+		return 1;
+	}
+	if (strcmp(argv[1], "all") == 0)
+	{
+		ret = ioctl(fd, FUJITSU_HWB_IOC_RESET, &dummy);
+	}
+	else
+	{
+		ret = ioctl(fd, A64FX_HWB_IOC_RESET_SCOPED, &reset);
+	}
+	if (ret < 0)
+	{
+		fprintf(stderr, "Reset failed: %s\n", strerror(errno));
+		close(fd);
+		return 1;
+	}
+	if (strcmp(argv[1], "all") != 0)
+	{
+		printf("Freed %u allocations\n", reset.freed);
+	}
 
-    close(fd);
+	close(fd);
 	return 0;
 }
@@ -0,0 +1,794 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <linux/kernel.h>
+#include <linux/smp.h>
+#include <linux/cpumask.h>
+#include <linux/sched.h>
+
+#include "a64fx_hwb.h"
+#include "a64fx_hwb_asm.h"
+#include "a64fx_hwb_ioctl.h"
+#include "a64fx_hwb_topo.h"
+#include "a64fx_hwb_uapi.h"
+#include "mock_hwb.h"
+
+/*
+ * Stress driver for the control path of the module. Simulated tasks (one thread each,
+ * grouped into processes sharing a file and TGID) run allocate/assign/wait/status/
+ * resize/unassign/free sequences with random cpumasks on random CMGs, migrating between
+ * the CPUs of the mask like the threads of an OpenMP team, and occasionally reset their
+ * process, blade or CMG or the whole device. Every other process has CAP_SYS_ADMIN.
+ * A checker thread periodically takes the device lock and verifies the bookkeeping
+ * and the simulated registers. Reports throughput and latency percentiles
+ * per IOCTL and exits with 1 if any invariant was violated.
+ */
+
+enum stress_op {
+    STRESS_ALLOC = 0,
+    STRESS_ASSIGN,
+    STRESS_WAIT,
+    STRESS_STATUS,
+    STRESS_RESIZE,
+    STRESS_UNASSIGN,
+    STRESS_FREE,
+    STRESS_RESET,
+    STRESS_RESET_ALL,
+    STRESS_NUM_OPS
+};
+
+static const char* stress_op_names[STRESS_NUM_OPS] = {
+    "alloc", "assign", "wait", "status", "resize", "unassign", "free", "reset", "reset_all"
+};
+
+static const unsigned int stress_op_ioc[STRESS_NUM_OPS] = {
+    FUJITSU_HWB_IOC_BB_ALLOC,
+    FUJITSU_HWB_IOC_BW_ASSIGN,
+    A64FX_HWB_IOC_WAIT,
+    A64FX_HWB_IOC_BB_STATUS,
+    A64FX_HWB_IOC_BB_RESIZE,
+    FUJITSU_HWB_IOC_BW_UNASSIGN,
+    FUJITSU_HWB_IOC_BB_FREE,
+    A64FX_HWB_IOC_RESET_SCOPED,
+    FUJITSU_HWB_IOC_RESET,
+};
+
+struct stress_samples {
+    u64 *ns;
+    size_t count;
+    size_t size;
+    unsigned long fails;
+};
+
+struct stress_proc {
+    struct file file;
+    struct task_struct *leader;
+    int threads_left;
+};
+
+struct stress_thread {
+    pthread_t thread;
+    int id;
+    u64 rng;
+    struct stress_proc *proc;
+    struct task_struct task;
+    struct stress_samples samples[STRESS_NUM_OPS];
+    // allocations failing because all blades of the CMG are taken, and with other errors
+    unsigned long alloc_busy;
+    unsigned long alloc_unexpected;
+};
+
+static struct a64fx_hwb_device stress_dev;
+static int num_cmgs = MAX_NUM_CMG;
+static int pes_per_cmg = 12;
+static int num_threads = 16;
+static int threads_per_proc = 1;
+static int iterations = 2000;
+static int reset_every = 500;
+static int check_us = 200;
+static int verbose = 0;
+static unsigned long seed = 42;
+static int max_busy_percent = 50;
+
+static volatile int stress_stop = 0;
+// incremented before and after every reset, odd while one is running
+static unsigned long stress_resets = 0;
+static unsigned long stress_checks = 0;
+static unsigned long stress_violations = 0;
+
+static u64 stress_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+// xorshift64*
+static u64 stress_rand(struct stress_thread *t)
+{
+    t->rng ^= t->rng >> 12;
+    t->rng ^= t->rng << 25;
+    t->rng ^= t->rng >> 27;
+    return t->rng * 2685821657736338717ULL;
+}
+
+static void stress_record(struct stress_samples *s, u64 ns, int err)
+{
+    if (s->count == s->size)
+    {
+        s->size = (s->size ? 2 * s->size : 1024);
+        s->ns = realloc(s->ns, s->size * sizeof(u64));
+        if (!s->ns)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(2);
+        }
+    }
+    s->ns[s->count++] = ns;
+    if (err)
+    {
+        s->fails++;
+    }
+}
+
+static int stress_ioctl(struct stress_thread *t, enum stress_op op, void *arg)
+{
+    long err = 0;
+    u64 start = 0;
+    int reset = (op == STRESS_RESET || op == STRESS_RESET_ALL);
+    if (reset)
+    {
+        __atomic_add_fetch(&stress_resets, 1, __ATOMIC_SEQ_CST);
+    }
+    start = stress_now_ns();
+    err = mock_hwb_ioctl(&stress_dev, &t->proc->file, stress_op_ioc[op], (unsigned long)arg);
+    stress_record(&t->samples[op], stress_now_ns() - start, (int)err);
+    if (reset)
+    {
+        __atomic_add_fetch(&stress_resets, 1, __ATOMIC_SEQ_CST);
+    }
+    return (int)err;
+}
+
+// Random CPU out of a mask of CPU numbers
+static int stress_pick_cpu(struct stress_thread *t, unsigned long mask)
+{
+    int n = (int)(stress_rand(t) % (u64)hweight_long(mask));
+    int cpu = 0;
+    for_each_set_bit(cpu, &mask, BITS_PER_LONG)
+    {
+        if (n-- == 0)
+        {
+            break;
+        }
+    }
+    return cpu;
+}
+
+// Random mask of at least two CPUs of a CMG
+static unsigned long stress_pick_mask(struct stress_thread *t, int cmg)
+{
+    unsigned long all = ((1UL << pes_per_cmg) - 1) << (cmg * pes_per_cmg);
+    unsigned long mask = (unsigned long)stress_rand(t) & all;
+    while (hweight_long(mask) < 2)
+    {
+        mask |= BIT(stress_pick_cpu(t, all));
+    }
+    return mask;
+}
+
+// Only the task that registered the process frees a blade completely through the IOCTL,
+// for the other tasks of the group it just leaves the blade. They free through the
+// allocating task like the kernel API does, otherwise the blades leak per process.
+static int stress_free(struct stress_thread *t, struct fujitsu_hwb_ioc_bb_ctl *bb_ctl)
+{
+    int err = 0;
+    int owner = 0;
+    u64 start = 0;
+    struct a64fx_task_mapping *taskmap = NULL;
+
+    spin_lock(&stress_dev.dev_lock);
+    taskmap = get_taskmap(&stress_dev, &t->task);
+    // the mapping cannot be replaced while the process holds the allocation
+    owner = ((!taskmap) || taskmap->task == &t->task);
+    spin_unlock(&stress_dev.dev_lock);
+    if (owner)
+    {
+        return stress_ioctl(t, STRESS_FREE, bb_ctl);
+    }
+    start = stress_now_ns();
+    err = oss_a64fx_hwb_free_task(&stress_dev, &t->task, bb_ctl->cmg, bb_ctl->bb);
+    stress_record(&t->samples[STRESS_FREE], stress_now_ns() - start, err);
+    return err;
+}
+
+static void stress_iteration(struct stress_thread *t)
+{
+    int cpu = 0;
+    int err = 0;
+    int sync = 0;
+    int window[NR_CPUS];
+    unsigned long resets = 0;
+    unsigned long cpus = 0x0UL;
+    unsigned long assigned = 0x0UL;
+    int cmg = (int)(stress_rand(t) % (u64)num_cmgs);
+    struct fujitsu_hwb_ioc_bb_ctl bb_ctl;
+    struct fujitsu_hwb_ioc_bw_ctl bw_ctl;
+    struct a64fx_hwb_ioc_wait wait;
+    struct a64fx_hwb_ioc_bb_status status;
+
+    cpus = stress_pick_mask(t, cmg);
+    mock_hwb_migrate(stress_pick_cpu(t, cpus));
+    resets = __atomic_load_n(&stress_resets, __ATOMIC_SEQ_CST);
+    memset(&bb_ctl, 0, sizeof(bb_ctl));
+    bb_ctl.pemask = &cpus;
+    bb_ctl.size = sizeof(cpus);
+    err = stress_ioctl(t, STRESS_ALLOC, &bb_ctl);
+    if (err < 0)
+    {
+        if (err == -ENODEV)
+        {
+            t->alloc_busy++;
+        }
+        else
+        {
+            t->alloc_unexpected++;
+            if (verbose)
+            {
+                fprintf(stderr, "Thread %d: alloc on CMG %d returns %d\n", t->id, cmg, err);
+            }
+        }
+        return;
+    }
+
+    // assign windows on a random subset of the CPUs, like a team entering a region
+    for_each_set_bit(cpu, &cpus, BITS_PER_LONG)
+    {
+        if (stress_rand(t) & 0x3)
+        {
+            mock_hwb_migrate(cpu);
+            bw_ctl.bb = bb_ctl.bb;
+            bw_ctl.window = -1;
+            if (stress_ioctl(t, STRESS_ASSIGN, &bw_ctl) == 0)
+            {
+                window[cpu] = bw_ctl.window;
+                assigned |= BIT(cpu);
+            }
+        }
+    }
+
+    if (assigned)
+    {
+        // LBSY does not change without BST writes, so the wait returns immediately
+        mock_hwb_migrate(stress_pick_cpu(t, assigned));
+        read_bst_sync_wr(window[kshim_cpu], &sync);
+        memset(&wait, 0, sizeof(wait));
+        wait.window = (__u8)window[kshim_cpu];
+        wait.sync = (__u8)sync;
+        wait.timeout_us = 1000;
+        stress_ioctl(t, STRESS_WAIT, &wait);
+
+        // nobody arrived, so all PEs of the blade are pending. A reset by another task
+        // (e.g. of the own process) may have freed the blade in the meantime.
+        memset(&status, 0, sizeof(status));
+        status.window = (__s8)window[kshim_cpu];
+        if (stress_ioctl(t, STRESS_STATUS, &status) == 0 && (resets & 1) == 0 &&
+            resets == __atomic_load_n(&stress_resets, __ATOMIC_SEQ_CST) &&
+            (status.cmg != bb_ctl.cmg || status.bb != bb_ctl.bb || (!status.active) ||
+             status.tgid != t->task.tgid || status.pending != status.bst_mask ||
+             status.cpu[kshim_cpu % pes_per_cmg] != kshim_cpu))
+        {
+            __atomic_add_fetch(&stress_violations, 1, __ATOMIC_RELAXED);
+            if (verbose)
+            {
+                fprintf(stderr, "Thread %d: wrong status of CMG %d Blade %d\n", t->id, bb_ctl.cmg, bb_ctl.bb);
+            }
+        }
+    }
+
+    if ((stress_rand(t) & 0x3) == 0)
+    {
+        // grow or shrink the team, the assigned CPUs have to stay
+        unsigned long resized = assigned | (stress_pick_mask(t, cmg) & stress_rand(t));
+        while (hweight_long(resized) < 2)
+        {
+            resized |= BIT(stress_pick_cpu(t, stress_pick_mask(t, cmg)));
+        }
+        bb_ctl.pemask = &resized;
+        if (stress_ioctl(t, STRESS_RESIZE, &bb_ctl) == 0)
+        {
+            cpus = resized;
+        }
+        bb_ctl.pemask = &cpus;
+    }
+
+    // unassign some windows, the free has to release the remaining ones
+    for_each_set_bit(cpu, &assigned, BITS_PER_LONG)
+    {
+        if (stress_rand(t) & 0x1)
+        {
+            mock_hwb_migrate(cpu);
+            bw_ctl.bb = bb_ctl.bb;
+            bw_ctl.window = (__s8)window[cpu];
+            stress_ioctl(t, STRESS_UNASSIGN, &bw_ctl);
+        }
+    }
+
+    mock_hwb_migrate(stress_pick_cpu(t, cpus));
+    if (reset_every > 0 && (stress_rand(t) % (u64)reset_every) == 0)
+    {
+        // instead of the free, reset the own process, the own blade or the whole CMG
+        // (EPERM without CAP_SYS_ADMIN)
+        struct a64fx_hwb_ioc_reset reset;
+        memset(&reset, 0, sizeof(reset));
+        reset.scope = (__u8)(stress_rand(t) % 3);
+        reset.cmg = bb_ctl.cmg;
+        reset.bb = bb_ctl.bb;
+        if (stress_ioctl(t, STRESS_RESET, &reset) == 0)
+        {
+            return;
+        }
+    }
+    err = stress_free(t, &bb_ctl);
+    if (err < 0 && verbose)
+    {
+        fprintf(stderr, "Thread %d: free of CMG %d Blade %d returns %d\n", t->id, bb_ctl.cmg, bb_ctl.bb, err);
+    }
+
+    if (reset_every > 0 && (stress_rand(t) % (8 * (u64)reset_every)) == 0)
+    {
+        int dummy = 0;
+        stress_ioctl(t, STRESS_RESET_ALL, &dummy);
+    }
+}
+
+static void* stress_thread_func(void *arg)
+{
+    int i = 0;
+    int last = 0;
+    struct stress_thread *t = (struct stress_thread*) arg;
+
+    kshim_current = &t->task;
+    for (i = 0; i < iterations; i++)
+    {
+        stress_iteration(t);
+    }
+    last = (__atomic_sub_fetch(&t->proc->threads_left, 1, __ATOMIC_ACQ_REL) == 0);
+    if (last)
+    {
+        // the last thread of the process drops the file, freeing its leftovers
+        mock_hwb_release(&stress_dev, &t->proc->file);
+    }
+    mock_hwb_exit();
+    return NULL;
+}
+
+static void* stress_check_func(void *arg)
+{
+    struct timespec ts = { .tv_sec = check_us / 1000000, .tv_nsec = (check_us % 1000000) * 1000L };
+    while (!stress_stop)
+    {
+        nanosleep(&ts, NULL);
+        spin_lock(&stress_dev.dev_lock);
+        __atomic_add_fetch(&stress_violations, mock_hwb_check(&stress_dev, verbose), __ATOMIC_RELAXED);
+        stress_checks++;
+        spin_unlock(&stress_dev.dev_lock);
+    }
+    return NULL;
+}
+
+static int stress_cmp(const void *a, const void *b)
+{
+    u64 x = *(const u64*)a;
+    u64 y = *(const u64*)b;
+    return (x > y) - (x < y);
+}
+
+static double stress_percentile(struct stress_samples *s, double p)
+{
+    if (s->count == 0)
+    {
+        return 0.0;
+    }
+    return (double)s->ns[(size_t)(p * (double)(s->count - 1))] / 1000.0;
+}
+
+static void stress_report(struct stress_thread *threads, double wall)
+{
+    int i = 0;
+    int op = 0;
+    int c = 0;
+    long local = 0, hk = 0, idle = 0, unassigned = 0, busy = 0;
+    unsigned long total = 0;
+    struct stress_samples all;
+
+    printf("%-9s %10s %10s %10s %10s %10s %10s\n", "ioctl", "count", "failed", "p50[us]", "p99[us]", "p99.9[us]", "max[us]");
+    for (op = 0; op < STRESS_NUM_OPS; op++)
+    {
+        memset(&all, 0, sizeof(all));
+        for (i = 0; i < num_threads; i++)
+        {
+            struct stress_samples *s = &threads[i].samples[op];
+            size_t j = 0;
+            for (j = 0; j < s->count; j++)
+            {
+                stress_record(&all, s->ns[j], 0);
+            }
+            all.fails += s->fails;
+        }
+        qsort(all.ns, all.count, sizeof(u64), stress_cmp);
+        printf("%-9s %10zu %10lu %10.2f %10.2f %10.2f %10.2f\n", stress_op_names[op], all.count, all.fails,
+               stress_percentile(&all, 0.5), stress_percentile(&all, 0.99), stress_percentile(&all, 0.999),
+               stress_percentile(&all, 1.0));
+        total += all.count;
+        free(all.ns);
+    }
+    printf("%lu IOCTLs in %.3f s (%.0f IOCTL/s), %lu IPIs on %lu CPUs, %lu errors logged\n", total, wall,
+           (double)total / wall, kshim_ipi_calls, kshim_ipi_cpus, kshim_errors);
+    // control path placement, summed over the CMGs like CMGx/ipi_stats
+    for (c = 0; c < num_cmgs; c++)
+    {
+        local += atomic_long_read(&stress_dev.cmgs[c].ipi_stats.local);
+        hk += atomic_long_read(&stress_dev.cmgs[c].ipi_stats.housekeeping);
+        idle += atomic_long_read(&stress_dev.cmgs[c].ipi_stats.idle);
+        unassigned += atomic_long_read(&stress_dev.cmgs[c].ipi_stats.unassigned);
+        busy += atomic_long_read(&stress_dev.cmgs[c].ipi_stats.busy);
+    }
+    printf("Control path: %ld local, %ld housekeeping, %ld idle, %ld unassigned, %ld busy\n", local, hk, idle, unassigned, busy);
+}
+
+// The binary topology export has to agree with the topology index, all blades are free
+static unsigned long stress_check_topology(void)
+{
+    int cpu = 0;
+    int c = 0;
+    unsigned long violations = 0;
+    struct a64fx_cpu_topo *topo = NULL;
+    struct a64fx_hwb_topology *out = malloc(sizeof(struct a64fx_hwb_topology));
+    if (!out)
+    {
+        return 1;
+    }
+    a64fx_hwb_topo_export(&stress_dev, out);
+    for (cpu = 0; cpu < A64FX_HWB_TOPO_CPUS; cpu++)
+    {
+        topo = a64fx_hwb_topo(cpu);
+        if (topo ? (out->cpu[cpu].cmg != topo->cmg_id || out->cpu[cpu].ppe != topo->ppe_id || (!out->cpu[cpu].online))
+                 : (out->cpu[cpu].cmg != -1))
+        {
+            fprintf(stderr, "check failed: topology export of CPU %d is %d/%d\n", cpu, out->cpu[cpu].cmg, out->cpu[cpu].ppe);
+            violations++;
+        }
+    }
+    for (c = 0; c < num_cmgs; c++)
+    {
+        if (out->cmg[c].num_pes != pes_per_cmg || out->cmg[c].online_pes != pes_per_cmg ||
+            out->cmg[c].free_blades != out->cmg[c].num_blades)
+        {
+            fprintf(stderr, "check failed: topology export of CMG %d has %d/%d PEs and %d/%d free blades\n", c,
+                    out->cmg[c].online_pes, out->cmg[c].num_pes, out->cmg[c].free_blades, out->cmg[c].num_blades);
+            violations++;
+        }
+    }
+    free(out);
+    return violations;
+}
+
+// Single-threaded process pid as the current task, running on cpu
+static void stress_fixture_task(struct task_struct *task, int pid, int cpu)
+{
+    memset(task, 0, sizeof(struct task_struct));
+    task->pid = pid;
+    task->tgid = task->pid;
+    task->group_leader = task;
+    task->nr_threads = 1;
+    kshim_current = task;
+    mock_hwb_migrate(cpu);
+}
+
+// Open file for the current task and allocate a blade for the CPUs in mask through it
+static int stress_fixture_alloc(struct file *file, unsigned long *mask, struct fujitsu_hwb_ioc_bb_ctl *bb_ctl)
+{
+    memset(file, 0, sizeof(struct file));
+    mock_hwb_open(&stress_dev, file);
+    memset(bb_ctl, 0, sizeof(struct fujitsu_hwb_ioc_bb_ctl));
+    bb_ctl->pemask = mask;
+    bb_ctl->size = sizeof(unsigned long);
+    return (int)mock_hwb_ioctl(&stress_dev, file, FUJITSU_HWB_IOC_BB_ALLOC, (unsigned long)bb_ctl);
+}
+
+// A process with two files (ulib and hwbx open the device separately): the release of
+// one file frees only the allocations made through it
+static unsigned long stress_check_files(void)
+{
+    int i = 0;
+    unsigned long violations = 0;
+    unsigned long cpus = 0x3UL;
+    struct task_struct task;
+    struct file files[2];
+    struct fujitsu_hwb_ioc_bb_ctl bb_ctl[2];
+    struct a64fx_task_mapping *taskmap = NULL;
+
+    stress_fixture_task(&task, 999, 0);
+    set_bit(CAP_SYS_ADMIN, &task.cap_effective);
+    for (i = 0; i < 2; i++)
+    {
+        if (stress_fixture_alloc(&files[i], &cpus, &bb_ctl[i]) < 0)
+        {
+            fprintf(stderr, "check failed: allocation through file %d\n", i);
+            violations++;
+        }
+    }
+    mock_hwb_release(&stress_dev, &files[0]);
+    spin_lock(&stress_dev.dev_lock);
+    taskmap = get_taskmap(&stress_dev, &task);
+    if ((!taskmap) || taskmap->num_allocs != 1 || test_bit(bb_ctl[0].bb, &stress_dev.cmgs[0].bb_active) ||
+        (!test_bit(bb_ctl[1].bb, &stress_dev.cmgs[0].bb_active)))
+    {
+        fprintf(stderr, "check failed: release of one file did not free exactly its allocation\n");
+        violations++;
+    }
+    spin_unlock(&stress_dev.dev_lock);
+    mock_hwb_release(&stress_dev, &files[1]);
+    spin_lock(&stress_dev.dev_lock);
+    if (get_taskmap(&stress_dev, &task) || stress_dev.cmgs[0].bb_active != 0)
+    {
+        fprintf(stderr, "check failed: release of the second file left allocations\n");
+        violations++;
+    }
+    violations += mock_hwb_check(&stress_dev, 1);
+    spin_unlock(&stress_dev.dev_lock);
+    mock_hwb_exit();
+    return violations;
+}
+
+// Resetting the own blade clears it with the free, without interrupting the other
+// CPUs of the CMG
+static unsigned long stress_check_reset(void)
+{
+    unsigned long violations = 0;
+    unsigned long cpus = 0x3UL;
+    unsigned long ipi_cpus = 0;
+    struct task_struct task;
+    struct file file;
+    struct fujitsu_hwb_ioc_bb_ctl bb_ctl;
+    struct a64fx_hwb_ioc_reset reset;
+
+    stress_fixture_task(&task, 998, 0);
+    if (stress_fixture_alloc(&file, &cpus, &bb_ctl) < 0)
+    {
+        fprintf(stderr, "check failed: allocation for the reset\n");
+        violations++;
+    }
+    memset(&reset, 0, sizeof(reset));
+    reset.scope = A64FX_HWB_RESET_BLADE;
+    reset.cmg = bb_ctl.cmg;
+    reset.bb = bb_ctl.bb;
+    ipi_cpus = kshim_ipi_cpus;
+    if (mock_hwb_ioctl(&stress_dev, &file, A64FX_HWB_IOC_RESET_SCOPED, (unsigned long)&reset) < 0 ||
+        kshim_ipi_cpus - ipi_cpus > 1)
+    {
+        fprintf(stderr, "check failed: reset of the own blade ran on %lu CPUs\n", kshim_ipi_cpus - ipi_cpus);
+        violations++;
+    }
+    mock_hwb_release(&stress_dev, &file);
+    spin_lock(&stress_dev.dev_lock);
+    violations += mock_hwb_check(&stress_dev, 1);
+    spin_unlock(&stress_dev.dev_lock);
+    mock_hwb_exit();
+    return violations;
+}
+
+// A free while no CPU of the blade's CMG is online cannot clear the register. It reports
+// the error, the bookkeeping is dropped all the same.
+static unsigned long stress_check_offline(void)
+{
+    unsigned long violations = 0;
+    unsigned long cpus = (0x3UL << pes_per_cmg);
+    struct task_struct task;
+    struct file file;
+    struct cpumask online;
+    struct fujitsu_hwb_ioc_bb_ctl bb_ctl;
+    struct a64fx_cmg_device *cmg = &stress_dev.cmgs[1];
+
+    if (num_cmgs < 2)
+    {
+        return 0;
+    }
+    stress_fixture_task(&task, 997, pes_per_cmg);
+    if (stress_fixture_alloc(&file, &cpus, &bb_ctl) < 0)
+    {
+        fprintf(stderr, "check failed: allocation before the offline\n");
+        violations++;
+    }
+    // CMG 1 without online CPUs, the free runs on CMG 0
+    mock_hwb_migrate(0);
+    spin_lock(&stress_dev.dev_lock);
+    cpumask_copy(&online, &cmg->cmgmask);
+    cpumask_clear(&cmg->cmgmask);
+    spin_unlock(&stress_dev.dev_lock);
+    if (mock_hwb_ioctl(&stress_dev, &file, FUJITSU_HWB_IOC_BB_FREE, (unsigned long)&bb_ctl) != -ENXIO)
+    {
+        fprintf(stderr, "check failed: free on an offline CMG did not report -ENXIO\n");
+        violations++;
+    }
+    spin_lock(&stress_dev.dev_lock);
+    cpumask_copy(&cmg->cmgmask, &online);
+    if (test_bit(bb_ctl.bb, &cmg->bb_active) || get_taskmap(&stress_dev, &task))
+    {
+        fprintf(stderr, "check failed: free on an offline CMG kept the allocation\n");
+        violations++;
+    }
+    spin_unlock(&stress_dev.dev_lock);
+    mock_hwb_release(&stress_dev, &file);
+    mock_hwb_exit();
+    return violations;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("  -t <n>   simulated tasks (threads, default %d)\n", num_threads);
+    printf("  -g <n>   tasks per process (default %d)\n", threads_per_proc);
+    printf("  -n <n>   iterations per task (default %d)\n", iterations);
+    printf("  -c <n>   CMGs (default %d)\n", num_cmgs);
+    printf("  -p <n>   PEs per CMG (default %d)\n", pes_per_cmg);
+    printf("  -r <n>   scoped reset with probability 1/n per iteration, full reset with 1/8n,\n");
+    printf("           0 disables (default %d)\n", reset_every);
+    printf("  -i <us>  interval of the invariant checker (default %d)\n", check_us);
+    printf("  -s <n>   random seed (default %lu)\n", seed);
+    printf("  -f <n>   fail if more than n%% of the allocations find no free blade (default %d)\n", max_busy_percent);
+    printf("  -v       print violations, twice for module debug output\n");
+}
+
+int main(int argc, char* argv[])
+{
+    int c = 0;
+    int i = 0;
+    int err = 0;
+    int num_procs = 0;
+    u64 start = 0;
+    double wall = 0.0;
+    unsigned long allocs = 0, busy = 0, unexpected = 0;
+    pthread_t checker;
+    struct stress_proc *procs = NULL;
+    struct stress_thread *threads = NULL;
+
+    while ((c = getopt(argc, argv, "t:g:n:c:p:r:i:s:f:vh")) != -1)
+    {
+        switch (c)
+        {
+            case 't': num_threads = atoi(optarg); break;
+            case 'g': threads_per_proc = atoi(optarg); break;
+            case 'n': iterations = atoi(optarg); break;
+            case 'c': num_cmgs = atoi(optarg); break;
+            case 'p': pes_per_cmg = atoi(optarg); break;
+            case 'r': reset_every = atoi(optarg); break;
+            case 'i': check_us = atoi(optarg); break;
+            case 's': seed = strtoul(optarg, NULL, 0); break;
+            case 'f': max_busy_percent = atoi(optarg); break;
+            case 'v': verbose++; break;
+            default:
+                usage(argv[0]);
+                return (c == 'h' ? 0 : 2);
+        }
+    }
+    if (num_threads < 1 || threads_per_proc < 1 || iterations < 0 || check_us < 1)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    if (verbose > 1)
+    {
+        kshim_loglevel = KSHIM_LOG_DEBUG;
+    }
+    else if (!verbose)
+    {
+        // the module logs e.g. frees of still assigned blades as errors
+        kshim_loglevel = 0;
+    }
+    err = mock_hwb_init(&stress_dev, num_cmgs, pes_per_cmg);
+    if (err < 0)
+    {
+        fprintf(stderr, "Invalid topology: %d CMGs with %d PEs\n", num_cmgs, pes_per_cmg);
+        return 2;
+    }
+
+    num_procs = (num_threads + threads_per_proc - 1) / threads_per_proc;
+    procs = calloc(num_procs, sizeof(struct stress_proc));
+    threads = calloc(num_threads, sizeof(struct stress_thread));
+    if ((!procs) || (!threads))
+    {
+        return 2;
+    }
+    for (i = 0; i < num_threads; i++)
+    {
+        struct stress_thread *t = &threads[i];
+        struct stress_proc *p = &procs[i / threads_per_proc];
+        t->id = i;
+        t->rng = (seed + 1) * 0x9E3779B97F4A7C15ULL + (u64)i;
+        t->proc = p;
+        t->task.pid = 1000 + i;
+        if (((i / threads_per_proc) % 2) == 0)
+        {
+            // every other process is privileged
+            set_bit(CAP_SYS_ADMIN, &t->task.cap_effective);
+        }
+        if (!p->leader)
+        {
+            p->leader = &t->task;
+            kshim_current = &t->task;
+            mock_hwb_open(&stress_dev, &p->file);
+        }
+        t->task.tgid = p->leader->pid;
+        t->task.group_leader = p->leader;
+        p->threads_left++;
+        p->leader->nr_threads++;
+    }
+
+    printf("%d tasks in %d processes, %d iterations each, %d CMGs x %d PEs\n", num_threads, num_procs, iterations, num_cmgs, pes_per_cmg);
+    pthread_create(&checker, NULL, stress_check_func, NULL);
+    start = stress_now_ns();
+    for (i = 0; i < num_threads; i++)
+    {
+        pthread_create(&threads[i].thread, NULL, stress_thread_func, &threads[i]);
+    }
+    for (i = 0; i < num_threads; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+    }
+    wall = (double)(stress_now_ns() - start) / 1e9;
+    stress_stop = 1;
+    pthread_join(checker, NULL);
+
+    // all files are released, nothing may be left
+    spin_lock(&stress_dev.dev_lock);
+    stress_violations += mock_hwb_check(&stress_dev, 1);
+    stress_checks++;
+    if (stress_dev.num_tasks != 0 || (!list_empty(&stress_dev.task_list)))
+    {
+        fprintf(stderr, "check failed: %d task mappings left after release\n", stress_dev.num_tasks);
+        stress_violations++;
+    }
+    spin_unlock(&stress_dev.dev_lock);
+    stress_violations += stress_check_topology();
+    stress_checks++;
+    stress_violations += stress_check_files();
+    stress_checks++;
+    stress_violations += stress_check_reset();
+    stress_checks++;
+    stress_violations += stress_check_offline();
+    stress_checks++;
+
+    stress_report(threads, wall);
+    // leaked blades show up as allocations without a free blade
+    for (i = 0; i < num_threads; i++)
+    {
+        busy += threads[i].alloc_busy;
+        unexpected += threads[i].alloc_unexpected;
+        allocs += threads[i].samples[STRESS_ALLOC].count;
+    }
+    printf("Allocations: %lu, %lu without free blade, %lu unexpected failures\n", allocs, busy, unexpected);
+    if (unexpected > 0 || (allocs > 0 && busy * 100 > allocs * (unsigned long)max_busy_percent))
+    {
+        fprintf(stderr, "check failed: too many failed allocations\n");
+        stress_violations++;
+    }
+    printf("%lu invariant checks, %lu violations\n", stress_checks, stress_violations);
+
+    for (i = 0; i < num_threads; i++)
+    {
+        for (c = 0; c < STRESS_NUM_OPS; c++)
+        {
+            free(threads[i].samples[c].ns);
+        }
+    }
+    free(threads);
+    free(procs);
+    return (stress_violations ? 1 : 0);
+}
@@ -0,0 +1,402 @@
+#ifndef KSHIM_H
+#define KSHIM_H
+
+/*
+ * Minimal user-space replacements for the kernel APIs used by the control path of the
+ * module (a64fx_hwb_ioctl.c, a64fx_hwb_topo.c). All headers in include/linux/ only
+ * include this file. Spinlocks are mutexes (the stress driver usually runs with more
+ * threads than CPUs), the "current" task and the CPU a task runs on are thread-local
+ * and the smp_call_function family executes the function in the calling thread after
+ * switching the thread-local CPU. The simulated barrier registers are in mock_hwb.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <linux/types.h>
+
+#ifndef KBUILD_MODNAME
+#define KBUILD_MODNAME "a64fx_hwb"
+#endif
+
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + ((c) > 255 ? 255 : (c)))
+#ifndef LINUX_VERSION_CODE
+#define LINUX_VERSION_CODE KERNEL_VERSION(5, 15, 0)
+#endif
+
+#define __user
+#define __init
+#define __exit
+
+typedef __u8 u8;
+typedef __u16 u16;
+typedef __u32 u32;
+typedef __u64 u64;
+typedef __s8 s8;
+typedef __s16 s16;
+typedef __s32 s32;
+typedef __s64 s64;
+
+#define GFP_KERNEL 0
+#define kmalloc(size, flags) malloc(size)
+#define kzalloc(size, flags) calloc(1, size)
+#define kfree(ptr) free(ptr)
+
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define module_param(name, type, perm) extern int __kshim_module_param_##name
+#define MODULE_PARM_DESC(name, desc) extern int __kshim_module_parm_desc_##name
+#define EXPORT_SYMBOL(sym) extern int __kshim_export_##sym
+#define EXPORT_SYMBOL_GPL(sym) extern int __kshim_export_##sym
+
+
+/*
+ * Logging, pr_debug is only printed with kshim_loglevel >= KSHIM_LOG_DEBUG
+ */
+#define KSHIM_LOG_ERR 3
+#define KSHIM_LOG_INFO 6
+#define KSHIM_LOG_DEBUG 7
+
+extern int kshim_loglevel;
+extern unsigned long kshim_errors;
+void kshim_printk(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#ifndef pr_fmt
+#define pr_fmt(fmt) fmt
+#endif
+#define pr_err(fmt, ...) kshim_printk(KSHIM_LOG_ERR, pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_info(fmt, ...) kshim_printk(KSHIM_LOG_INFO, pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_debug(fmt, ...) kshim_printk(KSHIM_LOG_DEBUG, pr_fmt(fmt), ##__VA_ARGS__)
+
+
+/*
+ * Error pointers
+ */
+#define MAX_ERRNO 4095
+#define IS_ERR_VALUE(x) ((unsigned long)(void *)(x) >= (unsigned long)-MAX_ERRNO)
+static inline void *ERR_PTR(long error) { return (void *)error; }
+static inline long PTR_ERR(const void *ptr) { return (long)ptr; }
+static inline bool IS_ERR(const void *ptr) { return IS_ERR_VALUE((unsigned long)ptr); }
+
+
+/*
+ * User copies, the "user" pointers are plain pointers of the stress driver
+ */
+static inline unsigned long copy_from_user(void *to, const void __user *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_to_user(void __user *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+
+/*
+ * Locks and atomics
+ */
+typedef struct {
+    pthread_mutex_t m;
+} spinlock_t;
+
+static inline void spin_lock_init(spinlock_t *lock) { pthread_mutex_init(&lock->m, NULL); }
+static inline void spin_lock(spinlock_t *lock) { pthread_mutex_lock(&lock->m); }
+static inline void spin_unlock(spinlock_t *lock) { pthread_mutex_unlock(&lock->m); }
+
+struct mutex {
+    pthread_mutex_t m;
+};
+
+static inline void mutex_init(struct mutex *lock) { pthread_mutex_init(&lock->m, NULL); }
+static inline void mutex_lock(struct mutex *lock) { pthread_mutex_lock(&lock->m); }
+static inline void mutex_unlock(struct mutex *lock) { pthread_mutex_unlock(&lock->m); }
+
+typedef struct {
+    long counter;
+} atomic_long_t;
+
+static inline long atomic_long_read(const atomic_long_t *v) { return __atomic_load_n(&v->counter, __ATOMIC_RELAXED); }
+static inline void atomic_long_set(atomic_long_t *v, long i) { __atomic_store_n(&v->counter, i, __ATOMIC_RELAXED); }
+static inline void atomic_long_inc(atomic_long_t *v) { __atomic_fetch_add(&v->counter, 1, __ATOMIC_RELAXED); }
+static inline void atomic_long_dec(atomic_long_t *v) { __atomic_fetch_sub(&v->counter, 1, __ATOMIC_RELAXED); }
+
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, val) __atomic_store_n(&(x), (val), __ATOMIC_RELAXED)
+
+
+/*
+ * Bit operations
+ */
+#define BITS_PER_LONG ((int)(8 * sizeof(unsigned long)))
+#define BITS_TO_LONGS(nr) (((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define BIT(nr) (1UL << (nr))
+#define BIT_WORD(nr) ((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr) (1UL << ((nr) % BITS_PER_LONG))
+
+static inline void set_bit(long nr, volatile unsigned long *addr)
+{
+    __atomic_fetch_or(&addr[BIT_WORD(nr)], BIT_MASK(nr), __ATOMIC_RELAXED);
+}
+
+static inline void clear_bit(long nr, volatile unsigned long *addr)
+{
+    __atomic_fetch_and(&addr[BIT_WORD(nr)], ~BIT_MASK(nr), __ATOMIC_RELAXED);
+}
+
+static inline int test_bit(long nr, const volatile unsigned long *addr)
+{
+    return (int)((addr[BIT_WORD(nr)] >> (nr % BITS_PER_LONG)) & 0x1UL);
+}
+
+static inline unsigned long find_next_bit(const unsigned long *addr, unsigned long size, unsigned long offset)
+{
+    for (; offset < size; offset++)
+    {
+        if (test_bit(offset, addr))
+        {
+            return offset;
+        }
+    }
+    return size;
+}
+
+static inline unsigned long find_next_zero_bit(const unsigned long *addr, unsigned long size, unsigned long offset)
+{
+    for (; offset < size; offset++)
+    {
+        if (!test_bit(offset, addr))
+        {
+            return offset;
+        }
+    }
+    return size;
+}
+
+#define find_first_bit(addr, size) find_next_bit((addr), (size), 0)
+#define find_first_zero_bit(addr, size) find_next_zero_bit((addr), (size), 0)
+#define for_each_set_bit(bit, addr, size) \
+    for ((bit) = find_first_bit((addr), (size)); (bit) < (size); (bit) = find_next_bit((addr), (size), (bit) + 1))
+
+static inline int hweight_long(unsigned long w) { return __builtin_popcountl(w); }
+
+
+/*
+ * Cpumasks, NR_CPUS is large enough for a full A64FX node (4 CMGs x 13 PEs)
+ */
+#define NR_CPUS 64
+
+struct cpumask {
+    unsigned long bits[BITS_TO_LONGS(NR_CPUS)];
+};
+typedef struct cpumask cpumask_t;
+
+extern unsigned int nr_cpu_ids;
+extern struct cpumask __cpu_online_mask;
+#define cpu_online_mask ((const struct cpumask *)&__cpu_online_mask)
+#define cpumask_bits(maskp) ((maskp)->bits)
+
+static inline void cpumask_set_cpu(unsigned int cpu, struct cpumask *dstp) { set_bit(cpu, dstp->bits); }
+static inline void cpumask_clear_cpu(int cpu, struct cpumask *dstp) { clear_bit(cpu, dstp->bits); }
+static inline int cpumask_test_cpu(int cpu, const struct cpumask *cpumask) { return test_bit(cpu, cpumask->bits); }
+static inline void cpumask_clear(struct cpumask *dstp) { memset(dstp->bits, 0, sizeof(dstp->bits)); }
+static inline void cpumask_copy(struct cpumask *dstp, const struct cpumask *srcp) { memcpy(dstp->bits, srcp->bits, sizeof(dstp->bits)); }
+static inline unsigned int cpumask_first(const struct cpumask *srcp) { return find_first_bit(srcp->bits, nr_cpu_ids); }
+static inline unsigned int cpumask_next(int n, const struct cpumask *srcp) { return find_next_bit(srcp->bits, nr_cpu_ids, n + 1); }
+static inline bool cpu_online(unsigned int cpu) { return cpumask_test_cpu(cpu, cpu_online_mask); }
+
+static inline bool cpumask_and(struct cpumask *dstp, const struct cpumask *src1p, const struct cpumask *src2p)
+{
+    int i = 0;
+    unsigned long any = 0x0UL;
+    for (i = 0; i < BITS_TO_LONGS(NR_CPUS); i++)
+    {
+        dstp->bits[i] = src1p->bits[i] & src2p->bits[i];
+        any |= dstp->bits[i];
+    }
+    return any != 0x0UL;
+}
+
+static inline bool cpumask_subset(const struct cpumask *src1p, const struct cpumask *src2p)
+{
+    int i = 0;
+    for (i = 0; i < BITS_TO_LONGS(NR_CPUS); i++)
+    {
+        if (src1p->bits[i] & ~src2p->bits[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline bool cpumask_empty(const struct cpumask *srcp)
+{
+    return cpumask_first(srcp) >= nr_cpu_ids;
+}
+
+static inline unsigned int cpumask_weight(const struct cpumask *srcp)
+{
+    int i = 0;
+    unsigned int w = 0;
+    for (i = 0; i < BITS_TO_LONGS(NR_CPUS); i++)
+    {
+        w += hweight_long(srcp->bits[i]);
+    }
+    return w;
+}
+
+#define for_each_cpu(cpu, mask) \
+    for ((cpu) = -1; (cpu) = cpumask_next((cpu), (mask)), (cpu) < nr_cpu_ids;)
+#define for_each_online_cpu(cpu) for_each_cpu((cpu), cpu_online_mask)
+int cpulist_parse(const char *buf, struct cpumask *dstp);
+
+
+/*
+ * Per-CPU variables are plain arrays indexed by the CPU number
+ */
+#define DECLARE_PER_CPU(type, name) extern type name[NR_CPUS]
+#define DEFINE_PER_CPU(type, name) type name[NR_CPUS]
+#define per_cpu_ptr(ptr, cpu) (&(*(ptr))[(cpu)])
+#define per_cpu(var, cpu) ((var)[(cpu)])
+
+
+/*
+ * CPU of the calling thread and cross calls. The functions are executed in the calling
+ * thread with kshim_cpu switched to the target CPU. kshim_ipi_calls counts the calls,
+ * kshim_ipi_cpus the CPUs they were executed on. A CPU is idle while no simulated task
+ * runs on it, kshim_cpu_tasks is maintained by mock_hwb_migrate().
+ */
+typedef void (*smp_call_func_t)(void *info);
+
+extern __thread int kshim_cpu;
+extern unsigned long kshim_ipi_calls;
+extern unsigned long kshim_ipi_cpus;
+extern int kshim_cpu_tasks[NR_CPUS];
+
+static inline int idle_cpu(int cpu) { return __atomic_load_n(&kshim_cpu_tasks[cpu], __ATOMIC_RELAXED) == 0; }
+
+static inline int smp_processor_id(void) { return kshim_cpu; }
+static inline int raw_smp_processor_id(void) { return kshim_cpu; }
+static inline int get_cpu(void) { return kshim_cpu; }
+static inline void put_cpu(void) { }
+static inline void cpus_read_lock(void) { }
+static inline void cpus_read_unlock(void) { }
+
+int smp_call_function_single(int cpu, smp_call_func_t func, void *info, int wait);
+int smp_call_function_any(const struct cpumask *mask, smp_call_func_t func, void *info, int wait);
+void on_each_cpu_mask(const struct cpumask *mask, smp_call_func_t func, void *info, bool wait);
+void on_each_cpu(smp_call_func_t func, void *info, int wait);
+
+
+/*
+ * Lists
+ */
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+    list->next = list;
+    list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev, struct list_head *next)
+{
+    next->prev = new;
+    new->next = next;
+    new->prev = prev;
+    prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head) { __list_add(new, head, head->next); }
+static inline void list_add_tail(struct list_head *new, struct list_head *head) { __list_add(new, head->prev, head); }
+
+static inline void list_del(struct list_head *entry)
+{
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+static inline int list_empty(const struct list_head *head) { return head->next == head; }
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_for_each(pos, head) for ((pos) = (head)->next; (pos) != (head); (pos) = (pos)->next)
+#define list_for_each_safe(pos, n, head) \
+    for ((pos) = (head)->next, (n) = (pos)->next; (pos) != (head); (pos) = (n), (n) = (pos)->next)
+
+
+/*
+ * Tasks. Each thread of the stress driver sets kshim_current to its own task_struct,
+ * threads of the same simulated process share the group leader.
+ */
+#define PF_EXITING 0x00000004
+#define CAP_SYS_ADMIN 21
+
+struct task_struct {
+    int pid;
+    int tgid;
+    unsigned int flags;
+    long exit_state;
+    struct task_struct *group_leader;
+    // number of live threads in the group, only used on the leader
+    int nr_threads;
+    cpumask_t cpus_mask;
+    cpumask_t cpus_allowed;
+    atomic_long_t usage;
+    // bit CAP_SYS_ADMIN decides capable()
+    unsigned long cap_effective;
+};
+
+extern __thread struct task_struct *kshim_current;
+
+static inline struct task_struct *get_current(void) { return kshim_current; }
+#define current get_current()
+static inline int task_pid_nr(struct task_struct *tsk) { return tsk->pid; }
+static inline int task_tgid_nr(struct task_struct *tsk) { return tsk->tgid; }
+static inline void get_task_struct(struct task_struct *t) { atomic_long_inc(&t->usage); }
+static inline void put_task_struct(struct task_struct *t) { atomic_long_dec(&t->usage); }
+static inline int thread_group_empty(struct task_struct *p) { return READ_ONCE(p->nr_threads) <= 1; }
+static inline bool capable(int cap) { return test_bit(cap, &get_current()->cap_effective); }
+
+
+/*
+ * Opaque kernel objects the module's structures embed or point to
+ */
+struct kobject {
+    const char *name;
+};
+
+struct file_operations;
+
+struct miscdevice {
+    int minor;
+    const char *name;
+    const struct file_operations *fops;
+    unsigned short mode;
+};
+
+struct file {
+    int unused;
+};
+
+struct device {
+    int unused;
+};
+
+struct cgroup;
+
+#endif
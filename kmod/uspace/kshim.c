@@ -0,0 +1,124 @@
+#include <linux/kernel.h>
+#include <linux/smp.h>
+#include <linux/cpumask.h>
+
+/*
+ * Global state of the kernel shim, see include/kshim.h
+ */
+
+int kshim_loglevel = KSHIM_LOG_INFO;
+unsigned long kshim_errors = 0;
+
+unsigned int nr_cpu_ids = 0;
+struct cpumask __cpu_online_mask;
+
+__thread int kshim_cpu = 0;
+__thread struct task_struct *kshim_current = NULL;
+
+unsigned long kshim_ipi_calls = 0;
+unsigned long kshim_ipi_cpus = 0;
+int kshim_cpu_tasks[NR_CPUS];
+
+void kshim_printk(int level, const char *fmt, ...)
+{
+    va_list ap;
+    if (level <= KSHIM_LOG_ERR)
+    {
+        __atomic_fetch_add(&kshim_errors, 1, __ATOMIC_RELAXED);
+    }
+    if (level > kshim_loglevel)
+    {
+        return;
+    }
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+// Run func as if it was executed on cpu
+static void kshim_run_on(int cpu, smp_call_func_t func, void *info)
+{
+    int self = kshim_cpu;
+    kshim_cpu = cpu;
+    func(info);
+    kshim_cpu = self;
+    __atomic_fetch_add(&kshim_ipi_cpus, 1, __ATOMIC_RELAXED);
+}
+
+int smp_call_function_single(int cpu, smp_call_func_t func, void *info, int wait)
+{
+    if ((cpu < 0) || (cpu >= (int)nr_cpu_ids) || (!cpu_online(cpu)))
+    {
+        return -ENXIO;
+    }
+    __atomic_fetch_add(&kshim_ipi_calls, 1, __ATOMIC_RELAXED);
+    kshim_run_on(cpu, func, info);
+    return 0;
+}
+
+// Like the kernel, prefer the current CPU if it is in the mask
+int smp_call_function_any(const struct cpumask *mask, smp_call_func_t func, void *info, int wait)
+{
+    int cpu = kshim_cpu;
+    struct cpumask online;
+    if (!(cpumask_test_cpu(cpu, mask) && cpu_online(cpu)))
+    {
+        cpumask_and(&online, mask, cpu_online_mask);
+        cpu = cpumask_first(&online);
+    }
+    return smp_call_function_single(cpu, func, info, wait);
+}
+
+void on_each_cpu_mask(const struct cpumask *mask, smp_call_func_t func, void *info, bool wait)
+{
+    int cpu = 0;
+    struct cpumask online;
+    if (!cpumask_and(&online, mask, cpu_online_mask))
+    {
+        return;
+    }
+    __atomic_fetch_add(&kshim_ipi_calls, 1, __ATOMIC_RELAXED);
+    for_each_cpu(cpu, &online)
+    {
+        kshim_run_on(cpu, func, info);
+    }
+}
+
+void on_each_cpu(smp_call_func_t func, void *info, int wait)
+{
+    on_each_cpu_mask(cpu_online_mask, func, info, wait);
+}
+
+// CPU list like "0-3,12", ranges with stride are not supported
+int cpulist_parse(const char *buf, struct cpumask *dstp)
+{
+    int cpu = 0;
+    int first = 0, last = 0;
+    int len = 0;
+    cpumask_clear(dstp);
+    while (*buf != '\0')
+    {
+        if (sscanf(buf, "%d-%d%n", &first, &last, &len) != 2)
+        {
+            if (sscanf(buf, "%d%n", &first, &len) != 1)
+            {
+                return -EINVAL;
+            }
+            last = first;
+        }
+        if (first < 0 || last < first || last >= (int)nr_cpu_ids)
+        {
+            return -EINVAL;
+        }
+        for (cpu = first; cpu <= last; cpu++)
+        {
+            cpumask_set_cpu(cpu, dstp);
+        }
+        buf += len;
+        if (*buf == ',')
+        {
+            buf++;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,542 @@
+#include <linux/kernel.h>
+#include <linux/smp.h>
+#include <linux/cpumask.h>
+#include <linux/sched.h>
+#include <sched.h>
+#include <time.h>
+
+#include "a64fx_hwb.h"
+#include "a64fx_hwb_asm.h"
+#include "a64fx_hwb_ioctl.h"
+#include "a64fx_hwb_uapi.h"
+#include "a64fx_hwb_wait.h"
+#include "a64fx_hwb_quota.h"
+#include "a64fx_hwb_topo.h"
+#include "mock_hwb.h"
+
+/*
+ * Simulated A64FX barrier registers and the parts of the module that are not built in
+ * user-space (device setup, hotplug, quota, blocking wait). The register functions of
+ * a64fx_hwb_asm.h act on the registers of the CPU in kshim_cpu, so they work unchanged
+ * from the IPI functions of a64fx_hwb_ioctl.c.
+ *
+ * Like the hardware, writing INIT_SYNC_BBx clears BST and LBSY of the blade. Writing
+ * BST_SYNC_Wx sets the PE's bit in the BST of the blade assigned to the window, LBSY
+ * becomes 1 when all BST bits in BST_MASK are 1 and 0 when all of them are 0. Reading
+ * BST_SYNC_Wx returns the LBSY of the assigned blade.
+ */
+
+struct mock_pe_regs {
+    int cmg;
+    int ppe;
+    u64 ctrl;
+    u64 assign_sync_wr[MAX_BW_PER_CMG];
+    u64 bst_sync_wr[MAX_BW_PER_CMG];
+};
+
+static u64 mock_init_sync_bb[MAX_NUM_CMG][MAX_BB_PER_CMG];
+static struct mock_pe_regs mock_pes[NR_CPUS];
+
+static inline struct mock_pe_regs* mock_this_pe(void)
+{
+    return &mock_pes[kshim_cpu];
+}
+
+int read_peinfo(u8 *cmg, u8 *ppe)
+{
+    if ((!cmg) || (!ppe))
+        return -EINVAL;
+    *cmg = (u8)mock_this_pe()->cmg;
+    *ppe = (u8)mock_this_pe()->ppe;
+    return 0;
+}
+
+int read_hwb_ctrl(int *el0ae, int *el1ae)
+{
+    u64 val = mock_this_pe()->ctrl;
+    if ((!el0ae) || (!el1ae))
+        return -EINVAL;
+    *el0ae = (val >> A64FX_HWB_CTRL_EL0AE_SHIFT) & 0x1;
+    *el1ae = (val >> A64FX_HWB_CTRL_EL1AE_SHIFT) & 0x1;
+    return 0;
+}
+
+int write_hwb_ctrl(int el0ae, int el1ae)
+{
+    mock_this_pe()->ctrl = (el0ae ? (1ULL<<A64FX_HWB_CTRL_EL0AE_SHIFT) : 0x0ULL) |
+                           (el1ae ? (1ULL<<A64FX_HWB_CTRL_EL1AE_SHIFT) : 0x0ULL);
+    return 0;
+}
+
+static inline void __write_init_sync_bb(int blade, u64 val)
+{
+    // BST and LBSY are cleared by the write
+    mock_init_sync_bb[mock_this_pe()->cmg][blade] = a64fx_hwb_init_sync_bb_val(A64FX_HWB_INIT_MASK(val));
+}
+
+static inline void __write_bst_sync_wr(int window, u64 val)
+{
+    u64 *bb = NULL;
+    unsigned long mask = 0x0UL;
+    unsigned long bst = 0x0UL;
+    struct mock_pe_regs *pe = mock_this_pe();
+    u64 assign = pe->assign_sync_wr[window];
+
+    pe->bst_sync_wr[window] = val & A64FX_HWB_SYNC_WINDOW_MASK;
+    if (!A64FX_HWB_ASSIGN_VALID(assign))
+    {
+        return;
+    }
+    bb = &mock_init_sync_bb[pe->cmg][A64FX_HWB_ASSIGN_BB(assign)];
+    mask = A64FX_HWB_INIT_MASK(*bb);
+    bst = A64FX_HWB_INIT_BST(*bb);
+    if (val & A64FX_HWB_SYNC_WINDOW_MASK)
+        bst |= BIT(pe->ppe);
+    else
+        bst &= ~BIT(pe->ppe);
+    *bb = (*bb & ~A64FX_HWB_INIT_BST_MASK) | bst;
+    // LBSY keeps its value while the BST bits disagree
+    if (mask && (bst & mask) == mask)
+        *bb |= (1UL << A64FX_HWB_INIT_LBSY_SHIFT);
+    else if (mask && (bst & mask) == 0x0UL)
+        *bb &= ~(1UL << A64FX_HWB_INIT_LBSY_SHIFT);
+}
+
+static inline u64 __read_bst_sync_wr(int window)
+{
+    u64 assign = mock_this_pe()->assign_sync_wr[window];
+    if (!A64FX_HWB_ASSIGN_VALID(assign))
+    {
+        return 0x0ULL;
+    }
+    return A64FX_HWB_INIT_LBSY(mock_init_sync_bb[mock_this_pe()->cmg][A64FX_HWB_ASSIGN_BB(assign)]);
+}
+
+void read_init_sync_bb_all(u64 *vals)
+{
+    memcpy(vals, mock_init_sync_bb[mock_this_pe()->cmg], sizeof(u64) * MAX_BB_PER_CMG);
+}
+
+void write_init_sync_bb_bulk(unsigned long mask, const u64 *vals)
+{
+    int i = 0;
+    for_each_set_bit(i, &mask, MAX_BB_PER_CMG)
+        __write_init_sync_bb(i, vals[i]);
+}
+
+void read_assign_sync_wr_all(u64 *vals)
+{
+    memcpy(vals, mock_this_pe()->assign_sync_wr, sizeof(u64) * MAX_BW_PER_CMG);
+}
+
+void write_assign_sync_wr_bulk(unsigned long mask, const u64 *vals)
+{
+    int i = 0;
+    for_each_set_bit(i, &mask, MAX_BW_PER_CMG)
+        mock_this_pe()->assign_sync_wr[i] = vals[i];
+}
+
+void read_bst_sync_wr_all(u64 *vals)
+{
+    int i = 0;
+    for (i = 0; i < MAX_BW_PER_CMG; i++)
+        vals[i] = __read_bst_sync_wr(i);
+}
+
+void write_bst_sync_wr_bulk(unsigned long mask, const u64 *vals)
+{
+    int i = 0;
+    for_each_set_bit(i, &mask, MAX_BW_PER_CMG)
+        __write_bst_sync_wr(i, vals[i]);
+}
+
+int read_init_sync_bb(int bb, unsigned long *mask, unsigned long *bst, unsigned long *lbsy)
+{
+    u64 val = 0;
+    if ((bb < 0) || (bb >= MAX_BB_PER_CMG) || (!mask) || (!bst))
+        return -EINVAL;
+    val = mock_init_sync_bb[mock_this_pe()->cmg][bb];
+    *bst = A64FX_HWB_INIT_BST(val);
+    *mask = A64FX_HWB_INIT_MASK(val);
+    if (lbsy)
+        *lbsy = A64FX_HWB_INIT_LBSY(val);
+    return 0;
+}
+
+int write_init_sync_bb(int blade, unsigned long bst_mask)
+{
+    if ((blade < 0) || (blade >= MAX_BB_PER_CMG))
+        return -EINVAL;
+    __write_init_sync_bb(blade, a64fx_hwb_init_sync_bb_val(bst_mask));
+    return 0;
+}
+
+int read_assign_sync_wr(int window, int* valid, int *blade)
+{
+    u64 val = 0;
+    if ((window < 0) || (window >= MAX_BW_PER_CMG) || (!valid) || (!blade))
+        return -EINVAL;
+    val = mock_this_pe()->assign_sync_wr[window];
+    *valid = A64FX_HWB_ASSIGN_VALID(val);
+    *blade = A64FX_HWB_ASSIGN_BB(val);
+    return 0;
+}
+
+int write_assign_sync_wr(int window, int valid, int blade)
+{
+    if ((window < 0) || (window >= MAX_BW_PER_CMG) || (blade < 0) || (blade >= MAX_BB_PER_CMG))
+        return -EINVAL;
+    mock_this_pe()->assign_sync_wr[window] = a64fx_hwb_assign_sync_wr_val(valid, blade);
+    return 0;
+}
+
+int read_bst_sync_wr(int window, int* sync)
+{
+    if ((window < 0) || (window >= MAX_BW_PER_CMG) || (!sync))
+        return -EINVAL;
+    *sync = (int)(__read_bst_sync_wr(window) & A64FX_HWB_SYNC_WINDOW_MASK);
+    return 0;
+}
+
+int write_bst_sync_wr(int window, int sync)
+{
+    if ((window < 0) || (window >= MAX_BW_PER_CMG))
+        return -EINVAL;
+    __write_bst_sync_wr(window, (sync ? A64FX_HWB_SYNC_WINDOW_MASK : 0x0UL));
+    return 0;
+}
+
+
+/*
+ * Quota support needs cgroups, all tasks are unlimited
+ */
+
+struct a64fx_hwb_quota* a64fx_hwb_quota_charge(struct a64fx_hwb_device *dev, struct task_struct *task, int cmg)
+{
+    return NULL;
+}
+
+void a64fx_hwb_quota_uncharge_cmg(struct a64fx_hwb_quota *quota, int cmg)
+{
+}
+
+void a64fx_hwb_quota_uncharge(struct a64fx_task_allocation *alloc)
+{
+    alloc->quota = NULL;
+}
+
+
+/*
+ * Blocking wait, polls the window of the current CPU instead of using an hrtimer
+ */
+
+static u64 mock_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000ULL + (u64)ts.tv_nsec / 1000ULL;
+}
+
+int a64fx_hwb_wait_lbsy(struct a64fx_cmg_device *cmg, int window, int sync, unsigned int timeout_us)
+{
+    int cur = 0;
+    int valid = 0;
+    int blade = 0;
+    u64 start = mock_now_us();
+
+    read_bst_sync_wr(window, &cur);
+    if (cur == sync)
+    {
+        atomic_long_inc(&cmg->wait_stats.immediate);
+        return 0;
+    }
+    for (;;)
+    {
+        sched_yield();
+        read_assign_sync_wr(window, &valid, &blade);
+        if (!valid)
+        {
+            atomic_long_inc(&cmg->wait_stats.unassigned);
+            return -ENODEV;
+        }
+        read_bst_sync_wr(window, &cur);
+        if (cur == sync)
+        {
+            atomic_long_inc(&cmg->wait_stats.resolved);
+            return 0;
+        }
+        if (timeout_us > 0 && mock_now_us() - start >= timeout_us)
+        {
+            atomic_long_inc(&cmg->wait_stats.timeout);
+            return -ETIMEDOUT;
+        }
+    }
+}
+
+
+/*
+ * Device setup and file operations
+ */
+
+int mock_hwb_init(struct a64fx_hwb_device *dev, int num_cmgs, int pes_per_cmg)
+{
+    int i = 0;
+    int cpu = 0;
+    struct a64fx_cmg_device *cmg = NULL;
+    struct a64fx_core_mapping *pe = NULL;
+
+    if (num_cmgs < 1 || num_cmgs > MAX_NUM_CMG || pes_per_cmg < 2 || pes_per_cmg > MAX_PE_PER_CMG ||
+        num_cmgs * pes_per_cmg > NR_CPUS)
+    {
+        return -EINVAL;
+    }
+    memset(dev, 0, sizeof(struct a64fx_hwb_device));
+    memset(mock_init_sync_bb, 0, sizeof(mock_init_sync_bb));
+    memset(mock_pes, 0, sizeof(mock_pes));
+    spin_lock_init(&dev->dev_lock);
+    INIT_LIST_HEAD(&dev->task_list);
+    INIT_LIST_HEAD(&dev->quota_list);
+    dev->misc.name = "fujitsu_hwb";
+    dev->num_cmgs = num_cmgs;
+    dev->num_bb_per_cmg = MAX_BB_PER_CMG;
+    dev->num_bw_per_cmg = MAX_BW_PER_CMG;
+    dev->max_pe_per_cmg = pes_per_cmg;
+
+    nr_cpu_ids = num_cmgs * pes_per_cmg;
+    cpumask_clear(&__cpu_online_mask);
+    for (i = 0; i < MAX_NUM_CMG; i++)
+    {
+        cmg = &dev->cmgs[i];
+        cmg->cmg_id = i;
+        cmg->num_pes = (i < num_cmgs ? pes_per_cmg : 0);
+        memset(cmg->pe_map, -1, sizeof(struct a64fx_core_mapping)*MAX_PE_PER_CMG);
+        spin_lock_init(&cmg->cmg_lock);
+        mutex_init(&cmg->snapshot_lock);
+    }
+    for (cpu = 0; cpu < (int)nr_cpu_ids; cpu++)
+    {
+        cmg = &dev->cmgs[cpu / pes_per_cmg];
+        pe = &cmg->pe_map[cpu % pes_per_cmg];
+        pe->cpu_id = cpu;
+        pe->cmg_id = cmg->cmg_id;
+        pe->ppe_id = cpu % pes_per_cmg;
+        pe->bw_map = 0x0;
+        memset(pe->win_blades, A64FX_HWB_UNASSIGNED_BB, sizeof(pe->win_blades));
+        a64fx_hwb_topo_set(cpu, pe);
+        cpumask_set_cpu(cpu, &cmg->cmgmask);
+        cpumask_set_cpu(cpu, &__cpu_online_mask);
+        mock_pes[cpu].cmg = pe->cmg_id;
+        mock_pes[cpu].ppe = pe->ppe_id;
+        mock_pes[cpu].ctrl = (1ULL<<A64FX_HWB_CTRL_EL0AE_SHIFT) | (1ULL<<A64FX_HWB_CTRL_EL1AE_SHIFT);
+    }
+    return 0;
+}
+
+int mock_hwb_open(struct a64fx_hwb_device *dev, struct file *file)
+{
+    spin_lock(&dev->dev_lock);
+    dev->active_count++;
+    spin_unlock(&dev->dev_lock);
+    return 0;
+}
+
+int mock_hwb_release(struct a64fx_hwb_device *dev, struct file *file)
+{
+    spin_lock(&dev->dev_lock);
+    if (dev->active_count > 0)
+    {
+        dev->active_count--;
+    }
+    reclaim_file_allocations(dev, file);
+    spin_unlock(&dev->dev_lock);
+    return 0;
+}
+
+long mock_hwb_ioctl(struct a64fx_hwb_device *dev, struct file *file, unsigned int ioc, unsigned long arg)
+{
+    switch (ioc)
+    {
+        case FUJITSU_HWB_IOC_GET_PE_INFO:
+            return oss_a64fx_hwb_get_peinfo_ioctl(arg);
+        case FUJITSU_HWB_IOC_BW_ASSIGN:
+            return oss_a64fx_hwb_assign_blade_ioctl(dev, arg);
+        case FUJITSU_HWB_IOC_BW_UNASSIGN:
+            return oss_a64fx_hwb_unassign_blade_ioctl(dev, arg);
+        case FUJITSU_HWB_IOC_BB_ALLOC:
+            return oss_a64fx_hwb_allocate_ioctl(dev, file, arg);
+        case FUJITSU_HWB_IOC_BB_FREE:
+            return oss_a64fx_hwb_free_ioctl(dev, arg);
+        case A64FX_HWB_IOC_BB_RESIZE:
+            return oss_a64fx_hwb_resize_ioctl(dev, arg);
+        case A64FX_HWB_IOC_WAIT:
+            return oss_a64fx_hwb_wait_ioctl(dev, arg);
+        case FUJITSU_HWB_IOC_RESET:
+            return oss_a64fx_hwb_reset_ioctl(dev, arg);
+        case A64FX_HWB_IOC_RESET_SCOPED:
+            return oss_a64fx_hwb_reset_scoped_ioctl(dev, arg);
+        case A64FX_HWB_IOC_BB_STATUS:
+            return oss_a64fx_hwb_status_ioctl(dev, arg);
+    }
+    return -ENOTTY;
+}
+
+// CPU the task of the calling thread runs on, -1 before the first migration
+static __thread int mock_running = -1;
+
+void mock_hwb_migrate(int cpu)
+{
+    struct task_struct *task = get_current();
+    mock_hwb_exit();
+    __atomic_add_fetch(&kshim_cpu_tasks[cpu], 1, __ATOMIC_RELAXED);
+    mock_running = cpu;
+    kshim_cpu = cpu;
+    cpumask_clear(&task->cpus_mask);
+    cpumask_set_cpu(cpu, &task->cpus_mask);
+    cpumask_copy(&task->cpus_allowed, &task->cpus_mask);
+}
+
+void mock_hwb_exit(void)
+{
+    if (mock_running >= 0)
+    {
+        __atomic_sub_fetch(&kshim_cpu_tasks[mock_running], 1, __ATOMIC_RELAXED);
+        mock_running = -1;
+    }
+}
+
+
+/*
+ * Invariants
+ */
+
+#define MOCK_CHECK(cond, ...) \
+    do { \
+        if (!(cond)) \
+        { \
+            errs++; \
+            if (verbose) \
+            { \
+                fprintf(stderr, "check failed: " __VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+
+// Bookkeeping and registers of one allocation. Marks its blade and windows in the seen maps.
+static int mock_check_allocation(struct a64fx_hwb_device *dev, struct a64fx_task_allocation *alloc,
+                                 unsigned long *bb_seen, unsigned long (*bw_seen)[MAX_PE_PER_CMG], int verbose)
+{
+    int errs = 0;
+    int ppe = 0;
+    int window = 0;
+    unsigned long ppemask = 0x0UL;
+    struct a64fx_cmg_device *cmg = NULL;
+    struct a64fx_core_mapping *pe = NULL;
+
+    if (alloc->cmg >= dev->num_cmgs || alloc->blade >= dev->num_bb_per_cmg)
+    {
+        MOCK_CHECK(0, "allocation with CMG %d Blade %d out of range\n", alloc->cmg, alloc->blade);
+        return errs;
+    }
+    cmg = &dev->cmgs[alloc->cmg];
+    MOCK_CHECK(!test_bit(alloc->blade, &bb_seen[alloc->cmg]), "CMG %d Blade %d allocated twice\n", alloc->cmg, alloc->blade);
+    set_bit(alloc->blade, &bb_seen[alloc->cmg]);
+    MOCK_CHECK(test_bit(alloc->blade, &cmg->bb_active), "CMG %d Blade %d allocated but not active\n", alloc->cmg, alloc->blade);
+    MOCK_CHECK((int)cpumask_weight(&alloc->assign_mask) == alloc->assign_count,
+               "CMG %d Blade %d assign_count %d but %u CPUs assigned\n", alloc->cmg, alloc->blade, alloc->assign_count, cpumask_weight(&alloc->assign_mask));
+    MOCK_CHECK(cpumask_subset(&alloc->assign_mask, &alloc->cpumask), "CMG %d Blade %d assigned CPUs outside of cpumask\n", alloc->cmg, alloc->blade);
+
+    ppemask = a64fx_hwb_topo_ppemask(cmg, &alloc->cpumask);
+    MOCK_CHECK(A64FX_HWB_INIT_MASK(mock_init_sync_bb[alloc->cmg][alloc->blade]) == ppemask,
+               "CMG %d Blade %d BST_MASK 0x%lx but cpumask gives 0x%lx\n", alloc->cmg, alloc->blade,
+               A64FX_HWB_INIT_MASK(mock_init_sync_bb[alloc->cmg][alloc->blade]), ppemask);
+
+    for (ppe = 0; ppe < MAX_PE_PER_CMG; ppe++)
+    {
+        pe = &cmg->pe_map[ppe];
+        window = alloc->window[ppe];
+        if (pe->cpu_id < 0 || (!cpumask_test_cpu(pe->cpu_id, &alloc->assign_mask)))
+        {
+            MOCK_CHECK(window == A64FX_HWB_UNASSIGNED_WIN, "CMG %d Blade %d has window %d on unassigned PPE %d\n", alloc->cmg, alloc->blade, window, ppe);
+            continue;
+        }
+        if (window < 0 || window >= MAX_BW_PER_CMG)
+        {
+            MOCK_CHECK(0, "CMG %d Blade %d assigned on PPE %d with invalid window %d\n", alloc->cmg, alloc->blade, ppe, window);
+            continue;
+        }
+        MOCK_CHECK(test_bit(window, &pe->bw_map), "CMG %d Blade %d window %d of PPE %d not in bw_map\n", alloc->cmg, alloc->blade, window, ppe);
+        MOCK_CHECK(pe->win_blades[window] == alloc->blade, "CMG %d PPE %d window %d maps to Blade %d, allocation has Blade %d\n",
+                   alloc->cmg, ppe, window, pe->win_blades[window], alloc->blade);
+        MOCK_CHECK(!test_bit(window, &bw_seen[alloc->cmg][ppe]), "CMG %d PPE %d window %d used by two allocations\n", alloc->cmg, ppe, window);
+        set_bit(window, &bw_seen[alloc->cmg][ppe]);
+    }
+    return errs;
+}
+
+int mock_hwb_check(struct a64fx_hwb_device *dev, int verbose)
+{
+    int errs = 0;
+    int i = 0;
+    int ppe = 0;
+    int window = 0;
+    int num_tasks = 0;
+    int num_allocs = 0;
+    u64 assign = 0;
+    unsigned long bb_seen[MAX_NUM_CMG] = {0};
+    unsigned long bw_seen[MAX_NUM_CMG][MAX_PE_PER_CMG] = {{0}};
+    struct list_head *taskcur = NULL, *alloccur = NULL;
+    struct a64fx_task_mapping *taskmap = NULL;
+    struct a64fx_cmg_device *cmg = NULL;
+    struct a64fx_core_mapping *pe = NULL;
+
+    list_for_each(taskcur, &dev->task_list)
+    {
+        taskmap = list_entry(taskcur, struct a64fx_task_mapping, list);
+        num_tasks++;
+        num_allocs = 0;
+        list_for_each(alloccur, &taskmap->allocs)
+        {
+            num_allocs++;
+            errs += mock_check_allocation(dev, list_entry(alloccur, struct a64fx_task_allocation, list), bb_seen, bw_seen, verbose);
+        }
+        MOCK_CHECK(num_allocs == taskmap->num_allocs, "TGID %d has num_allocs %d but %d allocations\n", task_tgid_nr(taskmap->task), taskmap->num_allocs, num_allocs);
+    }
+    MOCK_CHECK(num_tasks == dev->num_tasks, "num_tasks %d but %d task mappings\n", dev->num_tasks, num_tasks);
+
+    for (i = 0; i < dev->num_cmgs; i++)
+    {
+        cmg = &dev->cmgs[i];
+        MOCK_CHECK(cmg->bb_active == bb_seen[i], "CMG %d bb_active 0x%lx but allocations 0x%lx\n", i, cmg->bb_active, bb_seen[i]);
+        for (window = 0; window < MAX_BB_PER_CMG; window++)
+        {
+            MOCK_CHECK(test_bit(window, &bb_seen[i]) || A64FX_HWB_INIT_MASK(mock_init_sync_bb[i][window]) == 0x0UL,
+                       "CMG %d Blade %d not allocated but has BST_MASK 0x%lx\n", i, window, A64FX_HWB_INIT_MASK(mock_init_sync_bb[i][window]));
+        }
+        for (ppe = 0; ppe < MAX_PE_PER_CMG; ppe++)
+        {
+            pe = &cmg->pe_map[ppe];
+            if (pe->cpu_id < 0)
+            {
+                continue;
+            }
+            MOCK_CHECK(pe->bw_map == bw_seen[i][ppe], "CMG %d PPE %d bw_map 0x%lx but allocations 0x%lx\n", i, ppe, pe->bw_map, bw_seen[i][ppe]);
+            MOCK_CHECK(mock_pes[pe->cpu_id].ctrl & (1ULL<<A64FX_HWB_CTRL_EL0AE_SHIFT), "CPU %d lost EL0 access\n", pe->cpu_id);
+            for (window = 0; window < MAX_BW_PER_CMG; window++)
+            {
+                assign = mock_pes[pe->cpu_id].assign_sync_wr[window];
+                if (test_bit(window, &pe->bw_map))
+                {
+                    MOCK_CHECK(A64FX_HWB_ASSIGN_VALID(assign) && A64FX_HWB_ASSIGN_BB(assign) == pe->win_blades[window],
+                               "CPU %d window %d register (valid %d blade %d) does not match Blade %d\n", pe->cpu_id, window,
+                               A64FX_HWB_ASSIGN_VALID(assign), A64FX_HWB_ASSIGN_BB(assign), pe->win_blades[window]);
+                }
+                else
+                {
+                    MOCK_CHECK(pe->win_blades[window] == A64FX_HWB_UNASSIGNED_BB, "CPU %d window %d free but maps to Blade %d\n", pe->cpu_id, window, pe->win_blades[window]);
+                    MOCK_CHECK(!A64FX_HWB_ASSIGN_VALID(assign), "CPU %d window %d free but register is valid\n", pe->cpu_id, window);
+                }
+            }
+        }
+    }
+    return errs;
+}
@@ -0,0 +1,26 @@
+#ifndef MOCK_HWB_H
+#define MOCK_HWB_H
+
+#include "a64fx_hwb.h"
+
+// Set up a simulated node with num_cmgs CMGs of pes_per_cmg PEs each. CPU c is PE
+// (c % pes_per_cmg) of CMG (c / pes_per_cmg). Fills the device like module init and
+// the hotplug online callback do.
+int mock_hwb_init(struct a64fx_hwb_device *dev, int num_cmgs, int pes_per_cmg);
+
+// File operations of a64fx_hwb_main.c for the current task
+int mock_hwb_open(struct a64fx_hwb_device *dev, struct file *file);
+int mock_hwb_release(struct a64fx_hwb_device *dev, struct file *file);
+long mock_hwb_ioctl(struct a64fx_hwb_device *dev, struct file *file, unsigned int ioc, unsigned long arg);
+
+// Pin the current task to cpu
+void mock_hwb_migrate(int cpu);
+// The current task stops running, its CPU becomes idle
+void mock_hwb_exit(void);
+
+// Check the bookkeeping for consistency and compare it with the simulated registers.
+// Has to be called with the device lock held. Returns the number of violations, they
+// are printed if verbose is set.
+int mock_hwb_check(struct a64fx_hwb_device *dev, int verbose);
+
+#endif